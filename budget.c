@@ -0,0 +1,143 @@
+/* budget.c
+ *******************************************
+ * Memory budgets, counting the bytes
+ * buffered for something against a limit.
+ *
+ * A budget can have a parent that is
+ * charged along with it, so the server
+ * keeps one budget for every connection
+ * under one for all of them. Charging
+ * never fails: whatever has been received
+ * or read has to go somewhere. Instead
+ * the caller stops taking in more while
+ * a budget or any of its parents is
+ * exhausted, and carries on once what
+ * it buffered has been let go of.
+ *
+ * A limit of 0 never runs out.
+ * Budgets aren't locked, and are only
+ * charged and refunded by one thread.
+ *
+ */
+#include <stdio.h>
+
+#include "budget.h"
+
+/* Sets up an empty budget.
+ *
+ * Input:
+ *     budget: the budget
+ *     parent: budget charged along
+ *             with it, or NULL
+ *     limit:  most bytes, 0 for
+ *             no limit
+ * Return:
+ *     void
+ */
+void initBudget(struct budget *budget, struct budget *parent, size_t limit){
+    budget->parent = parent;
+    budget->limit = limit;
+    budget->used = 0;
+    budget->peak = 0;
+    budget->exhausted = 0;
+    budget->exhaustions = 0;
+}
+
+/* Charges bytes to a budget and its
+ * parents, and counts every budget
+ * that runs out by it.
+ *
+ * Input:
+ *     budget: the budget
+ *     len:    amount of bytes
+ * Return:
+ *     void
+ */
+void chargeBudget(struct budget *budget, size_t len){
+    for(; budget != NULL; budget = budget->parent){
+        budget->used += len;
+        if(budget->used > budget->peak){
+            budget->peak = budget->used;
+        }
+        if(budget->limit > 0 && budget->used >= budget->limit && !budget->exhausted){
+            budget->exhausted = 1;
+            budget->exhaustions++;
+        }
+    }
+}
+
+/* Gives bytes charged before back to
+ * a budget and its parents.
+ *
+ * Input:
+ *     budget: the budget
+ *     len:    amount of bytes
+ * Return:
+ *     void
+ */
+void refundBudget(struct budget *budget, size_t len){
+    for(; budget != NULL; budget = budget->parent){
+        budget->used -= len < budget->used ? len : budget->used;
+        if(budget->used < budget->limit){
+            budget->exhausted = 0;
+        }
+    }
+}
+
+/* Checks if a budget or any of its
+ * parents has run out.
+ *
+ * Input:
+ *     budget: the budget
+ * Return:
+ *     1 if one has
+ *     0 if not
+ */
+int budgetExhausted(struct budget *budget){
+    for(; budget != NULL; budget = budget->parent){
+        if(budget->exhausted){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Checks if len more bytes can be
+ * charged to a budget and its parents
+ * without any of them running out.
+ *
+ * Input:
+ *     budget: the budget
+ *     len:    amount of bytes
+ * Return:
+ *     1 if they can
+ *     0 if not
+ */
+int budgetRoom(struct budget *budget, size_t len){
+    for(; budget != NULL; budget = budget->parent){
+        if(budget->limit > 0 && budget->used + len >= budget->limit){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Writes how much of a budget is used,
+ * its peak, and how often it ran out.
+ *
+ * Input:
+ *     budget: the budget
+ *     buf:    where to write
+ *     len:    size of buf
+ * Return:
+ *     void
+ */
+void describeBudget(struct budget *budget, char *buf, size_t len){
+    if(budget->limit == 0){
+        snprintf(buf, len, "%zu byte(s) used, peak %zu, no limit",
+                 budget->used, budget->peak);
+        return;
+    }
+    snprintf(buf, len, "%zu of %zu byte(s) used, peak %zu, ran out %lu time(s)",
+             budget->used, budget->limit, budget->peak, budget->exhaustions);
+}
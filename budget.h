@@ -0,0 +1,32 @@
+/* BUDGET.H
+ *
+ *****************************************
+ * Header file for the memory budgets the
+ * server and client charge what they
+ * buffer against.
+ *
+ */
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+
+#define BUDGET_MIN          (64*1024)
+
+struct budget {
+    struct budget *parent;
+    size_t limit;
+    size_t used;
+    size_t peak;
+    int exhausted;
+    unsigned long exhaustions;
+};
+
+void initBudget(struct budget *budget, struct budget *parent, size_t limit);
+void chargeBudget(struct budget *budget, size_t len);
+void refundBudget(struct budget *budget, size_t len);
+int budgetExhausted(struct budget *budget);
+int budgetRoom(struct budget *budget, size_t len);
+void describeBudget(struct budget *budget, char *buf, size_t len);
+
+#endif
@@ -2,9 +2,85 @@
  ******************************************
  * USAGE:
  * Arguments: <hostname> <port> -DEBUG
+ *            unix:<path> -DEBUG
+ *            shm:<name> -DEBUG
+ *
+ * The socket options in sockopts.c can
+ * be added after -DEBUG.
+ *
+ * -LATENCY=<path> writes the latency
+ * histograms, see recordLatency(), to
+ * <path> as JSON on exit and on SIGUSR1.
+ * Without it SIGUSR1 prints them.
+ *
+ * -RECORD=<path> records the requests
+ * and frames of the session to <path>,
+ * see trace.c, for ./replay.
+ *
+ * If the server runs in dedup mode the
+ * client keeps the texts of the last jobs
+ * it received, see dedup.c, and the
+ * server sends repeated texts as
+ * references to them.
+ *
+ * Every job the children are done with
+ * is sent back to the server as a
+ * result, in batches, see addResult().
+ *
+ * -PARALLEL=<K> adds a menu choice that
+ * fetches every job of the queue over K
+ * connections of their own at once, each
+ * asking for a range of the jobs, see
+ * fetchParallel(). Jobs are handed to
+ * the children in job order, or with
+ * -PARALLEL=<K>/unordered as they come.
+ *
+ * -MEMORY=<KB> bounds what the client
+ * buffers from the server, see budget.c:
+ * the receive buffers of the ranges and
+ * the jobs held for later ones, or the
+ * chunks of -STREAM. While it is
+ * exhausted only the range whose turn
+ * it is is read, so the server is held
+ * back by TCP on the others.
+ *
+ * -TYPES=<O|E|OE> subscribes to jobs of
+ * those types only, so the server leaves
+ * the others for other clients instead
+ * of sending them here.
+ *
+ * -MATCH=<expression> has the server
+ * only send jobs whose text contains
+ * one of the literals in it, or has a
+ * length in its range, see match.c:
+ * "-MATCH=error,fatal,len:10-500".
+ *
+ * -STREAM runs without the menu and the
+ * children: every job is requested, and
+ * the text of each is written to stdout
+ * as it is verified, for the next stage
+ * of a pipeline, see streamJobs().
+ * -STREAM=nul ends every text with a NUL
+ * and -STREAM=length puts its length in
+ * front of it, as a 4-byte integer in
+ * host byte order. Messages go to stderr.
+ *
+ * Received, dispatched and finished
+ * jobs can be traced while running,
+ * see probes.h.
+ *
+ * Heartbeats from the server are
+ * answered, also while the menu waits
+ * for input, see awaitInput().
+ *
+ * unix:<path> connects over an AF_UNIX
+ * socket and shm:<name> through shared
+ * memory to a server on the same host,
+ * see transport.c.
  *
  *
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
@@ -16,15 +92,127 @@
 #include <sys/wait.h>
 #include <assert.h>
 #include <netdb.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include "colors.h"
+#include "transport.h"
+#include "sockopts.h"
+#include "protocol.h"
+#include "pool.h"
+#include "histogram.h"
+#include "trace.h"
+#include "dedup.h"
+#include "budget.h"
+#include "match.h"
+#include "probes.h"
+
+#define PARALLEL_MAX        64
+#define RANGE_BUFFER        (256*1024)
+#define MEMORY_DEFAULT      (64*1024*1024)
+
+#define STREAM_OFF          0
+#define STREAM_RAW          1
+#define STREAM_NUL          2
+#define STREAM_LENGTH       3
+#define STREAM_CHUNK        (1024*1024)
+#define STREAM_FRAME_MAX    (65535+6)
+#define STREAM_IOV          256
+
+struct resultqueue {
+    int socket;
+    char batch[sizeof(int)+RESULT_BATCH_BYTES];
+    size_t len;
+    unsigned int count;
+};
+
+struct rangejob {
+    struct rangejob *next;
+    uint64_t received_us;
+    int text_length;
+    char *message;
+};
+
+struct rangeconn {
+    int socket;
+    uint32_t start;
+    uint32_t end;
+    uint32_t received;
+    uint32_t dispatched;
+    char *buf;
+    size_t len;
+    struct rangejob *head;
+    struct rangejob *tail;
+    struct dedupcache dedup;
+    struct resultqueue results;
+    unsigned long long bytes;
+    uint64_t done_us;
+};
 
 /* Fields 		*/
 int network_socket;
+int transport;
+struct shmring *ring;
+unsigned long jobs_received;
+unsigned long long bytes_received;
+uint64_t rate_mark_us;
+unsigned long long rate_mark_bytes;
 int pipe_child1[2];
 int pipe_child2[2];
 int pipe_parent[2];
 int debug;
+char *latency_path;
+char *record_path;
+uint64_t request_us;
+uint64_t ready_us;
+struct jobtiming {
+    int type;
+    uint64_t first_us;
+    uint64_t frame_us;
+    uint64_t handoff_us;
+} timing;
+struct histogram latencies[2][5];
+struct resultqueue session_results;
+struct resultqueue *results;
+unsigned long results_sent;
+volatile sig_atomic_t interrupted;
+volatile sig_atomic_t latencies_requested;
+struct dedupcache dedup;
+char *server_host;
+char *server_port;
+int selected_queue;
+int subscribed;
+char *match_expression;
+long job_count;
+int parallel;
+int unordered;
+struct rangeconn *ranges;
+int range_count;
+int range_current;
+struct budget memory;
+char range_error;
+int streaming;
+int stream_fd;
+struct streamout {
+    int pipe;
+    struct iovec iov[STREAM_IOV];
+    int count;
+    unsigned long long out_bytes;
+    unsigned long splices;
+    unsigned long writes;
+    unsigned long waits;
+} stream;
+
+#define STAGE_WAIT          0
+#define STAGE_RECEIVE       1
+#define STAGE_HANDOFF       2
+#define STAGE_WORK          3
+#define STAGE_TOTAL         4
 
 pid_t parentid;
 pid_t child1_id;
@@ -36,20 +224,53 @@ void createPipes();
 void childOneBehaviour();
 void childTwoBehaviour();
 void createSocket(char* address, char* port);
+int connectServer(char *hostname, char *port, char *ipstring);
+void printSockopts();
 void userMenu();
 int receiveJob();
+int receiveControl(int kind, char *text, int length);
+char *resolveReference(struct dedupcache *cache, char *ref, int length,
+                       unsigned char *job_type, int *text_length);
+int fetchParallel();
+int openRange(struct rangeconn *range);
+int takeRangeFrames(struct rangeconn *range);
+int takeRangeJob(struct rangeconn *range, unsigned char job_info, char *text, int text_length);
+int dispatchRangeJob(struct rangeconn *range, char *message, int text_length, uint64_t received_us);
+int advanceRanges();
+void closeRanges();
+int streamJobs(char *address, char *port);
+int streamFrame(unsigned char *frame, int text_length);
+int streamText(char *text, int text_length, unsigned char *frame, int copy);
+int streamOut(char *data, size_t len, int copy);
+int flushStream();
+int waitStream(unsigned long long end);
+ssize_t receiveSome(void *buf, size_t len);
+ssize_t receiveBytes(void *buf, size_t len);
+ssize_t readPipe(int fd, void *buf, size_t len);
+int awaitChild();
+int addResult(struct resultheader *header, char *text);
+int flushResults();
+void sendResult(uint32_t job, char *text, int length);
 int sendMessage(int message);
+int sendMatch();
 int checkServerTerm(char type);
-void getIntput(int* input);
+int awaitInput();
+int getIntput(int* input);
 void killChildren();
 void shutdownError(char* string, char type);
 void parentSignalHandler(int sig);
+void checkInterrupt();
 void childSignalHandler(int sig);
+void recordLatency(uint64_t ack_us);
+void writeLatencies(FILE *out);
+void dumpLatencies();
+void latencySignalHandler(int sig);
 
 void debugPrint(char *string, int debug);
 void errorPrint(char *string);
 int portCheck(char* port);
 int getChecksum(char *string, int length);
+uint64_t monotonicMicros();
 
 /* Main-function that checks if the
  * program was supplied the right amount
@@ -72,6 +293,7 @@ int getChecksum(char *string, int length);
  */
 int main(int argc, char *argv[]) {
     parentid = getpid();
+    initBudget(&memory, NULL, MEMORY_DEFAULT);
     usage(argc, argv);
 
     struct sigaction sigint;
@@ -84,7 +306,13 @@ int main(int argc, char *argv[]) {
     sigquit.sa_handler = childSignalHandler;
     sigaction(SIGQUIT, &sigquit, NULL);
 
+    if(streaming != STREAM_OFF){
+        int ret = streamJobs(argv[1], transport == TRANSPORT_TCP ? argv[2] : NULL);
+        exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     createPipes();
+    ready_us = monotonicMicros();
 
     debugPrint("Forking the first child-process.", debug);
     child1_id = fork();
@@ -93,6 +321,7 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     if(child1_id == 0){
+        signal(SIGINT, SIG_IGN);
         childOneBehaviour();
     }else{
         debugPrint("Forking second child process.", debug);
@@ -102,18 +331,26 @@ int main(int argc, char *argv[]) {
             exit(EXIT_FAILURE);
         }
         if(child2_id == 0){
+            signal(SIGINT, SIG_IGN);
             childTwoBehaviour();
         }else{
             close(pipe_child1[0]);
             close(pipe_child2[0]);
             close(pipe_parent[1]);
+            struct sigaction sigusr1;
+            memset(&sigusr1, 0, sizeof(sigusr1));
+            sigusr1.sa_handler = latencySignalHandler;
+            sigusr1.sa_flags = SA_RESTART;
+            sigaction(SIGUSR1, &sigusr1, NULL);
             debugPrint("Creating network socket.", debug);
             debugPrint("Attempting to connect to the server.", debug);
-            createSocket(argv[1], argv[2]);
+            createSocket(argv[1], transport == TRANSPORT_TCP ? argv[2] : NULL);
             if(network_socket == -1){
                 errorPrint("Couldn't connect to server at:");
                 printf(COLOR_RED ">>%d<< Hostname: %s\n", getpid(), argv[1]);
-                printf(COLOR_RED ">>%d<< Port:     %s", getpid(), argv[2]);
+                if(transport == TRANSPORT_TCP){
+                    printf(COLOR_RED ">>%d<< Port:     %s", getpid(), argv[2]);
+                }
                 printf(COLOR_RESET"\n");
                 killChildren();
                 printf("Exiting program...\n");
@@ -122,7 +359,25 @@ int main(int argc, char *argv[]) {
                 close(pipe_parent[0]);
                 exit(EXIT_FAILURE);
             }
-            userMenu();
+            session_results.socket = network_socket;
+            results = &session_results;
+            if(record_path != NULL && openTrace(record_path, TRACE_CLIENT) == 0){
+                traceRecord(TRACE_CONNECT, 1, 0, 0);
+            }
+            /* Unbuffered, so input waiting to be
+             * read is seen by awaitInput(). */
+            setvbuf(stdin, NULL, _IONBF, 0);
+            if((subscribed != 0 && sendMessage(REQUEST_FILTER + (subscribed << 8)) == -1) ||
+               sendMatch() == -1){
+                killChildren();
+            }else{
+                userMenu();
+            }
+            if(latency_path != NULL){
+                dumpLatencies();
+            }
+            traceRecord(TRACE_CLOSE, 1, 0, 0);
+            closeTrace();
 
             printf("Exiting program...\n");
             close(pipe_child1[1]);
@@ -146,27 +401,76 @@ int main(int argc, char *argv[]) {
  */
 void usage(int argc, char* argv[]){
     debug = 0;
-    if(argc < 3){
+    transport = TRANSPORT_TCP;
+    if(argc >= 2){
+        transport = transportType(argv[1]);
+        server_host = argv[1];
+    }
+    int first_flag = transport == TRANSPORT_TCP ? 3 : 2;
+    if(argc < first_flag){
         errorPrint("Not enough program arguments supplied.");
         errorPrint("./client <hostname> <Port>");
+        errorPrint("./client unix:<path> or ./client shm:<name>");
         errorPrint("To run client in debug mode add last argument '-DEBUG'\n");
         exit(EXIT_FAILURE);
     }
-    if(portCheck(argv[2]) == -1){
+    if(transport == TRANSPORT_TCP){
+        server_port = argv[2];
+    }
+    if(transport == TRANSPORT_TCP && portCheck(argv[2]) == -1){
         errorPrint("Please choose a port from 1 to 6535.");
         errorPrint("./client <hostname> <Port>");
         errorPrint("To run client in debug mode add last argument '-DEBUG'\n");
         exit(EXIT_FAILURE);
     }
-    if(argc == 4){
+    for(int i = first_flag; i < argc; i++){
         char comp[7]= "-DEBUG";
         comp[6] = '\0';
-        if(strcmp(comp, argv[3]) == 0){
+        if(strcmp(comp, argv[i]) == 0){
             debug = 1;
             debugPrint("Running client in debug mode.", debug);
+        }else if(strncmp("-LATENCY=", argv[i], 9) == 0 && argv[i][9] != '\0'){
+            latency_path = argv[i]+9;
+        }else if(strncmp("-RECORD=", argv[i], 8) == 0 && argv[i][8] != '\0'){
+            record_path = argv[i]+8;
+        }else if(strncmp("-PARALLEL=", argv[i], 10) == 0 && atoi(argv[i]+10) > 0 &&
+                 atoi(argv[i]+10) <= PARALLEL_MAX && transport != TRANSPORT_SHM){
+            parallel = atoi(argv[i]+10);
+            char *mode = strchr(argv[i], '/');
+            unordered = mode != NULL && strcmp(mode, "/unordered") == 0;
+        }else if(strncmp("-TYPES=", argv[i], 7) == 0 && argv[i][7] != '\0' &&
+                 strspn(argv[i]+7, "OE") == strlen(argv[i]+7)){
+            subscribed = (strchr(argv[i]+7, 'O') ? FILTER_O : 0) |
+                         (strchr(argv[i]+7, 'E') ? FILTER_E : 0);
+        }else if(strncmp("-MATCH=", argv[i], 7) == 0 && argv[i][7] != '\0'){
+            char request[MATCH_REQUEST_MAX];
+            if(buildMatch(request, sizeof(request), argv[i]+7) == -1){
+                errorPrint("Invalid filter. Use literals and 'len:<min>-<max>' separated by commas,");
+                errorPrint("at most 16 literals of at most 64 bytes each.");
+                exit(EXIT_FAILURE);
+            }
+            match_expression = argv[i]+7;
+        }else if(strcmp("-STREAM", argv[i]) == 0){
+            streaming = STREAM_RAW;
+        }else if(strcmp("-STREAM=nul", argv[i]) == 0){
+            streaming = STREAM_NUL;
+        }else if(strcmp("-STREAM=length", argv[i]) == 0){
+            streaming = STREAM_LENGTH;
+        }else if(strncmp("-MEMORY=", argv[i], 8) == 0 && atoi(argv[i]+8) >= BUDGET_MIN/1024){
+            memory.limit = (size_t)atoi(argv[i]+8) * 1024;
+        }else if(parseSockopt(argv[i]) == 0){
         }else{
             errorPrint("./client <hostname> <Port>");
-            errorPrint("To run client in debug mode add last argument '-DEBUG'\n");
+            errorPrint("To run client in debug mode add argument '-DEBUG'\n");
+            errorPrint("To tune the socket add '-NODELAY', '-SNDBUF=<n|auto>', '-RCVBUF=<n|auto>' or '-LOWAT=<n>'\n");
+            errorPrint("To drop a dead server in the kernel add '-KEEPALIVE=<s>' or '-USERTIMEOUT=<ms>'\n");
+            errorPrint("To write latency histograms add '-LATENCY=<path>'\n");
+            errorPrint("To record the session for ./replay add '-RECORD=<path>'\n");
+            errorPrint("To fetch all jobs over K connections add '-PARALLEL=<K>[/unordered]', not over shm\n");
+            errorPrint("To only take jobs of some types add '-TYPES=<O|E|OE>'\n");
+            errorPrint("To only take jobs whose text matches add '-MATCH=<literal,...,len:<min>-<max>>'\n");
+            errorPrint("To write every job's text to stdout without the menu add '-STREAM[=nul|length]'\n");
+            errorPrint("To bound what is buffered from the server add '-MEMORY=<KB>', at least 64\n");
             exit(EXIT_FAILURE);
         }
     }
@@ -208,8 +512,9 @@ void createPipes(){
  * child.
  *
  * It reads job messages from parent
- * returning 'C' if successful and
- * 'E' if an error occurred.
+ * returning 'C' and the job's result
+ * if successful and 'E' if an error
+ * occurred.
  *
  * Input:
  *     none
@@ -235,15 +540,17 @@ void childOneBehaviour(){
           write(pipe_parent[1], &err, sizeof(char));
           continue;
         }
+        char lengthchars[4];
+        uint32_t job;
+        if(readPipe(pipe_child1[0], lengthchars, sizeof(lengthchars)) != (ssize_t)sizeof(lengthchars) ||
+           readPipe(pipe_child1[0], &job, sizeof(job)) != (ssize_t)sizeof(job)){
+            write(pipe_parent[1], &err, sizeof(char));
+            continue;
+        }
         int text_length = 0;
         for(int i = 0; i < (int)sizeof(int); i++){
             int shuffle = 12 -(i*4);
-            char ch;
-            if(read(pipe_child1[0], &ch, sizeof(char)) == -1){
-                write(pipe_parent[1], &err, sizeof(char));
-                continue;
-            }
-            text_length = text_length +(ch << shuffle);
+            text_length = text_length +(lengthchars[i] << shuffle);
         }
         printf("\n");
         debugPrint("Received job from parent.", debug);
@@ -251,17 +558,19 @@ void childOneBehaviour(){
             printf(COLOR_CYAN">>%d<< text length: %d",getpid(), text_length);
             printf(COLOR_RESET"\n");
         }
-        char print_text[text_length+1];
-        print_text[text_length] = '\0';
-        if(read(pipe_child1[0], &print_text, text_length*sizeof(char))==-1){
+        char *print_text = poolAlloc(text_length+1);
+        if(print_text == NULL ||
+           readPipe(pipe_child1[0], print_text, text_length) != (ssize_t)text_length){
+                poolFree(print_text);
                 write(pipe_parent[1], &err, sizeof(char));
                 continue;
         }
+        print_text[text_length] = '\0';
         fprintf(stdout,COLOR_YELLOW "%s", print_text);
         printf("\n"COLOR_RESET);
-
-        char cont = 'C';
-        write(pipe_parent[1],&cont,sizeof(char));
+        sendResult(job, print_text, text_length);
+        PROBE4(job_worked, job, 0, text_length, 0);
+        poolFree(print_text);
         fflush(stdout);
     }
     debugPrint("Terminating child process #1...", debug);
@@ -276,8 +585,9 @@ void childOneBehaviour(){
  * second child.
  *
  * It reads job messages from parent
- * returning 'C' if successful and
- * 'E' if an error occurred.
+ * returning 'C' and the job's result
+ * if successful and 'E' if an error
+ * occurred.
  *
  * Input:
  *     none
@@ -303,15 +613,17 @@ void childTwoBehaviour(){
           write(pipe_parent[1], &err, sizeof(char));
           continue;
         }
+        char lengthchars[4];
+        uint32_t job;
+        if(readPipe(pipe_child2[0], lengthchars, sizeof(lengthchars)) != (ssize_t)sizeof(lengthchars) ||
+           readPipe(pipe_child2[0], &job, sizeof(job)) != (ssize_t)sizeof(job)){
+            write(pipe_parent[1], &err, sizeof(char));
+            continue;
+        }
         int text_length = 0;
         for(int i = 0; i < (int)sizeof(int); i++){
             int shuffle = 12 -(i*4);
-            char ch;
-            if(read(pipe_child2[0], &ch, sizeof(char))==-1){
-                write(pipe_parent[1], &err, sizeof(char));
-                continue;
-            }
-            text_length = text_length +(ch << shuffle);
+            text_length = text_length +(lengthchars[i] << shuffle);
         }
         printf("\n");
         debugPrint("Received job from parent.", debug);
@@ -319,14 +631,19 @@ void childTwoBehaviour(){
             printf(COLOR_CYAN">>%d<< text length: %d",getpid(), text_length);
             printf(COLOR_RESET"\n");
         }
-        char print_text[text_length+1];
+        char *print_text = poolAlloc(text_length+1);
+        if(print_text == NULL ||
+           readPipe(pipe_child2[0], print_text, text_length) != (ssize_t)text_length){
+                poolFree(print_text);
+                write(pipe_parent[1], &err, sizeof(char));
+                continue;
+        }
         print_text[text_length] = '\0';
-        read(pipe_child2[0], &print_text, text_length);
         fprintf(stdout,COLOR_MAGENTA "%s", print_text);
         printf("\n"COLOR_RESET);
-
-        char cont = 'C';
-        write(pipe_parent[1],&cont,sizeof(char));
+        sendResult(job, print_text, text_length);
+        PROBE4(job_worked, job, 1, text_length, 0);
+        poolFree(print_text);
         fflush(stderr);
     }
     debugPrint("Terminating child process #2...", debug);
@@ -339,7 +656,8 @@ void childTwoBehaviour(){
 /* Creates a networking socket and
  * attempts to connect to the server
  * through the hostname and port
- * specified by the user.
+ * specified by the user, or through
+ * the local transport in hostname.
  *
  * Input:
  *     hostname: char* hostname
@@ -348,8 +666,54 @@ void childTwoBehaviour(){
  *     void
  */
 void createSocket(char* hostname, char* port){
+    if(transport != TRANSPORT_TCP){
+        network_socket = connectLocal(transport, transportPath(hostname));
+        if(network_socket == -1){
+            return;
+        }
+        if(transport == TRANSPORT_SHM){
+            ring = attachRing(network_socket);
+            if(ring == NULL){
+                errorPrint("Couldn't map the server's shared memory.");
+                close(network_socket);
+                network_socket = -1;
+                return;
+            }
+        }
+        printf(COLOR_CYAN">>%d<<Connected to server at: %s",getpid(), hostname);
+        printf(COLOR_RESET"\n");
+        applySockopts(network_socket, 0);
+        printSockopts();
+        return;
+    }
+
+    char ipstring[INET_ADDRSTRLEN];
+    network_socket = connectServer(hostname, port, ipstring);
+    if(network_socket == -1){
+        return;
+    }
+    printf(COLOR_CYAN">>%d<<Connected to server at: %s",getpid(), ipstring);
+    printf(COLOR_RESET"\n");
+
+    applySockopts(network_socket, 1);
+    rate_mark_us = monotonicMicros();
+    printSockopts();
+}
+
+/* Connects to the server over TCP.
+ *
+ * Input:
+ *     hostname: char* hostname
+ *     port:     char* port
+ *     ipstring: set to the server's
+ *               address
+ * Return:
+ *     the socket, or -1 on error
+ */
+int connectServer(char *hostname, char *port, char *ipstring){
     struct addrinfo hints;
     struct addrinfo *result, *rp;
+    int sock = -1;
 
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_INET;
@@ -358,49 +722,62 @@ void createSocket(char* hostname, char* port){
     hints.ai_protocol = IPPROTO_TCP;
 
     if (getaddrinfo(hostname, port, &hints, &result) != 0){
-        network_socket = -1;
-        return;
+        return -1;
     }
 
     for (rp = result; rp != NULL; rp = rp->ai_next) {
-        network_socket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (network_socket == -1) {
+        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock == -1) {
             continue;
         }
-        if (connect(network_socket, rp->ai_addr, rp->ai_addrlen) != -1) {
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) != -1) {
             break;
         }
+        close(sock);
+        sock = -1;
     }
     if (rp == NULL) {
         errorPrint("Could not connect.\n");
         freeaddrinfo(result);
-        network_socket = -1;
-        return;
+        return -1;
     }
 
-    char ipstring[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &((struct sockaddr_in *)rp->ai_addr)->sin_addr, ipstring, sizeof ipstring);
-    printf(COLOR_CYAN">>%d<<Connected to server at: %s",getpid(), ipstring);
-    printf(COLOR_RESET"\n");
-
+    inet_ntop(AF_INET, &((struct sockaddr_in *)rp->ai_addr)->sin_addr, ipstring, INET_ADDRSTRLEN);
     freeaddrinfo(result);
+    return sock;
+}
+
+/* Prints the socket settings in effect
+ * when running in debug mode.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printSockopts(){
+    if(debug){
+        char settings[160];
+        describeSockopts(network_socket, transport == TRANSPORT_TCP, settings, sizeof(settings));
+        printf(COLOR_CYAN">>%d<< Socket: %s", getpid(), settings);
+        printf(COLOR_RESET"\n");
+    }
 }
 
 /* Interactive terminal menu that lets the user
  * send 4-byte messages to the server.
+ * Jobs are served from queue 0 until the
+ * user selects another queue.
  * Exits the command-loop when the
  * server runs out of jobs, if the server
  * signals an error, or if the client itself
  * experiences an error.
  *
  * After sending a job to a child, the parent
- * waits for a char-message that signals
- * that the child is done printing.
- * 'C' if the child was succesful, and
- * 'E' if it experienced an error.
- * This is only checked with ret != 'C'
- * however; as any other return value
- * would also be considered an error.
+ * waits for the child to be done printing,
+ * see awaitChild(). Results that haven't
+ * been sent yet are sent before the menu
+ * waits for the user again.
  *
  * Input:
  *    none
@@ -413,13 +790,25 @@ void userMenu(){
     int request;
 
     while(1){
+        if(flushResults() == -1){
+            return;
+        }
         usleep(2500);
     	printf(COLOR_RESET"\n-------Server-connected client-------");
     	printf(COLOR_RESET"\n[1] Get job from server.");
     	printf(COLOR_RESET"\n[2] Get multiple jobs from server.");
     	printf(COLOR_RESET"\n[3] Get all jobs from server.");
-    	printf(COLOR_RESET"\n[4] Exit program.\n");
-    	getIntput(&choice);
+    	printf(COLOR_RESET"\n[4] Exit program.");
+    	printf(COLOR_RESET"\n[5] Select job queue.");
+    	printf(COLOR_RESET"\n[6] Get stats from server.");
+    	printf(COLOR_RESET"\n[7] Reload the server's jobs.");
+    	if(parallel > 0){
+    	    printf(COLOR_RESET"\n[8] Get all jobs over %d connections.", parallel);
+    	}
+    	printf("\n");
+    	if(getIntput(&choice) == -1){
+    	    return;
+    	}
 
     	if(choice == 1){
     		request = 'J';
@@ -427,27 +816,31 @@ void userMenu(){
             if(sendMessage(request) == -1){
                 return;
             }
-    		if(receiveJob() == -1){
+            int received;
+            do{
+                received = receiveJob();
+            }while(received == 1);
+    		if(received == -1){
                 return;
             }
-            char ret;
-            read(pipe_parent[0], &ret, sizeof(char));
-            if(ret != 'C'){
-                shutdownError("Error ocurred in child.", 'C');
+            if(awaitChild() == -1){
                 return;
             }
-            debugPrint("Child done working. Resuming parent.",debug);
 
     	}
     	if(choice == 2){
             printf(COLOR_RESET"How many jobs to request?\n");
             int howmany;
-            getIntput(&howmany);
+            if(getIntput(&howmany) == -1){
+                return;
+            }
     		while(howmany > 8388607 || howmany < 1){
                 errorPrint("Amount out of bounds.");
                 printf("Request jobs between 1 and 8388607.\n");
                 printf(COLOR_RESET"How many jobs to request?\n");
-                getIntput(&howmany);
+                if(getIntput(&howmany) == -1){
+                    return;
+                }
             }
 
             request = 'J';
@@ -457,16 +850,17 @@ void userMenu(){
                 return;
             }
             for(int i = 0; i < howmany; i++){
-                if(receiveJob() == -1){
+                int received = receiveJob();
+                if(received == -1){
                     return;
                 }
-                char ret;
-                read(pipe_parent[0], &ret, sizeof(char));
-                if(ret != 'C'){
-                    shutdownError("Error ocurred in child.", 'C');
+                if(received == 1){
+                    i--;
+                    continue;
+                }
+                if(awaitChild() == -1){
                     return;
                 }
-                debugPrint("Child done working. Resuming parent.", debug);
             }
     	}
     	if(choice == 3){
@@ -475,16 +869,16 @@ void userMenu(){
                 return;
             }
             while(1){
-                if(receiveJob() == -1){
+                int received = receiveJob();
+                if(received == -1){
                     return;
                 }
-                char ret;
-                read(pipe_parent[0], &ret, sizeof(char));
-                if(ret != 'C'){
-                    shutdownError("Error ocurred in child.", 'C');
+                if(received == 1){
+                    continue;
+                }
+                if(awaitChild() == -1){
                     return;
                 }
-                debugPrint("Child done working. Resuming parent.", debug);
             }
         }
     	if(choice == 4){
@@ -495,172 +889,1548 @@ void userMenu(){
             }
             break;
     	}
-        if(choice > 4 || choice < 1){
+        if(choice == 5){
+            printf(COLOR_RESET"Which queue id to get jobs from?\n");
+            int queue_id;
+            if(getIntput(&queue_id) == -1){
+                return;
+            }
+            while(queue_id > 16777215 || queue_id < 0){
+                errorPrint("Queue id out of bounds.");
+                printf("Choose a queue id between 0 and 16777215.\n");
+                printf(COLOR_RESET"Which queue id to get jobs from?\n");
+                if(getIntput(&queue_id) == -1){
+                    return;
+                }
+            }
+            request = 'S';
+            request = request + ((unsigned int)queue_id << 8);
+            if(sendMessage(request) == -1){
+                return;
+            }
+            selected_queue = queue_id;
+        }
+        if(choice == 6 || choice == 7){
+            request = choice == 6 ? 'I' : 'R';
+            if(sendMessage(request) == -1){
+                return;
+            }
+            int received = receiveJob();
+            if(received == -1){
+                return;
+            }
+            if(received == 0 && awaitChild() == -1){
+                return;
+            }
+        }
+        if(choice == 8 && parallel > 0){
+            if(fetchParallel() == -1){
+                return;
+            }
+        }
+        if(choice > (parallel > 0 ? 8 : 7) || choice < 1){
             printf("Not a valid choice. Try again.\n");
         }
     	printf("\n\n");
     }
 }
 
-/* Attempts to send the message from the
- * input to the server.
+/* Fetches every job of the selected
+ * queue over -PARALLEL connections of
+ * their own. The amount of jobs is asked
+ * for on the session's connection, and
+ * every connection asks for an equal
+ * range of them, see openRange(). Frames
+ * are checked as they arrive on any of
+ * them, see takeRangeFrames().
+ *
+ * Jobs are handed to the children in job
+ * order: those of the range whose turn
+ * it is as they arrive, those of later
+ * ranges once it is their turn. While
+ * the memory budget is exhausted only
+ * the range whose turn it is is read,
+ * so the server is held back by TCP on
+ * the others. With /unordered every job
+ * is handed over as it arrives.
+ *
+ * Results go back on the connection the
+ * job came on, as the server numbers
+ * jobs per connection.
  *
  * Input:
- *     message: Integer message for server
+ *     none
  * Return:
- *    0 on success.
- *   -1 on error.
- *
+ *     0 on success
+ *    -1 on error
  */
-int sendMessage(int message){
-    if(debug == 1){
-        printf(COLOR_CYAN ">>%d<< Sending message to server: ", getpid());
-        printf("%c \n"COLOR_RESET,(char)(message&255));
+int fetchParallel(){
+    job_count = -1;
+    if(sendMessage(REQUEST_COUNT) == -1){
+        return -1;
     }
-    if(send(network_socket, &message, sizeof(message), 0) == -1){
-        errorPrint("Error while attempting to message server!");
+    while(job_count == -1){
+        int received = receiveJob();
+        if(received == -1){
+            return -1;
+        }
+        if(received == 0 && awaitChild() == -1){
+            return -1;
+        }
+    }
+    if(job_count == 0){
+        printf(COLOR_CYAN">>%d<< The queue has no jobs to fetch.", getpid());
+        printf(COLOR_RESET"\n");
+        return 0;
+    }
+    range_count = job_count < parallel ? job_count : parallel;
+    ranges = calloc(range_count, sizeof(struct rangeconn));
+    if(ranges == NULL){
+        range_count = 0;
+        shutdownError("Out of memory while fetching ranges.", 'C');
         return -1;
     }
-    return 0;
+    range_current = 0;
+    range_error = 'C';
+    uint64_t start_us = monotonicMicros();
+    request_us = start_us;
+    ready_us = start_us;
+    int ret = 0;
+    for(int i = 0; i < range_count; i++){
+        ranges[i].socket = -1;
+        ranges[i].start = (uint64_t)job_count * i / range_count;
+        ranges[i].end = (uint64_t)job_count * (i+1) / range_count;
+    }
+    for(int i = 0; i < range_count && ret == 0; i++){
+        ret = openRange(&ranges[i]);
+    }
+
+    struct pollfd fds[PARALLEL_MAX];
+    int polled[PARALLEL_MAX];
+    while(ret == 0 && range_current < range_count){
+        int count = 0;
+        for(int i = range_current; i < range_count; i++){
+            if(ranges[i].done_us != 0){
+                continue;
+            }
+            if(!unordered && i != range_current && budgetExhausted(&memory)){
+                continue;
+            }
+            fds[count].fd = ranges[i].socket;
+            fds[count].events = POLLIN;
+            polled[count] = i;
+            count++;
+        }
+        if(count > 0 && poll(fds, count, -1) == -1){
+            if(errno == EINTR){
+                checkInterrupt();
+                continue;
+            }
+            errorPrint("Error while waiting for ranges.");
+            ret = -1;
+            break;
+        }
+        for(int j = 0; j < count && ret == 0; j++){
+            if(fds[j].revents != 0){
+                ret = takeRangeFrames(&ranges[polled[j]]);
+            }
+        }
+        if(ret == 0){
+            ret = advanceRanges();
+        }
+    }
+
+    if(ret == 0){
+        uint64_t fetched_us = start_us;
+        unsigned long long bytes = 0;
+        for(int i = 0; i < range_count; i++){
+            struct rangeconn *range = &ranges[i];
+            double seconds = (range->done_us - start_us) / 1000000.0;
+            if(range->done_us > fetched_us){
+                fetched_us = range->done_us;
+            }
+            bytes += range->bytes;
+            if(debug == 1){
+                printf(COLOR_CYAN">>%d<< Range %u-%u: %llu byte(s) in %.3f s (%.1f MB/s).",
+                       getpid(), range->start, range->end, range->bytes, seconds,
+                       seconds > 0 ? range->bytes / 1048576.0 / seconds : 0);
+                printf(COLOR_RESET"\n");
+            }
+        }
+        double fetch_s = (fetched_us - start_us) / 1000000.0;
+        double total_s = (monotonicMicros() - start_us) / 1000000.0;
+        printf(COLOR_CYAN">>%d<< Fetched %ld job(s), %llu byte(s) over %d connection(s) "
+               "in %.3f s (%.1f MB/s), handed over %s in %.3f s.", getpid(), job_count,
+               bytes, range_count, fetch_s, fetch_s > 0 ? bytes / 1048576.0 / fetch_s : 0,
+               unordered ? "as they came" : "in job order", total_s);
+        printf(COLOR_RESET"\n");
+        char budget[128];
+        describeBudget(&memory, budget, sizeof(budget));
+        printf(COLOR_CYAN">>%d<< Memory: %s.", getpid(), budget);
+        printf(COLOR_RESET"\n");
+    }
+    closeRanges();
+    if(ret == -1){
+        shutdownError("Terminating client due to an error while fetching ranges.", range_error);
+    }
+    return ret;
 }
 
-/* Behaviour for receiving the job
- * from the server. Picking apart
- * the message and sending it to
- * the correct child.
- * If the server sends a termination message
- * it makes sure to kill the children, and
- * terminate correctly.
+/* Opens a connection for a range, and
+ * asks for its jobs from the queue the
+ * session has selected.
  *
  * Input:
- *     none
+ *     range: the range
  * Return:
- *    0 on success.
- *   -1 on error.
+ *     0 on success
+ *    -1 on error
  */
-int receiveJob(){
-    unsigned char job_info;
-    if(recv(network_socket, &job_info, sizeof(char), 0) == -1){
-        errorPrint("Lost connection to server.");
-        debugPrint("Terminating children...", debug);
-        killChildren();
-        return-1;
+int openRange(struct rangeconn *range){
+    char ipstring[INET_ADDRSTRLEN];
+    if(transport == TRANSPORT_TCP){
+        range->socket = connectServer(server_host, server_port, ipstring);
+    }else{
+        range->socket = connectLocal(transport, transportPath(server_host));
     }
-    unsigned char job_type = job_info >> 5;
-    if(checkServerTerm(job_type) == -1){
+    range->buf = malloc(RANGE_BUFFER);
+    if(range->buf != NULL){
+        chargeBudget(&memory, RANGE_BUFFER);
+    }
+    if(range->socket == -1 || range->buf == NULL){
+        errorPrint("Couldn't open a connection for a range.");
         return -1;
     }
-    char lengthchars[4];
+    applySockopts(range->socket, transport == TRANSPORT_TCP);
+    range->results.socket = range->socket;
 
-    char checksum = job_info & 31;
-    int text_length = 0;
-     for(int i = 0; i < (int)sizeof(int); i++){
-        int shuffle = 12 -(i*4);
-        char ch;
-        if(recv(network_socket, &ch, sizeof(char), 0) == -1){
-            errorPrint("Lost connection to server.");
-            killChildren();
-            return-1;
-        }
-        lengthchars[i] = ch;
-        text_length = text_length +(ch << shuffle);
-    }
-    char temp_text[text_length+1];
-    if(recv(network_socket, &temp_text, sizeof(temp_text), 0) == -1){
-        errorPrint("Lost connection to server.");
-        killChildren();
-        return-1;
+    char request[2*sizeof(int)+sizeof(struct rangerequest)];
+    size_t len = 0;
+    int word;
+    if(selected_queue != 0){
+        word = 'S' + ((unsigned int)selected_queue << 8);
+        memcpy(request, &word, sizeof(word));
+        len += sizeof(word);
     }
-    if(checksum != getChecksum(temp_text, text_length)){
-        errorPrint("Error! Checksum did not match.");
-        shutdownError("Terminating client due to checksum error.", 'S');
+    word = REQUEST_RANGE;
+    memcpy(request+len, &word, sizeof(word));
+    len += sizeof(word);
+    struct rangerequest ask = {range->start, range->end};
+    memcpy(request+len, &ask, sizeof(ask));
+    len += sizeof(ask);
+    if(send(range->socket, request, len, MSG_NOSIGNAL) != (ssize_t)len){
+        errorPrint("Error while asking for a range!");
         return -1;
     }
-    char job_text[text_length+5];
-    memset(job_text,0, text_length+5);
-    for(int i = 0; i < 4; i++){
-        job_text[i+1] = lengthchars[i];
-    }
-    for(int i = 0; i < text_length; i++){
-        job_text[i+5] = temp_text[i];
-    }
-
     if(debug == 1){
-        printf(COLOR_CYAN"\n>>%d<< Received job from server:", getpid());
-        printf(COLOR_CYAN"\n>>%d<< jobtype:    %d", getpid(), job_type);
-        printf(COLOR_CYAN"\n>>%d<< textlength: %d", getpid(), text_length);
-        printf(COLOR_CYAN"\n>>%d<< checksum:   %d", getpid(), checksum);
+        printf(COLOR_CYAN">>%d<< Asked for jobs %u to %u.", getpid(), range->start, range->end);
         printf(COLOR_RESET"\n");
     }
-    switch(job_type){
-        case 0:
-            job_text[0] = 'O';
-            write(pipe_child1[1], job_text, sizeof(job_text));
-            break;
-        case 1:
-            job_text[0] = 'E';
-            write(pipe_child2[1], job_text, sizeof(job_text));
-            break;
-    }
     return 0;
 }
 
-/* Function that checks for
- * termination messages from
- * the server in the job_type
- * part of the job message.
- * protocol described in protokoll.txt
+/* Reads what has arrived on a range's
+ * connection, and takes every complete
+ * frame in it, see takeRangeJob().
+ * A frame split across reads is kept
+ * until the rest arrives.
  *
  * Input:
- *     type: char message
+ *     range: the range
  * Return:
- *     0 if server still alive
- *    -1 if termination message
- *     received
+ *     0 on success
+ *    -1 on error
  */
-int checkServerTerm(char type){
-    switch (type){
-        case 7:
-            debugPrint("Server out of Jobs.", debug);
-            int terrMsg = 'T';
-            sendMessage(terrMsg);
-            usleep(250000);
-            killChildren();
-            return -1;
-        case 2:
-            debugPrint("Server terminated due to filereading error.", debug);
-            killChildren();
-            return -1;
-        case 3:
-            debugPrint("Server terminated due to receiving unkown request.", debug);
-            killChildren();
+int takeRangeFrames(struct rangeconn *range){
+    ssize_t got = recv(range->socket, range->buf+range->len, RANGE_BUFFER-range->len, MSG_DONTWAIT);
+    if(got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return 0;
+    }
+    if(got <= 0){
+        errorPrint("Lost connection to server while fetching a range.");
+        return -1;
+    }
+    range->len += got;
+    range->bytes += got;
+    size_t used = 0;
+    while(range->len - used >= 1+sizeof(int)){
+        unsigned char *frame = (unsigned char*)range->buf + used;
+        unsigned char job_type = frame[0] >> 5;
+        if(job_type != 0 && job_type != 1 && job_type != FRAME_CONTROL){
+            errorPrint("Server ended a range before sending all of it.");
             return -1;
-        case 6:
-            debugPrint("Server terminated due to CTRL+C (sigint).", debug);
-            killChildren();
+        }
+        int text_length = 0;
+        for(int i = 0; i < (int)sizeof(int); i++){
+            int shuffle = 12 -(i*4);
+            text_length = text_length +(frame[i+1] << shuffle);
+        }
+        if(range->len - used < (size_t)text_length+6){
+            break;
+        }
+        if(takeRangeJob(range, frame[0], (char*)frame+5, text_length) == -1){
             return -1;
+        }
+        used += text_length+6;
+    }
+    memmove(range->buf, range->buf+used, range->len-used);
+    range->len -= used;
+    if(range->received == range->end - range->start && range->done_us == 0){
+        range->done_us = monotonicMicros();
     }
     return 0;
 }
 
+/* Checks a frame received for a range,
+ * and hands the job in it to a child if
+ * it is the range's turn, or holds it
+ * until then. Jobs are numbered per
+ * connection, like in receiveJob(), and
+ * control frames are handled like there.
+ *
+ * Input:
+ *     range:       the range
+ *     job_info:    first byte of the frame
+ *     text:        text of the frame
+ *     text_length: length of the text
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int takeRangeJob(struct rangeconn *range, unsigned char job_info, char *text, int text_length){
+    unsigned char job_type = job_info >> 5;
+    char checksum = job_info & 31;
+    char *message;
+    if(job_type == FRAME_CONTROL && checksum == CONTROL_DEDUP){
+        int capacity = atoi(text);
+        freeDedup(&range->dedup);
+        if(capacity < 1 || capacity > DEDUP_MAX || initDedup(&range->dedup, capacity, 1) == -1){
+            errorPrint("Couldn't set up the job cache for dedup mode.");
+            return -1;
+        }
+        return 0;
+    }else if(job_type == FRAME_CONTROL && checksum == CONTROL_REFERENCE){
+        message = resolveReference(&range->dedup, text, text_length, &job_type, &text_length);
+        if(message == NULL){
+            range_error = 'S';
+            return -1;
+        }
+    }else if(job_type == FRAME_CONTROL && checksum == CONTROL_HEARTBEAT){
+        int beat = REQUEST_HEARTBEAT;
+        send(range->socket, &beat, sizeof(beat), MSG_NOSIGNAL);
+        return 0;
+    }else if(job_type == FRAME_CONTROL){
+        return 0;
+    }else{
+        if(checksum != getChecksum(text, text_length)){
+            errorPrint("Error! Checksum did not match.");
+            range_error = 'S';
+            return -1;
+        }
+        if(range->dedup.capacity > 0 && text_length <= DEDUP_TEXT_MAX &&
+           addDedup(&range->dedup, hashText(text, text_length), text, text_length) == -1){
+            errorPrint("Out of memory while caching job.");
+            return -1;
+        }
+        message = poolAlloc(text_length+10);
+        if(message == NULL){
+            errorPrint("Out of memory while receiving job.");
+            return -1;
+        }
+        for(int i = 0; i < (int)sizeof(int); i++){
+            int shuffle = 12 -(i*4);
+            message[i+1] = (char)((text_length >> shuffle) & 15);
+        }
+        memcpy(message+9, text, text_length);
+    }
+    message[0] = job_type == 0 ? 'O' : 'E';
+    range->received++;
+    uint32_t job = range->received;
+    memcpy(message+5, &job, sizeof(job));
+    PROBE4(frame_received, job, job_type, text_length, range->socket);
+    uint64_t now = monotonicMicros();
+    if(unordered || range == &ranges[range_current]){
+        return dispatchRangeJob(range, message, text_length, now);
+    }
+    struct rangejob *held = malloc(sizeof(struct rangejob));
+    if(held == NULL){
+        errorPrint("Out of memory while holding job.");
+        poolFree(message);
+        return -1;
+    }
+    held->next = NULL;
+    held->received_us = now;
+    held->text_length = text_length;
+    held->message = message;
+    if(range->tail == NULL){
+        range->head = held;
+    }else{
+        range->tail->next = held;
+    }
+    range->tail = held;
+    chargeBudget(&memory, text_length+9);
+    return 0;
+}
+
+/* Hands a job of a range to the child
+ * for its type and waits for it, with
+ * the result added to the range's
+ * batch of results.
+ *
+ * Input:
+ *     range:       the range
+ *     message:     the job, laid out as
+ *                  the message to the
+ *                  child, given back to
+ *                  the pool
+ *     text_length: length of its text
+ *     received_us: when it arrived
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int dispatchRangeJob(struct rangeconn *range, char *message, int text_length, uint64_t received_us){
+    timing.type = message[0] == 'O' ? 0 : 1;
+    timing.first_us = received_us;
+    timing.frame_us = received_us;
+    if(ready_us > received_us){
+        ready_us = received_us;
+    }
+    write(timing.type == 0 ? pipe_child1[1] : pipe_child2[1], message, text_length+9);
+    timing.handoff_us = monotonicMicros();
+    uint32_t job;
+    memcpy(&job, message+5, sizeof(job));
+    PROBE4(job_dispatched, job, timing.type, text_length, range->socket);
+    poolFree(message);
+    range->dispatched++;
+    results = &range->results;
+    int ret = awaitChild();
+    results = &session_results;
+    return ret;
+}
+
+/* Moves the turn on past every range
+ * whose jobs have all been handed over,
+ * handing over the jobs held for the
+ * range whose turn it is then.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int advanceRanges(){
+    while(range_current < range_count){
+        struct rangeconn *range = &ranges[range_current];
+        while(range->head != NULL){
+            struct rangejob *held = range->head;
+            range->head = held->next;
+            if(range->head == NULL){
+                range->tail = NULL;
+            }
+            refundBudget(&memory, held->text_length+9);
+            int ret = dispatchRangeJob(range, held->message, held->text_length, held->received_us);
+            free(held);
+            if(ret == -1){
+                return -1;
+            }
+        }
+        if(range->dispatched < range->end - range->start){
+            break;
+        }
+        range_current++;
+    }
+    return 0;
+}
+
+/* Sends what is left of the results
+ * of every range, ends their sessions
+ * and frees them.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void closeRanges(){
+    for(int i = 0; i < range_count; i++){
+        struct rangeconn *range = &ranges[i];
+        if(range->socket != -1){
+            results = &range->results;
+            flushResults();
+            results = &session_results;
+            int request = 'T';
+            send(range->socket, &request, sizeof(request), MSG_NOSIGNAL);
+            close(range->socket);
+        }
+        while(range->head != NULL){
+            struct rangejob *held = range->head;
+            range->head = held->next;
+            poolFree(held->message);
+            free(held);
+        }
+        if(range->buf != NULL){
+            refundBudget(&memory, RANGE_BUFFER);
+        }
+        free(range->buf);
+        freeDedup(&range->dedup);
+    }
+    free(ranges);
+    ranges = NULL;
+    range_count = 0;
+}
+
+/* Attempts to send the message from the
+ * input to the server. Results not sent
+ * yet are sent first, so the server has
+ * them before the session can end.
+ *
+ * Input:
+ *     message: Integer message for server
+ * Return:
+ *    0 on success.
+ *   -1 on error.
+ *
+ */
+int sendMessage(int message){
+    if(flushResults() == -1){
+        return -1;
+    }
+    if(debug == 1){
+        printf(COLOR_CYAN ">>%d<< Sending message to server: ", getpid());
+        printf("%c \n"COLOR_RESET,(char)(message&255));
+    }
+    if((message&255) == 'J' || (message&255) == 'U'){
+        request_us = monotonicMicros();
+        ready_us = request_us;
+    }
+    traceRecord(TRACE_REQUEST, 1, message, 0);
+    if(send(network_socket, &message, sizeof(message), 0) == -1){
+        errorPrint("Error while attempting to message server!");
+        return -1;
+    }
+    return 0;
+}
+
+/* Sends the filter given with -MATCH to
+ * the server, as REQUEST_MATCH followed
+ * by its text, see protocol.h.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 on success, or if there is
+ *       no filter
+ *    -1 on error
+ */
+int sendMatch(){
+    if(match_expression == NULL){
+        return 0;
+    }
+    char request[sizeof(int)+MATCH_REQUEST_MAX];
+    int len = buildMatch(request+sizeof(int), MATCH_REQUEST_MAX, match_expression);
+    int message = REQUEST_MATCH + (len << 8);
+    memcpy(request, &message, sizeof(message));
+    if(flushResults() == -1){
+        return -1;
+    }
+    debugPrint("Sending filter to server.", debug);
+    traceRecord(TRACE_REQUEST, 1, message, 0);
+    tracePayload(1, request+sizeof(int), len);
+    if(send(network_socket, request, sizeof(int)+len, 0) == -1){
+        errorPrint("Error while attempting to message server!");
+        return -1;
+    }
+    return 0;
+}
+
+/* Behaviour for receiving the job
+ * from the server. Picking apart
+ * the message and sending it to
+ * the correct child.
+ * If the server sends a termination message
+ * it makes sure to kill the children, and
+ * terminate correctly.
+ *
+ * Control frames from the server are
+ * handled here, and aren't sent to
+ * any child, except references to a
+ * cached job, which are sent on as
+ * the job.
+ *
+ * Input:
+ *     none
+ * Return:
+ *    0 on success.
+ *    1 if a control frame was received
+ *      instead of a job.
+ *   -1 on error.
+ */
+int receiveJob(){
+    unsigned char job_info;
+    if(latencies_requested){
+        latencies_requested = 0;
+        dumpLatencies();
+    }
+    if(receiveBytes(&job_info, sizeof(char)) <= 0){
+        errorPrint("Lost connection to server.");
+        debugPrint("Terminating children...", debug);
+        killChildren();
+        return-1;
+    }
+    timing.first_us = monotonicMicros();
+    unsigned char job_type = job_info >> 5;
+    if(job_type != 0 && job_type != 1 && job_type != FRAME_CONTROL){
+        traceRecord(TRACE_FRAME, 1, 5, job_info);
+    }
+    if(checkServerTerm(job_type) == -1){
+        return -1;
+    }
+    char lengthchars[4];
+    if(receiveBytes(lengthchars, sizeof(lengthchars)) != (ssize_t)sizeof(lengthchars)){
+        errorPrint("Lost connection to server.");
+        killChildren();
+        return-1;
+    }
+
+    char checksum = job_info & 31;
+    int text_length = 0;
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        text_length = text_length +(lengthchars[i] << shuffle);
+    }
+    /* Laid out as the message to the child:
+     * type, length, job number and text,
+     * with the text received in place
+     * behind the header. */
+    char *job_text = poolAlloc(text_length+10);
+    if(job_text == NULL){
+        errorPrint("Out of memory while receiving job.");
+        shutdownError("Terminating client.", 'C');
+        return -1;
+    }
+    memcpy(job_text+1, lengthchars, sizeof(lengthchars));
+    char *text = job_text+9;
+    if(receiveBytes(text, text_length+1) != (ssize_t)(text_length+1)){
+        errorPrint("Lost connection to server.");
+        poolFree(job_text);
+        killChildren();
+        return-1;
+    }
+    traceRecord(TRACE_FRAME, 1, text_length+6, job_info);
+    int frame_length = text_length+6;
+    if(job_type == FRAME_CONTROL && checksum == CONTROL_REFERENCE){
+        char *cached = resolveReference(&dedup, text, text_length, &job_type, &text_length);
+        poolFree(job_text);
+        if(cached == NULL){
+            shutdownError("Terminating client due to a reference to an unknown job.", 'S');
+            return -1;
+        }
+        job_text = cached;
+        text = job_text+9;
+        checksum = getChecksum(text, text_length);
+    }else if(job_type == FRAME_CONTROL){
+        text[text_length] = '\0';
+        int ret = receiveControl(checksum, text, text_length);
+        poolFree(job_text);
+        return ret;
+    }else if(checksum != getChecksum(text, text_length)){
+        errorPrint("Error! Checksum did not match.");
+        poolFree(job_text);
+        shutdownError("Terminating client due to checksum error.", 'S');
+        return -1;
+    }else if(dedup.capacity > 0 && text_length <= DEDUP_TEXT_MAX &&
+             addDedup(&dedup, hashText(text, text_length), text, text_length) == -1){
+        errorPrint("Out of memory while caching job.");
+        poolFree(job_text);
+        shutdownError("Terminating client.", 'C');
+        return -1;
+    }
+    timing.frame_us = monotonicMicros();
+    timing.type = job_type;
+
+    if(debug == 1){
+        printf(COLOR_CYAN"\n>>%d<< Received job from server:", getpid());
+        printf(COLOR_CYAN"\n>>%d<< jobtype:    %d", getpid(), job_type);
+        printf(COLOR_CYAN"\n>>%d<< textlength: %d", getpid(), text_length);
+        printf(COLOR_CYAN"\n>>%d<< checksum:   %d", getpid(), checksum);
+        printf(COLOR_RESET"\n");
+    }
+    jobs_received++;
+    bytes_received += frame_length;
+    uint32_t job = jobs_received;
+    memcpy(job_text+5, &job, sizeof(job));
+    PROBE4(frame_received, job, job_type, text_length, network_socket);
+    if(transport == TRANSPORT_TCP && jobs_received % 256 == 0){
+        uint64_t now = monotonicMicros();
+        uint64_t rate = (bytes_received - rate_mark_bytes) * 1000000 / (now - rate_mark_us + 1);
+        if(autosizeBuffers(network_socket, rate) > 0){
+            printSockopts();
+        }
+        rate_mark_us = now;
+        rate_mark_bytes = bytes_received;
+    }
+    switch(job_type){
+        case 0:
+            job_text[0] = 'O';
+            write(pipe_child1[1], job_text, text_length+9);
+            break;
+        case 1:
+            job_text[0] = 'E';
+            write(pipe_child2[1], job_text, text_length+9);
+            break;
+    }
+    timing.handoff_us = monotonicMicros();
+    PROBE4(job_dispatched, job, job_type, text_length, network_socket);
+    poolFree(job_text);
+    return 0;
+}
+
+/* Handles a control frame from the
+ * server. See protocol.h.
+ *
+ * Input:
+ *     kind:   kind of control message
+ *     text:   the message
+ *     length: length of the message
+ * Return:
+ *     1 on success
+ *    -1 on error
+ */
+int receiveControl(int kind, char *text, int length){
+    int capacity;
+    switch(kind){
+        case CONTROL_DEDUP:
+            capacity = atoi(text);
+            freeDedup(&dedup);
+            if(capacity < 1 || capacity > DEDUP_MAX || initDedup(&dedup, capacity, 1) == -1){
+                shutdownError("Couldn't set up the job cache for dedup mode.", 'C');
+                return -1;
+            }
+            if(debug == 1){
+                printf(COLOR_CYAN">>%d<< Caching the texts of the last %d job(s).", getpid(), capacity);
+                printf(COLOR_RESET"\n");
+            }
+            break;
+        case CONTROL_COUNT:
+            job_count = atol(text);
+            break;
+        case CONTROL_HEARTBEAT:
+            debugPrint("Answering a heartbeat.", debug);
+            if(sendMessage(REQUEST_HEARTBEAT) == -1){
+                return -1;
+            }
+            break;
+        case CONTROL_STATS:
+            printf(COLOR_CYAN">>%d<< Server stats: %s", getpid(), text);
+            printf(COLOR_RESET"\n");
+            break;
+        case CONTROL_NOTICE:
+            printf(COLOR_CYAN">>%d<< Server: %s", getpid(), text);
+            printf(COLOR_RESET"\n");
+            break;
+        default:
+            if(debug == 1){
+                printf(COLOR_CYAN">>%d<< Unknown control frame %d of %d byte(s).", getpid(), kind, length);
+                printf(COLOR_RESET"\n");
+            }
+            break;
+    }
+    return 1;
+}
+
+/* Looks up the job a reference frame
+ * refers to in a job cache, and lays
+ * it out like a received job.
+ *
+ * Input:
+ *     cache:       the job cache
+ *     ref:         text of the frame, the
+ *                  job type and a dedupref
+ *     length:      length of the text
+ *     job_type:    set to the job type
+ *     text_length: set to the length of
+ *                  the job's text
+ * Return:
+ *     the job, to be given back to the
+ *     pool, or NULL if it isn't cached
+ */
+char *resolveReference(struct dedupcache *cache, char *ref, int length,
+                       unsigned char *job_type, int *text_length){
+    struct dedupref key;
+    if(length != 1+(int)sizeof(key)){
+        errorPrint("Malformed reference from server.");
+        return NULL;
+    }
+    memcpy(&key, ref+1, sizeof(key));
+    struct dedupentry *entry = findDedup(cache, key.hash);
+    if(entry == NULL){
+        errorPrint("Server referred to a job that isn't cached.");
+        return NULL;
+    }
+    char *job_text = poolAlloc(entry->len+10);
+    if(job_text == NULL){
+        errorPrint("Out of memory while receiving job.");
+        return NULL;
+    }
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        job_text[i+1] = (char)((entry->len >> shuffle) & 15);
+    }
+    memcpy(job_text+9, entry->text, entry->len);
+    *job_type = ref[0] & 1;
+    *text_length = entry->len;
+    if(debug == 1){
+        printf(COLOR_CYAN">>%d<< Job of %d byte(s) taken from the cache.", getpid(), entry->len);
+        printf(COLOR_RESET"\n");
+    }
+    return job_text;
+}
+
+/* Streams every job of the selected
+ * queue to stdout, without the menu
+ * and children. Frames are received
+ * into one of two large chunks and
+ * checked in place, and the texts are
+ * handed to the output straight from
+ * there, see streamOut(). A frame cut
+ * off at the end of a chunk is carried
+ * to the start of the other one.
+ *
+ * When stdout is a pipe the texts are
+ * spliced into it with vmsplice(), which
+ * hands the pipe the chunk's pages
+ * instead of copying them. A chunk is
+ * then only received into again once
+ * the reader has taken all of it, see
+ * waitStream(). Anything else is written
+ * with writev().
+ *
+ * stdout is moved to another descriptor
+ * first, and every message goes to
+ * stderr from then on.
+ *
+ * Input:
+ *     address: hostname, or unix:/shm:
+ *     port:    port, NULL if local
+ * Return:
+ *     0 once the server is out of jobs
+ *    -1 on error
+ */
+int streamJobs(char *address, char *port){
+    fflush(stdout);
+    stream_fd = dup(STDOUT_FILENO);
+    if(stream_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1){
+        errorPrint("Couldn't set up the output stream.");
+        return -1;
+    }
+    struct stat st;
+    int queued;
+    stream.pipe = fstat(stream_fd, &st) == 0 && S_ISFIFO(st.st_mode) &&
+                  ioctl(stream_fd, FIONREAD, &queued) == 0;
+    createSocket(address, port);
+    if(network_socket == -1){
+        errorPrint("Couldn't connect to server.");
+        return -1;
+    }
+    session_results.socket = network_socket;
+    results = &session_results;
+    char *chunks[2];
+    chunks[0] = aligned_alloc(4096, STREAM_CHUNK);
+    chunks[1] = aligned_alloc(4096, STREAM_CHUNK);
+    if(chunks[0] == NULL || chunks[1] == NULL){
+        errorPrint("Out of memory for the stream.");
+        free(chunks[0]);
+        free(chunks[1]);
+        close(network_socket);
+        return -1;
+    }
+    chargeBudget(&memory, 2*STREAM_CHUNK);
+    if(record_path != NULL && openTrace(record_path, TRACE_CLIENT) == 0){
+        traceRecord(TRACE_CONNECT, 1, 0, 0);
+    }
+
+    int ret = 0;
+    if(subscribed != 0){
+        ret = sendMessage(REQUEST_FILTER + (subscribed << 8));
+    }
+    if(ret == 0){
+        ret = sendMatch();
+    }
+    if(ret == 0){
+        ret = sendMessage('U');
+    }
+    uint64_t start_us = monotonicMicros();
+    unsigned long long chunk_end[2] = {0, 0};
+    int cur = 0;
+    size_t len = 0;
+    size_t parsed = 0;
+    int done = 0;
+    while(ret == 0 && !done){
+        if(STREAM_CHUNK - len < STREAM_FRAME_MAX){
+            if(flushStream() == -1){
+                ret = -1;
+                break;
+            }
+            chunk_end[cur] = stream.out_bytes;
+            cur = !cur;
+            if(stream.pipe && waitStream(chunk_end[cur]) == -1){
+                ret = -1;
+                break;
+            }
+            memcpy(chunks[cur], chunks[!cur]+parsed, len-parsed);
+            len -= parsed;
+            parsed = 0;
+        }
+        ssize_t got = receiveSome(chunks[cur]+len, STREAM_CHUNK-len);
+        if(got <= 0){
+            errorPrint("Lost connection to server.");
+            ret = -1;
+            break;
+        }
+        len += got;
+        while(ret == 0 && len-parsed >= 5){
+            unsigned char *frame = (unsigned char *)chunks[cur]+parsed;
+            unsigned char job_type = frame[0] >> 5;
+            if(job_type != 0 && job_type != 1 && job_type != FRAME_CONTROL){
+                traceRecord(TRACE_FRAME, 1, 5, frame[0]);
+                if(job_type == 7){
+                    debugPrint("Server out of Jobs.", debug);
+                    ret = sendMessage('T');
+                }else{
+                    checkServerTerm(job_type);
+                    errorPrint("Server ended the stream.");
+                    ret = -1;
+                }
+                done = 1;
+                break;
+            }
+            int text_length = 0;
+            for(int i = 0; i < (int)sizeof(int); i++){
+                text_length += frame[i+1] << (12-(i*4));
+            }
+            if(len-parsed < (size_t)text_length+6){
+                break;
+            }
+            ret = streamFrame(frame, text_length);
+            parsed += text_length+6;
+        }
+        if(ret == 0 && flushStream() == -1){
+            ret = -1;
+        }
+    }
+
+    if(ret == 0){
+        double secs = (monotonicMicros() - start_us) / 1000000.0;
+        printf(COLOR_CYAN ">>%d<< Streamed %lu job(s), %llu byte(s) of text in %.3f s "
+               "(%.1f MB/s), %lu vmsplice(s), %lu write(s), waited %lu time(s) for the reader.",
+               getpid(), jobs_received, stream.out_bytes, secs,
+               secs > 0 ? stream.out_bytes / secs / 1000000.0 : 0.0,
+               stream.splices, stream.writes, stream.waits);
+        printf(COLOR_RESET "\n");
+    }
+    traceRecord(TRACE_CLOSE, 1, 0, 0);
+    closeTrace();
+    close(network_socket);
+    close(stream_fd);
+    refundBudget(&memory, 2*STREAM_CHUNK);
+    free(chunks[0]);
+    free(chunks[1]);
+    return ret;
+}
+
+/* Checks one frame of the stream and
+ * hands its text to the output, or
+ * handles it like receiveJob() if it
+ * is a control frame.
+ *
+ * Input:
+ *     frame:       the frame, in place
+ *     text_length: length of its text
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int streamFrame(unsigned char *frame, int text_length){
+    unsigned char job_type = frame[0] >> 5;
+    char checksum = frame[0] & 31;
+    char *text = (char *)frame+5;
+    traceRecord(TRACE_FRAME, 1, text_length+6, frame[0]);
+    if(job_type == FRAME_CONTROL && checksum == CONTROL_REFERENCE){
+        struct dedupref key;
+        struct dedupentry *entry = NULL;
+        if(text_length == 1+(int)sizeof(key)){
+            memcpy(&key, text+1, sizeof(key));
+            entry = findDedup(&dedup, key.hash);
+        }
+        if(entry == NULL){
+            shutdownError("Terminating client due to a reference to an unknown job.", 'S');
+            return -1;
+        }
+        jobs_received++;
+        bytes_received += text_length+6;
+        return streamText(entry->text, entry->len, NULL, 1);
+    }
+    if(job_type == FRAME_CONTROL){
+        return receiveControl(checksum, text, text_length) == -1 ? -1 : 0;
+    }
+    if(checksum != getChecksum(text, text_length)){
+        errorPrint("Error! Checksum did not match.");
+        shutdownError("Terminating client due to checksum error.", 'S');
+        return -1;
+    }
+    if(dedup.capacity > 0 && text_length <= DEDUP_TEXT_MAX &&
+       addDedup(&dedup, hashText(text, text_length), text, text_length) == -1){
+        shutdownError("Out of memory while caching job.", 'C');
+        return -1;
+    }
+    jobs_received++;
+    bytes_received += text_length+6;
+    PROBE4(frame_received, jobs_received, job_type, text_length, network_socket);
+    return streamText(text, text_length, frame, 0);
+}
+
+/* Hands a job's text to the output in
+ * the framing asked for. A text still
+ * in its frame is framed in place: the
+ * NUL the server ends it with is sent
+ * along, and the length is written
+ * over the frame's header.
+ *
+ * Input:
+ *     text:        the text
+ *     text_length: its length
+ *     frame:       the frame it is in,
+ *                  NULL if it is cached
+ *     copy:        1 if the text has to
+ *                  be copied right away
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int streamText(char *text, int text_length, unsigned char *frame, int copy){
+    uint32_t length = text_length;
+    switch(streaming){
+        case STREAM_NUL:
+            if(frame != NULL){
+                return streamOut(text, text_length+1, copy);
+            }
+            if(streamOut(text, text_length, copy) == -1){
+                return -1;
+            }
+            return streamOut("", 1, 1);
+        case STREAM_LENGTH:
+            if(frame != NULL){
+                memcpy(frame+1, &length, sizeof(length));
+                return streamOut((char *)frame+1, text_length+sizeof(length), copy);
+            }
+            if(streamOut((char *)&length, sizeof(length), 1) == -1){
+                return -1;
+            }
+            return streamOut(text, text_length, copy);
+        default:
+            return streamOut(text, text_length, copy);
+    }
+}
+
+/* Adds bytes to the output. Bytes in a
+ * chunk are queued as they are, and
+ * spliced or written with the rest by
+ * flushStream(). Bytes that may change
+ * before then are written right away,
+ * after what was queued before them.
+ *
+ * Input:
+ *     data: the bytes
+ *     len:  amount of bytes
+ *     copy: 1 to write them right away
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int streamOut(char *data, size_t len, int copy){
+    if(copy){
+        if(flushStream() == -1){
+            return -1;
+        }
+        while(len > 0){
+            ssize_t done = write(stream_fd, data, len);
+            if(done == -1){
+                if(errno == EINTR){
+                    checkInterrupt();
+                    continue;
+                }
+                errorPrint("Couldn't write to the output.");
+                return -1;
+            }
+            stream.writes++;
+            stream.out_bytes += done;
+            data += done;
+            len -= done;
+        }
+        return 0;
+    }
+    if(stream.count == STREAM_IOV && flushStream() == -1){
+        return -1;
+    }
+    stream.iov[stream.count].iov_base = data;
+    stream.iov[stream.count].iov_len = len;
+    stream.count++;
+    return 0;
+}
+
+/* Splices or writes the queued bytes
+ * to the output. If the output turns
+ * out not to take vmsplice(), it is
+ * written to from then on.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int flushStream(){
+    struct iovec *iov = stream.iov;
+    int count = stream.count;
+    while(count > 0){
+        ssize_t done;
+        if(stream.pipe){
+            done = vmsplice(stream_fd, iov, count, 0);
+        }else{
+            done = writev(stream_fd, iov, count);
+        }
+        if(done == -1){
+            if(errno == EINTR){
+                checkInterrupt();
+                continue;
+            }
+            if(stream.pipe && (errno == EINVAL || errno == ENOSYS)){
+                stream.pipe = 0;
+                continue;
+            }
+            errorPrint("Couldn't write to the output.");
+            return -1;
+        }
+        if(stream.pipe){
+            stream.splices++;
+        }else{
+            stream.writes++;
+        }
+        stream.out_bytes += done;
+        while(count > 0 && (size_t)done >= iov->iov_len){
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    stream.count = 0;
+    return 0;
+}
+
+/* Waits until the reader of the output
+ * pipe has taken every byte spliced
+ * into it up to end, so the pages they
+ * are in can be received into again.
+ * The pipe is read in order, so that is
+ * when no more bytes are left in it
+ * than were spliced after end.
+ *
+ * Input:
+ *     end: amount of bytes spliced
+ *          when the chunk was left
+ * Return:
+ *     0 once they are taken
+ *    -1 if the reader is gone
+ */
+int waitStream(unsigned long long end){
+    while(1){
+        int queued;
+        if(ioctl(stream_fd, FIONREAD, &queued) == -1){
+            return -1;
+        }
+        if((unsigned long long)queued <= stream.out_bytes - end){
+            return 0;
+        }
+        struct pollfd fd;
+        fd.fd = stream_fd;
+        fd.events = 0;
+        if(poll(&fd, 1, 0) == 1 && (fd.revents & POLLERR)){
+            errorPrint("The reader of the output went away.");
+            return -1;
+        }
+        stream.waits++;
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/* Receives exactly len bytes from the
+ * server, from the socket or from the
+ * shared-memory ring.
+ *
+ * Input:
+ *     buf: where to put the bytes
+ *     len: amount of bytes
+ * Return:
+ *     len on success
+ *     0 or -1 if the connection
+ *     was lost
+ */
+ssize_t receiveBytes(void *buf, size_t len){
+    size_t done = 0;
+    if(ring == NULL){
+        while(done < len){
+            checkInterrupt();
+            ssize_t got = recv(network_socket, (char*)buf+done, len-done, MSG_WAITALL);
+            if(got == -1 && errno == EINTR){
+                continue;
+            }
+            if(got <= 0){
+                return got;
+            }
+            done += got;
+        }
+        return len;
+    }
+    while(done < len){
+        checkInterrupt();
+        size_t got = ringRead(ring, (char*)buf+done, len-done);
+        if(got > 0){
+            ringNotifyWriter(ring, network_socket);
+            done += got;
+        }else if(ringWaitReader(ring, network_socket) == -1){
+            return 0;
+        }
+    }
+    return len;
+}
+
+/* Receives what the server has sent,
+ * up to len bytes, waiting for at
+ * least one.
+ *
+ * Input:
+ *     buf: where to put the bytes
+ *     len: room in buf
+ * Return:
+ *     amount of bytes received
+ *     0 or -1 if the connection
+ *     was lost
+ */
+ssize_t receiveSome(void *buf, size_t len){
+    if(ring == NULL){
+        ssize_t got;
+        do{
+            checkInterrupt();
+            got = recv(network_socket, buf, len, 0);
+        }while(got == -1 && errno == EINTR);
+        return got;
+    }
+    while(1){
+        checkInterrupt();
+        size_t got = ringRead(ring, buf, len);
+        if(got > 0){
+            ringNotifyWriter(ring, network_socket);
+            return got;
+        }
+        if(ringWaitReader(ring, network_socket) == -1){
+            return 0;
+        }
+    }
+}
+
+/* Reads exactly len bytes from a
+ * pipe, as a job larger than the pipe
+ * arrives in several pieces.
+ *
+ * Input:
+ *     fd:  read end of the pipe
+ *     buf: where to put the bytes
+ *     len: amount of bytes
+ * Return:
+ *     len on success
+ *     less if the pipe was closed
+ *    -1 on error
+ */
+ssize_t readPipe(int fd, void *buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t got = read(fd, (char*)buf+done, len-done);
+        if(got == -1){
+            if(errno == EINTR){
+                checkInterrupt();
+                continue;
+            }
+            return -1;
+        }
+        if(got == 0){
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+/* Waits for the child that was just
+ * handed a job to be done with it.
+ * The child writes 'C', a resultheader
+ * and the result if it was succesful,
+ * and 'E' if it experienced an error.
+ * Any other message is also
+ * considered an error.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int awaitChild(){
+    char ret = 'E';
+    readPipe(pipe_parent[0], &ret, sizeof(char));
+    uint64_t ack_us = monotonicMicros();
+    struct resultheader header;
+    char text[RESULT_TEXT_MAX];
+    if(ret != 'C' ||
+       readPipe(pipe_parent[0], &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+       readPipe(pipe_parent[0], text, header.len) != (ssize_t)header.len){
+        shutdownError("Error ocurred in child.", 'C');
+        return -1;
+    }
+    recordLatency(ack_us);
+    PROBE4(job_acked, header.job, timing.type, header.len, results->socket);
+    debugPrint("Child done working. Resuming parent.", debug);
+    return addResult(&header, text);
+}
+
+/* Adds the result of a job to the
+ * batch of results for the server,
+ * and sends the batch when it is full.
+ * Batches are sent as REQUEST_RESULTS,
+ * see protocol.h, which saves the
+ * server a request per job.
+ * Results are added to the batch of
+ * the connection the job came on, see
+ * fetchParallel().
+ *
+ * Input:
+ *     header: job number, status and
+ *             length of the result
+ *     text:   the result
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int addResult(struct resultheader *header, char *text){
+    if(results->len + sizeof(*header) + header->len > RESULT_BATCH_BYTES &&
+       flushResults() == -1){
+        return -1;
+    }
+    char *end = results->batch + sizeof(int) + results->len;
+    memcpy(end, header, sizeof(*header));
+    memcpy(end+sizeof(*header), text, header->len);
+    results->len += sizeof(*header) + header->len;
+    results->count++;
+    if(results->count == RESULT_BATCH_JOBS){
+        return flushResults();
+    }
+    return 0;
+}
+
+/* Sends the results batched so far as
+ * one request, with room for the
+ * request left in front of the batch.
+ * The results of the session, unlike
+ * those of its ranges, are traced like
+ * any other request.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 on success, or if there
+ *       was nothing to send
+ *    -1 on error
+ */
+int flushResults(){
+    if(results->count == 0){
+        return 0;
+    }
+    int request = REQUEST_RESULTS + (results->count << 8);
+    memcpy(results->batch, &request, sizeof(request));
+    if(debug == 1){
+        printf(COLOR_CYAN ">>%d<< Sending %u result(s) to server.", getpid(), results->count);
+        printf(COLOR_RESET "\n");
+    }
+    size_t len = sizeof(request) + results->len;
+    if(results == &session_results){
+        traceRecord(TRACE_REQUEST, 1, request, 0);
+        tracePayload(1, results->batch+sizeof(request), results->len);
+    }
+    results_sent += results->count;
+    results->count = 0;
+    results->len = 0;
+    int ret = send(results->socket, results->batch, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+    if(ret == -1){
+        errorPrint("Error while attempting to send results to server!");
+    }
+    return ret;
+}
+
+/* Sends the parent the result of the
+ * job a child is done with: 'C', then
+ * a resultheader and a line on what
+ * was printed, in one write so it
+ * can't be mixed up with the other
+ * child's.
+ *
+ * Input:
+ *     job:    number of the job
+ *     text:   the job's text
+ *     length: length of the text
+ * Return:
+ *     void
+ */
+void sendResult(uint32_t job, char *text, int length){
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++){
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    char message[1+sizeof(struct resultheader)+RESULT_TEXT_MAX+1];
+    struct resultheader header;
+    memset(&header, 0, sizeof(header));
+    header.job = job;
+    header.status = RESULT_DONE;
+    int len = snprintf(message+1+sizeof(header), RESULT_TEXT_MAX+1,
+                       "printed %d byte(s), fnv1a %08x", length, hash);
+    header.len = len > RESULT_TEXT_MAX ? RESULT_TEXT_MAX : len;
+    message[0] = 'C';
+    memcpy(message+1, &header, sizeof(header));
+    write(pipe_parent[1], message, 1+sizeof(header)+header.len);
+}
+
+/* Function that checks for
+ * termination messages from
+ * the server in the job_type
+ * part of the job message.
+ * protocol described in protokoll.txt
+ *
+ * Input:
+ *     type: char message
+ * Return:
+ *     0 if server still alive
+ *    -1 if termination message
+ *     received
+ */
+int checkServerTerm(char type){
+    switch (type){
+        case 7:
+            debugPrint("Server out of Jobs.", debug);
+            int terrMsg = 'T';
+            sendMessage(terrMsg);
+            usleep(250000);
+            killChildren();
+            return -1;
+        case 2:
+            debugPrint("Server terminated due to filereading error.", debug);
+            killChildren();
+            return -1;
+        case 3:
+            debugPrint("Server terminated due to receiving unkown request.", debug);
+            killChildren();
+            return -1;
+        case 5:
+            errorPrint("Server is full. Try again later.");
+            killChildren();
+            return -1;
+        case 6:
+            debugPrint("Server terminated due to CTRL+C (sigint).", debug);
+            killChildren();
+            return -1;
+    }
+    return 0;
+}
+
+/* Waits for the user to type a menu
+ * choice. Frames the server sends in
+ * the meantime, like heartbeats, are
+ * taken as they come, so the session
+ * stays alive while the user thinks.
+ * Over shm only the input is waited for.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 once there is input
+ *    -1 if the session ended
+ */
+int awaitInput(){
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = network_socket;
+    fds[1].events = POLLIN;
+    while(1){
+        if(latencies_requested){
+            latencies_requested = 0;
+            dumpLatencies();
+        }
+        if(poll(fds, ring == NULL ? 2 : 1, -1) == -1){
+            if(errno == EINTR){
+                checkInterrupt();
+                continue;
+            }
+            return 0;
+        }
+        if(fds[0].revents != 0){
+            return 0;
+        }
+        if(fds[1].revents != 0){
+            int received = receiveJob();
+            if(received == -1){
+                return -1;
+            }
+            if(received == 0 && awaitChild() == -1){
+                return -1;
+            }
+        }
+    }
+}
+
 /* Prompts user for an integer
  * and saves the integer in the
- * pointer.
+ * pointer. Every line is waited
+ * for with awaitInput(), so the
+ * server's heartbeats are answered
+ * at any prompt.
  *
  * Input:
  *     input: integer pointer
  * Return:
- *     void
+ *     0 on success or end of input
+ *    -1 if the session ended
  *
  */
-void getIntput(int* input){
+int getIntput(int* input){
     char *p, s[100];
-    while (fgets(s, sizeof(s), stdin)) {
+    while (1) {
+        if (awaitInput() == -1) {
+            return -1;
+        }
+        if (fgets(s, sizeof(s), stdin) == NULL) {
+            return 0;
+        }
         *input = strtol(s, &p, 10);
         if (p == s || *p != '\n') {
             printf("Not an integer. Try Again\n");
         }else break;
     }
+    return 0;
 }
 
 /* Kills the children by sending both
@@ -672,6 +2442,9 @@ void getIntput(int* input){
  *     void
  */
 void killChildren(){
+    if(streaming != STREAM_OFF){
+        return;
+    }
     debugPrint("Terminating children...", debug);
     char jobempty[2] = {0};
     jobempty[0] = 'Q';
@@ -724,10 +2497,11 @@ void childSignalHandler(int sig){
     }
 }
 
-/* Signal handler that makes sure
- * the parent shuts down in a good
- * way when the user interrupts with
- * CTRL+C.
+/* Signal handler for SIGINT that asks
+ * the parent to shut down, which
+ * checkInterrupt() does outside the
+ * handler. The children ignore it and
+ * end once their pipes are closed.
  *
  * Input:
  *     sig: integer signal
@@ -736,9 +2510,36 @@ void childSignalHandler(int sig){
  */
 void parentSignalHandler(int sig) {
     assert(sig == SIGINT);
+    interrupted = 1;
+}
+
+/* Makes sure the parent shuts down in
+ * a good way once the user interrupted
+ * with CTRL+C. Called wherever the
+ * client waits, as the interrupt wakes
+ * it up there.
+ *
+ * Input:
+ *     none
+ * Return:
+ *    void
+ */
+void checkInterrupt(){
+    if(!interrupted){
+        return;
+    }
+    if(latency_path != NULL){
+        dumpLatencies();
+    }
 
+    if(results != NULL){
+        flushResults();
+    }
     int request = 'Q';
+    traceRecord(TRACE_REQUEST, 1, request, 0);
     send(network_socket, &request, sizeof(int), 0);
+    traceRecord(TRACE_CLOSE, 1, 0, 0);
+    closeTrace();
 
     close(pipe_child1[1]);
     close(pipe_child2[1]);
@@ -748,3 +2549,98 @@ void parentSignalHandler(int sig) {
     close(network_socket);
     exit(EXIT_FAILURE);
 }
+
+/* Records how long each stage of the
+ * job that was just acked by a child
+ * took, in the histograms of its type.
+ *
+ *     wait:    from the request, or from
+ *              the ack of the job before
+ *              it in the same request, to
+ *              its first byte
+ *     receive: first byte to the whole
+ *              frame being received
+ *     handoff: frame to written to the
+ *              child's pipe
+ *     work:    handed to the child to
+ *              the child's ack
+ *     total:   from the request that
+ *              asked for the job to the ack
+ *
+ * Input:
+ *     ack_us: when the child acked
+ * Return:
+ *     void
+ */
+void recordLatency(uint64_t ack_us){
+    struct histogram *hist = latencies[timing.type & 1];
+    recordValue(&hist[STAGE_WAIT], timing.first_us - ready_us);
+    recordValue(&hist[STAGE_RECEIVE], timing.frame_us - timing.first_us);
+    recordValue(&hist[STAGE_HANDOFF], timing.handoff_us - timing.frame_us);
+    recordValue(&hist[STAGE_WORK], ack_us - timing.handoff_us);
+    recordValue(&hist[STAGE_TOTAL], ack_us - request_us);
+    ready_us = ack_us;
+}
+
+/* Writes the latency histograms of
+ * both job types as one JSON object.
+ * All values are in microseconds.
+ *
+ * Input:
+ *     out: where to write
+ * Return:
+ *     void
+ */
+void writeLatencies(FILE *out){
+    static char *types[2] = {"O", "E"};
+    static char *stages[5] = {"wait", "receive", "handoff", "work", "total"};
+    fprintf(out, "{\"unit\": \"us\", \"jobs\": %lu", jobs_received);
+    for(int t = 0; t < 2; t++){
+        fprintf(out, ",\n \"%s\": {", types[t]);
+        for(int s = 0; s < 5; s++){
+            fprintf(out, "%s\n  \"%s\": ", s == 0 ? "" : ",", stages[s]);
+            writeHistogram(out, &latencies[t][s]);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}\n");
+}
+
+/* Writes the latency histograms to the
+ * file given with -LATENCY, or prints
+ * them if there is none.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void dumpLatencies(){
+    if(latency_path == NULL){
+        writeLatencies(stdout);
+        fflush(stdout);
+        return;
+    }
+    FILE *out = fopen(latency_path, "w");
+    if(out == NULL){
+        errorPrint("Couldn't write the latency histograms.");
+        return;
+    }
+    writeLatencies(out);
+    fclose(out);
+}
+
+/* Signal handler for SIGUSR1 that asks
+ * for the latency histograms to be
+ * dumped, which receiveJob() and
+ * awaitInput() do outside the handler.
+ *
+ * Input:
+ *     sig: integer signal
+ * Return:
+ *    void
+ */
+void latencySignalHandler(int sig){
+    assert(sig == SIGUSR1);
+    latencies_requested = 1;
+}
@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "colors.h"
 
@@ -82,3 +84,16 @@ int portCheck(char* port){
 		return -1;
 	}
 }
+/* Returns the monotonic clock
+ * in microseconds.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     microseconds as uint64_t
+ */
+uint64_t monotonicMicros(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+}
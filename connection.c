@@ -0,0 +1,552 @@
+/* connection.c
+ *******************************************
+ * Send queues of the connections the
+ * server keeps with its clients.
+ * Every message to a client is put in
+ * a frame and queued on its connection.
+ * The server's scheduler decides when
+ * each queue may send, see serveClients()
+ * in server.c.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "colors.h"
+#include "connection.h"
+#include "scheduler.h"
+#include "sockopts.h"
+#include "pool.h"
+#include "trace.h"
+#include "probes.h"
+
+uint64_t monotonicMicros();
+
+/* Gets a frame that can hold len
+ * bytes from the buffer pool.
+ *
+ * Input:
+ *     len: size of the message
+ * Return:
+ *     the frame, or NULL if
+ *     out of memory
+ */
+struct frame *newFrame(size_t len){
+    struct frame *frame = poolAlloc(sizeof(struct frame)+len);
+    if(frame == NULL){
+        return NULL;
+    }
+    frame->next = NULL;
+    frame->shared = NULL;
+    frame->refs = 1;
+    frame->len = len;
+    frame->sent = 0;
+    return frame;
+}
+
+/* Gets a frame that sends the message
+ * of another frame without copying it,
+ * so one message can be queued on many
+ * connections. The message is freed
+ * when the last frame sending it is.
+ *
+ * Input:
+ *     frame: the frame with the message
+ * Return:
+ *     the new frame, or NULL if
+ *     out of memory
+ */
+struct frame *shareFrame(struct frame *frame){
+    if(frame->shared != NULL){
+        frame = frame->shared;
+    }
+    struct frame *share = poolAlloc(sizeof(struct frame));
+    if(share == NULL){
+        return NULL;
+    }
+    share->next = NULL;
+    share->shared = frame;
+    share->refs = 1;
+    share->len = frame->len;
+    share->sent = 0;
+    frame->refs++;
+    return share;
+}
+
+/* Finds the message a frame sends.
+ *
+ * Input:
+ *     frame: the frame
+ * Return:
+ *     the message
+ */
+char *frameData(struct frame *frame){
+    return frame->shared != NULL ? frame->shared->data : frame->data;
+}
+
+/* Gives a frame back to the buffer
+ * pool, and the message it shares once
+ * no other frame sends it.
+ *
+ * Input:
+ *     frame: the frame, or NULL
+ * Return:
+ *     void
+ */
+void freeFrame(struct frame *frame){
+    if(frame == NULL){
+        return;
+    }
+    struct frame *shared = frame->shared;
+    if(--frame->refs == 0){
+        poolFree(frame);
+    }
+    if(shared != NULL && --shared->refs == 0){
+        poolFree(shared);
+    }
+}
+
+/* Appends a frame to the send
+ * queue of a connection, charging it
+ * to the connection's memory budget
+ * until it is sent, and keeps
+ * track of how fast frames come in,
+ * for tuneBatch().
+ *
+ * Input:
+ *     conn:  the connection
+ *     frame: the frame to queue
+ * Return:
+ *     void
+ */
+void queueFrame(struct connection *conn, struct frame *frame){
+    uint64_t now = monotonicMicros();
+    frame->queued_us = now;
+    if(conn->last_queued_us != 0){
+        uint64_t gap = now - conn->last_queued_us;
+        if(gap > BATCH_GAP_CAP){
+            gap = BATCH_GAP_CAP;
+        }
+        conn->arrival_gap_us += (gap - conn->arrival_gap_us) / 8;
+    }
+    conn->arrival_len += (frame->len - conn->arrival_len) / 8;
+    conn->last_queued_us = now;
+    if(conn->send_tail == NULL){
+        conn->send_head = frame;
+    }else{
+        conn->send_tail->next = frame;
+    }
+    conn->send_tail = frame;
+    conn->queued_bytes += frame->len;
+    chargeBudget(&conn->memory, frame->len);
+}
+
+/* Counts the fully sent frame at the
+ * head of the send queue in the
+ * connection's stats, and frees it.
+ *
+ * Input:
+ *     conn: the connection
+ *     now:  current time
+ * Return:
+ *     void
+ */
+static void frameSent(struct connection *conn, uint64_t now){
+    struct frame *frame = conn->send_head;
+    uint64_t latency = now - frame->queued_us;
+    traceRecord(TRACE_FRAME, conn->id, frame->len, frameData(frame)[0]);
+    conn->frames_sent++;
+    PROBE5(frame_sent, conn->frames_sent, (unsigned char)frameData(frame)[0] >> 5,
+           frame->len, conn->id, latency);
+    conn->total_latency_us += latency;
+    if(latency > conn->max_latency_us){
+        conn->max_latency_us = latency;
+    }
+    conn->send_head = frame->next;
+    if(conn->send_head == NULL){
+        conn->send_tail = NULL;
+    }
+    refundBudget(&conn->memory, frame->len);
+    freeFrame(frame);
+}
+
+/* Sends as much of the frame at the
+ * head of the send queue as the socket
+ * takes without blocking. A fully sent
+ * frame is removed from the queue and
+ * counted in the connection's stats.
+ * If the socket or shm ring is full the
+ * connection is marked as blocked.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     amount of bytes sent
+ *    -1 if the connection is lost, or
+ *       the client broke its ring
+ */
+long flushFrame(struct connection *conn){
+    struct frame *frame = conn->send_head;
+    if(frame == NULL){
+        return 0;
+    }
+    char *data = frameData(frame);
+    ssize_t sent;
+    if(conn->ring != NULL){
+        sent = 0;
+        while(1){
+            long wrote = ringWrite(conn->ring, conn->ring_size, data+frame->sent+sent,
+                                   frame->len-frame->sent-sent);
+            if(wrote == -1){
+                return -1;
+            }
+            sent += wrote;
+            ringNotifyReader(conn->ring, conn->socket);
+            if((size_t)sent == frame->len-frame->sent ||
+               ringParkWriter(conn->ring, conn->ring_size) == 1){
+                break;
+            }
+        }
+    }else{
+        sent = send(conn->socket, data+frame->sent,
+                    frame->len-frame->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    if(sent == -1){
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            conn->blocked = 1;
+            return 0;
+        }
+        if(errno == EINTR){
+            return 0;
+        }
+        return -1;
+    }
+    frame->sent += sent;
+    conn->queued_bytes -= sent;
+    conn->bytes_sent += sent;
+    if(frame->sent == frame->len){
+        frameSent(conn, monotonicMicros());
+    }else{
+        conn->blocked = 1;
+    }
+    return sent;
+}
+
+/* Sends the frames at the head of the
+ * send queue with a single sendmsg(),
+ * as many as fit in limit bytes and
+ * at least the first one. Fully sent
+ * frames are removed and counted like
+ * in flushFrame(), and the write is
+ * counted as one batch. Through shared
+ * memory, where writes aren't system
+ * calls, frames are sent one by one.
+ *
+ * Input:
+ *     conn:  the connection
+ *     limit: most bytes to send
+ * Return:
+ *     amount of bytes sent
+ *    -1 if the connection is lost
+ */
+long flushBatch(struct connection *conn, size_t limit){
+    if(conn->ring != NULL){
+        return flushFrame(conn);
+    }
+    struct iovec iov[BATCH_FRAMES];
+    int count = 0;
+    size_t len = 0;
+    for(struct frame *frame = conn->send_head; frame != NULL && count < BATCH_FRAMES;
+        frame = frame->next){
+        size_t left = frame->len - frame->sent;
+        if(count > 0 && len + left > limit){
+            break;
+        }
+        iov[count].iov_base = frameData(frame) + frame->sent;
+        iov[count].iov_len = left;
+        len += left;
+        count++;
+    }
+    if(count == 0){
+        return 0;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t sent = sendmsg(conn->socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(sent == -1){
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            conn->blocked = 1;
+            conn->drain_limited = 1;
+            return 0;
+        }
+        if(errno == EINTR){
+            return 0;
+        }
+        return -1;
+    }
+    conn->queued_bytes -= sent;
+    conn->bytes_sent += sent;
+    conn->batches++;
+    conn->batched_bytes += sent;
+    if((size_t)sent > conn->max_batch){
+        conn->max_batch = sent;
+    }
+    uint64_t now = monotonicMicros();
+    size_t left = sent;
+    while(left > 0){
+        struct frame *frame = conn->send_head;
+        size_t take = frame->len - frame->sent;
+        if(take > left){
+            take = left;
+        }
+        frame->sent += take;
+        left -= take;
+        if(frame->sent == frame->len){
+            conn->batched_frames++;
+            frameSent(conn, now);
+        }
+    }
+    if((size_t)sent < len){
+        conn->blocked = 1;
+    }
+    conn->drain_limited = conn->blocked;
+    return sent;
+}
+
+/* Tunes the byte budget and deadline
+ * of a connection's batches from how
+ * fast frames come in and how fast its
+ * socket drains.
+ * The budget is what is expected to
+ * come in within max_deadline_us, and
+ * the deadline how long that takes. If
+ * not even two frames are expected in
+ * that time waiting would only add
+ * latency, so frames are sent as they
+ * come. While the socket can't keep up,
+ * the budget is held to what it drains
+ * within max_deadline_us, so batches
+ * don't outgrow the socket.
+ *
+ * Input:
+ *     conn:            the connection
+ *     max_deadline_us: longest a frame
+ *                      may be held back
+ * Return:
+ *     void
+ */
+void tuneBatch(struct connection *conn, uint64_t max_deadline_us){
+    double rate = conn->arrival_len / (conn->arrival_gap_us + 1);
+    double expected = rate * max_deadline_us;
+    size_t budget = BATCH_MIN;
+    uint64_t deadline = 0;
+    if(conn->arrival_len > 0 && expected >= 2 * conn->arrival_len){
+        budget = expected > BATCH_MAX ? BATCH_MAX : expected;
+        if(budget < BATCH_MIN){
+            budget = BATCH_MIN;
+        }
+        deadline = budget / rate;
+        if(deadline > max_deadline_us){
+            deadline = max_deadline_us;
+        }
+    }
+    if(conn->drain_limited && conn->drain_rate > 0){
+        size_t drained = conn->drain_rate * max_deadline_us / 1000000;
+        if(drained < budget){
+            budget = drained > BATCH_MIN ? drained : BATCH_MIN;
+        }
+    }
+    conn->batch_budget = budget;
+    conn->batch_deadline_us = deadline;
+}
+
+/* Frees every frame still queued
+ * on a connection.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void freeFrames(struct connection *conn){
+    while(conn->send_head != NULL){
+        struct frame *next = conn->send_head->next;
+        refundBudget(&conn->memory, conn->send_head->len);
+        freeFrame(conn->send_head);
+        conn->send_head = next;
+    }
+    conn->send_tail = NULL;
+    conn->queued_bytes = 0;
+}
+
+/* Remembers which job was just sent
+ * on a connection, so the result the
+ * client sends back for it can be
+ * matched to it. Jobs are numbered
+ * from 1 by conn->jobs_sent, and kept
+ * until their result arrives, in a ring
+ * that grows up to SENT_MAX jobs. Past
+ * that the oldest job is forgotten.
+ *
+ * Input:
+ *     conn:  the connection
+ *     queue: the queue the job is from
+ *     seq:   its number in the queue
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+int rememberJob(struct connection *conn, struct jobqueue *queue, uint64_t seq){
+    unsigned long id = conn->jobs_sent;
+    if(conn->sent_first == 0){
+        conn->sent_first = id;
+    }
+    if(id - conn->sent_first >= conn->sent_size){
+        if(conn->sent_size >= SENT_MAX){
+            conn->sent_first++;
+        }else{
+            size_t size = conn->sent_size == 0 ? SENT_MIN : conn->sent_size*2;
+            struct sentjob *grown = malloc(size*sizeof(struct sentjob));
+            if(grown == NULL){
+                return -1;
+            }
+            for(unsigned long old = conn->sent_first; old < id; old++){
+                grown[old & (size-1)] = conn->sent[old & (conn->sent_size-1)];
+            }
+            free(conn->sent);
+            conn->sent = grown;
+            conn->sent_size = size;
+        }
+    }
+    conn->sent[id & (conn->sent_size-1)].queue = queue;
+    conn->sent[id & (conn->sent_size-1)].seq = seq;
+    return 0;
+}
+
+/* Finds a job sent on a connection by
+ * its number. Results mostly come back
+ * in the order jobs were sent, so the
+ * oldest job is forgotten once its
+ * result is in. A relay passes on the
+ * results of many clients out of order,
+ * and those are found as long as the
+ * job is one of the last SENT_MAX sent.
+ *
+ * Input:
+ *     conn: the connection
+ *     id:   number of the job
+ * Return:
+ *     the job, valid until the next
+ *     job is remembered, or NULL if
+ *     it isn't known
+ */
+struct sentjob *findJob(struct connection *conn, unsigned long id){
+    if(conn->sent_size == 0 || id < conn->sent_first || id > conn->jobs_sent){
+        return NULL;
+    }
+    if(id == conn->sent_first){
+        conn->sent_first = id+1;
+    }
+    return &conn->sent[id & (conn->sent_size-1)];
+}
+
+/* Prints what has been sent on a
+ * connection, how long frames waited
+ * in its send queue, and the socket
+ * settings that were in effect.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void printConnectionStats(struct connection *conn){
+    double avg_ms = 0;
+    if(conn->frames_sent > 0){
+        avg_ms = conn->total_latency_us / 1000.0 / conn->frames_sent;
+    }
+    double seconds = (monotonicMicros() - conn->connected_us) / 1000000.0;
+    printf(COLOR_CYAN ">>%d<< Client %lu (%s): %lu job(s), %llu byte(s) "
+           "(%.1f KB/s) in %lu round(s), send latency avg %.3f ms, max %.3f ms, "
+           "%lu request(s) in %lu read(s).",
+           getpid(), conn->id, conn->ip, conn->jobs_sent, conn->bytes_sent,
+           seconds > 0 ? conn->bytes_sent / 1024.0 / seconds : 0,
+           conn->rounds, avg_ms, conn->max_latency_us / 1000.0,
+           conn->requests, conn->recv_calls);
+    printf(COLOR_RESET "\n");
+    char settings[128];
+    describeSockopts(conn->socket, conn->tcp, settings, sizeof(settings));
+    printf(COLOR_CYAN ">>%d<< Client %lu socket: %s", getpid(), conn->id, settings);
+    printf(COLOR_RESET "\n");
+    if(conn->jobs_dropped > 0){
+        printf(COLOR_CYAN ">>%d<< Client %lu missed %lu broadcast job(s) by falling behind.",
+               getpid(), conn->id, conn->jobs_dropped);
+        printf(COLOR_RESET "\n");
+    }
+    if(conn->batches > 0){
+        printf(COLOR_CYAN ">>%d<< Client %lu batches: %lu write(s) of %.1f frame(s), "
+               "%.0f byte(s) on average, max %zu, %lu sent at the deadline, "
+               "budget now %zu byte(s), deadline %.3f ms.", getpid(), conn->id,
+               conn->batches, (double)conn->batched_frames / conn->batches,
+               (double)conn->batched_bytes / conn->batches, conn->max_batch,
+               conn->deadline_flushes, conn->batch_budget, conn->batch_deadline_us / 1000.0);
+        printf(COLOR_RESET "\n");
+    }
+    if(conn->memory.limit > 0){
+        char memory[128];
+        describeBudget(&conn->memory, memory, sizeof(memory));
+        printf(COLOR_CYAN ">>%d<< Client %lu memory: %s, throttled %lu time(s).",
+               getpid(), conn->id, memory, conn->throttles);
+        printf(COLOR_RESET "\n");
+    }
+    if(conn->match != NULL){
+        printf(COLOR_CYAN ">>%d<< Client %lu filter: %lu of %lu job(s) passed, %lu job(s) "
+               "and %llu byte(s) not sent, %llu byte(s) searched with %s.", getpid(), conn->id,
+               conn->match->matched, conn->match->tested, conn->jobs_filtered,
+               conn->bytes_filtered, conn->match->bytes, matchKernelName(conn->match->kernel));
+        printf(COLOR_RESET "\n");
+    }
+    if(conn->dedup.capacity > 0){
+        printf(COLOR_CYAN ">>%d<< Client %lu dedup: %lu reference(s), %llu byte(s) saved, "
+               "%lu eviction(s).", getpid(), conn->id, conn->refs_sent, conn->bytes_saved,
+               conn->dedup.evictions);
+        printf(COLOR_RESET "\n");
+    }
+}
+
+/* Calculates Jain's fairness index over
+ * the bytes sent to every connection
+ * that has been sent anything.
+ * 1.0 means every client got the same
+ * share, 1/n that one client got it all.
+ *
+ * Input:
+ *     conns: list of connections
+ * Return:
+ *     the index, 1.0 if no client
+ *     has been sent anything
+ */
+double fairnessIndex(struct connection *conns){
+    double sum = 0;
+    double squares = 0;
+    int count = 0;
+    for(struct connection *conn = conns; conn != NULL; conn = conn->next){
+        if(conn->bytes_sent == 0){
+            continue;
+        }
+        sum += conn->bytes_sent;
+        squares += (double)conn->bytes_sent * conn->bytes_sent;
+        count++;
+    }
+    if(count == 0){
+        return 1.0;
+    }
+    return sum * sum / (count * squares);
+}
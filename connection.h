@@ -0,0 +1,149 @@
+/* CONNECTION.H
+ *
+ *****************************************
+ * Header file for the connections the
+ * server keeps with its clients, and the
+ * frames queued for sending on them.
+ *
+ */
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "jobqueue.h"
+#include "transport.h"
+#include "protocol.h"
+#include "dedup.h"
+#include "timerwheel.h"
+#include "budget.h"
+#include "match.h"
+
+#define CONN_OPEN           0
+#define CONN_ENDING         1
+#define CONN_FLUSH_CLOSE    2
+#define CONN_CLOSED         3
+
+#define PENDING_ALL         -1
+
+#define SENT_MIN            64
+#define SENT_MAX            16384
+
+#define BATCH_MIN           1024
+#define BATCH_MAX           65536
+#define BATCH_FRAMES        256
+#define BATCH_GAP_CAP       100000
+
+struct frame {
+    struct frame *next;
+    struct frame *shared;
+    int refs;
+    uint64_t queued_us;
+    size_t len;
+    size_t sent;
+    char data[];
+};
+
+struct sentjob {
+    struct jobqueue *queue;
+    uint64_t seq;
+};
+
+struct connection {
+    int socket;
+    int tcp;
+    struct shmring *ring;
+    size_t ring_size;
+    unsigned long id;
+    char ip[INET_ADDRSTRLEN];
+    int state;
+    struct jobset *jobs;
+    struct jobqueue *queue;
+    long pending;
+    uint64_t range_next;
+    uint64_t range_end;
+    unsigned int types;
+    struct matcher *match;
+    unsigned long jobs_filtered;
+    unsigned long long bytes_filtered;
+    int waiting;
+    int blocked;
+    int lagging;
+    int active;
+    struct connection *next;
+    struct connection *active_next;
+
+    char in_buf[REQUEST_BUFFER];
+    size_t in_len;
+    unsigned long requests;
+    unsigned long recv_calls;
+
+    struct frame *send_head;
+    struct frame *send_tail;
+    size_t queued_bytes;
+    size_t deficit;
+
+    struct budget memory;
+    int throttled;
+    unsigned long throttles;
+
+    unsigned long jobs_sent;
+    unsigned long jobs_dropped;
+    unsigned long long bytes_sent;
+    unsigned long frames_sent;
+    unsigned long rounds;
+    unsigned long results;
+
+    struct dedupcache dedup;
+    unsigned long refs_sent;
+    unsigned long long bytes_saved;
+
+    struct sentjob *sent;
+    size_t sent_size;
+    unsigned long sent_first;
+
+    size_t batch_budget;
+    uint64_t batch_deadline_us;
+    uint64_t held_until_us;
+    uint64_t last_queued_us;
+    double arrival_gap_us;
+    double arrival_len;
+    uint64_t drain_rate;
+    int drain_limited;
+    unsigned long batches;
+    unsigned long batched_frames;
+    unsigned long long batched_bytes;
+    size_t max_batch;
+    unsigned long deadline_flushes;
+
+    struct wheeltimer timer;
+    uint64_t heard_us;
+    uint64_t requested_us;
+    uint64_t pinged_us;
+    unsigned long heard_frames;
+    unsigned long pings;
+
+    uint64_t total_latency_us;
+    uint64_t max_latency_us;
+    uint64_t connected_us;
+    uint64_t rate_mark_us;
+    unsigned long long rate_mark_bytes;
+};
+
+struct frame *newFrame(size_t len);
+struct frame *shareFrame(struct frame *frame);
+char *frameData(struct frame *frame);
+void freeFrame(struct frame *frame);
+void queueFrame(struct connection *conn, struct frame *frame);
+long flushFrame(struct connection *conn);
+long flushBatch(struct connection *conn, size_t limit);
+void tuneBatch(struct connection *conn, uint64_t max_deadline_us);
+void freeFrames(struct connection *conn);
+int rememberJob(struct connection *conn, struct jobqueue *queue, uint64_t seq);
+struct sentjob *findJob(struct connection *conn, unsigned long id);
+void printConnectionStats(struct connection *conn);
+double fairnessIndex(struct connection *conns);
+
+#endif
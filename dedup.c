@@ -0,0 +1,203 @@
+/* dedup.c
+ *******************************************
+ * Least-recently-used cache of job texts,
+ * keyed by a 64-bit hash of the text.
+ *
+ * In dedup mode the client keeps the text
+ * of the last jobs it received, and the
+ * server keeps the same cache without the
+ * texts for every connection. Both add a
+ * job to it when its whole text is sent,
+ * and move it to the front when it is
+ * referred to, in the same order, so the
+ * server always knows what the client
+ * has. A job whose text the client has
+ * is sent as a reference to its hash
+ * instead, see protocol.h.
+ *
+ * Entries are kept in an array, linked
+ * from most to least recently used by
+ * index, and found through a chained
+ * hash table.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "pool.h"
+
+/* Hashes a job text with 64-bit FNV-1a,
+ * starting from its length.
+ *
+ * Input:
+ *     text: the text
+ *     len:  length of the text
+ * Return:
+ *     the hash
+ */
+uint64_t hashText(char *text, size_t len){
+    uint64_t hash = 14695981039346656037ULL ^ len;
+    for(size_t i = 0; i < len; i++){
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Sets up an empty cache.
+ *
+ * Input:
+ *     cache:    the cache
+ *     capacity: most entries to keep
+ *     store:    1 to keep the texts,
+ *               0 to keep only hashes
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+int initDedup(struct dedupcache *cache, int capacity, int store){
+    memset(cache, 0, sizeof(*cache));
+    int buckets = 16;
+    while(buckets < capacity*2){
+        buckets *= 2;
+    }
+    cache->entries = calloc(capacity, sizeof(struct dedupentry));
+    cache->buckets = malloc(buckets*sizeof(int));
+    if(cache->entries == NULL || cache->buckets == NULL){
+        free(cache->entries);
+        free(cache->buckets);
+        memset(cache, 0, sizeof(*cache));
+        return -1;
+    }
+    memset(cache->buckets, -1, buckets*sizeof(int));
+    cache->mask = buckets-1;
+    cache->capacity = capacity;
+    cache->store = store;
+    cache->mru = -1;
+    cache->lru = -1;
+    return 0;
+}
+
+/* Frees a cache and every text in it.
+ *
+ * Input:
+ *     cache: the cache
+ * Return:
+ *     void
+ */
+void freeDedup(struct dedupcache *cache){
+    for(int i = 0; i < cache->count; i++){
+        poolFree(cache->entries[i].text);
+    }
+    free(cache->entries);
+    free(cache->buckets);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static int *bucketOf(struct dedupcache *cache, uint64_t hash){
+    return &cache->buckets[(hash ^ (hash >> 32)) & cache->mask];
+}
+
+static void unlinkEntry(struct dedupcache *cache, int i){
+    struct dedupentry *entry = &cache->entries[i];
+    if(entry->prev == -1){
+        cache->mru = entry->next;
+    }else{
+        cache->entries[entry->prev].next = entry->next;
+    }
+    if(entry->next == -1){
+        cache->lru = entry->prev;
+    }else{
+        cache->entries[entry->next].prev = entry->prev;
+    }
+}
+
+static void pushEntry(struct dedupcache *cache, int i){
+    struct dedupentry *entry = &cache->entries[i];
+    entry->prev = -1;
+    entry->next = cache->mru;
+    if(cache->mru != -1){
+        cache->entries[cache->mru].prev = i;
+    }
+    cache->mru = i;
+    if(cache->lru == -1){
+        cache->lru = i;
+    }
+}
+
+/* Looks a text up by its hash, and
+ * makes it the most recently used.
+ *
+ * Input:
+ *     cache: the cache
+ *     hash:  hash of the text
+ * Return:
+ *     the entry, or NULL if it
+ *     isn't cached
+ */
+struct dedupentry *findDedup(struct dedupcache *cache, uint64_t hash){
+    if(cache->capacity == 0){
+        return NULL;
+    }
+    for(int i = *bucketOf(cache, hash); i != -1; i = cache->entries[i].chain){
+        if(cache->entries[i].hash == hash){
+            if(cache->mru != i){
+                unlinkEntry(cache, i);
+                pushEntry(cache, i);
+            }
+            cache->hits++;
+            return &cache->entries[i];
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+/* Adds a text as the most recently
+ * used, making room by dropping the
+ * least recently used one if full.
+ *
+ * Input:
+ *     cache: the cache
+ *     hash:  hash of the text
+ *     text:  the text, copied if the
+ *            cache keeps texts
+ *     len:   length of the text
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+int addDedup(struct dedupcache *cache, uint64_t hash, char *text, int len){
+    char *copy = NULL;
+    if(cache->store){
+        copy = poolAlloc(len);
+        if(copy == NULL){
+            return -1;
+        }
+        memcpy(copy, text, len);
+    }
+    int i;
+    if(cache->count < cache->capacity){
+        i = cache->count++;
+    }else{
+        i = cache->lru;
+        unlinkEntry(cache, i);
+        int *link = bucketOf(cache, cache->entries[i].hash);
+        while(*link != i){
+            link = &cache->entries[*link].chain;
+        }
+        *link = cache->entries[i].chain;
+        poolFree(cache->entries[i].text);
+        cache->evictions++;
+    }
+    struct dedupentry *entry = &cache->entries[i];
+    entry->hash = hash;
+    entry->text = copy;
+    entry->len = len;
+    int *bucket = bucketOf(cache, hash);
+    entry->chain = *bucket;
+    *bucket = i;
+    pushEntry(cache, i);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* DEDUP.H
+ *
+ *****************************************
+ * Header file for the cache of job texts
+ * kept by the client in dedup mode, and
+ * the copy of it the server keeps for
+ * every connection.
+ *
+ */
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEDUP_DEFAULT       1024
+#define DEDUP_MAX           65536
+#define DEDUP_TEXT_MAX      4096
+
+struct dedupentry {
+    uint64_t hash;
+    char *text;
+    int len;
+    int prev;
+    int next;
+    int chain;
+};
+
+struct dedupcache {
+    struct dedupentry *entries;
+    int *buckets;
+    int mask;
+    int capacity;
+    int count;
+    int mru;
+    int lru;
+    int store;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+uint64_t hashText(char *text, size_t len);
+int initDedup(struct dedupcache *cache, int capacity, int store);
+void freeDedup(struct dedupcache *cache);
+struct dedupentry *findDedup(struct dedupcache *cache, uint64_t hash);
+int addDedup(struct dedupcache *cache, uint64_t hash, char *text, int len);
+
+#endif
@@ -0,0 +1,130 @@
+/* histogram.c
+ *******************************************
+ * Histograms with a fixed relative error,
+ * laid out like HdrHistogram: values
+ * below HIST_SUB_COUNT get a bucket each,
+ * and every power of two above that is
+ * split into HIST_HALF_COUNT buckets.
+ * With 5 sub-bucket bits a value is off
+ * by at most 1/16th, whether it is a few
+ * microseconds or a few minutes, and
+ * recording a value is a few shifts.
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+/* Finds the bucket of a value.
+ *
+ * Return:
+ *     index into counts
+ */
+static int bucketOf(uint64_t value){
+    if(value < HIST_SUB_COUNT){
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS-1);
+    return HIST_SUB_COUNT + (shift-1)*HIST_HALF_COUNT +
+           (int)((value >> shift) - HIST_HALF_COUNT);
+}
+
+/* Finds the highest value that
+ * falls in a bucket.
+ *
+ * Return:
+ *     the value
+ */
+static uint64_t bucketTop(int bucket){
+    if(bucket < HIST_SUB_COUNT){
+        return bucket;
+    }
+    int shift = (bucket - HIST_SUB_COUNT)/HIST_HALF_COUNT + 1;
+    uint64_t sub = (bucket - HIST_SUB_COUNT)%HIST_HALF_COUNT + HIST_HALF_COUNT;
+    return ((sub+1) << shift) - 1;
+}
+
+/* Adds a value to a histogram.
+ *
+ * Input:
+ *     hist:  the histogram
+ *     value: the value
+ * Return:
+ *     void
+ */
+void recordValue(struct histogram *hist, uint64_t value){
+    hist->counts[bucketOf(value)]++;
+    if(hist->count == 0 || value < hist->min){
+        hist->min = value;
+    }
+    if(value > hist->max){
+        hist->max = value;
+    }
+    hist->count++;
+    hist->sum += value;
+}
+
+/* Finds the value below which the
+ * given percentage of values fall.
+ *
+ * Input:
+ *     hist:       the histogram
+ *     percentile: 0 to 100
+ * Return:
+ *     the value, rounded up to the
+ *     top of its bucket, or 0 if
+ *     nothing was recorded
+ */
+uint64_t valueAtPercentile(struct histogram *hist, double percentile){
+    if(hist->count == 0){
+        return 0;
+    }
+    uint64_t wanted = (uint64_t)(percentile/100.0 * hist->count + 0.5);
+    if(wanted < 1){
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for(int b = 0; b < HIST_BUCKETS; b++){
+        seen += hist->counts[b];
+        if(seen >= wanted){
+            uint64_t top = bucketTop(b);
+            return top < hist->max ? top : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/* Writes a histogram as a JSON object
+ * with its count, min, mean, max, some
+ * percentiles and every non-empty bucket
+ * as [highest value, count].
+ *
+ * Input:
+ *     out:  where to write
+ *     hist: the histogram
+ * Return:
+ *     void
+ */
+void writeHistogram(FILE *out, struct histogram *hist){
+    fprintf(out, "{\"count\": %llu, \"min\": %llu, \"mean\": %.1f, "
+            "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"max\": %llu, "
+            "\"buckets\": [",
+            (unsigned long long)hist->count, (unsigned long long)hist->min,
+            hist->count > 0 ? (double)hist->sum / hist->count : 0.0,
+            (unsigned long long)valueAtPercentile(hist, 50),
+            (unsigned long long)valueAtPercentile(hist, 90),
+            (unsigned long long)valueAtPercentile(hist, 99),
+            (unsigned long long)valueAtPercentile(hist, 99.9),
+            (unsigned long long)hist->max);
+    int first = 1;
+    for(int b = 0; b < HIST_BUCKETS; b++){
+        if(hist->counts[b] == 0){
+            continue;
+        }
+        fprintf(out, "%s[%llu, %llu]", first ? "" : ", ",
+                (unsigned long long)bucketTop(b), (unsigned long long)hist->counts[b]);
+        first = 0;
+    }
+    fprintf(out, "]}");
+}
@@ -0,0 +1,31 @@
+/* HISTOGRAM.H
+ *
+ *****************************************
+ * Header file for the latency histograms
+ * kept by the client.
+ *
+ */
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS       5
+#define HIST_SUB_COUNT      (1 << HIST_SUB_BITS)
+#define HIST_HALF_COUNT     (HIST_SUB_COUNT/2)
+#define HIST_BUCKETS        (HIST_SUB_COUNT + (64-HIST_SUB_BITS)*HIST_HALF_COUNT)
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+void recordValue(struct histogram *hist, uint64_t value);
+uint64_t valueAtPercentile(struct histogram *hist, double percentile);
+void writeHistogram(FILE *out, struct histogram *hist);
+
+#endif
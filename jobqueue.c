@@ -0,0 +1,332 @@
+/* jobqueue.c
+ *******************************************
+ * Loads the job files the server serves
+ * from as named queues. The job source
+ * given to the server can be:
+ *
+ *     <file>      a single job file,
+ *                 served as queue 0.
+ *     <dir>       every regular file in
+ *                 the directory, sorted
+ *                 by name.
+ *     @<manifest> a text file with one
+ *                 "<name> <path>" line
+ *                 per queue. Relative paths
+ *                 are relative to the
+ *                 manifest itself.
+ *
+ * Queue ids are the position of the
+ * queue in the set, starting at 0.
+ * Once loaded a set doesn't change; a
+ * reload loads a new set, see reload.c.
+ * Sets are reference counted so a set
+ * is freed once the last session served
+ * from it ends.
+ * Each queue schedules its jobs by
+ * priority, see scheduler.c, and may
+ * be read ahead by a thread of its own,
+ * see readahead.c.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "colors.h"
+#include "jobqueue.h"
+#include "readahead.h"
+
+void errorPrint(char *string);
+
+/* Opens the job file at path and
+ * appends it to the set as a new
+ * queue with the given name.
+ *
+ * Input:
+ *     set:  the job set
+ *     name: name of the queue
+ *     path: path to the job file
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+static int addQueue(struct jobset *set, char *name, char *path){
+    if(set->count >= QUEUE_MAX_COUNT){
+        errorPrint("Too many job queues.");
+        return -1;
+    }
+    struct jobqueue *grown = realloc(set->queues, (set->count+1)*sizeof(struct jobqueue));
+    if(grown == NULL){
+        errorPrint("Out of memory while loading job queues.");
+        return -1;
+    }
+    set->queues = grown;
+
+    struct jobqueue *queue = &set->queues[set->count];
+    memset(queue, 0, sizeof(struct jobqueue));
+    snprintf(queue->name, sizeof(queue->name), "%s", name);
+    snprintf(queue->path, sizeof(queue->path), "%s", path);
+    queue->file = fopen(path, "r");
+    if(queue->file == NULL){
+        errorPrint("Couldn't open job file:");
+        printf(COLOR_RED ">>%d<< %s" COLOR_RESET "\n", getpid(), path);
+        return -1;
+    }
+    set->count++;
+    return 0;
+}
+
+static int compareNames(const void *a, const void *b){
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Adds every regular, non-hidden
+ * file in the directory as a queue
+ * named after the file.
+ *
+ * Input:
+ *     set:  the job set
+ *     path: path to the directory
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+static int loadDirectory(struct jobset *set, char *path){
+    DIR *dir = opendir(path);
+    if(dir == NULL){
+        errorPrint("Couldn't open job directory.");
+        return -1;
+    }
+    char **names = NULL;
+    int count = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL){
+        if(entry->d_name[0] == '.'){
+            continue;
+        }
+        char **grown = realloc(names, (count+1)*sizeof(char*));
+        if(grown != NULL){
+            names = grown;
+            names[count] = strdup(entry->d_name);
+        }
+        if(grown == NULL || names[count] == NULL){
+            errorPrint("Out of memory while listing job directory.");
+            for(int i = 0; i < count; i++){
+                free(names[i]);
+            }
+            free(names);
+            closedir(dir);
+            return -1;
+        }
+        count++;
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char*), compareNames);
+
+    int ret = 0;
+    for(int i = 0; i < count; i++){
+        char file_path[PATH_MAX];
+        struct stat st;
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, names[i]);
+        if(ret == 0 && stat(file_path, &st) == 0 && S_ISREG(st.st_mode)){
+            ret = addQueue(set, names[i], file_path);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+/* Adds one queue for every
+ * "<name> <path>" line in the manifest.
+ * Empty lines and lines starting
+ * with '#' are skipped.
+ *
+ * Input:
+ *     set:  the job set
+ *     path: path to the manifest
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+static int loadManifest(struct jobset *set, char *path){
+    FILE *manifest = fopen(path, "r");
+    if(manifest == NULL){
+        errorPrint("Couldn't open job manifest.");
+        return -1;
+    }
+    char base[PATH_MAX];
+    snprintf(base, sizeof(base), "%s", path);
+    char *slash = strrchr(base, '/');
+    if(slash != NULL){
+        *(slash+1) = '\0';
+    }else{
+        base[0] = '\0';
+    }
+
+    char line[PATH_MAX+QUEUE_NAME_LEN];
+    int ret = 0;
+    while(ret == 0 && fgets(line, sizeof(line), manifest) != NULL){
+        char name[QUEUE_NAME_LEN];
+        char file[PATH_MAX];
+        if(line[0] == '#' || sscanf(line, "%63s %4095s", name, file) != 2){
+            continue;
+        }
+        char file_path[PATH_MAX+PATH_MAX];
+        if(file[0] == '/'){
+            snprintf(file_path, sizeof(file_path), "%s", file);
+        }else{
+            snprintf(file_path, sizeof(file_path), "%s%s", base, file);
+        }
+        ret = addQueue(set, name, file_path);
+    }
+    fclose(manifest);
+    return ret;
+}
+
+/* Loads the job source given to the
+ * server into the job set.
+ *
+ * Input:
+ *     set:  the job set to fill
+ *     path: job file, directory or
+ *           '@' followed by a manifest
+ * Return:
+ *     0 on success
+ *    -1 on error or if no queues
+ *       were found
+ */
+int loadJobset(struct jobset *set, char *path){
+    memset(set, 0, sizeof(struct jobset));
+    int ret;
+    struct stat st;
+    if(path[0] == '@'){
+        ret = loadManifest(set, path+1);
+    }else if(stat(path, &st) == 0 && S_ISDIR(st.st_mode)){
+        ret = loadDirectory(set, path);
+    }else{
+        char *name = strrchr(path, '/');
+        ret = addQueue(set, name == NULL ? path : name+1, path);
+    }
+    if(ret == 0 && set->count == 0){
+        errorPrint("No job files found.");
+        ret = -1;
+    }
+    if(ret == -1){
+        closeJobset(set);
+    }
+    return ret;
+}
+
+/* Closes every job file in
+ * the set and frees it.
+ *
+ * Input:
+ *     set: the job set
+ * Return:
+ *     void
+ */
+void closeJobset(struct jobset *set){
+    for(int i = 0; i < set->count; i++){
+        if(set->queues[i].ra != NULL){
+            stopReadahead(set->queues[i].ra);
+        }
+        fclose(set->queues[i].file);
+        freeScheduler(&set->queues[i].sched);
+        freeIndex(&set->queues[i].index);
+    }
+    free(set->queues);
+    set->queues = NULL;
+    set->count = 0;
+}
+
+/* Indexes the first window of jobs,
+ * see scanJobs(), in the job files of
+ * a set, so the first requests don't
+ * have to.
+ *
+ * Input:
+ *     set: the job set
+ * Return:
+ *     0 on success
+ *    -1 if a job file is invalid
+ */
+int indexJobset(struct jobset *set){
+    for(int i = 0; i < set->count; i++){
+        struct jobqueue *queue = &set->queues[i];
+        if(scanJobs(&queue->sched, fileno(queue->file), TYPES_ALL) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Takes a reference to a job set.
+ *
+ * Input:
+ *     set: the job set
+ * Return:
+ *     void
+ */
+void holdJobset(struct jobset *set){
+    set->refs++;
+}
+
+/* Drops a reference to a job set that
+ * was allocated on the heap, closing
+ * and freeing it with the last one.
+ *
+ * Input:
+ *     set: the job set
+ * Return:
+ *     void
+ */
+void releaseJobset(struct jobset *set){
+    if(--set->refs > 0){
+        return;
+    }
+    closeJobset(set);
+    free(set);
+}
+
+/* Looks up a queue by its id.
+ *
+ * Input:
+ *     set: the job set
+ *     id:  queue id
+ * Return:
+ *     the queue, or NULL if there
+ *     is no queue with that id
+ */
+struct jobqueue *getQueue(struct jobset *set, int id){
+    if(id < 0 || id >= set->count){
+        return NULL;
+    }
+    return &set->queues[id];
+}
+
+/* Prints the id, name, cursor and
+ * how much has been served from
+ * every queue in the set.
+ *
+ * Input:
+ *     set: the job set
+ * Return:
+ *     void
+ */
+void printQueueStats(struct jobset *set){
+    for(int i = 0; i < set->count; i++){
+        struct jobqueue *queue = &set->queues[i];
+        printf(COLOR_CYAN ">>%d<< Queue %d (%s): cursor %ld, %lu request(s), "
+               "%lu job(s), %llu byte(s) sent.", getpid(), i, queue->name,
+               queue->cursor, queue->requests, queue->jobs_sent, queue->bytes_sent);
+        printf(COLOR_RESET "\n");
+        printSchedulerStats(&queue->sched);
+        if(queue->ra != NULL){
+            printReadaheadStats(queue->ra);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/* JOBQUEUE.H
+ *
+ *****************************************
+ * Header file for the job queues the
+ * server serves jobs from. One job file
+ * is one named queue, and a job set is
+ * every queue loaded by one server.
+ *
+ */
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "scheduler.h"
+#include "protocol.h"
+
+#define QUEUE_NAME_LEN      64
+
+struct jobqueue {
+    char name[QUEUE_NAME_LEN];
+    char path[PATH_MAX];
+    FILE *file;
+    int watch;
+    int grown;
+    long cursor;
+    unsigned long requests;
+    unsigned long jobs_sent;
+    unsigned long long bytes_sent;
+    struct scheduler sched;
+    struct jobindex index;
+    struct readahead *ra;
+};
+
+struct jobset {
+    struct jobqueue *queues;
+    int count;
+    int refs;
+    unsigned long generation;
+};
+
+int loadJobset(struct jobset *set, char *path);
+void closeJobset(struct jobset *set);
+int indexJobset(struct jobset *set);
+void holdJobset(struct jobset *set);
+void releaseJobset(struct jobset *set);
+struct jobqueue *getQueue(struct jobset *set, int id);
+void printQueueStats(struct jobset *set);
+
+#endif
@@ -0,0 +1,355 @@
+/* match.c
+ *******************************************
+ * Filters on job texts, sent by a client
+ * with REQUEST_MATCH, see protocol.h, and
+ * applied by the server to every job it
+ * takes from the queue for the client,
+ * so jobs the client doesn't want are
+ * never sent.
+ *
+ * A filter is a set of literals and a
+ * range of text lengths. A text passes
+ * if its length is in the range and it
+ * contains any of the literals, or any
+ * text in the range if there are none.
+ * Literals are compared byte for byte,
+ * case sensitive.
+ *
+ * Texts are searched for every literal
+ * at once, 16 or 32 positions at a time
+ * with SSE2 or AVX2: a position is a
+ * candidate for a literal if the text
+ * has the literal's first byte there and
+ * its last byte where the literal would
+ * end, and only candidates are compared
+ * in full. The rest of the text, and
+ * texts on CPUs without either, are
+ * searched by the scalar kernel, which
+ * only compares the literals starting
+ * with the byte at each position.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCH_X86
+#endif
+
+#include "match.h"
+#include "protocol.h"
+
+/* Builds the text of a REQUEST_MATCH from
+ * a filter expression: literals and
+ * "len:<min>-<max>" separated by commas,
+ * where either bound can be left out.
+ * Literals can't contain commas.
+ *
+ * Input:
+ *     buf:        where to build it
+ *     size:       size of buf
+ *     expression: the expression
+ * Return:
+ *     length of the text
+ *    -1 if the expression is invalid
+ *        or too long
+ */
+int buildMatch(char *buf, size_t size, const char *expression){
+    struct matchrequest header = {0, 0};
+    size_t len = sizeof(header);
+    int count = 0;
+    if(size < sizeof(header)){
+        return -1;
+    }
+    const char *item = expression;
+    while(*item != '\0'){
+        size_t item_len = strcspn(item, ",");
+        if(strncmp(item, "len:", 4) == 0){
+            char *end = (char *)item+4;
+            if(*end >= '0' && *end <= '9'){
+                header.min_length = strtoul(end, &end, 10);
+            }
+            if(*end != '-'){
+                return -1;
+            }
+            end++;
+            if(*end >= '0' && *end <= '9'){
+                header.max_length = strtoul(end, &end, 10);
+            }
+            if(end != item+item_len ||
+               (header.max_length != 0 && header.max_length < header.min_length)){
+                return -1;
+            }
+        }else{
+            if(item_len == 0 || item_len > MATCH_LITERAL_MAX || ++count > MATCH_LITERALS_MAX ||
+               len+1+item_len > size){
+                return -1;
+            }
+            buf[len] = item_len;
+            memcpy(buf+len+1, item, item_len);
+            len += 1+item_len;
+        }
+        item += item_len;
+        if(*item == ','){
+            item++;
+        }
+    }
+    memcpy(buf, &header, sizeof(header));
+    return len;
+}
+
+/* Sets a filter up from the text of a
+ * REQUEST_MATCH, and picks the fastest
+ * kernel the CPU supports for it.
+ *
+ * Input:
+ *     m:    the filter
+ *     data: the text of the request
+ *     len:  length of the text
+ * Return:
+ *     0 on success
+ *    -1 if the text is invalid
+ */
+int parseMatch(struct matcher *m, const char *data, size_t len){
+    struct matchrequest header;
+    memset(m, 0, sizeof(*m));
+    if(len < sizeof(header)){
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if(header.max_length != 0 && header.max_length < header.min_length){
+        return -1;
+    }
+    m->min_length = header.min_length;
+    m->max_length = header.max_length;
+    size_t at = sizeof(header);
+    while(at < len){
+        size_t literal_len = (unsigned char)data[at];
+        if(literal_len == 0 || literal_len > MATCH_LITERAL_MAX ||
+           m->count == MATCH_LITERALS_MAX || at+1+literal_len > len){
+            return -1;
+        }
+        memcpy(m->literals[m->count], data+at+1, literal_len);
+        m->lens[m->count] = literal_len;
+        m->starts[(unsigned char)data[at+1]] |= 1 << m->count;
+        if((int)literal_len > m->longest){
+            m->longest = literal_len;
+        }
+        m->count++;
+        at += 1+literal_len;
+    }
+    m->kernel = MATCH_SCALAR;
+    for(int kernel = MATCH_SCALAR; kernel < MATCH_KERNELS; kernel++){
+        if(matchSupported(kernel)){
+            m->kernel = kernel;
+        }
+    }
+    return 0;
+}
+
+/* Searches a text for the literals of a
+ * filter at every position from the
+ * given one on, comparing only the
+ * literals that start with the byte
+ * at the position.
+ *
+ * Input:
+ *     m:    the filter
+ *     text: the text
+ *     len:  length of the text
+ *     from: first position to search
+ * Return:
+ *     1 if a literal was found
+ *     0 otherwise
+ */
+static int scanScalar(struct matcher *m, const char *text, size_t len, size_t from){
+    for(size_t i = from; i < len; i++){
+        unsigned int lits = m->starts[(unsigned char)text[i]];
+        while(lits != 0){
+            int j = __builtin_ctz(lits);
+            lits &= lits-1;
+            if(i+m->lens[j] <= len && memcmp(text+i, m->literals[j], m->lens[j]) == 0){
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+#ifdef MATCH_X86
+/* Searches a text for the literals of a
+ * filter 16 positions at a time, see
+ * the top of the file.
+ *
+ * Input:
+ *     m:    the filter
+ *     text: the text
+ *     len:  length of the text
+ * Return:
+ *     1 if a literal was found
+ *     0 otherwise
+ */
+__attribute__((target("sse2")))
+static int scanSSE2(struct matcher *m, const char *text, size_t len){
+    __m128i first[MATCH_LITERALS_MAX];
+    __m128i last[MATCH_LITERALS_MAX];
+    for(int j = 0; j < m->count; j++){
+        first[j] = _mm_set1_epi8(m->literals[j][0]);
+        last[j] = _mm_set1_epi8(m->literals[j][m->lens[j]-1]);
+    }
+    size_t i = 0;
+    for(; i+m->longest+15 <= len; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *)(text+i));
+        for(int j = 0; j < m->count; j++){
+            size_t k = m->lens[j];
+            __m128i end = _mm_loadu_si128((const __m128i *)(text+i+k-1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block, first[j]),
+                                                                _mm_cmpeq_epi8(end, last[j])));
+            while(mask != 0){
+                int bit = __builtin_ctz(mask);
+                mask &= mask-1;
+                if(k <= 2 || memcmp(text+i+bit+1, m->literals[j]+1, k-2) == 0){
+                    return 1;
+                }
+            }
+        }
+    }
+    return scanScalar(m, text, len, i);
+}
+
+/* Searches a text for the literals of a
+ * filter 32 positions at a time, see
+ * the top of the file.
+ *
+ * Input:
+ *     m:    the filter
+ *     text: the text
+ *     len:  length of the text
+ * Return:
+ *     1 if a literal was found
+ *     0 otherwise
+ */
+__attribute__((target("avx2")))
+static int scanAVX2(struct matcher *m, const char *text, size_t len){
+    __m256i first[MATCH_LITERALS_MAX];
+    __m256i last[MATCH_LITERALS_MAX];
+    for(int j = 0; j < m->count; j++){
+        first[j] = _mm256_set1_epi8(m->literals[j][0]);
+        last[j] = _mm256_set1_epi8(m->literals[j][m->lens[j]-1]);
+    }
+    size_t i = 0;
+    for(; i+m->longest+31 <= len; i += 32){
+        __m256i block = _mm256_loadu_si256((const __m256i *)(text+i));
+        for(int j = 0; j < m->count; j++){
+            size_t k = m->lens[j];
+            __m256i end = _mm256_loadu_si256((const __m256i *)(text+i+k-1));
+            unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block, first[j]),
+                                                                      _mm256_cmpeq_epi8(end, last[j])));
+            while(mask != 0){
+                int bit = __builtin_ctz(mask);
+                mask &= mask-1;
+                if(k <= 2 || memcmp(text+i+bit+1, m->literals[j]+1, k-2) == 0){
+                    return 1;
+                }
+            }
+        }
+    }
+    return scanScalar(m, text, len, i);
+}
+#endif
+
+/* Checks if a text passes a filter,
+ * searching it with the given kernel.
+ * The kernel has to be supported, see
+ * matchSupported().
+ *
+ * Input:
+ *     m:      the filter
+ *     kernel: MATCH_SCALAR, MATCH_SSE2
+ *             or MATCH_AVX2
+ *     text:   the text
+ *     len:    length of the text
+ * Return:
+ *     1 if it passes
+ *     0 otherwise
+ */
+int matchWith(struct matcher *m, int kernel, const char *text, size_t len){
+    if(len < m->min_length || (m->max_length != 0 && len > m->max_length)){
+        return 0;
+    }
+    if(m->count == 0){
+        return 1;
+    }
+    switch(kernel){
+#ifdef MATCH_X86
+        case MATCH_AVX2:
+            return scanAVX2(m, text, len);
+        case MATCH_SSE2:
+            return scanSSE2(m, text, len);
+#endif
+        default:
+            return scanScalar(m, text, len, 0);
+    }
+}
+
+/* Checks if a text passes a filter with
+ * the filter's kernel, and counts it.
+ *
+ * Input:
+ *     m:    the filter
+ *     text: the text
+ *     len:  length of the text
+ * Return:
+ *     1 if it passes
+ *     0 otherwise
+ */
+int matchText(struct matcher *m, const char *text, size_t len){
+    int matched = matchWith(m, m->kernel, text, len);
+    m->tested++;
+    m->matched += matched;
+    m->bytes += len;
+    return matched;
+}
+
+/* Checks if the CPU runs a kernel.
+ *
+ * Input:
+ *     kernel: the kernel
+ * Return:
+ *     1 if it does
+ *     0 otherwise
+ */
+int matchSupported(int kernel){
+    switch(kernel){
+        case MATCH_SCALAR:
+            return 1;
+#ifdef MATCH_X86
+        case MATCH_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case MATCH_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return 0;
+    }
+}
+
+/* Names a kernel, for stats.
+ *
+ * Input:
+ *     kernel: the kernel
+ * Return:
+ *     its name
+ */
+const char *matchKernelName(int kernel){
+    switch(kernel){
+        case MATCH_SSE2:
+            return "sse2";
+        case MATCH_AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,44 @@
+/* MATCH.H
+ *
+ *****************************************
+ * Header file for the job filters a
+ * client can have the server apply to
+ * the jobs it takes, see match.c.
+ *
+ */
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MATCH_LITERALS_MAX  16
+#define MATCH_LITERAL_MAX   64
+
+#define MATCH_SCALAR        0
+#define MATCH_SSE2          1
+#define MATCH_AVX2          2
+#define MATCH_KERNELS       3
+
+struct matcher {
+    uint32_t min_length;
+    uint32_t max_length;
+    int count;
+    int longest;
+    unsigned char lens[MATCH_LITERALS_MAX];
+    char literals[MATCH_LITERALS_MAX][MATCH_LITERAL_MAX];
+    uint16_t starts[256];
+    int kernel;
+    unsigned long tested;
+    unsigned long matched;
+    unsigned long long bytes;
+};
+
+int buildMatch(char *buf, size_t size, const char *expression);
+int parseMatch(struct matcher *m, const char *data, size_t len);
+int matchText(struct matcher *m, const char *text, size_t len);
+int matchWith(struct matcher *m, int kernel, const char *text, size_t len);
+int matchSupported(int kernel);
+const char *matchKernelName(int kernel);
+
+#endif
@@ -0,0 +1,236 @@
+/* matchbench.c
+ ******************************************
+ * USAGE:
+ * Arguments: <filepath> <expression> -SECONDS=<s>
+ *
+ * Measures how fast the filter kernels
+ * of match.c search the texts of a job
+ * file for a -MATCH expression of the
+ * client, see buildMatch().
+ *
+ * The texts are read into memory once,
+ * then every kernel the CPU supports
+ * runs over all of them for -SECONDS (1)
+ * and its throughput is printed in GB/s
+ * of job text filtered. Every kernel
+ * has to pass the same jobs as the
+ * scalar one, or the bench fails.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "colors.h"
+#include "match.h"
+#include "protocol.h"
+
+struct texts {
+    char *data;
+    size_t size;
+    size_t *offsets;
+    uint32_t *lens;
+    size_t count;
+    size_t capacity;
+};
+
+int loadTexts(char *path, struct texts *texts);
+int runKernel(struct matcher *m, int kernel, struct texts *texts, unsigned char *passed,
+              double seconds, double *rate);
+
+void errorPrint(char *string);
+uint64_t monotonicMicros();
+
+/* Main-function that loads the job
+ * file, sets the filter up and runs
+ * every kernel over the texts.
+ *
+ * Input:
+ *     argc: amount of user arguments
+ *     argv: user arguments
+ * Return:
+ *     0 if every kernel agrees
+ *     1 otherwise
+ */
+int main(int argc, char *argv[]){
+    double seconds = 1;
+    if(argc < 3){
+        errorPrint("./matchbench <filepath> <expression>");
+        errorPrint("To run every kernel for longer add '-SECONDS=<s>'\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 3; i < argc; i++){
+        if(strncmp("-SECONDS=", argv[i], 9) == 0 && atof(argv[i]+9) > 0){
+            seconds = atof(argv[i]+9);
+        }else{
+            errorPrint("./matchbench <filepath> <expression>");
+            errorPrint("To run every kernel for longer add '-SECONDS=<s>'\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    char request[MATCH_REQUEST_MAX];
+    int len = buildMatch(request, sizeof(request), argv[2]);
+    struct matcher m;
+    if(len == -1 || parseMatch(&m, request, len) == -1){
+        errorPrint("Invalid filter. Use literals and 'len:<min>-<max>' separated by commas.");
+        exit(EXIT_FAILURE);
+    }
+    struct texts texts;
+    if(loadTexts(argv[1], &texts) == -1){
+        exit(EXIT_FAILURE);
+    }
+    printf(COLOR_CYAN ">>%d<< %zu text(s), %.1f MB, %d literal(s), longest %d byte(s).",
+           getpid(), texts.count, texts.size / 1048576.0, m.count, m.longest);
+    printf(COLOR_RESET "\n");
+
+    unsigned char *expected = malloc(texts.count+1);
+    unsigned char *passed = malloc(texts.count+1);
+    if(expected == NULL || passed == NULL){
+        errorPrint("Out of memory for the results.");
+        exit(EXIT_FAILURE);
+    }
+    int failed = 0;
+    for(int kernel = MATCH_SCALAR; kernel < MATCH_KERNELS; kernel++){
+        if(!matchSupported(kernel)){
+            printf(COLOR_CYAN ">>%d<< %-8s not supported by this CPU.", getpid(),
+                   matchKernelName(kernel));
+            printf(COLOR_RESET "\n");
+            continue;
+        }
+        double rate;
+        int matched = runKernel(&m, kernel, &texts, kernel == MATCH_SCALAR ? expected : passed,
+                                seconds, &rate);
+        printf(COLOR_CYAN ">>%d<< %-8s %8.3f GB/s, %d of %zu job(s) passed.", getpid(),
+               matchKernelName(kernel), rate / 1e9, matched, texts.count);
+        printf(COLOR_RESET "\n");
+        if(kernel != MATCH_SCALAR && memcmp(expected, passed, texts.count) != 0){
+            printf(COLOR_RED ">>%d<< %s passed other jobs than scalar.", getpid(),
+                   matchKernelName(kernel));
+            printf(COLOR_RESET "\n");
+            failed = 1;
+        }
+    }
+    free(expected);
+    free(passed);
+    free(texts.data);
+    free(texts.offsets);
+    free(texts.lens);
+    return failed;
+}
+
+/* Reads the texts of every job in a
+ * job file into memory, one after the
+ * other.
+ *
+ * Input:
+ *     path:  the job file
+ *     texts: where to keep them
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int loadTexts(char *path, struct texts *texts){
+    memset(texts, 0, sizeof(*texts));
+    FILE *f = fopen(path, "rb");
+    if(f == NULL){
+        errorPrint("Couldn't open the job file.");
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    texts->data = malloc(file_size > 0 ? file_size : 1);
+    if(texts->data == NULL){
+        errorPrint("Out of memory for the texts.");
+        fclose(f);
+        return -1;
+    }
+    int c;
+    while((c = fgetc(f)) != EOF){
+        if(c == 'P'){
+            if(fgetc(f) == EOF){
+                break;
+            }
+            c = fgetc(f);
+        }
+        unsigned int text_length;
+        if(c == EOF || fread(&text_length, sizeof(int), 1, f) != 1){
+            break;
+        }
+        if(text_length < 1 || text_length > 1000000 ||
+           texts->size+text_length > (size_t)file_size){
+            errorPrint("Text-length out of bounds. Inspect job file.");
+            break;
+        }
+        if(texts->count == texts->capacity){
+            texts->capacity = texts->capacity ? texts->capacity*2 : 1024;
+            size_t *offsets = realloc(texts->offsets, texts->capacity*sizeof(size_t));
+            uint32_t *lens = realloc(texts->lens, texts->capacity*sizeof(uint32_t));
+            if(offsets != NULL){
+                texts->offsets = offsets;
+            }
+            if(lens != NULL){
+                texts->lens = lens;
+            }
+            if(offsets == NULL || lens == NULL){
+                errorPrint("Out of memory for the texts.");
+                fclose(f);
+                return -1;
+            }
+        }
+        if(fread(texts->data+texts->size, 1, text_length, f) != text_length){
+            errorPrint("Error with reading job-text. Inspect job file.");
+            break;
+        }
+        texts->offsets[texts->count] = texts->size;
+        texts->lens[texts->count] = text_length;
+        texts->count++;
+        texts->size += text_length;
+    }
+    fclose(f);
+    if(texts->count == 0){
+        errorPrint("No jobs in the job file.");
+        return -1;
+    }
+    return 0;
+}
+
+/* Runs a kernel over every text until
+ * the given time is up, and notes
+ * which texts passed on the first go.
+ *
+ * Input:
+ *     m:       the filter
+ *     kernel:  the kernel
+ *     texts:   the texts
+ *     passed:  set to 1 for every text
+ *              that passed, 0 otherwise
+ *     seconds: how long to run
+ *     rate:    set to the bytes of
+ *              text searched per second
+ * Return:
+ *     amount of texts that passed
+ */
+int runKernel(struct matcher *m, int kernel, struct texts *texts, unsigned char *passed,
+              double seconds, double *rate){
+    int matched = 0;
+    for(size_t i = 0; i < texts->count; i++){
+        passed[i] = matchWith(m, kernel, texts->data+texts->offsets[i], texts->lens[i]);
+        matched += passed[i];
+    }
+    unsigned long long bytes = 0;
+    volatile int sink = 0;
+    uint64_t start = monotonicMicros();
+    uint64_t now = start;
+    while(now - start < seconds*1000000){
+        for(size_t i = 0; i < texts->count; i++){
+            sink += matchWith(m, kernel, texts->data+texts->offsets[i], texts->lens[i]);
+        }
+        bytes += texts->size;
+        now = monotonicMicros();
+    }
+    *rate = bytes * 1000000.0 / (now - start);
+    return matched;
+}
@@ -0,0 +1,144 @@
+/* pool.c
+ *******************************************
+ * Size-classed buffer pool shared by the
+ * frame encoder in the server and the
+ * frame decoder in the client.
+ *
+ * Buffers come in powers of two from
+ * 2^POOL_MIN_SHIFT to 2^POOL_MAX_SHIFT
+ * bytes, which holds the largest job.
+ * A freed buffer goes on the free list
+ * of its class, and is handed out again
+ * by the next allocation of that class,
+ * so once every class in use has a few
+ * buffers no more memory is allocated.
+ * At most POOL_KEEP_BYTES are kept per
+ * class; the rest is given back.
+ * Larger buffers aren't pooled.
+ *
+ * The pool is shared by the threads of
+ * the server, see readahead.c, and
+ * guarded by a spinlock.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "colors.h"
+#include "pool.h"
+
+#define POOL_OVERSIZE       POOL_CLASSES
+
+union poolblock {
+    struct {
+        union poolblock *next;
+        int cls;
+    } hdr;
+    long double align;
+};
+
+static union poolblock *free_lists[POOL_CLASSES];
+static size_t kept_bytes[POOL_CLASSES];
+static char pool_lock;
+static unsigned long pool_allocs;
+static unsigned long pool_reused;
+
+static void lockPool(){
+    while(__atomic_test_and_set(&pool_lock, __ATOMIC_ACQUIRE)){
+    }
+}
+
+static void unlockPool(){
+    __atomic_clear(&pool_lock, __ATOMIC_RELEASE);
+}
+
+/* Gets a buffer of at least len bytes,
+ * from the pool if it has one of the
+ * right class.
+ *
+ * Input:
+ *     len: size needed
+ * Return:
+ *     the buffer, or NULL if out
+ *     of memory
+ */
+void *poolAlloc(size_t len){
+    size_t total = len + sizeof(union poolblock);
+    int cls = 0;
+    while(cls < POOL_CLASSES && ((size_t)1 << (cls+POOL_MIN_SHIFT)) < total){
+        cls++;
+    }
+    union poolblock *block = NULL;
+    lockPool();
+    pool_allocs++;
+    if(cls < POOL_CLASSES && free_lists[cls] != NULL){
+        block = free_lists[cls];
+        free_lists[cls] = block->hdr.next;
+        kept_bytes[cls] -= (size_t)1 << (cls+POOL_MIN_SHIFT);
+        pool_reused++;
+    }
+    unlockPool();
+    if(block == NULL){
+        block = malloc(cls < POOL_CLASSES ? (size_t)1 << (cls+POOL_MIN_SHIFT) : total);
+        if(block == NULL){
+            return NULL;
+        }
+    }
+    block->hdr.cls = cls < POOL_CLASSES ? cls : POOL_OVERSIZE;
+    return block+1;
+}
+
+/* Gives a buffer back to the pool.
+ *
+ * Input:
+ *     buf: buffer from poolAlloc(),
+ *          or NULL
+ * Return:
+ *     void
+ */
+void poolFree(void *buf){
+    if(buf == NULL){
+        return;
+    }
+    union poolblock *block = (union poolblock *)buf - 1;
+    int cls = block->hdr.cls;
+    if(cls == POOL_OVERSIZE){
+        free(block);
+        return;
+    }
+    size_t size = (size_t)1 << (cls+POOL_MIN_SHIFT);
+    lockPool();
+    if(kept_bytes[cls] + size <= POOL_KEEP_BYTES){
+        block->hdr.next = free_lists[cls];
+        free_lists[cls] = block;
+        kept_bytes[cls] += size;
+        block = NULL;
+    }
+    unlockPool();
+    free(block);
+}
+
+/* Prints how many buffers have been
+ * handed out, how many of them were
+ * reused, and how much the pool keeps.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printPoolStats(){
+    size_t kept = 0;
+    lockPool();
+    for(int c = 0; c < POOL_CLASSES; c++){
+        kept += kept_bytes[c];
+    }
+    unsigned long allocs = pool_allocs;
+    unsigned long reused = pool_reused;
+    unlockPool();
+    printf(COLOR_CYAN ">>%d<< Buffer pool: %lu buffer(s) handed out, %lu reused, "
+           "%zu byte(s) kept.", getpid(), allocs, reused, kept);
+    printf(COLOR_RESET "\n");
+}
@@ -0,0 +1,23 @@
+/* POOL.H
+ *
+ *****************************************
+ * Header file for the buffer pool that
+ * frames are built and parsed in, used
+ * by both server and client.
+ *
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_MIN_SHIFT      8
+#define POOL_MAX_SHIFT      20
+#define POOL_CLASSES        (POOL_MAX_SHIFT-POOL_MIN_SHIFT+1)
+#define POOL_KEEP_BYTES     (4*1024*1024)
+
+void *poolAlloc(size_t len);
+void poolFree(void *buf);
+void printPoolStats();
+
+#endif
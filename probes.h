@@ -0,0 +1,51 @@
+/* PROBES.H
+ *
+ *****************************************
+ * Static tracepoints (USDT) in the hot
+ * paths of server and client, for
+ * profiling a running session with
+ * bpftrace or perf, see scripts/.
+ *
+ * Every probe is in the "jobs" provider
+ * and carries the job's number, its type,
+ * a length in bytes and the connection:
+ *
+ *   server  request        request number, opcode, bytes, client id
+ *           job_checksum   job in its queue, type, text, client id
+ *           job_read       job in its queue, type, frame, client id
+ *           frame_sent     frame number, type, frame, client id,
+ *                          and the us it waited queued
+ *   client  frame_received job, type, text, socket
+ *           job_dispatched job, type, text, socket
+ *           job_worked     job, type, text, 0, in the child
+ *           job_acked      job, type, result, socket
+ *
+ * With <sys/sdt.h> a probe is a single
+ * nop until a tracer attaches to it.
+ * Without it, or built with -DNO_PROBES,
+ * probes compile to nothing.
+ *
+ */
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBES_ENABLED
+#endif
+#endif
+
+#ifdef PROBES_ENABLED
+#define PROBE4(name, job, type, len, conn) \
+    DTRACE_PROBE4(jobs, name, job, type, len, conn)
+#define PROBE5(name, job, type, len, conn, extra) \
+    DTRACE_PROBE5(jobs, name, job, type, len, conn, extra)
+#else
+#define PROBE4(name, job, type, len, conn) \
+    do{ (void)(job); (void)(type); (void)(len); (void)(conn); }while(0)
+#define PROBE5(name, job, type, len, conn, extra) \
+    do{ (void)(job); (void)(type); (void)(len); (void)(conn); (void)(extra); }while(0)
+#endif
+
+#endif
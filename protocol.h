@@ -0,0 +1,140 @@
+/* PROTOCOL.H
+ *
+ *****************************************
+ * Header file for the parts of the message
+ * protocol shared by server and client
+ * that aren't plain jobs or termination
+ * signals.
+ *
+ * Frames whose 3-bit type is FRAME_CONTROL
+ * carry a message from the server instead
+ * of a job. The 5 bits that hold the
+ * checksum of a job hold the kind of
+ * control message instead. Length and
+ * text follow like in a job frame.
+ *
+ * In dedup mode, see dedup.c, the server
+ * starts the session with CONTROL_DEDUP,
+ * whose text is the amount of job texts
+ * the client is to cache. A job whose
+ * text the client has cached is then
+ * sent as CONTROL_REFERENCE, whose text
+ * is the job type and a dedupref.
+ *
+ * REQUEST_COUNT asks for CONTROL_COUNT,
+ * whose text is the amount of jobs in
+ * the selected queue's file so far.
+ * REQUEST_RANGE is followed by a
+ * rangerequest, and has the jobs from
+ * start up to end of the file sent, in
+ * file order and whatever their
+ * priority, without taking them from
+ * the queue. Jobs are numbered from 0.
+ *
+ * REQUEST_FILTER subscribes the client
+ * to the job types set in the upper 24
+ * bits, bit 1 << type for every 3-bit
+ * frame type, FILTER_O and FILTER_E.
+ * Jobs the client takes from the queue
+ * are then only of those types, and jobs
+ * of the others are left for other
+ * clients. No bits set subscribes to
+ * every type again, as does a new
+ * session. Ranges are sent whatever the
+ * subscription.
+ *
+ * REQUEST_MATCH has the server filter
+ * the jobs the client takes from the
+ * queue by their text, see match.c. Its
+ * upper 24 bits are the length of the
+ * text that follows: a matchrequest,
+ * then every literal as a byte with its
+ * length and the literal. A max_length
+ * of 0 is no maximum. Jobs that don't
+ * pass are taken from the queue but
+ * never sent, and count as neither
+ * sent nor pending; a broadcast job
+ * is only queued on the clients it
+ * passes the filter of. No text turns
+ * filtering off again, as does a new
+ * session. Ranges aren't filtered.
+ *
+ * With heartbeats on, the server sends
+ * an empty CONTROL_HEARTBEAT to a client
+ * it hasn't heard from for a heartbeat
+ * interval, and the client answers with
+ * REQUEST_HEARTBEAT. Anything the client
+ * sends counts as a heartbeat.
+ *
+ * Clients send the results of their jobs
+ * back with REQUEST_RESULTS, with the
+ * amount of results in the upper 24 bits,
+ * each followed by a resultheader and
+ * its text. Jobs are numbered from 1 in
+ * the order they were sent on the
+ * connection. Results can come back in
+ * any order, as from a relay, see
+ * relay.c, but mostly come in the order
+ * jobs were sent. Results are sent in
+ * batches of at most RESULT_BATCH_JOBS
+ * results and RESULT_BATCH_BYTES bytes,
+ * so a batch always fits the server's
+ * request buffer.
+ *
+ */
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+#define FRAME_CONTROL       4
+
+#define CONTROL_STATS       0
+#define CONTROL_NOTICE      1
+#define CONTROL_DEDUP       2
+#define CONTROL_REFERENCE   3
+#define CONTROL_COUNT       4
+#define CONTROL_HEARTBEAT   5
+
+#define REQUEST_BUFFER      4096
+#define QUEUE_MAX_COUNT     16777215
+
+#define REQUEST_RANGE       'G'
+#define REQUEST_COUNT       'N'
+
+#define REQUEST_FILTER      'F'
+#define REQUEST_HEARTBEAT   'H'
+#define REQUEST_MATCH       'M'
+#define MATCH_REQUEST_MAX   (REQUEST_BUFFER/2)
+#define FILTER_O            1
+#define FILTER_E            2
+
+#define REQUEST_RESULTS     'D'
+#define RESULT_BATCH_JOBS   64
+#define RESULT_BATCH_BYTES  (REQUEST_BUFFER/2)
+#define RESULT_TEXT_MAX     255
+
+#define RESULT_DONE         'C'
+#define RESULT_FAILED       'E'
+
+struct dedupref {
+    uint64_t hash;
+};
+
+struct rangerequest {
+    uint32_t start;
+    uint32_t end;
+};
+
+struct matchrequest {
+    uint32_t min_length;
+    uint32_t max_length;
+};
+
+struct resultheader {
+    uint32_t job;
+    uint8_t status;
+    uint8_t len;
+};
+
+#endif
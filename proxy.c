@@ -0,0 +1,809 @@
+/* proxy.c
+ ******************************************
+ * USAGE:
+ * Arguments: <port> <server hostname> <server port>
+ *            -DELAY=<ms> -JITTER=<ms> -RATE=<KB/s>
+ *            -SPLIT=<bytes>[/<us>] -STALL=<ms>/<ms> -DEBUG
+ *
+ * A TCP proxy that makes loopback behave
+ * more like a slow or distant network.
+ * Clients connect to <port>, and every
+ * client gets its own connection to the
+ * server. Both directions are impaired
+ * the same way:
+ *
+ * -DELAY holds every read back this many
+ * ms before it is passed on, so the round
+ * trip grows by twice that. -JITTER adds
+ * up to this many ms more or less to each
+ * read, without reordering the bytes.
+ *
+ * -RATE passes at most this many KB per
+ * second on in each direction.
+ *
+ * -SPLIT writes at most <bytes> at once,
+ * waiting <us> (200) between the pieces
+ * of one read, so the other side gets
+ * short reads and partial frames.
+ *
+ * -STALL=<ms>/<ms> passes nothing on for
+ * the first ms out of every second ms,
+ * like a congested or flapping link.
+ *
+ * When a connection closes, and on
+ * CTRL+C for all of them, the proxy
+ * prints what went through each
+ * direction, how fast, and how long
+ * bytes were held in the proxy.
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+#include "colors.h"
+#include "pool.h"
+#include "histogram.h"
+
+#define PROXY_READ          16384
+#define PROXY_QUEUE_MAX     (4*1024*1024)
+
+#define DIR_UP              0
+#define DIR_DOWN            1
+
+struct chunk {
+    struct chunk *next;
+    uint64_t read_us;
+    uint64_t due_us;
+    size_t len;
+    size_t sent;
+    char data[];
+};
+
+struct direction {
+    int from;
+    int to;
+    struct chunk *head;
+    struct chunk *tail;
+    size_t queued;
+    uint64_t last_due_us;
+    double tokens;
+    uint64_t refill_us;
+    int eof;
+    int shut;
+    int blocked;
+
+    unsigned long long bytes;
+    unsigned long reads;
+    unsigned long writes;
+    uint64_t first_us;
+    uint64_t last_us;
+    struct histogram held;
+};
+
+struct link {
+    unsigned long id;
+    struct direction dir[2];
+    int connecting;
+    int closed;
+    struct link *next;
+};
+
+/* Fields 		*/
+struct link *links;
+unsigned long next_link_id;
+int listen_socket;
+char *server_host;
+char *server_port;
+struct sockaddr_storage server_address;
+socklen_t server_address_len;
+uint64_t delay_us;
+uint64_t jitter_us;
+double rate;
+size_t split;
+uint64_t split_gap_us;
+uint64_t stall_us;
+uint64_t stall_every_us;
+uint64_t started_us;
+int debug;
+struct direction totals[2];
+volatile sig_atomic_t stop;
+
+/* Functions 	*/
+void usage(int argc, char* argv[]);
+int listenOn(char *port);
+int resolveServer();
+int connectServer(int *connecting);
+void acceptLink();
+void finishLink(struct link *link);
+void takeBytes(struct direction *dir, uint64_t now);
+int passBytes(struct direction *dir, uint64_t now);
+uint64_t stallEnd(uint64_t now);
+uint64_t nextWake(uint64_t now);
+void closeLink(struct link *link);
+void reapLinks();
+void addTotals(struct direction *total, struct direction *dir);
+void printDirection(char *name, unsigned long id, struct direction *dir);
+void signalHandler(int sig);
+
+void errorPrint(char* string);
+void debugPrint(char* string, int debug);
+int portCheck(char* port);
+uint64_t monotonicMicros();
+
+/* Main-function
+ * That listens for clients and passes
+ * their bytes on to and from the server
+ * until it is interrupted.
+ *
+ * Input:
+ *     argc: amount of user arguments
+ *     argv: user arguments
+ * Return:
+ *     Returns 0 on success
+ *     1 on error.
+ *
+ */
+int main(int argc, char *argv[]){
+    usage(argc, argv);
+    srandom(getpid());
+
+    struct sigaction sigint;
+    memset(&sigint, 0, sizeof(sigint));
+    sigint.sa_handler = signalHandler;
+    sigaction(SIGINT, &sigint, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_socket = listenOn(argv[1]);
+    if(listen_socket == -1 || resolveServer() == -1){
+        return 1;
+    }
+    started_us = monotonicMicros();
+    printf(COLOR_CYAN ">>%d<< Proxying port %s to %s:%s, delay %.1f ms, jitter %.1f ms, "
+           "rate %s, split %zu, stall %.1f/%.1f ms.", getpid(), argv[1], server_host, server_port,
+           delay_us/1000.0, jitter_us/1000.0, rate > 0 ? "capped" : "uncapped", split,
+           stall_us/1000.0, stall_every_us/1000.0);
+    printf(COLOR_RESET "\n");
+
+    while(!stop){
+        uint64_t now = monotonicMicros();
+        for(struct link *link = links; link != NULL; link = link->next){
+            if(link->connecting){
+                continue;
+            }
+            for(int d = 0; d < 2 && !link->closed; d++){
+                if(passBytes(&link->dir[d], now) == -1){
+                    closeLink(link);
+                }
+            }
+            if(!link->closed && link->dir[DIR_UP].shut && link->dir[DIR_DOWN].shut){
+                closeLink(link);
+            }
+        }
+        reapLinks();
+
+        int count = 1;
+        for(struct link *link = links; link != NULL; link = link->next){
+            count += 2;
+        }
+        struct pollfd fds[count];
+        fds[0].fd = listen_socket;
+        fds[0].events = POLLIN;
+        int n = 1;
+        for(struct link *link = links; link != NULL; link = link->next){
+            /* The client's socket is read for the way up
+             * and written for the way down, and the other
+             * way around for the server's. While the
+             * server is being connected to, only its
+             * socket is polled, for the connect to end. */
+            if(link->connecting){
+                fds[n].fd = link->dir[DIR_UP].from;
+                fds[n++].events = 0;
+                fds[n].fd = link->dir[DIR_DOWN].from;
+                fds[n++].events = POLLOUT;
+                continue;
+            }
+            for(int d = 0; d < 2; d++){
+                struct direction *in = &link->dir[d];
+                struct direction *out = &link->dir[1-d];
+                fds[n].fd = in->from;
+                fds[n].events = 0;
+                if(!in->eof && in->queued < PROXY_QUEUE_MAX){
+                    fds[n].events |= POLLIN;
+                }
+                if(out->blocked){
+                    fds[n].events |= POLLOUT;
+                }
+                n++;
+            }
+        }
+        uint64_t wake = nextWake(now);
+        struct timespec timeout;
+        timeout.tv_sec = (wake - now) / 1000000;
+        timeout.tv_nsec = ((wake - now) % 1000000) * 1000;
+        int ready = ppoll(fds, n, wake == UINT64_MAX ? NULL : &timeout, NULL);
+        if(ready == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            errorPrint("Error while waiting for events.");
+            break;
+        }
+        now = monotonicMicros();
+        n = 1;
+        for(struct link *link = links; link != NULL && n < count; link = link->next){
+            if(link->connecting){
+                if(fds[n+DIR_DOWN].revents != 0){
+                    finishLink(link);
+                }
+                n += 2;
+                continue;
+            }
+            for(int d = 0; d < 2; d++, n++){
+                if(fds[n].revents & POLLOUT){
+                    link->dir[1-d].blocked = 0;
+                }
+                if(fds[n].revents & (POLLIN | POLLHUP | POLLERR)){
+                    takeBytes(&link->dir[d], now);
+                }
+            }
+        }
+        if(fds[0].revents & POLLIN){
+            acceptLink();
+        }
+    }
+
+    for(struct link *link = links; link != NULL; link = link->next){
+        closeLink(link);
+    }
+    reapLinks();
+    printDirection("up", 0, &totals[DIR_UP]);
+    printDirection("down", 0, &totals[DIR_DOWN]);
+    close(listen_socket);
+    return 0;
+}
+
+/* How the program treats
+ * arguments from user.
+ *
+ * Input:
+ *     argc: amount of args
+ *     argv: pointer to the args
+ * Return:
+ *     void
+ *
+ */
+void usage(int argc, char* argv[]){
+    split_gap_us = 200;
+    if(argc < 4){
+        errorPrint("Not enough program arguments supplied.");
+        errorPrint("./proxy <port> <server hostname> <server port>");
+        exit(EXIT_FAILURE);
+    }
+    if(portCheck(argv[1]) == -1 || portCheck(argv[3]) == -1){
+        errorPrint("Please choose ports from 1 to 6535.");
+        exit(EXIT_FAILURE);
+    }
+    server_host = argv[2];
+    server_port = argv[3];
+    for(int i = 4; i < argc; i++){
+        if(strcmp("-DEBUG", argv[i]) == 0){
+            debug = 1;
+        }else if(strncmp("-DELAY=", argv[i], 7) == 0 && atoi(argv[i]+7) >= 0){
+            delay_us = (uint64_t)(atof(argv[i]+7) * 1000);
+        }else if(strncmp("-JITTER=", argv[i], 8) == 0 && atoi(argv[i]+8) >= 0){
+            jitter_us = (uint64_t)(atof(argv[i]+8) * 1000);
+        }else if(strncmp("-RATE=", argv[i], 6) == 0 && atof(argv[i]+6) > 0){
+            rate = atof(argv[i]+6) * 1024;
+        }else if(strncmp("-SPLIT=", argv[i], 7) == 0 && atoi(argv[i]+7) > 0){
+            split = atoi(argv[i]+7);
+            char *gap = strchr(argv[i], '/');
+            if(gap != NULL){
+                split_gap_us = atoi(gap+1);
+            }
+        }else if(strncmp("-STALL=", argv[i], 7) == 0 && strchr(argv[i], '/') != NULL &&
+                 atof(argv[i]+7) > 0 && atof(strchr(argv[i], '/')+1) > atof(argv[i]+7)){
+            stall_us = (uint64_t)(atof(argv[i]+7) * 1000);
+            stall_every_us = (uint64_t)(atof(strchr(argv[i], '/')+1) * 1000);
+        }else{
+            errorPrint("./proxy <port> <server hostname> <server port>");
+            errorPrint("To hold every read back add '-DELAY=<ms>', and '-JITTER=<ms>' to vary it");
+            errorPrint("To cap the bandwidth of each direction add '-RATE=<KB/s>'");
+            errorPrint("To pass reads on in pieces add '-SPLIT=<bytes>[/<us>]'");
+            errorPrint("To stop passing bytes on for a while now and then add '-STALL=<ms>/<every ms>'");
+            errorPrint("To print every connection as it comes and goes add '-DEBUG'");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Creates the socket clients connect
+ * to the proxy on.
+ *
+ * Input:
+ *     port: port to listen on
+ * Return:
+ *     the socket, or -1 on error
+ */
+int listenOn(char *port){
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if(sock == -1){
+        errorPrint("Couldn't create the listening socket.");
+        return -1;
+    }
+    int optval = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(port));
+    address.sin_addr.s_addr = INADDR_ANY;
+    if(bind(sock, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+       listen(sock, SOMAXCONN) == -1){
+        errorPrint("Couldn't listen on the proxy's port.");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Looks the server up once, so no
+ * link waits on the resolver.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int resolveServer(){
+    struct addrinfo hints;
+    struct addrinfo *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if(getaddrinfo(server_host, server_port, &hints, &result) != 0){
+        errorPrint("Couldn't look up the server.");
+        return -1;
+    }
+    memcpy(&server_address, result->ai_addr, result->ai_addrlen);
+    server_address_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+/* Starts connecting to the server for
+ * a client that just connected. The
+ * socket is non-blocking, so a slow
+ * server holds up no other link; the
+ * connect is finished by finishLink().
+ *
+ * Input:
+ *     connecting: set to 1 if the
+ *                 connect is still
+ *                 going on, 0 if done
+ * Return:
+ *     the socket, or -1 on error
+ */
+int connectServer(int *connecting){
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if(sock == -1){
+        return -1;
+    }
+    *connecting = 0;
+    if(connect(sock, (struct sockaddr *)&server_address, server_address_len) == -1){
+        if(errno != EINPROGRESS){
+            close(sock);
+            return -1;
+        }
+        *connecting = 1;
+    }
+    return sock;
+}
+
+/* Accepts a client and starts connecting
+ * it to the server. Both sockets are
+ * non-blocking with Nagle off, so
+ * what the proxy writes goes out
+ * as it is written. Nothing is passed
+ * on until the server has accepted.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void acceptLink(){
+    int client = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(client == -1){
+        return;
+    }
+    int connecting;
+    int server = connectServer(&connecting);
+    if(server == -1){
+        errorPrint("Couldn't connect to the server. Dropping client.");
+        close(client);
+        return;
+    }
+    int optval = 1;
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    struct link *link = calloc(1, sizeof(struct link));
+    if(link == NULL){
+        errorPrint("Out of memory while accepting client.");
+        close(client);
+        close(server);
+        return;
+    }
+    link->id = ++next_link_id;
+    link->connecting = connecting;
+    link->dir[DIR_UP].from = client;
+    link->dir[DIR_UP].to = server;
+    link->dir[DIR_DOWN].from = server;
+    link->dir[DIR_DOWN].to = client;
+    for(int d = 0; d < 2; d++){
+        link->dir[d].tokens = rate > 0 ? rate/100 : 0;
+        link->dir[d].refill_us = monotonicMicros();
+    }
+    link->next = links;
+    links = link;
+    if(debug && !connecting){
+        printf(COLOR_CYAN ">>%d<< Link %lu opened.", getpid(), link->id);
+        printf(COLOR_RESET "\n");
+    }
+}
+
+/* Finishes connecting a link to the
+ * server once its socket is ready,
+ * and drops the client if the
+ * connect failed.
+ *
+ * Input:
+ *     link: the link
+ * Return:
+ *     void
+ */
+void finishLink(struct link *link){
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if(getsockopt(link->dir[DIR_DOWN].from, SOL_SOCKET, SO_ERROR, &error, &len) == -1){
+        error = errno;
+    }
+    if(error == EINPROGRESS){
+        return;
+    }
+    if(error != 0){
+        errorPrint("Couldn't connect to the server. Dropping client.");
+        closeLink(link);
+        return;
+    }
+    link->connecting = 0;
+    for(int d = 0; d < 2; d++){
+        link->dir[d].refill_us = monotonicMicros();
+    }
+    if(debug){
+        printf(COLOR_CYAN ">>%d<< Link %lu opened.", getpid(), link->id);
+        printf(COLOR_RESET "\n");
+    }
+}
+
+/* Reads what has arrived in one
+ * direction, and queues it to be
+ * passed on once its delay is over.
+ * Bytes are never passed on out of
+ * order, whatever the jitter.
+ *
+ * Input:
+ *     dir: the direction
+ *     now: current time
+ * Return:
+ *     void
+ */
+void takeBytes(struct direction *dir, uint64_t now){
+    if(dir->eof){
+        return;
+    }
+    struct chunk *chunk = poolAlloc(sizeof(struct chunk)+PROXY_READ);
+    if(chunk == NULL){
+        return;
+    }
+    ssize_t got = recv(dir->from, chunk->data, PROXY_READ, MSG_DONTWAIT);
+    if(got <= 0){
+        poolFree(chunk);
+        if(got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            dir->eof = 1;
+        }
+        return;
+    }
+    int64_t held = delay_us;
+    if(jitter_us > 0){
+        held += (int64_t)(random() % (2*jitter_us+1)) - (int64_t)jitter_us;
+    }
+    chunk->next = NULL;
+    chunk->read_us = now;
+    chunk->due_us = held > 0 ? now + held : now;
+    if(chunk->due_us < dir->last_due_us){
+        chunk->due_us = dir->last_due_us;
+    }
+    dir->last_due_us = chunk->due_us;
+    chunk->len = got;
+    chunk->sent = 0;
+    if(dir->tail == NULL){
+        dir->head = chunk;
+    }else{
+        dir->tail->next = chunk;
+    }
+    dir->tail = chunk;
+    dir->queued += got;
+    dir->reads++;
+    if(dir->first_us == 0){
+        dir->first_us = now;
+    }
+}
+
+/* Passes on what is due in one
+ * direction, as far as the rate,
+ * the splitting, the stalls and the
+ * receiving socket allow. Once the
+ * sending side has closed and all
+ * is passed on, the receiving side
+ * is closed for writing too.
+ *
+ * Input:
+ *     dir: the direction
+ *     now: current time
+ * Return:
+ *     0 on success
+ *    -1 if the connection broke
+ */
+int passBytes(struct direction *dir, uint64_t now){
+    if(rate > 0){
+        dir->tokens += (now - dir->refill_us) * rate / 1000000.0;
+        if(dir->tokens > rate/100 && dir->tokens > PROXY_READ){
+            dir->tokens = rate/100 > PROXY_READ ? rate/100 : PROXY_READ;
+        }
+        dir->refill_us = now;
+    }
+    while(dir->head != NULL && !dir->blocked && dir->head->due_us <= now && stallEnd(now) == 0){
+        struct chunk *chunk = dir->head;
+        size_t len = chunk->len - chunk->sent;
+        if(split > 0 && len > split){
+            len = split;
+        }
+        if(rate > 0){
+            if(dir->tokens < 1){
+                break;
+            }
+            if(len > dir->tokens){
+                len = dir->tokens;
+            }
+        }
+        ssize_t sent = send(dir->to, chunk->data+chunk->sent, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(sent == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                dir->blocked = 1;
+                break;
+            }
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        dir->tokens -= sent;
+        dir->writes++;
+        dir->bytes += sent;
+        dir->queued -= sent;
+        dir->last_us = now;
+        chunk->sent += sent;
+        if(chunk->sent < chunk->len){
+            if(split > 0 && (size_t)sent == len){
+                chunk->due_us = now + split_gap_us;
+            }
+            continue;
+        }
+        recordValue(&dir->held, now - chunk->read_us);
+        dir->head = chunk->next;
+        if(dir->head == NULL){
+            dir->tail = NULL;
+        }
+        poolFree(chunk);
+    }
+    if(dir->eof && dir->head == NULL && !dir->shut){
+        shutdown(dir->to, SHUT_WR);
+        dir->shut = 1;
+    }
+    return 0;
+}
+
+/* Works out if the link is stalled.
+ *
+ * Input:
+ *     now: current time
+ * Return:
+ *     when the stall ends, or 0 if
+ *     the link isn't stalled
+ */
+uint64_t stallEnd(uint64_t now){
+    if(stall_us == 0){
+        return 0;
+    }
+    uint64_t phase = (now - started_us) % stall_every_us;
+    return phase < stall_us ? now + stall_us - phase : 0;
+}
+
+/* Works out when something next
+ * becomes due to be passed on.
+ *
+ * Input:
+ *     now: current time
+ * Return:
+ *     the time, or UINT64_MAX if
+ *     nothing is waiting
+ */
+uint64_t nextWake(uint64_t now){
+    uint64_t wake = UINT64_MAX;
+    for(struct link *link = links; link != NULL; link = link->next){
+        for(int d = 0; d < 2; d++){
+            struct direction *dir = &link->dir[d];
+            if(dir->head == NULL || dir->blocked){
+                continue;
+            }
+            uint64_t due = dir->head->due_us > now ? dir->head->due_us : now;
+            if(rate > 0 && dir->tokens < 1){
+                uint64_t refill = now + (uint64_t)((1 - dir->tokens) * 1000000 / rate) + 1;
+                due = refill > due ? refill : due;
+            }
+            uint64_t stall = stallEnd(due);
+            if(stall > due){
+                due = stall;
+            }
+            if(due < wake){
+                wake = due;
+            }
+        }
+    }
+    return wake;
+}
+
+/* Closes both sides of a link and
+ * prints what went through it. The
+ * link is freed by reapLinks().
+ *
+ * Input:
+ *     link: the link
+ * Return:
+ *     void
+ */
+void closeLink(struct link *link){
+    if(link->closed){
+        return;
+    }
+    link->closed = 1;
+    close(link->dir[DIR_UP].from);
+    close(link->dir[DIR_UP].to);
+    printDirection("up", link->id, &link->dir[DIR_UP]);
+    printDirection("down", link->id, &link->dir[DIR_DOWN]);
+    addTotals(&totals[DIR_UP], &link->dir[DIR_UP]);
+    addTotals(&totals[DIR_DOWN], &link->dir[DIR_DOWN]);
+}
+
+/* Frees every closed link, and the
+ * bytes it still had queued.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void reapLinks(){
+    struct link **next = &links;
+    while(*next != NULL){
+        struct link *link = *next;
+        if(!link->closed){
+            next = &link->next;
+            continue;
+        }
+        *next = link->next;
+        for(int d = 0; d < 2; d++){
+            while(link->dir[d].head != NULL){
+                struct chunk *chunk = link->dir[d].head;
+                link->dir[d].head = chunk->next;
+                poolFree(chunk);
+            }
+        }
+        free(link);
+    }
+}
+
+/* Adds what went through a direction
+ * of one link to the totals.
+ *
+ * Input:
+ *     total: the totals
+ *     dir:   the direction
+ * Return:
+ *     void
+ */
+void addTotals(struct direction *total, struct direction *dir){
+    total->bytes += dir->bytes;
+    total->reads += dir->reads;
+    total->writes += dir->writes;
+    if(dir->first_us != 0 && (total->first_us == 0 || dir->first_us < total->first_us)){
+        total->first_us = dir->first_us;
+    }
+    if(dir->last_us > total->last_us){
+        total->last_us = dir->last_us;
+    }
+    for(int b = 0; b < HIST_BUCKETS; b++){
+        total->held.counts[b] += dir->held.counts[b];
+    }
+    if(dir->held.count > 0 && (total->held.count == 0 || dir->held.min < total->held.min)){
+        total->held.min = dir->held.min;
+    }
+    if(dir->held.max > total->held.max){
+        total->held.max = dir->held.max;
+    }
+    total->held.count += dir->held.count;
+    total->held.sum += dir->held.sum;
+}
+
+/* Prints what went through one
+ * direction: bytes, reads and writes,
+ * throughput from the first read to
+ * the last write, and how long reads
+ * were held in the proxy.
+ *
+ * Input:
+ *     name: "up" or "down"
+ *     id:   the link, or 0 for
+ *           the totals
+ *     dir:  the direction
+ * Return:
+ *     void
+ */
+void printDirection(char *name, unsigned long id, struct direction *dir){
+    double seconds = (dir->last_us - dir->first_us) / 1000000.0;
+    char who[32];
+    if(id == 0){
+        snprintf(who, sizeof(who), "Total %s", name);
+    }else{
+        snprintf(who, sizeof(who), "Link %lu %s", id, name);
+    }
+    printf(COLOR_CYAN ">>%d<< %s: %llu byte(s) in %lu read(s) and %lu write(s), %.1f KB/s, "
+           "held p50 %.3f ms, p99 %.3f ms, max %.3f ms.", getpid(), who, dir->bytes,
+           dir->reads, dir->writes, seconds > 0 ? dir->bytes / 1024.0 / seconds : 0,
+           valueAtPercentile(&dir->held, 50) / 1000.0,
+           valueAtPercentile(&dir->held, 99) / 1000.0, dir->held.max / 1000.0);
+    printf(COLOR_RESET "\n");
+}
+
+/* Signal handler that makes the
+ * proxy print its totals and stop
+ * when the user interrupts with
+ * CTRL+C.
+ *
+ * Input:
+ *     sig: integer signal
+ * Return:
+ *    void
+ */
+void signalHandler(int sig){
+    assert(sig == SIGINT);
+    stop = 1;
+}
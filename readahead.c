@@ -0,0 +1,471 @@
+/* readahead.c
+ *******************************************
+ * Reader threads that keep the sending
+ * path fed from job files too large to
+ * read from in the middle of sendJob().
+ *
+ * Each queue served with -READAHEAD gets
+ * one thread that reads its job file
+ * front to back in READAHEAD_CHUNK sized,
+ * aligned chunks, alternating between two
+ * buffers. A record split across chunks
+ * is carried to the front of the other
+ * buffer before the next chunk is read
+ * in behind it. Complete records are
+ * turned into ready-to-send frames and
+ * put in a bounded ring that the event
+ * loop takes them from, so the disk is
+ * read while the network is written.
+ *
+ * Memory stays fixed whatever the size
+ * of the file: the thread waits while
+ * the frames it made and that haven't
+ * been sent yet take up more than
+ * readahead_budget bytes.
+ *
+ * With -DIRECT the file is opened with
+ * O_DIRECT, bypassing the page cache.
+ * Otherwise the kernel is told the file
+ * is read sequentially, to fetch the
+ * next chunk while this one is parsed,
+ * and to drop what has been read.
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include "colors.h"
+#include "readahead.h"
+#include "connection.h"
+#include "scheduler.h"
+
+#define RECORD_MAX          (2+1+sizeof(int)+1000000)
+#define ALIGN_UP(n)         (((n)+READAHEAD_ALIGN-1) & ~(size_t)(READAHEAD_ALIGN-1))
+
+size_t readahead_budget = 0;
+int readahead_direct = 0;
+
+void errorPrint(char *string);
+int getChecksum(char *string, int length);
+
+/* Puts a frame in the ring, waiting
+ * while the ring is full or over its
+ * byte budget. Wakes the event loop if
+ * it found the ring empty.
+ *
+ * Return:
+ *     0 on success
+ *    -1 if the reader is stopped
+ */
+static int pushFrame(struct readahead *ra, struct readslot *slot){
+    pthread_mutex_lock(&ra->lock);
+    while(!ra->stop && (ra->tail - ra->head == READAHEAD_SLOTS ||
+          (ra->held_bytes > 0 && ra->held_bytes + slot->frame->len > readahead_budget))){
+        ra->stalls++;
+        ra->full = 1;
+        pthread_cond_wait(&ra->wake, &ra->lock);
+    }
+    ra->full = 0;
+    if(ra->stop){
+        pthread_mutex_unlock(&ra->lock);
+        freeFrame(slot->frame);
+        return -1;
+    }
+    ra->slots[ra->tail % READAHEAD_SLOTS] = *slot;
+    ra->tail++;
+    ra->held_bytes += slot->frame->len;
+    int notify = ra->starved;
+    ra->starved = 0;
+    pthread_mutex_unlock(&ra->lock);
+    if(notify){
+        uint64_t one = 1;
+        write(ra->notify_fd, &one, sizeof(one));
+    }
+    return 0;
+}
+
+/* Marks the end of what can be read,
+ * and wakes the event loop.
+ */
+static void finish(struct readahead *ra, int error){
+    pthread_mutex_lock(&ra->lock);
+    if(error){
+        ra->error = 1;
+    }else{
+        ra->eof = 1;
+    }
+    pthread_mutex_unlock(&ra->lock);
+    uint64_t one = 1;
+    write(ra->notify_fd, &one, sizeof(one));
+}
+
+/* Parses one record at the start of
+ * the bytes read so far, and makes
+ * the frame for it, laid out like in
+ * sendJob() in server.c.
+ *
+ * Input:
+ *     data: unparsed bytes
+ *     len:  amount of unparsed bytes
+ *     slot: where to store the frame
+ * Return:
+ *     size of the record
+ *     0 if the record isn't complete
+ *    -1 if the record is invalid
+ */
+static long parseRecord(char *data, size_t len, struct readslot *slot){
+    size_t header = 0;
+    slot->priority = PRIORITY_NORMAL;
+    slot->prefix = 0;
+    if(len < 2){
+        return 0;
+    }
+    if(data[0] == 'P'){
+        if((unsigned char)data[1] >= PRIORITY_CLASSES){
+            errorPrint("Invalid priority class. Inspect job file.");
+            return -1;
+        }
+        slot->priority = data[1];
+        slot->prefix = 2;
+        header = 2;
+    }
+    unsigned int text_length;
+    if(len < header+1+sizeof(int)){
+        return 0;
+    }
+    memcpy(&text_length, data+header+1, sizeof(int));
+    if(text_length < 1 || text_length > 1000000){
+        errorPrint("Text-length out of bounds. Inspect job file.");
+        return -1;
+    }
+    size_t size = header+1+sizeof(int)+text_length;
+    if(len < size){
+        return 0;
+    }
+    char *text = data+header+1+sizeof(int);
+    unsigned char job_info = getChecksum(text, text_length);
+    switch(data[header]){
+        case 'O':
+            break;
+        case 'E':
+            job_info = job_info + (1<<5);
+            break;
+        default:
+            errorPrint("Invalid job type.");
+            return -1;
+    }
+
+    slot->frame = newFrame(text_length+2+sizeof(int));
+    if(slot->frame == NULL){
+        errorPrint("Out of memory while reading ahead.");
+        return -1;
+    }
+    char *out = slot->frame->data;
+    out[0] = job_info;
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        out[i+1] = (char)((text_length >> shuffle) & 15);
+    }
+    memcpy(out+1+sizeof(int), text, text_length);
+    out[1+sizeof(int)+text_length] = '\0';
+    return size;
+}
+
+/* Waits until the job file has been
+ * written to, in follow mode.
+ *
+ * Return:
+ *     0 when there may be more to read
+ *    -1 if the reader is stopped
+ */
+static int waitAppend(struct readahead *ra){
+    pthread_mutex_lock(&ra->lock);
+    while(!ra->appended && !ra->stop){
+        pthread_cond_wait(&ra->wake, &ra->lock);
+    }
+    ra->appended = 0;
+    int stop = ra->stop;
+    pthread_mutex_unlock(&ra->lock);
+    return stop ? -1 : 0;
+}
+
+/* Body of the reader thread.
+ *
+ * Input:
+ *     arg: the readahead of the queue
+ * Return:
+ *     NULL
+ */
+static void *readAhead(void *arg){
+    struct readahead *ra = arg;
+    size_t span = ALIGN_UP(RECORD_MAX) + READAHEAD_CHUNK;
+    char *buffers[2] = {NULL, NULL};
+    if(posix_memalign((void **)&buffers[0], READAHEAD_ALIGN, span) != 0 ||
+       posix_memalign((void **)&buffers[1], READAHEAD_ALIGN, span) != 0){
+        errorPrint("Out of memory while reading ahead.");
+        free(buffers[0]);
+        finish(ra, 1);
+        return NULL;
+    }
+    if(!ra->direct){
+        posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    int current = 0;
+    size_t start = 0;
+    size_t end = 0;
+    long file_pos = 0;
+    long parsed = 0;
+    while(1){
+        char *buf = buffers[current];
+        while(1){
+            struct readslot slot;
+            long size = parseRecord(buf+start, end-start, &slot);
+            if(size == -1){
+                finish(ra, 1);
+                goto out;
+            }
+            if(size == 0){
+                break;
+            }
+            start += size;
+            parsed += size;
+            slot.end = parsed;
+            if(pushFrame(ra, &slot) == -1){
+                goto out;
+            }
+        }
+
+        size_t carry = end-start;
+        size_t target = ALIGN_UP(carry);
+        char *next = buffers[1-current];
+        memcpy(next+target-carry, buf+start, carry);
+        start = target-carry;
+        end = target;
+        current = 1-current;
+
+        ssize_t got = pread(ra->fd, next+target, READAHEAD_CHUNK, file_pos);
+        if(got == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            errorPrint("Error while reading ahead. Inspect job file.");
+            finish(ra, 1);
+            goto out;
+        }
+        if(got > 0){
+            if(!ra->direct){
+                posix_fadvise(ra->fd, file_pos, got, POSIX_FADV_DONTNEED);
+                posix_fadvise(ra->fd, file_pos+got, READAHEAD_CHUNK, POSIX_FADV_WILLNEED);
+            }
+            file_pos += got;
+            end += got;
+            pthread_mutex_lock(&ra->lock);
+            ra->chunks_read++;
+            ra->bytes_read += got;
+            pthread_mutex_unlock(&ra->lock);
+            continue;
+        }
+        if(!ra->follow){
+            finish(ra, 0);
+            goto out;
+        }
+        if(waitAppend(ra) == -1){
+            goto out;
+        }
+    }
+out:
+    free(buffers[0]);
+    free(buffers[1]);
+    return NULL;
+}
+
+/* Opens a job file and starts a
+ * thread reading it ahead.
+ * Falls back to the page cache if the
+ * file system doesn't take O_DIRECT.
+ * Follow mode always reads through the
+ * page cache, since O_DIRECT can't read
+ * on from the unaligned end of a file.
+ *
+ * Input:
+ *     path:      path to the job file
+ *     follow:    1 to keep reading what
+ *                is appended to the file
+ *     notify_fd: eventfd written to when
+ *                frames are ready after
+ *                the ring ran empty
+ * Return:
+ *     the readahead, or NULL on error
+ */
+struct readahead *startReadahead(char *path, int follow, int notify_fd){
+    struct readahead *ra = calloc(1, sizeof(struct readahead));
+    if(ra == NULL){
+        return NULL;
+    }
+    ra->follow = follow;
+    ra->notify_fd = notify_fd;
+    ra->fd = -1;
+    if(readahead_direct && !follow){
+        ra->fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+        ra->direct = ra->fd != -1;
+    }
+    if(ra->fd == -1){
+        ra->fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if(ra->fd == -1){
+        free(ra);
+        return NULL;
+    }
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->wake, NULL);
+
+    /* Signals are handled by the event loop only. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = pthread_create(&ra->thread, NULL, readAhead, ra);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(ret != 0){
+        close(ra->fd);
+        pthread_mutex_destroy(&ra->lock);
+        pthread_cond_destroy(&ra->wake);
+        free(ra);
+        return NULL;
+    }
+    return ra;
+}
+
+/* Takes the next frame from the ring.
+ * If there is none yet the event loop
+ * is woken through the eventfd as soon
+ * as there is.
+ *
+ * Input:
+ *     ra:   the readahead
+ *     slot: where to store the frame
+ * Return:
+ *     READAHEAD_TAKEN if a frame was taken
+ *     READAHEAD_EMPTY if none is ready yet
+ *     READAHEAD_EOF   at end of file
+ *     READAHEAD_ERROR if the file is invalid
+ */
+int takeReadahead(struct readahead *ra, struct readslot *slot){
+    int ret;
+    pthread_mutex_lock(&ra->lock);
+    if(ra->head != ra->tail){
+        *slot = ra->slots[ra->head % READAHEAD_SLOTS];
+        ra->head++;
+        pthread_cond_signal(&ra->wake);
+        ret = READAHEAD_TAKEN;
+    }else if(ra->error){
+        ret = READAHEAD_ERROR;
+    }else if(ra->eof){
+        ret = READAHEAD_EOF;
+    }else{
+        ra->starved = 1;
+        ret = READAHEAD_EMPTY;
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return ret;
+}
+
+/* Gives back the budget of a frame
+ * taken from the ring once it leaves
+ * the queue's scheduler.
+ *
+ * Input:
+ *     ra:  the readahead
+ *     len: length of the frame
+ * Return:
+ *     void
+ */
+void releaseReadahead(struct readahead *ra, size_t len){
+    pthread_mutex_lock(&ra->lock);
+    ra->held_bytes -= len;
+    pthread_cond_signal(&ra->wake);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/* Tells a reader in follow mode that
+ * its job file has been written to.
+ *
+ * Input:
+ *     ra: the readahead
+ * Return:
+ *     void
+ */
+void pokeReadahead(struct readahead *ra){
+    pthread_mutex_lock(&ra->lock);
+    ra->appended = 1;
+    pthread_cond_signal(&ra->wake);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/* Checks if the reader is waiting for
+ * frames it made to be sent.
+ *
+ * Input:
+ *     ra: the readahead
+ * Return:
+ *     1 if it is
+ *     0 otherwise
+ */
+int readaheadFull(struct readahead *ra){
+    pthread_mutex_lock(&ra->lock);
+    int full = ra->full;
+    pthread_mutex_unlock(&ra->lock);
+    return full;
+}
+
+/* Stops the reader thread and frees
+ * the frames left in the ring.
+ *
+ * Input:
+ *     ra: the readahead
+ * Return:
+ *     void
+ */
+void stopReadahead(struct readahead *ra){
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = 1;
+    pthread_cond_signal(&ra->wake);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    while(ra->head != ra->tail){
+        freeFrame(ra->slots[ra->head % READAHEAD_SLOTS].frame);
+        ra->head++;
+    }
+    close(ra->fd);
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->wake);
+    free(ra);
+}
+
+/* Prints how much has been read ahead,
+ * how much of it is waiting to be sent,
+ * and how often the reader had to wait
+ * for the budget.
+ *
+ * Input:
+ *     ra: the readahead
+ * Return:
+ *     void
+ */
+void printReadaheadStats(struct readahead *ra){
+    pthread_mutex_lock(&ra->lock);
+    printf(COLOR_CYAN ">>%d<<     read-ahead%s: %lu chunk(s), %llu byte(s) read, "
+           "%lu frame(s) in ring, %zu byte(s) held, reader waited %lu time(s).",
+           getpid(), ra->direct ? " (direct)" : "", ra->chunks_read, ra->bytes_read,
+           ra->tail - ra->head, ra->held_bytes, ra->stalls);
+    pthread_mutex_unlock(&ra->lock);
+    printf(COLOR_RESET "\n");
+}
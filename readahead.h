@@ -0,0 +1,70 @@
+/* READAHEAD.H
+ *
+ *****************************************
+ * Header file for the reader threads that
+ * stream job files ahead of the sending
+ * path.
+ *
+ */
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define READAHEAD_SLOTS     1024
+#define READAHEAD_CHUNK     (1024*1024)
+#define READAHEAD_ALIGN     4096
+#define READAHEAD_DEFAULT   (8*1024*1024)
+
+#define READAHEAD_TAKEN     0
+#define READAHEAD_EMPTY     1
+#define READAHEAD_EOF       2
+#define READAHEAD_ERROR     3
+
+struct frame;
+
+struct readslot {
+    struct frame *frame;
+    long end;
+    unsigned char priority;
+    unsigned char prefix;
+};
+
+struct readahead {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int fd;
+    int direct;
+    int follow;
+    int notify_fd;
+
+    struct readslot slots[READAHEAD_SLOTS];
+    unsigned long head;
+    unsigned long tail;
+    size_t held_bytes;
+    int starved;
+    int full;
+    int appended;
+    int eof;
+    int error;
+    int stop;
+
+    unsigned long chunks_read;
+    unsigned long long bytes_read;
+    unsigned long stalls;
+};
+
+extern size_t readahead_budget;
+extern int readahead_direct;
+
+struct readahead *startReadahead(char *path, int follow, int notify_fd);
+int takeReadahead(struct readahead *ra, struct readslot *slot);
+void releaseReadahead(struct readahead *ra, size_t len);
+void pokeReadahead(struct readahead *ra);
+int readaheadFull(struct readahead *ra);
+void stopReadahead(struct readahead *ra);
+void printReadaheadStats(struct readahead *ra);
+
+#endif
@@ -0,0 +1,1741 @@
+/* relay.c
+ ******************************************
+ * USAGE:
+ * Arguments: <port> <server hostname> <server port>
+ *            unix:<path> unix:<server path>
+ *            -PREFETCH=<jobs> -MEMORY=<KB> -SPILL=<path>
+ *            -DISK=<MB> -BROADCAST -QUEUE=<id> -DEBUG
+ *
+ * Serves the jobs of one server to the
+ * clients near the relay, over one
+ * connection to the server. Upstream the
+ * relay is a client, see client.c, and
+ * downstream a server, see server.c, so
+ * clients connect to it unchanged, and
+ * relays can connect to relays: one per
+ * site, then one per rack, and so on.
+ * Either side can also be unix:<path>.
+ * The socket options in sockopts.c can
+ * be added, and apply to both sides.
+ *
+ * Jobs are asked for upstream ahead of
+ * the clients, up to -PREFETCH (1024)
+ * jobs that no client has been sent yet,
+ * and kept in the relay's cache until
+ * they are. The cache holds up to
+ * -MEMORY KB (65536) of frames, and with
+ * -SPILL the frames past that go to a
+ * file at <path>, up to -DISK MB (1024),
+ * which is removed right away and only
+ * read back from. No more jobs are asked
+ * for while both are full, and the jobs
+ * already asked for are kept whatever
+ * the budget.
+ *
+ * Every job in the cache goes to one
+ * client, the first that asks for a job
+ * of its type, like jobs of a queue on
+ * the server, and its frame is freed as
+ * it is sent. Jobs of a type no client
+ * connected takes, left over from
+ * clients gone, are moved to the end of
+ * the cache once they reach its start,
+ * so they don't hold on to the jobs
+ * behind them, and don't count against
+ * -MEMORY. With -BROADCAST every job
+ * goes to every client instead, and is
+ * kept until each client connected has
+ * been sent it, so the server sends it
+ * across once for all of them. A client
+ * that connects gets what the cache
+ * still has.
+ *
+ * Clients' subscriptions and filters,
+ * see protocol.h, apply in the relay;
+ * the relay takes every job. Results
+ * are passed on upstream with the job
+ * numbers of the relay's own session,
+ * and so are requests for the amount of
+ * jobs and reloads. Ranges, and queues
+ * other than the one relayed, set with
+ * -QUEUE upstream, aren't served.
+ *
+ * Once the server ends the session,
+ * clients get the same termination
+ * signal when the cache has nothing
+ * left for them. On CTRL+C clients are
+ * sent termination signal 6 and the
+ * relay prints what went through it.
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+#include "colors.h"
+#include "transport.h"
+#include "sockopts.h"
+#include "protocol.h"
+#include "pool.h"
+#include "dedup.h"
+#include "budget.h"
+#include "match.h"
+
+#define RELAY_IN            (2*65536)
+#define RELAY_OUT_MAX       65536
+#define RELAY_FRAME_MAX     (65535+6)
+#define PREFETCH_DEFAULT    1024
+#define PREFETCH_MAX        (1 << 22)
+#define MEMORY_DEFAULT      (64*1024*1024)
+#define DISK_DEFAULT        1024
+#define LOG_MIN             1024
+#define COUNT_WAITERS       256
+#define SENT_MIN            64
+#define SENT_MAX            16384
+#define REPORTED_BITS       (1 << 20)
+
+#define CLIENT_OPEN         0
+#define CLIENT_ENDING       1
+#define CLIENT_FLUSH_CLOSE  2
+#define CLIENT_CLOSED       3
+
+#define TYPES_ALL           (FILTER_O | FILTER_E)
+
+struct outbuf {
+    char *data;
+    size_t len;
+    size_t sent;
+    size_t size;
+};
+
+struct cached {
+    char *frame;
+    off_t offset;
+    uint32_t len;
+    uint64_t number;
+    unsigned char type;
+    int taken;
+};
+
+struct client {
+    int socket;
+    unsigned long id;
+    int state;
+    long pending;
+    unsigned int types;
+    struct matcher *match;
+    uint64_t cursor;
+    char in_buf[REQUEST_BUFFER];
+    size_t in_len;
+    struct outbuf out;
+
+    uint64_t *sent;
+    size_t sent_size;
+    unsigned long sent_first;
+
+    unsigned long jobs_sent;
+    unsigned long long bytes_sent;
+    unsigned long jobs_filtered;
+    unsigned long requests;
+    unsigned long results;
+    struct client *next;
+};
+
+struct upstream {
+    int socket;
+    int done;
+    int term;
+    int finished;
+    char in[RELAY_IN];
+    size_t in_len;
+    struct outbuf out;
+    struct dedupcache dedup;
+    uint64_t asked;
+    uint64_t received;
+    unsigned long requests;
+    unsigned long refs;
+    unsigned long corrupt;
+    unsigned long results;
+    unsigned long results_dropped;
+    unsigned long long bytes;
+};
+
+/* Fields 		*/
+struct upstream up;
+struct client *clients;
+int client_count;
+unsigned long next_client_id;
+int listen_socket;
+int listen_tcp;
+char *server_host;
+char *server_port;
+int upstream_transport;
+int queue_id;
+int broadcast;
+uint64_t prefetch;
+int debug;
+
+struct cached *cache;
+size_t cache_size;
+uint64_t cache_first;
+uint64_t cache_next;
+uint64_t untaken;
+uint64_t untaken_types[2];
+unsigned int subscribed = TYPES_ALL;
+uint64_t type_head[2];
+unsigned long long jobs_served;
+uint64_t taken_cached;
+size_t untaken_bytes[2];
+struct budget memory;
+struct budget disk;
+int spill_fd;
+off_t spill_end;
+unsigned long spill_live;
+unsigned long spilled;
+
+unsigned char reported[REPORTED_BITS/8];
+unsigned long count_waiters[COUNT_WAITERS];
+int count_head;
+int count_len;
+volatile sig_atomic_t stop;
+
+/* Functions 	*/
+void usage(int argc, char* argv[]);
+int listenOn(char *address);
+int connectUpstream();
+void acceptClients();
+int appendOut(struct outbuf *out, const char *data, size_t len);
+int flushOut(int socket, struct outbuf *out);
+void sendUpstream(int message);
+void takeUpstream();
+int takeFrame(unsigned char *frame, int text_length);
+void takeControl(int kind, char *text, int length);
+int takeReference(char *ref, int length);
+void endUpstream(int term);
+void fetchJobs();
+unsigned int wantedTypes();
+void finishUpstream();
+int cacheJob(unsigned char job_info, char *text, int text_length);
+struct cached *cachedJob(uint64_t seq);
+struct cached *nextJob(struct client *client);
+void trimCache();
+void freeCached(struct cached *entry);
+void takeRequests(struct client *client);
+size_t handleRequest(struct client *client, char *data, size_t len);
+size_t takeResults(struct client *client, char *data, size_t len);
+void takeMatch(struct client *client, char *data, size_t len);
+void serveClient(struct client *client);
+int sendJob(struct client *client);
+int rememberJob(struct client *client, uint64_t number);
+uint64_t findJob(struct client *client, unsigned long id);
+void sendStats(struct client *client);
+void sendControl(struct client *client, int kind, char *text, int len);
+void sendTermSignal(struct client *client, int sig);
+void closeClient(struct client *client);
+void reapClients();
+void printClientStats(struct client *client);
+void printStats();
+void signalHandler(int sig);
+
+void errorPrint(char* string);
+void debugPrint(char* string, int debug);
+int getChecksum(char* string, int length);
+int portCheck(char* port);
+
+/* Main-function
+ * That connects to the server, listens
+ * for clients and relays jobs from the
+ * one to the others until interrupted.
+ *
+ * Input:
+ *     argc: amount of user arguments
+ *     argv: user arguments
+ * Return:
+ *     Returns 0 on success
+ *     1 on error.
+ *
+ */
+int main(int argc, char *argv[]){
+    usage(argc, argv);
+
+    struct sigaction sigint;
+    memset(&sigint, 0, sizeof(sigint));
+    sigint.sa_handler = signalHandler;
+    sigaction(SIGINT, &sigint, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    cache = calloc(LOG_MIN, sizeof(struct cached));
+    if(cache == NULL){
+        errorPrint("Out of memory for the cache.");
+        return 1;
+    }
+    cache_size = LOG_MIN;
+    up.socket = connectUpstream();
+    if(up.socket == -1){
+        errorPrint("Couldn't connect to the server.");
+        return 1;
+    }
+    listen_socket = listenOn(argv[1]);
+    if(listen_socket == -1){
+        close(up.socket);
+        return 1;
+    }
+    if(queue_id != 0){
+        sendUpstream('S' + ((unsigned int)queue_id << 8));
+    }
+    printf(COLOR_CYAN ">>%d<< Relaying %s%s%s to %s, prefetching %llu job(s), "
+           "%zu KB in memory%s, %s.", getpid(), server_host, server_port != NULL ? ":" : "",
+           server_port != NULL ? server_port : "", argv[1], (unsigned long long)prefetch,
+           memory.limit / 1024, spill_fd != -1 ? " and spilling to disk" : "",
+           broadcast ? "every job to every client" : "every job to one client");
+    printf(COLOR_RESET "\n");
+
+    while(!stop){
+        for(struct client *client = clients; client != NULL; client = client->next){
+            serveClient(client);
+        }
+        trimCache();
+        reapClients();
+        /* After the trim, so the memory of jobs
+         * just sent is refunded before asking. */
+        fetchJobs();
+        finishUpstream();
+        if(up.socket != -1 && flushOut(up.socket, &up.out) == -1){
+            errorPrint("Lost connection to the server.");
+            endUpstream(6);
+        }
+
+        struct pollfd fds[client_count+2];
+        fds[0].fd = listen_socket;
+        fds[0].events = POLLIN;
+        fds[1].fd = up.socket;
+        fds[1].events = POLLIN;
+        if(up.out.len > up.out.sent){
+            fds[1].events |= POLLOUT;
+        }
+        int n = 2;
+        for(struct client *client = clients; client != NULL; client = client->next, n++){
+            fds[n].fd = client->socket;
+            fds[n].events = 0;
+            /* Requests are left unread while the
+             * server is slow to take what they
+             * are passed on as. */
+            if(up.out.len - up.out.sent < RELAY_OUT_MAX){
+                fds[n].events |= POLLIN;
+            }
+            if(client->out.len > client->out.sent){
+                fds[n].events |= POLLOUT;
+            }
+        }
+        if(poll(fds, n, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            errorPrint("Error while waiting for events.");
+            break;
+        }
+        if(fds[0].revents & POLLIN){
+            acceptClients();
+        }
+        if(fds[1].revents & (POLLIN | POLLHUP | POLLERR)){
+            takeUpstream();
+        }
+        n = 2;
+        for(struct client *client = clients; client != NULL; client = client->next, n++){
+            if(fds[n].revents & (POLLIN | POLLHUP | POLLERR)){
+                takeRequests(client);
+            }
+            if(client->state != CLIENT_CLOSED && (fds[n].revents & POLLOUT) &&
+               flushOut(client->socket, &client->out) == -1){
+                debugPrint("Lost connection to client.", debug);
+                closeClient(client);
+            }
+        }
+    }
+
+    for(struct client *client = clients; client != NULL; client = client->next){
+        if(client->state == CLIENT_OPEN || client->state == CLIENT_ENDING){
+            sendTermSignal(client, 6);
+            flushOut(client->socket, &client->out);
+        }
+        closeClient(client);
+    }
+    reapClients();
+    if(up.socket != -1){
+        sendUpstream('Q');
+        flushOut(up.socket, &up.out);
+        close(up.socket);
+    }
+    printStats();
+    close(listen_socket);
+    return 0;
+}
+
+/* How the program treats
+ * arguments from user.
+ *
+ * Input:
+ *     argc: amount of args
+ *     argv: pointer to the args
+ * Return:
+ *     void
+ *
+ */
+void usage(int argc, char* argv[]){
+    prefetch = PREFETCH_DEFAULT;
+    spill_fd = -1;
+    char *spill_path = NULL;
+    initBudget(&memory, NULL, MEMORY_DEFAULT);
+    initBudget(&disk, NULL, (size_t)DISK_DEFAULT*1024*1024);
+    if(argc < 3){
+        errorPrint("Not enough program arguments supplied.");
+        errorPrint("./relay <port> <server hostname> <server port>");
+        errorPrint("./relay unix:<path> unix:<server path>");
+        exit(EXIT_FAILURE);
+    }
+    listen_tcp = transportType(argv[1]) == TRANSPORT_TCP;
+    upstream_transport = transportType(argv[2]);
+    server_host = argv[2];
+    int first_flag = 3;
+    if(upstream_transport == TRANSPORT_TCP){
+        if(argc < 4 || portCheck(argv[3]) == -1){
+            errorPrint("Please choose a server port from 1 to 6535.");
+            exit(EXIT_FAILURE);
+        }
+        server_port = argv[3];
+        first_flag = 4;
+    }
+    if(transportType(argv[1]) == TRANSPORT_SHM || upstream_transport == TRANSPORT_SHM ||
+       (listen_tcp && portCheck(argv[1]) == -1)){
+        errorPrint("Please choose a port from 1 to 6535, or unix:<path>.");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = first_flag; i < argc; i++){
+        if(strcmp("-DEBUG", argv[i]) == 0){
+            debug = 1;
+        }else if(strncmp("-PREFETCH=", argv[i], 10) == 0 && atoi(argv[i]+10) > 0 &&
+                 atoi(argv[i]+10) <= PREFETCH_MAX){
+            prefetch = atoi(argv[i]+10);
+        }else if(strncmp("-MEMORY=", argv[i], 8) == 0 && atoi(argv[i]+8) >= BUDGET_MIN/1024){
+            memory.limit = (size_t)atoi(argv[i]+8) * 1024;
+        }else if(strncmp("-SPILL=", argv[i], 7) == 0 && argv[i][7] != '\0'){
+            spill_path = argv[i]+7;
+        }else if(strncmp("-DISK=", argv[i], 6) == 0 && atoi(argv[i]+6) > 0){
+            disk.limit = (size_t)atoi(argv[i]+6) * 1024 * 1024;
+        }else if(strcmp("-BROADCAST", argv[i]) == 0){
+            broadcast = 1;
+        }else if(strncmp("-QUEUE=", argv[i], 7) == 0 && atoi(argv[i]+7) > 0 &&
+                 atoi(argv[i]+7) <= QUEUE_MAX_COUNT){
+            queue_id = atoi(argv[i]+7);
+        }else if(parseSockopt(argv[i]) == 0){
+        }else{
+            errorPrint("./relay <port> <server hostname> <server port>");
+            errorPrint("To keep more or fewer jobs ahead of the clients add '-PREFETCH=<jobs>'");
+            errorPrint("To bound the jobs cached in memory add '-MEMORY=<KB>', at least 64");
+            errorPrint("To cache the jobs past that on disk add '-SPILL=<path>' and '-DISK=<MB>'");
+            errorPrint("To send every job to every client add '-BROADCAST'");
+            errorPrint("To relay another queue than the server's first add '-QUEUE=<id>'");
+            errorPrint("To tune the sockets add '-NODELAY', '-SNDBUF=<n|auto>', '-RCVBUF=<n|auto>' or '-LOWAT=<n>'");
+            errorPrint("To print every client as it comes and goes add '-DEBUG'");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(spill_path != NULL){
+        spill_fd = open(spill_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if(spill_fd == -1){
+            errorPrint("Couldn't open the spill file.");
+            exit(EXIT_FAILURE);
+        }
+        unlink(spill_path);
+    }
+}
+
+/* Creates the socket clients connect
+ * to the relay on.
+ *
+ * Input:
+ *     address: port, or unix:<path>
+ * Return:
+ *     the socket, or -1 on error
+ */
+int listenOn(char *address){
+    if(!listen_tcp){
+        int sock = listenLocal(TRANSPORT_UNIX, transportPath(address));
+        if(sock == -1){
+            errorPrint("Couldn't listen on the relay's socket.");
+        }
+        return sock;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if(sock == -1){
+        errorPrint("Couldn't create the listening socket.");
+        return -1;
+    }
+    int optval = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    struct sockaddr_in address_in;
+    memset(&address_in, 0, sizeof(address_in));
+    address_in.sin_family = AF_INET;
+    address_in.sin_port = htons(atoi(address));
+    address_in.sin_addr.s_addr = INADDR_ANY;
+    if(bind(sock, (struct sockaddr *)&address_in, sizeof(address_in)) == -1 ||
+       listen(sock, SOMAXCONN) == -1){
+        errorPrint("Couldn't listen on the relay's port.");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Opens the relay's connection to the
+ * server, or to the next relay up, and
+ * makes it non-blocking.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     the socket, or -1 on error
+ */
+int connectUpstream(){
+    int sock = -1;
+    if(upstream_transport == TRANSPORT_UNIX){
+        sock = connectLocal(TRANSPORT_UNIX, transportPath(server_host));
+    }else{
+        struct addrinfo hints;
+        struct addrinfo *result, *rp;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        if(getaddrinfo(server_host, server_port, &hints, &result) != 0){
+            return -1;
+        }
+        for(rp = result; rp != NULL; rp = rp->ai_next){
+            sock = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC, rp->ai_protocol);
+            if(sock == -1){
+                continue;
+            }
+            if(connect(sock, rp->ai_addr, rp->ai_addrlen) != -1){
+                break;
+            }
+            close(sock);
+            sock = -1;
+        }
+        freeaddrinfo(result);
+    }
+    if(sock == -1){
+        return -1;
+    }
+    applySockopts(sock, upstream_transport == TRANSPORT_TCP);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    return sock;
+}
+
+/* Accepts every client waiting to
+ * connect. In broadcast mode a client
+ * starts at the oldest job cached.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void acceptClients(){
+    while(1){
+        int sock = accept4(listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(sock == -1){
+            return;
+        }
+        struct client *client = calloc(1, sizeof(struct client));
+        if(client == NULL){
+            errorPrint("Out of memory while accepting client.");
+            close(sock);
+            continue;
+        }
+        applySockopts(sock, listen_tcp);
+        client->socket = sock;
+        client->id = ++next_client_id;
+        client->types = TYPES_ALL;
+        client->cursor = cache_first;
+        client->next = clients;
+        clients = client;
+        client_count++;
+        if(debug){
+            printf(COLOR_CYAN ">>%d<< Client %lu connected.", getpid(), client->id);
+            printf(COLOR_RESET "\n");
+        }
+    }
+}
+
+/* Adds bytes to the end of an output
+ * buffer, growing it as needed.
+ *
+ * Input:
+ *     out:  the buffer
+ *     data: the bytes
+ *     len:  amount of bytes
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+int appendOut(struct outbuf *out, const char *data, size_t len){
+    if(out->len + len > out->size){
+        size_t size = out->size == 0 ? 4096 : out->size;
+        while(size < out->len + len){
+            size *= 2;
+        }
+        char *grown = realloc(out->data, size);
+        if(grown == NULL){
+            return -1;
+        }
+        out->data = grown;
+        out->size = size;
+    }
+    if(data != NULL){
+        memcpy(out->data+out->len, data, len);
+    }
+    out->len += len;
+    return 0;
+}
+
+/* Writes as much of an output buffer
+ * as the socket takes without blocking.
+ *
+ * Input:
+ *     socket: the socket
+ *     out:    the buffer
+ * Return:
+ *     0 on success, also if some is
+ *       left for later
+ *    -1 if the connection is lost
+ */
+int flushOut(int socket, struct outbuf *out){
+    while(out->sent < out->len){
+        ssize_t sent = send(socket, out->data+out->sent, out->len-out->sent,
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(sent == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+                return 0;
+            }
+            return -1;
+        }
+        out->sent += sent;
+    }
+    out->len = 0;
+    out->sent = 0;
+    return 0;
+}
+
+/* Queues a request to the server.
+ *
+ * Input:
+ *     message: 4-byte request
+ * Return:
+ *     void
+ */
+void sendUpstream(int message){
+    if(up.socket == -1){
+        return;
+    }
+    if(debug == 1){
+        printf(COLOR_CYAN ">>%d<< Sending message to server: %c", getpid(), (char)(message&255));
+        printf(COLOR_RESET "\n");
+    }
+    up.requests++;
+    if(appendOut(&up.out, (char *)&message, sizeof(message)) == -1){
+        errorPrint("Out of memory while messaging server.");
+    }
+}
+
+/* Reads what the server has sent, and
+ * takes every complete frame in it. A
+ * frame split across reads is kept
+ * until the rest arrives, like the
+ * frames of a range in client.c.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void takeUpstream(){
+    while(up.socket != -1){
+        ssize_t got = recv(up.socket, up.in+up.in_len, sizeof(up.in)-up.in_len, MSG_DONTWAIT);
+        if(got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+            if(!up.done){
+                errorPrint("Lost connection to the server.");
+            }
+            endUpstream(6);
+            return;
+        }
+        if(got == -1){
+            return;
+        }
+        up.in_len += got;
+        size_t used = 0;
+        while(up.in_len - used >= 1+sizeof(int)){
+            unsigned char *frame = (unsigned char *)up.in+used;
+            unsigned char job_type = frame[0] >> 5;
+            if(job_type != 0 && job_type != 1 && job_type != FRAME_CONTROL){
+                used += 1+sizeof(int);
+                endUpstream(job_type);
+                continue;
+            }
+            int text_length = 0;
+            for(int i = 0; i < (int)sizeof(int); i++){
+                int shuffle = 12 -(i*4);
+                text_length = text_length +(frame[i+1] << shuffle);
+            }
+            if(up.in_len - used < (size_t)text_length+6){
+                break;
+            }
+            used += text_length+6;
+            if(takeFrame(frame, text_length) == -1){
+                endUpstream(2);
+                return;
+            }
+        }
+        memmove(up.in, up.in+used, up.in_len-used);
+        up.in_len -= used;
+    }
+}
+
+/* Takes one complete frame from the
+ * server: caches a job, resolving it
+ * first if it is a reference to a job
+ * cached for dedup mode, or handles a
+ * control frame. A job whose checksum
+ * doesn't match is dropped, but still
+ * counts for the numbering of results.
+ *
+ * Input:
+ *     frame:       the frame
+ *     text_length: length of its text
+ * Return:
+ *     0 on success
+ *    -1 if the session can't go on
+ */
+int takeFrame(unsigned char *frame, int text_length){
+    unsigned char job_type = frame[0] >> 5;
+    char checksum = frame[0] & 31;
+    char *text = (char *)frame+1+sizeof(int);
+    up.bytes += text_length+6;
+    if(job_type == FRAME_CONTROL && checksum == CONTROL_REFERENCE){
+        return takeReference(text, text_length);
+    }
+    if(job_type == FRAME_CONTROL){
+        text[text_length] = '\0';
+        takeControl(checksum, text, text_length);
+        return 0;
+    }
+    up.received++;
+    if(checksum != getChecksum(text, text_length)){
+        errorPrint("Error! Checksum did not match. Dropping job.");
+        up.corrupt++;
+        return 0;
+    }
+    if(up.dedup.capacity > 0 && text_length <= DEDUP_TEXT_MAX &&
+       addDedup(&up.dedup, hashText(text, text_length), text, text_length) == -1){
+        errorPrint("Out of memory while caching job.");
+        return -1;
+    }
+    return cacheJob(frame[0], text, text_length);
+}
+
+/* Handles a control frame from the
+ * server. See protocol.h.
+ *
+ * Input:
+ *     kind:   kind of control message
+ *     text:   the message
+ *     length: length of the message
+ * Return:
+ *     void
+ */
+void takeControl(int kind, char *text, int length){
+    int capacity;
+    switch(kind){
+        case CONTROL_DEDUP:
+            capacity = atoi(text);
+            freeDedup(&up.dedup);
+            if(capacity < 1 || capacity > DEDUP_MAX || initDedup(&up.dedup, capacity, 1) == -1){
+                errorPrint("Couldn't set up the job cache for dedup mode.");
+                endUpstream(2);
+            }
+            break;
+        case CONTROL_COUNT:
+            if(count_len > 0){
+                unsigned long id = count_waiters[count_head];
+                count_head = (count_head+1) % COUNT_WAITERS;
+                count_len--;
+                for(struct client *client = clients; client != NULL; client = client->next){
+                    if(client->id == id && client->state == CLIENT_OPEN){
+                        sendControl(client, CONTROL_COUNT, text, length);
+                    }
+                }
+            }
+            break;
+        case CONTROL_HEARTBEAT:
+            debugPrint("Answering a heartbeat.", debug);
+            sendUpstream(REQUEST_HEARTBEAT);
+            break;
+        case CONTROL_STATS:
+        case CONTROL_NOTICE:
+            printf(COLOR_CYAN ">>%d<< Server: %s", getpid(), text);
+            printf(COLOR_RESET "\n");
+            break;
+        default:
+            if(debug == 1){
+                printf(COLOR_CYAN ">>%d<< Unknown control frame %d of %d byte(s).", getpid(), kind, length);
+                printf(COLOR_RESET "\n");
+            }
+            break;
+    }
+}
+
+/* Caches the job a reference frame from
+ * the server refers to, see dedup.c.
+ *
+ * Input:
+ *     ref:    text of the frame, the job
+ *             type and a dedupref
+ *     length: length of the text
+ * Return:
+ *     0 on success
+ *    -1 if the job isn't known
+ */
+int takeReference(char *ref, int length){
+    struct dedupref key;
+    up.received++;
+    if(length != 1+(int)sizeof(key)){
+        errorPrint("Malformed reference from server.");
+        return -1;
+    }
+    memcpy(&key, ref+1, sizeof(key));
+    struct dedupentry *entry = findDedup(&up.dedup, key.hash);
+    if(entry == NULL){
+        errorPrint("Server referred to a job that isn't cached.");
+        return -1;
+    }
+    up.refs++;
+    unsigned char job_info = ((ref[0] & 1) << 5) + getChecksum(entry->text, entry->len);
+    return cacheJob(job_info, entry->text, entry->len);
+}
+
+/* Ends the session with the server. The
+ * clients get the given termination
+ * signal once the cache has nothing
+ * left for them, see serveClient().
+ *
+ * Input:
+ *     term: the termination signal
+ * Return:
+ *     void
+ */
+void endUpstream(int term){
+    if(!up.done){
+        up.done = 1;
+        up.term = term;
+        if(term == 7){
+            debugPrint("Server out of jobs.", debug);
+        }else if(term == 5){
+            errorPrint("Server is full. Try again later.");
+        }else if(debug){
+            printf(COLOR_CYAN ">>%d<< Server ended the session with signal %d.", getpid(), term);
+            printf(COLOR_RESET "\n");
+        }
+    }
+    if(term == 6 && up.socket != -1){
+        close(up.socket);
+        up.socket = -1;
+    }
+}
+
+/* Asks the server for more jobs while
+ * fewer than -PREFETCH are cached or on
+ * their way, and the cache has room.
+ * Jobs are asked for a quarter of the
+ * prefetch or more at once. The relay
+ * subscribes to the types its clients
+ * take, see wantedTypes(), and cached
+ * jobs of other types, left over from
+ * clients gone, don't count, neither as
+ * jobs ahead nor against the memory
+ * budget, so they don't hold back the
+ * jobs of the clients connected.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void fetchJobs(){
+    if(up.socket == -1 || up.done){
+        return;
+    }
+    unsigned int wanted = wantedTypes();
+    if(wanted != subscribed){
+        sendUpstream(REQUEST_FILTER + (wanted << 8));
+        subscribed = wanted;
+    }
+    size_t left_over = 0;
+    for(int t = 0; t < 2; t++){
+        if(!(wanted & (1 << t))){
+            left_over += untaken_bytes[t];
+        }
+    }
+    if(budgetExhausted(&memory) && memory.used - left_over >= memory.limit &&
+       (spill_fd == -1 || budgetExhausted(&disk))){
+        return;
+    }
+    uint64_t ahead = up.asked - up.received;
+    if(broadcast){
+        ahead += cache_next - cache_first;
+    }else{
+        for(int t = 0; t < 2; t++){
+            if(wanted & (1 << t)){
+                ahead += untaken_types[t];
+            }
+        }
+    }
+    if(ahead + (prefetch+3)/4 > prefetch){
+        return;
+    }
+    sendUpstream('J' + (int)((prefetch - ahead) << 8));
+    up.asked += prefetch - ahead;
+}
+
+/* Finds the job types the relay's
+ * clients take, or every type if no
+ * client is connected.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     FILTER_O and FILTER_E bits
+ */
+unsigned int wantedTypes(){
+    unsigned int wanted = 0;
+    for(struct client *client = clients; client != NULL; client = client->next){
+        if(client->state != CLIENT_CLOSED){
+            wanted |= client->types;
+        }
+    }
+    return wanted != 0 ? wanted : TYPES_ALL;
+}
+
+/* Tells the server the relay is done,
+ * like the client does, once the server
+ * is out of jobs, the cache is empty and
+ * every client has ended its session,
+ * so the results of the last jobs are
+ * passed on before the server closes.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void finishUpstream(){
+    if(up.socket == -1 || !up.done || up.term != 7 || up.finished || client_count > 0 ||
+       (broadcast ? cache_next > cache_first : untaken > 0)){
+        return;
+    }
+    up.finished = 1;
+    sendUpstream('T');
+}
+
+/* Adds a job to the end of the cache,
+ * as a frame laid out like the server
+ * sends it. The frame is kept in memory,
+ * or written to the spill file if the
+ * memory budget is used up.
+ *
+ * Input:
+ *     job_info:    type and checksum
+ *     text:        the job's text
+ *     text_length: length of the text
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+int cacheJob(unsigned char job_info, char *text, int text_length){
+    if(cache_next - cache_first == cache_size){
+        struct cached *grown = calloc(cache_size*2, sizeof(struct cached));
+        if(grown == NULL){
+            errorPrint("Out of memory while caching job.");
+            return -1;
+        }
+        for(uint64_t seq = cache_first; seq < cache_next; seq++){
+            grown[seq & (cache_size*2-1)] = cache[seq & (cache_size-1)];
+        }
+        free(cache);
+        cache = grown;
+        cache_size *= 2;
+    }
+    char frame[RELAY_FRAME_MAX];
+    frame[0] = job_info;
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        frame[i+1] = (char)((text_length >> shuffle) & 15);
+    }
+    memcpy(frame+1+sizeof(int), text, text_length);
+    frame[text_length+5] = '\0';
+
+    struct cached *entry = &cache[cache_next & (cache_size-1)];
+    memset(entry, 0, sizeof(*entry));
+    entry->len = text_length+6;
+    entry->number = up.received;
+    reported[(up.received % REPORTED_BITS) / 8] &= ~(1 << (up.received % 8));
+    entry->type = job_info >> 5;
+    if(spill_fd != -1 && !budgetRoom(&memory, entry->len) &&
+       pwrite(spill_fd, frame, entry->len, spill_end) == entry->len){
+        entry->offset = spill_end;
+        spill_end += entry->len;
+        chargeBudget(&disk, entry->len);
+        spill_live++;
+        spilled++;
+    }else{
+        entry->frame = poolAlloc(entry->len);
+        if(entry->frame == NULL){
+            errorPrint("Out of memory while caching job.");
+            return -1;
+        }
+        memcpy(entry->frame, frame, entry->len);
+        chargeBudget(&memory, entry->len);
+        untaken_bytes[entry->type & 1] += entry->len;
+    }
+    cache_next++;
+    untaken++;
+    untaken_types[entry->type & 1]++;
+    return 0;
+}
+
+/* Finds a job in the cache by its place.
+ *
+ * Input:
+ *     seq: place of the job
+ * Return:
+ *     the job
+ */
+struct cached *cachedJob(uint64_t seq){
+    return &cache[seq & (cache_size-1)];
+}
+
+/* Finds the next job in the cache for
+ * a client: the oldest not yet taken of
+ * the types it takes, or in broadcast
+ * mode the next of them after the last
+ * one it was sent.
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     the job, or NULL if there is
+ *     none yet
+ */
+struct cached *nextJob(struct client *client){
+    if(broadcast){
+        uint64_t seq = client->cursor > cache_first ? client->cursor : cache_first;
+        while(seq < cache_next && !(client->types & (1 << cachedJob(seq)->type))){
+            seq++;
+        }
+        client->cursor = seq;
+        return seq < cache_next ? cachedJob(seq) : NULL;
+    }
+    uint64_t next = cache_next;
+    for(int t = 0; t < 2; t++){
+        if(!(client->types & (1 << t))){
+            continue;
+        }
+        uint64_t seq = type_head[t] > cache_first ? type_head[t] : cache_first;
+        while(seq < cache_next && (cachedJob(seq)->taken || cachedJob(seq)->type != t)){
+            seq++;
+        }
+        type_head[t] = seq;
+        if(seq < next){
+            next = seq;
+        }
+    }
+    return next < cache_next ? cachedJob(next) : NULL;
+}
+
+/* Drops the jobs at the start of the
+ * cache that are done with: taken, or
+ * in broadcast mode sent to every
+ * client connected. With no clients
+ * connected a broadcast keeps them.
+ * A job not taken whose type no client
+ * connected takes is moved to the end
+ * while taken jobs are left behind it.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void trimCache(){
+    uint64_t keep = cache_next;
+    unsigned int wanted = 0;
+    for(struct client *client = clients; client != NULL; client = client->next){
+        if(client->state != CLIENT_CLOSED){
+            wanted |= client->types;
+            if(broadcast && client->cursor < keep){
+                keep = client->cursor;
+            }
+        }
+    }
+    if(broadcast && wanted == 0){
+        return;
+    }
+    while(cache_first < keep){
+        struct cached *entry = cachedJob(cache_first);
+        if(broadcast){
+            untaken--;
+            untaken_types[entry->type & 1]--;
+            if(entry->frame != NULL){
+                untaken_bytes[entry->type & 1] -= entry->len;
+            }
+            freeCached(entry);
+        }else if(entry->taken){
+            taken_cached--;
+        }else if(taken_cached > 0 && !(wanted & (1 << entry->type))){
+            struct cached left = *entry;
+            cache_first++;
+            *cachedJob(cache_next++) = left;
+            continue;
+        }else{
+            break;
+        }
+        cache_first++;
+    }
+}
+
+/* Frees a cached job's frame, once it
+ * is sent or dropped. The spill file is
+ * emptied once none of the jobs written
+ * to it are left.
+ *
+ * Input:
+ *     entry: the job
+ * Return:
+ *     void
+ */
+void freeCached(struct cached *entry){
+    if(entry->frame != NULL){
+        poolFree(entry->frame);
+        refundBudget(&memory, entry->len);
+        entry->frame = NULL;
+        return;
+    }
+    if(--spill_live == 0){
+        if(ftruncate(spill_fd, 0) == -1){
+            errorPrint("Couldn't empty the spill file.");
+        }
+        spill_end = 0;
+        refundBudget(&disk, disk.used);
+    }
+}
+
+/* Reads what the client has sent, and
+ * handles every complete request in it,
+ * like takeRequests() in server.c.
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     void
+ */
+void takeRequests(struct client *client){
+    while(client->state != CLIENT_CLOSED){
+        ssize_t got = recv(client->socket, client->in_buf+client->in_len,
+                           sizeof(client->in_buf)-client->in_len, MSG_DONTWAIT);
+        if(got == 0){
+            debugPrint("Client closed the connection.", debug);
+            closeClient(client);
+            return;
+        }
+        if(got == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+                return;
+            }
+            debugPrint("Lost connection to client.", debug);
+            closeClient(client);
+            return;
+        }
+        client->in_len += got;
+        size_t used = 0;
+        while(client->state != CLIENT_CLOSED){
+            size_t consumed = handleRequest(client, client->in_buf+used, client->in_len-used);
+            if(consumed == 0){
+                break;
+            }
+            used += consumed;
+        }
+        memmove(client->in_buf, client->in_buf+used, client->in_len-used);
+        client->in_len -= used;
+    }
+}
+
+/* Handles one request from the start
+ * of the bytes received from a client,
+ * like handleRequest() in server.c.
+ * Requests for the amount of jobs and
+ * reloads are passed on to the server;
+ * ranges and unknown queues end the
+ * session like unfamiliar requests.
+ *
+ * Input:
+ *     client: the client
+ *     data:   received bytes
+ *     len:    amount of received bytes
+ * Return:
+ *     amount of bytes used, or 0 if
+ *     the request isn't complete yet
+ */
+size_t handleRequest(struct client *client, char *data, size_t len){
+    int client_message;
+    if(len < sizeof(client_message)){
+        return 0;
+    }
+    memcpy(&client_message, data, sizeof(client_message));
+    if((client_message & 255) == REQUEST_RESULTS){
+        return takeResults(client, data, len);
+    }
+    size_t used = sizeof(client_message);
+    if((client_message & 255) == REQUEST_MATCH &&
+       ((unsigned int)client_message >> 8) <= MATCH_REQUEST_MAX){
+        used += (unsigned int)client_message >> 8;
+        if(len < used){
+            return 0;
+        }
+    }
+    client->requests++;
+    char request = client_message & 255;
+    if(client->state != CLIENT_OPEN){
+        if(request == 'T' || request == 'E' || request == 'Q'){
+            closeClient(client);
+        }
+        return used;
+    }
+    switch(request){
+        case 'J':
+            if(client->pending != -1){
+                client->pending += client_message >> 8;
+            }
+            break;
+        case 'U':
+            client->pending = -1;
+            break;
+        case 'S':
+            if(((client_message >> 8) & QUEUE_MAX_COUNT) != 0){
+                errorPrint("Client selected a queue that isn't relayed.");
+                sendTermSignal(client, 3);
+            }
+            break;
+        case REQUEST_FILTER:
+            client->types = (client_message >> 8) & TYPES_ALL;
+            if(client->types == 0){
+                client->types = TYPES_ALL;
+            }
+            break;
+        case REQUEST_MATCH:
+            if(((unsigned int)client_message >> 8) > MATCH_REQUEST_MAX){
+                errorPrint("Client sent a filter that is too long.");
+                sendTermSignal(client, 3);
+                break;
+            }
+            takeMatch(client, data+sizeof(client_message), used-sizeof(client_message));
+            break;
+        case REQUEST_HEARTBEAT:
+            break;
+        case REQUEST_COUNT:
+            if(up.socket == -1 || count_len == COUNT_WAITERS){
+                sendControl(client, CONTROL_COUNT, "0", 1);
+                break;
+            }
+            count_waiters[(count_head+count_len) % COUNT_WAITERS] = client->id;
+            count_len++;
+            sendUpstream(REQUEST_COUNT);
+            break;
+        case 'I':
+            sendStats(client);
+            break;
+        case 'R':
+            sendUpstream('R');
+            sendControl(client, CONTROL_NOTICE, "Reload passed on to the server.", 31);
+            break;
+        case 'T':
+        case 'E':
+        case 'Q':
+            debugPrint("Client ended the session.", debug);
+            closeClient(client);
+            break;
+        default:
+            debugPrint("Unfamiliar or unrelayed request. Closing connection.", debug);
+            sendTermSignal(client, 3);
+            break;
+    }
+    return used;
+}
+
+/* Takes a batch of results from a client
+ * and passes it on to the server, with
+ * every job numbered like the server
+ * sent it to the relay. Results for
+ * jobs the relay doesn't know are
+ * dropped, and in broadcast mode so are
+ * all but the first result of a job.
+ *
+ * Input:
+ *     client: the client
+ *     data:   received bytes
+ *     len:    amount of received bytes
+ * Return:
+ *     amount of bytes used, or 0 if
+ *     the batch isn't complete yet
+ */
+size_t takeResults(struct client *client, char *data, size_t len){
+    int client_message;
+    memcpy(&client_message, data, sizeof(client_message));
+    unsigned int count = (unsigned int)client_message >> 8;
+    if(count > RESULT_BATCH_JOBS){
+        errorPrint("Client sent too many results at once.");
+        sendTermSignal(client, 3);
+        return len;
+    }
+    struct resultheader header;
+    size_t used = sizeof(client_message);
+    unsigned int complete = 0;
+    while(complete < count && used+sizeof(header) <= len){
+        memcpy(&header, data+used, sizeof(header));
+        if(used+sizeof(header)+header.len > len){
+            break;
+        }
+        used += sizeof(header)+header.len;
+        complete++;
+    }
+    if(complete < count){
+        if(len >= sizeof(client->in_buf)){
+            errorPrint("Client sent a batch of results larger than the request buffer.");
+            sendTermSignal(client, 3);
+            return len;
+        }
+        return 0;
+    }
+    client->requests++;
+    client->results += count;
+    if(up.socket == -1){
+        up.results_dropped += count;
+        return used;
+    }
+
+    size_t start = up.out.len;
+    if(appendOut(&up.out, NULL, used) == -1){
+        errorPrint("Out of memory while passing results on.");
+        return used;
+    }
+    size_t out = start+sizeof(client_message);
+    unsigned int kept = 0;
+    size_t offset = sizeof(client_message);
+    for(unsigned int i = 0; i < count; i++){
+        memcpy(&header, data+offset, sizeof(header));
+        char *text = data+offset+sizeof(header);
+        offset += sizeof(header)+header.len;
+        uint64_t number = findJob(client, header.job);
+        unsigned char *bit = &reported[(number % REPORTED_BITS) / 8];
+        if(number == 0 || (broadcast && (*bit & (1 << (number % 8))))){
+            up.results_dropped++;
+            continue;
+        }
+        *bit |= 1 << (number % 8);
+        header.job = number;
+        memcpy(up.out.data+out, &header, sizeof(header));
+        memcpy(up.out.data+out+sizeof(header), text, header.len);
+        out += sizeof(header)+header.len;
+        kept++;
+    }
+    if(kept == 0){
+        up.out.len = start;
+        return used;
+    }
+    int request = REQUEST_RESULTS + (kept << 8);
+    memcpy(up.out.data+start, &request, sizeof(request));
+    up.out.len = out;
+    up.results += kept;
+    up.requests++;
+    return used;
+}
+
+/* Sets a client's filter, like
+ * takeMatch() in server.c.
+ *
+ * Input:
+ *     client: the client
+ *     data:   the text of the request
+ *     len:    length of the text
+ * Return:
+ *     void
+ */
+void takeMatch(struct client *client, char *data, size_t len){
+    free(client->match);
+    client->match = NULL;
+    if(len == 0){
+        return;
+    }
+    client->match = malloc(sizeof(struct matcher));
+    if(client->match == NULL || parseMatch(client->match, data, len) == -1){
+        free(client->match);
+        client->match = NULL;
+        errorPrint("Client sent an invalid filter.");
+        sendTermSignal(client, 3);
+    }
+}
+
+/* Queues jobs from the cache on a client
+ * while it wants them and has less than
+ * RELAY_OUT_MAX queued, and sends what
+ * the socket takes. Once the socket took
+ * all of it, more is queued right away,
+ * as nothing is left to wait for. A
+ * client the cache has nothing left for
+ * once the server ended the session is
+ * sent the same termination signal.
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     void
+ */
+void serveClient(struct client *client){
+    int ret = 0;
+    do{
+        while(client->state == CLIENT_OPEN && client->pending != 0 &&
+              client->out.len - client->out.sent < RELAY_OUT_MAX){
+            ret = sendJob(client);
+            if(ret == 1 && up.done){
+                sendTermSignal(client, up.term);
+            }
+            if(ret != 0){
+                break;
+            }
+        }
+        if(client->state != CLIENT_CLOSED && flushOut(client->socket, &client->out) == -1){
+            debugPrint("Lost connection to client.", debug);
+            closeClient(client);
+            return;
+        }
+    }while(ret == 0 && client->state == CLIENT_OPEN && client->pending != 0 &&
+           client->out.len == 0);
+    if(client->state == CLIENT_FLUSH_CLOSE && client->out.len == 0){
+        closeClient(client);
+    }
+}
+
+/* Takes the next job in the cache for
+ * a client and queues its frame on it,
+ * unless it doesn't pass the client's
+ * filter, see takeMatch(). Like on the
+ * server, such a job is taken all the
+ * same.
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     -1 on error
+ *      0 if a job was taken
+ *      1 if there is none yet
+ */
+int sendJob(struct client *client){
+    struct cached *entry = nextJob(client);
+    if(entry == NULL){
+        return 1;
+    }
+    if(broadcast){
+        client->cursor++;
+    }else{
+        entry->taken = 1;
+        untaken--;
+        untaken_types[entry->type & 1]--;
+        if(entry->frame != NULL){
+            untaken_bytes[entry->type & 1] -= entry->len;
+        }
+        taken_cached++;
+    }
+    int ret = 0;
+    size_t start = client->out.len;
+    if(appendOut(&client->out, entry->frame, entry->len) == -1){
+        errorPrint("Out of memory while queueing job.");
+        ret = -1;
+    }else if(entry->frame == NULL &&
+             pread(spill_fd, client->out.data+start, entry->len, entry->offset) != entry->len){
+        errorPrint("Couldn't read a job back from the spill file.");
+        client->out.len = start;
+        ret = -1;
+    }
+    if(!broadcast){
+        freeCached(entry);
+    }
+    if(ret == -1){
+        return -1;
+    }
+    char *frame = client->out.data+start;
+    if(client->match != NULL && !matchText(client->match, frame+1+sizeof(int), entry->len-6)){
+        client->out.len = start;
+        client->jobs_filtered++;
+        return 0;
+    }
+    client->jobs_sent++;
+    client->bytes_sent += entry->len;
+    jobs_served++;
+    if(client->pending > 0){
+        client->pending--;
+    }
+    if(rememberJob(client, entry->number) == -1){
+        errorPrint("Out of memory while remembering job.");
+    }
+    return 0;
+}
+
+/* Remembers which job of the relay's
+ * session was just sent to a client, in
+ * a ring like rememberJob() in
+ * connection.c.
+ *
+ * Input:
+ *     client: the client
+ *     number: the job's number in the
+ *             relay's session
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+int rememberJob(struct client *client, uint64_t number){
+    unsigned long id = client->jobs_sent;
+    if(client->sent_first == 0){
+        client->sent_first = id;
+    }
+    if(id - client->sent_first >= client->sent_size){
+        if(client->sent_size >= SENT_MAX){
+            client->sent_first++;
+        }else{
+            size_t size = client->sent_size == 0 ? SENT_MIN : client->sent_size*2;
+            uint64_t *grown = malloc(size*sizeof(uint64_t));
+            if(grown == NULL){
+                return -1;
+            }
+            for(unsigned long old = client->sent_first; old < id; old++){
+                grown[old & (size-1)] = client->sent[old & (client->sent_size-1)];
+            }
+            free(client->sent);
+            client->sent = grown;
+            client->sent_size = size;
+        }
+    }
+    client->sent[id & (client->sent_size-1)] = number;
+    return 0;
+}
+
+/* Finds the number in the relay's
+ * session of a job sent to a client,
+ * and forgets it and every job sent
+ * before it.
+ *
+ * Input:
+ *     client: the client
+ *     id:     number of the job on the
+ *             client's connection
+ * Return:
+ *     the number, or 0 if it isn't
+ *     known
+ */
+uint64_t findJob(struct client *client, unsigned long id){
+    if(client->sent_size == 0 || id < client->sent_first || id > client->jobs_sent){
+        return 0;
+    }
+    client->sent_first = id+1;
+    return client->sent[id & (client->sent_size-1)];
+}
+
+/* Queues a control frame with the
+ * stats of a client's session and of
+ * the relay's cache.
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     void
+ */
+void sendStats(struct client *client){
+    char text[512];
+    int len = snprintf(text, sizeof(text),
+        "Client %lu: %lu job(s), %llu byte(s) sent, %ld pending, %lu filtered, "
+        "%lu request(s), %lu result(s). Relay: %llu job(s) cached, %zu byte(s) in memory, "
+        "%zu on disk, %llu job(s) sent, %d client(s) connected.",
+        client->id, client->jobs_sent, client->bytes_sent, client->pending,
+        client->jobs_filtered, client->requests, client->results,
+        (unsigned long long)(cache_next - cache_first), memory.used, disk.used,
+        jobs_served, client_count);
+    sendControl(client, CONTROL_STATS, text, len);
+}
+
+/* Queues a control frame on a client,
+ * laid out like controlFrame() in
+ * server.c lays it out.
+ *
+ * Input:
+ *     client: the client
+ *     kind:   kind of control message
+ *     text:   the message
+ *     len:    length of the message
+ * Return:
+ *     void
+ */
+void sendControl(struct client *client, int kind, char *text, int len){
+    char header[1+sizeof(int)];
+    header[0] = (FRAME_CONTROL << 5) + kind;
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        header[i+1] = (char)((len >> shuffle) & 15);
+    }
+    if(appendOut(&client->out, header, sizeof(header)) == -1 ||
+       appendOut(&client->out, text, len) == -1 ||
+       appendOut(&client->out, "", 1) == -1){
+        errorPrint("Out of memory while queueing control frame.");
+    }
+}
+
+/* Queues a termination signal on a
+ * client, see sendTermSignal() in
+ * server.c. After 7, out of jobs, the
+ * relay waits for the client to end
+ * the session; otherwise the client is
+ * closed once the signal is sent.
+ *
+ * Input:
+ *     client: the client
+ *     sig:    integer error code
+ * Return:
+ *     void
+ */
+void sendTermSignal(struct client *client, int sig){
+    char term[1+sizeof(int)];
+    memset(term, 0, sizeof(term));
+    term[0] = sig << 5;
+    if(appendOut(&client->out, term, sizeof(term)) == -1){
+        closeClient(client);
+        return;
+    }
+    client->pending = 0;
+    client->state = sig == 7 ? CLIENT_ENDING : CLIENT_FLUSH_CLOSE;
+}
+
+/* Closes a client's connection. The
+ * client is freed by reapClients().
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     void
+ */
+void closeClient(struct client *client){
+    if(client->state == CLIENT_CLOSED){
+        return;
+    }
+    client->state = CLIENT_CLOSED;
+    close(client->socket);
+    if(debug){
+        printClientStats(client);
+    }
+}
+
+/* Frees every closed client.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void reapClients(){
+    struct client **link = &clients;
+    while(*link != NULL){
+        struct client *client = *link;
+        if(client->state != CLIENT_CLOSED){
+            link = &client->next;
+            continue;
+        }
+        *link = client->next;
+        free(client->out.data);
+        free(client->sent);
+        free(client->match);
+        free(client);
+        client_count--;
+    }
+}
+
+/* Prints what a client was sent.
+ *
+ * Input:
+ *     client: the client
+ * Return:
+ *     void
+ */
+void printClientStats(struct client *client){
+    printf(COLOR_CYAN ">>%d<< Client %lu: %lu job(s), %llu byte(s) sent, %lu filtered, "
+           "%lu request(s), %lu result(s).", getpid(), client->id, client->jobs_sent,
+           client->bytes_sent, client->jobs_filtered, client->requests, client->results);
+    printf(COLOR_RESET "\n");
+}
+
+/* Prints what came from the server, what
+ * went to the clients, and how full the
+ * cache got.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printStats(){
+    printf(COLOR_CYAN ">>%d<< Upstream: %llu job(s) of %llu asked for, %llu byte(s), "
+           "%lu reference(s), %lu corrupt, %lu request(s), %lu result(s) passed on, %lu dropped.",
+           getpid(), (unsigned long long)up.received, (unsigned long long)up.asked, up.bytes,
+           up.refs, up.corrupt, up.requests, up.results, up.results_dropped);
+    printf(COLOR_RESET "\n");
+    char budget[128];
+    describeBudget(&memory, budget, sizeof(budget));
+    printf(COLOR_CYAN ">>%d<< Cache: %llu job(s) sent to clients, %llu left, memory %s.",
+           getpid(), jobs_served, (unsigned long long)(cache_next - cache_first), budget);
+    printf(COLOR_RESET "\n");
+    if(spill_fd != -1){
+        describeBudget(&disk, budget, sizeof(budget));
+        printf(COLOR_CYAN ">>%d<< Spill: %lu job(s) written, disk %s.", getpid(), spilled, budget);
+        printf(COLOR_RESET "\n");
+    }
+}
+
+/* Signal handler that makes the
+ * relay end every session and stop
+ * when the user interrupts with
+ * CTRL+C.
+ *
+ * Input:
+ *     sig: integer signal
+ * Return:
+ *    void
+ */
+void signalHandler(int sig){
+    assert(sig == SIGINT);
+    stop = 1;
+}
@@ -0,0 +1,123 @@
+/* reload.c
+ *******************************************
+ * Reloads the job set the server was
+ * started with, on SIGHUP or when a
+ * client sends 'R'.
+ *
+ * The new set is loaded, and its job
+ * files indexed, by a thread of its own
+ * so the event loop keeps sending while
+ * it runs. When it is done the thread
+ * writes to an eventfd, and the event
+ * loop swaps the new set in between two
+ * events. Sessions keep the set they
+ * started on until they end, and new
+ * sessions get the new one. A set is
+ * freed when its last session ends,
+ * see releaseJobset() in jobqueue.c.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "reload.h"
+
+struct reload {
+    char path[PATH_MAX];
+    int index;
+    int notify_fd;
+    struct jobset *set;
+};
+
+static pthread_t reload_thread;
+static int reloading;
+static struct reload job;
+
+void errorPrint(char *string);
+
+/* Body of the reload thread.
+ *
+ * Input:
+ *     arg: the reload
+ * Return:
+ *     NULL
+ */
+static void *reloadJobs(void *arg){
+    struct reload *reload = arg;
+    struct jobset *set = calloc(1, sizeof(struct jobset));
+    if(set != NULL && loadJobset(set, reload->path) == -1){
+        free(set);
+        set = NULL;
+    }
+    if(set != NULL && reload->index && indexJobset(set) == -1){
+        closeJobset(set);
+        free(set);
+        set = NULL;
+    }
+    reload->set = set;
+    uint64_t one = 1;
+    write(reload->notify_fd, &one, sizeof(one));
+    return NULL;
+}
+
+/* Starts loading the job set at path
+ * in the background.
+ *
+ * Input:
+ *     path:      job file, directory or
+ *                @manifest, see jobqueue.c
+ *     index:     1 to index the job files
+ *                while loading
+ *     notify_fd: eventfd written to when
+ *                the new set is loaded
+ * Return:
+ *     RELOAD_STARTED on success
+ *     RELOAD_BUSY if a reload is running
+ *    -1 on error
+ */
+int startReload(char *path, int index, int notify_fd){
+    if(reloading){
+        return RELOAD_BUSY;
+    }
+    memset(&job, 0, sizeof(job));
+    snprintf(job.path, sizeof(job.path), "%s", path);
+    job.index = index;
+    job.notify_fd = notify_fd;
+
+    /* Signals are handled by the event loop only. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = pthread_create(&reload_thread, NULL, reloadJobs, &job);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(ret != 0){
+        errorPrint("Couldn't start reloading the job set.");
+        return -1;
+    }
+    reloading = 1;
+    return RELOAD_STARTED;
+}
+
+/* Waits for the reload thread, which
+ * is done once it has written to the
+ * eventfd, and takes the new set.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     the new set, or NULL if it
+ *     couldn't be loaded
+ */
+struct jobset *finishReload(){
+    if(!reloading){
+        return NULL;
+    }
+    pthread_join(reload_thread, NULL);
+    reloading = 0;
+    return job.set;
+}
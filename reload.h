@@ -0,0 +1,19 @@
+/* RELOAD.H
+ *
+ *****************************************
+ * Header file for reloading the job set
+ * while the server keeps serving.
+ *
+ */
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "jobqueue.h"
+
+#define RELOAD_STARTED      0
+#define RELOAD_BUSY         1
+
+int startReload(char *path, int index, int notify_fd);
+struct jobset *finishReload();
+
+#endif
@@ -0,0 +1,580 @@
+/* replay.c
+ ******************************************
+ * USAGE:
+ * Arguments: <trace> <port> -FAST -TIMEOUT=<ms>
+ *            <trace> unix:<path> -FAST -TIMEOUT=<ms>
+ *
+ * Plays a session trace, recorded by the
+ * server or client with -RECORD=<path>,
+ * back against a server on this host,
+ * and compares how it went with the
+ * recording.
+ *
+ * Every recorded session gets its own
+ * connection, opened and sending its
+ * requests at the times they were
+ * recorded. A request is never sent
+ * before the frames the recording got
+ * in answer to the requests before it
+ * have arrived, so 'T' doesn't overtake
+ * the jobs it ends. With -FAST requests
+ * are sent as soon as that allows.
+ *
+ * A session that gets no frame for
+ * -TIMEOUT ms (5000) while it is owed
+ * some is given up on.
+ *
+ * Latency is the time from a request
+ * to the first frame received after it.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "colors.h"
+#include "trace.h"
+#include "transport.h"
+#include "histogram.h"
+
+#define REPLAY_BUFFER       65536
+
+struct request {
+    uint64_t time_us;
+    int word;
+    char *payload;
+    uint32_t payload_len;
+    unsigned long frames;
+};
+
+struct session {
+    uint64_t id;
+    uint64_t connect_us;
+    struct request *requests;
+    size_t count;
+    size_t size;
+
+    int socket;
+    size_t next;
+    unsigned long owed;
+    int ended;
+    int done;
+    uint64_t sent_us;
+    int awaiting;
+    uint64_t last_frame_us;
+    unsigned char header[5];
+    size_t header_len;
+    size_t skip;
+};
+
+struct totals {
+    unsigned long frames;
+    unsigned long long bytes;
+    uint64_t duration_us;
+    struct histogram latency;
+};
+
+/* Fields 		*/
+struct session *sessions;
+int session_count;
+char *payloads;
+struct totals baseline;
+struct totals replayed;
+int fast;
+uint64_t timeout_us;
+char *address;
+int transport;
+unsigned long stalled;
+
+/* Functions 	*/
+void usage(int argc, char* argv[]);
+int loadSessions(char *path, struct traceheader *header);
+struct session *findSession(uint64_t id);
+int connectSession(struct session *session);
+void replaySessions();
+int sendDue(struct session *session, uint64_t now);
+int readFrames(struct session *session, uint64_t now);
+void takeBytes(struct session *session, unsigned char *data, size_t len, uint64_t now);
+void printComparison();
+void printRow(char *name, double before, double after);
+
+void errorPrint(char* string);
+int portCheck(char* port);
+uint64_t monotonicMicros();
+
+/* Main-function
+ * That loads the trace, replays it and
+ * prints how it compares.
+ *
+ * Input:
+ *     argc: amount of user arguments
+ *     argv: user arguments
+ * Return:
+ *     Returns 0 on success
+ *     1 on error.
+ *
+ */
+int main(int argc, char *argv[]){
+    usage(argc, argv);
+    struct traceheader header;
+    if(loadSessions(argv[1], &header) == -1){
+        return 1;
+    }
+    unsigned long requests = 0;
+    for(int i = 0; i < session_count; i++){
+        requests += sessions[i].count;
+    }
+    printf(COLOR_CYAN ">>%d<< Replaying %d session(s), %lu request(s) from a %s trace%s.",
+           getpid(), session_count, requests,
+           header.source == TRACE_SERVER ? "server" : "client", fast ? ", as fast as possible" : "");
+    printf(COLOR_RESET "\n");
+
+    replaySessions();
+    printComparison();
+
+    for(int i = 0; i < session_count; i++){
+        free(sessions[i].requests);
+    }
+    free(sessions);
+    free(payloads);
+    return 0;
+}
+
+/* How the program treats
+ * arguments from user.
+ *
+ * Input:
+ *     argc: amount of args
+ *     argv: pointer to the args
+ * Return:
+ *     void
+ *
+ */
+void usage(int argc, char* argv[]){
+    fast = 0;
+    timeout_us = 5000000;
+    if(argc < 3){
+        errorPrint("Not enough program arguments supplied.");
+        errorPrint("./replay <trace> <port> or ./replay <trace> unix:<path>");
+        exit(EXIT_FAILURE);
+    }
+    address = argv[2];
+    transport = transportType(address);
+    if(transport == TRANSPORT_SHM ||
+       (transport == TRANSPORT_TCP && portCheck(address) == -1)){
+        errorPrint("Please choose a port from 1 to 6535, or unix:<path>.");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 3; i < argc; i++){
+        if(strcmp("-FAST", argv[i]) == 0){
+            fast = 1;
+        }else if(strncmp("-TIMEOUT=", argv[i], 9) == 0 && atoi(argv[i]+9) > 0){
+            timeout_us = (uint64_t)atoi(argv[i]+9) * 1000;
+        }else{
+            errorPrint("./replay <trace> <port> or ./replay <trace> unix:<path>");
+            errorPrint("To send requests without the recorded pauses add '-FAST'");
+            errorPrint("To give up on a silent session sooner add '-TIMEOUT=<ms>'");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Splits a trace into its sessions,
+ * and works out the baseline: what was
+ * sent, how long it took, and how soon
+ * requests were answered.
+ *
+ * Input:
+ *     path:   the trace file
+ *     header: where to store its header
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int loadSessions(char *path, struct traceheader *header){
+    struct tracerecord *records;
+    size_t count;
+    if(readTrace(path, header, &records, &count, &payloads) == -1){
+        return -1;
+    }
+    if(count == 0){
+        errorPrint("The trace is empty.");
+        free(records);
+        return -1;
+    }
+    uint64_t last_us = records[0].time_us;
+    for(size_t r = 0; r < count; r++){
+        struct tracerecord *record = &records[r];
+        if(record->kind != TRACE_PAYLOAD){
+            last_us = record->time_us;
+        }
+        struct session *session = findSession(record->conn);
+        if(session == NULL){
+            free(records);
+            return -1;
+        }
+        switch(record->kind){
+            case TRACE_CONNECT:
+                session->connect_us = record->time_us;
+                break;
+            case TRACE_REQUEST:
+                if(session->count == session->size){
+                    session->size = session->size == 0 ? 64 : session->size*2;
+                    struct request *grown = realloc(session->requests,
+                                                    session->size*sizeof(struct request));
+                    if(grown == NULL){
+                        errorPrint("Out of memory while loading the trace.");
+                        free(records);
+                        return -1;
+                    }
+                    session->requests = grown;
+                }
+                session->requests[session->count].time_us = record->time_us;
+                session->requests[session->count].word = record->value;
+                session->requests[session->count].payload = NULL;
+                session->requests[session->count].payload_len = 0;
+                session->requests[session->count].frames = 0;
+                session->count++;
+                session->sent_us = record->time_us;
+                session->awaiting = 1;
+                break;
+            case TRACE_PAYLOAD:
+                if(session->count > 0){
+                    session->requests[session->count-1].payload = payloads + record->time_us;
+                    session->requests[session->count-1].payload_len = record->value;
+                }
+                break;
+            case TRACE_FRAME:
+                baseline.frames++;
+                baseline.bytes += record->value;
+                if(session->count > 0){
+                    session->requests[session->count-1].frames++;
+                }
+                if(session->awaiting){
+                    recordValue(&baseline.latency, record->time_us - session->sent_us);
+                    session->awaiting = 0;
+                }
+                break;
+        }
+    }
+    baseline.duration_us = last_us - records[0].time_us;
+    for(int i = 0; i < session_count; i++){
+        sessions[i].awaiting = 0;
+        sessions[i].socket = -1;
+    }
+    free(records);
+    return 0;
+}
+
+/* Looks up the session with an id,
+ * adding it if it is new.
+ *
+ * Input:
+ *     id: session id from the trace
+ * Return:
+ *     the session, or NULL if
+ *     out of memory
+ */
+struct session *findSession(uint64_t id){
+    for(int i = 0; i < session_count; i++){
+        if(sessions[i].id == id){
+            return &sessions[i];
+        }
+    }
+    struct session *grown = realloc(sessions, (session_count+1)*sizeof(struct session));
+    if(grown == NULL){
+        errorPrint("Out of memory while loading the trace.");
+        return NULL;
+    }
+    sessions = grown;
+    struct session *session = &sessions[session_count++];
+    memset(session, 0, sizeof(struct session));
+    session->id = id;
+    return session;
+}
+
+/* Connects a session to the server
+ * over loopback or the unix socket.
+ *
+ * Input:
+ *     session: the session
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int connectSession(struct session *session){
+    int sock;
+    if(transport == TRANSPORT_UNIX){
+        sock = connectLocal(transport, transportPath(address));
+    }else{
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in server_address;
+        memset(&server_address, 0, sizeof(server_address));
+        server_address.sin_family = AF_INET;
+        server_address.sin_port = htons(atoi(address));
+        server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(sock != -1 &&
+           connect(sock, (struct sockaddr *)&server_address, sizeof(server_address)) == -1){
+            close(sock);
+            sock = -1;
+        }
+    }
+    if(sock == -1){
+        errorPrint("Couldn't connect to the server.");
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    session->socket = sock;
+    return 0;
+}
+
+/* Runs every session until it has sent
+ * all its requests and got everything
+ * it is owed, its server ended it, or
+ * it stalled.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void replaySessions(){
+    struct pollfd *fds = calloc(session_count, sizeof(struct pollfd));
+    if(fds == NULL){
+        errorPrint("Out of memory while replaying.");
+        return;
+    }
+    uint64_t start = monotonicMicros();
+    int running = session_count;
+    while(running > 0){
+        uint64_t now = monotonicMicros() - start;
+        int wait_ms = 100;
+        for(int i = 0; i < session_count; i++){
+            struct session *session = &sessions[i];
+            fds[i].fd = -1;
+            fds[i].events = POLLIN;
+            if(session->done){
+                continue;
+            }
+            if(session->socket == -1){
+                if(!fast && now < session->connect_us){
+                    uint64_t ms = (session->connect_us - now)/1000;
+                    wait_ms = (int)ms < wait_ms ? (int)ms : wait_ms;
+                    continue;
+                }
+                if(connectSession(session) == -1){
+                    session->done = 1;
+                    running--;
+                    continue;
+                }
+                session->last_frame_us = now;
+            }
+            if(sendDue(session, now) == -1 ||
+               (session->owed > 0 && !session->ended && now - session->last_frame_us > timeout_us)){
+                if(session->owed > 0 && !session->ended){
+                    stalled++;
+                }
+                session->ended = 1;
+            }
+            if(session->next == session->count && (session->owed == 0 || session->ended)){
+                close(session->socket);
+                session->done = 1;
+                running--;
+                continue;
+            }
+            if(session->next < session->count && (session->owed == 0 || session->ended) && !fast){
+                uint64_t due = session->requests[session->next].time_us;
+                uint64_t ms = due > now ? (due-now)/1000 : 0;
+                wait_ms = (int)ms < wait_ms ? (int)ms : wait_ms;
+            }
+            fds[i].fd = session->socket;
+        }
+        if(running == 0){
+            break;
+        }
+        if(poll(fds, session_count, wait_ms) == -1 && errno != EINTR){
+            errorPrint("Error while waiting for frames.");
+            break;
+        }
+        now = monotonicMicros() - start;
+        for(int i = 0; i < session_count; i++){
+            if(fds[i].fd != -1 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))){
+                if(readFrames(&sessions[i], now) == -1){
+                    sessions[i].ended = 1;
+                }
+            }
+        }
+    }
+    replayed.duration_us = monotonicMicros() - start;
+    free(fds);
+}
+
+/* Sends every request of a session that
+ * is due and no longer waits on frames
+ * owed for the requests before it, with
+ * the payload recorded for it, if any.
+ *
+ * Input:
+ *     session: the session
+ *     now:     time since the replay began
+ * Return:
+ *     0 on success
+ *    -1 if the connection is lost
+ */
+int sendDue(struct session *session, uint64_t now){
+    while(session->next < session->count && (session->owed == 0 || session->ended)){
+        struct request *request = &session->requests[session->next];
+        if(!fast && now < request->time_us){
+            return 0;
+        }
+        struct iovec iov[2] = {{&request->word, sizeof(int)},
+                               {request->payload, request->payload_len}};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = request->payload_len > 0 ? 2 : 1;
+        if(sendmsg(session->socket, &msg, MSG_NOSIGNAL) != (ssize_t)(sizeof(int)+request->payload_len)){
+            return -1;
+        }
+        session->next++;
+        session->owed += request->frames;
+        session->sent_us = now;
+        session->awaiting = 1;
+        session->last_frame_us = now;
+    }
+    return 0;
+}
+
+/* Reads what the server has sent a
+ * session and counts its frames.
+ *
+ * Input:
+ *     session: the session
+ *     now:     time since the replay began
+ * Return:
+ *     0 on success
+ *    -1 if the server closed the connection
+ */
+int readFrames(struct session *session, uint64_t now){
+    unsigned char buf[REPLAY_BUFFER];
+    while(1){
+        ssize_t got = recv(session->socket, buf, sizeof(buf), 0);
+        if(got == 0){
+            return -1;
+        }
+        if(got == -1){
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        takeBytes(session, buf, got, now);
+    }
+}
+
+/* Walks through received bytes frame by
+ * frame. Only the 5 header bytes of a
+ * frame are looked at; the rest is
+ * skipped.
+ *
+ * Input:
+ *     session: the session
+ *     data:    received bytes
+ *     len:     amount of bytes
+ *     now:     time since the replay began
+ * Return:
+ *     void
+ */
+void takeBytes(struct session *session, unsigned char *data, size_t len, uint64_t now){
+    size_t pos = 0;
+    while(pos < len){
+        if(session->skip > 0){
+            size_t take = len-pos < session->skip ? len-pos : session->skip;
+            session->skip -= take;
+            pos += take;
+        }else{
+            session->header[session->header_len++] = data[pos++];
+            if(session->header_len < sizeof(session->header)){
+                continue;
+            }
+            session->header_len = 0;
+            int type = session->header[0] >> 5;
+            size_t frame_len = 5;
+            if(type == 0 || type == 1 || type == 4){
+                unsigned int text_length = 0;
+                for(int i = 0; i < 4; i++){
+                    text_length = (text_length << 4) | (session->header[i+1] & 15);
+                }
+                frame_len = text_length + 6;
+                session->skip = text_length + 1;
+            }else{
+                session->ended = 1;
+            }
+            replayed.frames++;
+            replayed.bytes += frame_len;
+        }
+        if(session->skip == 0 && session->header_len == 0){
+            if(session->awaiting){
+                recordValue(&replayed.latency, now - session->sent_us);
+                session->awaiting = 0;
+            }
+            if(session->owed > 0){
+                session->owed--;
+            }
+            session->last_frame_us = now;
+        }
+    }
+}
+
+/* Prints the baseline and the replay
+ * side by side.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printComparison(){
+    struct totals *runs[2] = {&baseline, &replayed};
+    double rate[2];
+    for(int i = 0; i < 2; i++){
+        double seconds = runs[i]->duration_us / 1000000.0;
+        rate[i] = seconds > 0 ? runs[i]->bytes / 1024.0 / seconds : 0;
+    }
+    printf(COLOR_CYAN ">>%d<< %-18s %14s %14s %9s", getpid(), "", "baseline", "replay", "change");
+    printf(COLOR_RESET "\n");
+    printRow("frames", baseline.frames, replayed.frames);
+    printRow("bytes", baseline.bytes, replayed.bytes);
+    printRow("duration ms", baseline.duration_us / 1000.0, replayed.duration_us / 1000.0);
+    printRow("throughput KB/s", rate[0], rate[1]);
+    printRow("latency p50 ms", valueAtPercentile(&baseline.latency, 50) / 1000.0,
+             valueAtPercentile(&replayed.latency, 50) / 1000.0);
+    printRow("latency p99 ms", valueAtPercentile(&baseline.latency, 99) / 1000.0,
+             valueAtPercentile(&replayed.latency, 99) / 1000.0);
+    printRow("latency max ms", baseline.latency.max / 1000.0, replayed.latency.max / 1000.0);
+    if(stalled > 0){
+        printf(COLOR_RED ">>%d<< %lu session(s) stalled waiting for frames.", getpid(), stalled);
+        printf(COLOR_RESET "\n");
+    }
+}
+
+/* Prints one row of the comparison.
+ *
+ * Input:
+ *     name:   what is compared
+ *     before: baseline value
+ *     after:  replayed value
+ * Return:
+ *     void
+ */
+void printRow(char *name, double before, double after){
+    printf(COLOR_CYAN ">>%d<< %-18s %14.3f %14.3f", getpid(), name, before, after);
+    if(before > 0){
+        printf(" %+8.1f%%", (after-before) * 100.0 / before);
+    }
+    printf(COLOR_RESET "\n");
+}
@@ -0,0 +1,297 @@
+/* results.c
+ *******************************************
+ * Writes the results clients send back
+ * for their jobs to the file given with
+ * -RESULTS=<path>, one line per result:
+ *
+ *     <queue>\t<job>\t<client>\t<status>\t<result>
+ *
+ * where <job> is the number of the job
+ * in its queue's file, counting from 0.
+ *
+ * The event loop only formats the lines
+ * of a batch into a pooled buffer and
+ * queues it. A thread of its own copies
+ * the queued batches into a staging
+ * buffer and writes it to the end of the
+ * file once it is full or the queue runs
+ * empty, so a slow disk never holds up
+ * sending jobs, and a busy server writes
+ * the file in large appends.
+ * If the disk falls more than
+ * RESULTS_BACKLOG behind, batches are
+ * dropped and counted instead.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "colors.h"
+#include "results.h"
+#include "pool.h"
+
+static pthread_t writer_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static struct resultbatch *head;
+static struct resultbatch *tail;
+static size_t backlog;
+static int results_fd = -1;
+static int stop;
+
+static size_t peak_backlog;
+static unsigned long results_received;
+static unsigned long results_written;
+static unsigned long results_dropped;
+static unsigned long long bytes_written;
+static unsigned long writes;
+
+void errorPrint(char *string);
+
+/* Writes all of a buffer to the
+ * results file, retrying writes
+ * interrupted by a signal.
+ *
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+static int writeAll(char *buf, size_t len){
+    while(len > 0){
+        ssize_t done = write(results_fd, buf, len);
+        if(done == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        buf += done;
+        len -= done;
+    }
+    return 0;
+}
+
+/* Writes the staging buffer to the
+ * results file and counts it, with
+ * the lock held by the caller. The
+ * lock is let go during the write.
+ *
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+static int writeStaged(char *staging, size_t *staged, unsigned long *staged_results){
+    size_t len = *staged;
+    unsigned long count = *staged_results;
+    *staged = 0;
+    *staged_results = 0;
+    pthread_mutex_unlock(&lock);
+    int ret = writeAll(staging, len);
+    pthread_mutex_lock(&lock);
+    writes++;
+    if(ret == 0){
+        bytes_written += len;
+        results_written += count;
+    }else{
+        results_dropped += count;
+    }
+    return ret;
+}
+
+/* Body of the writer thread. Takes
+ * every queued batch at once, and
+ * writes when the staging buffer is
+ * full or nothing more is queued.
+ * After a failed write the rest is
+ * only counted as dropped.
+ *
+ * Input:
+ *     arg: unused
+ * Return:
+ *     NULL
+ */
+static void *writeResults(void *arg){
+    (void)arg;
+    char *staging = malloc(RESULTS_STAGING);
+    size_t staged = 0;
+    unsigned long staged_results = 0;
+    int failed = staging == NULL;
+    pthread_mutex_lock(&lock);
+    while(1){
+        while(head == NULL && !stop){
+            pthread_cond_wait(&wake, &lock);
+        }
+        if(head == NULL){
+            break;
+        }
+        struct resultbatch *batch = head;
+        head = NULL;
+        tail = NULL;
+        while(batch != NULL){
+            struct resultbatch *next = batch->next;
+            backlog -= batch->len;
+            if(!failed && staged + batch->len > RESULTS_STAGING && staged > 0){
+                failed = writeStaged(staging, &staged, &staged_results) == -1;
+            }
+            if(failed){
+                results_dropped += batch->count;
+            }else{
+                memcpy(staging+staged, batch->data, batch->len);
+                staged += batch->len;
+                staged_results += batch->count;
+            }
+            poolFree(batch);
+            batch = next;
+        }
+        if(!failed && staged > 0 && head == NULL){
+            failed = writeStaged(staging, &staged, &staged_results) == -1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    if(failed){
+        errorPrint("Couldn't write to the results file.");
+    }
+    free(staging);
+    return NULL;
+}
+
+/* Opens the results file for appending
+ * and starts the writer thread.
+ *
+ * Input:
+ *     path: the results file, created
+ *           if it doesn't exist
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int openResults(char *path){
+    results_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(results_fd == -1){
+        errorPrint("Couldn't open the results file.");
+        return -1;
+    }
+    /* Signals are handled by the event loop only. */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = pthread_create(&writer_thread, NULL, writeResults, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(ret != 0){
+        errorPrint("Couldn't start writing results.");
+        close(results_fd);
+        results_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Gets a batch that can hold size
+ * bytes of result lines from the
+ * buffer pool.
+ *
+ * Input:
+ *     size: room for the lines
+ * Return:
+ *     the empty batch, or NULL if
+ *     out of memory
+ */
+struct resultbatch *newResultBatch(size_t size){
+    struct resultbatch *batch = poolAlloc(sizeof(struct resultbatch)+size);
+    if(batch == NULL){
+        return NULL;
+    }
+    batch->next = NULL;
+    batch->count = 0;
+    batch->len = 0;
+    return batch;
+}
+
+/* Hands a batch of result lines to the
+ * writer thread, which frees it once
+ * written. Without a results file the
+ * results are only counted.
+ *
+ * Input:
+ *     batch: the filled batch
+ * Return:
+ *     void
+ */
+void queueResults(struct resultbatch *batch){
+    results_received += batch->count;
+    if(results_fd == -1 || batch->count == 0){
+        poolFree(batch);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if(backlog + batch->len > RESULTS_BACKLOG){
+        results_dropped += batch->count;
+        pthread_mutex_unlock(&lock);
+        poolFree(batch);
+        return;
+    }
+    backlog += batch->len;
+    if(backlog > peak_backlog){
+        peak_backlog = backlog;
+    }
+    if(tail == NULL){
+        head = batch;
+    }else{
+        tail->next = batch;
+    }
+    tail = batch;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Writes out every queued result,
+ * stops the writer thread and closes
+ * the results file.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void closeResults(){
+    if(results_fd == -1){
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stop = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writer_thread, NULL);
+    close(results_fd);
+    results_fd = -1;
+}
+
+/* Prints how many results were
+ * received and written, and how far
+ * behind the writer thread has been.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printResultStats(){
+    pthread_mutex_lock(&lock);
+    unsigned long written = results_written;
+    unsigned long long bytes = bytes_written;
+    unsigned long calls = writes;
+    unsigned long dropped = results_dropped;
+    size_t queued = backlog;
+    pthread_mutex_unlock(&lock);
+    printf(COLOR_CYAN ">>%d<< Results: %lu received, %lu written in %lu write(s) "
+           "(%llu byte(s)), %lu dropped, backlog %zu byte(s), peak %zu.",
+           getpid(), results_received, written, calls, bytes,
+           dropped, queued, peak_backlog);
+    printf(COLOR_RESET "\n");
+}
@@ -0,0 +1,30 @@
+/* RESULTS.H
+ *
+ *****************************************
+ * Header file for the results file the
+ * server writes the results clients send
+ * back for their jobs to.
+ *
+ */
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+
+#define RESULTS_STAGING     (1024*1024)
+#define RESULTS_BACKLOG     (64*1024*1024)
+
+struct resultbatch {
+    struct resultbatch *next;
+    unsigned long count;
+    size_t len;
+    char data[];
+};
+
+int openResults(char *path);
+struct resultbatch *newResultBatch(size_t size);
+void queueResults(struct resultbatch *batch);
+void closeResults();
+void printResultStats();
+
+#endif
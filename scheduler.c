@@ -0,0 +1,523 @@
+/* scheduler.c
+ *******************************************
+ * Priority scheduler for the jobs of one
+ * queue. The job file is indexed as it is
+ * scanned, and every complete record is
+ * put in the FIFO of its priority class
+ * and type, stamped with the time of the
+ * scan that found it.
+ *
+ * A record may be prefixed with 'P' and
+ * one byte holding its priority class:
+ *
+ *     0 - urgent
+ *     1 - normal (records without prefix)
+ *     2 - bulk
+ *
+ * The next job is the head of the class
+ * FIFO with the earliest deadline, where
+ * the deadline is the time the job was
+ * queued plus class * aging_us. A job
+ * waiting longer than that overtakes
+ * newer jobs of better classes, so no
+ * class starves. Since every job in a
+ * class gets the same delay, each FIFO
+ * stays in deadline order and picking a
+ * job is O(1). The jobs of one scan are
+ * queued at the same time, so the jobs
+ * of a window are sent in class order;
+ * only jobs scanned later are overtaken
+ * by older ones.
+ *
+ * At most bulk_cap bulk jobs are sent in
+ * a row while other jobs are waiting,
+ * once bulk jobs have aged past them.
+ *
+ * Every class keeps one FIFO per job
+ * type, so a client that only takes some
+ * types gets the next job of those
+ * without the others being looked at.
+ *
+ * The file isn't indexed whole: every
+ * type has a scan cursor of its own and
+ * at most SCHED_WINDOW jobs of it are
+ * queued at once, so the memory used
+ * doesn't grow with the file. A type is
+ * scanned further once its window
+ * drains to half, and only while some
+ * client takes it, so the jobs of a type
+ * nobody takes are neither queued nor
+ * kept; they are found by the scan once
+ * a client does take them.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "colors.h"
+#include "scheduler.h"
+#include "pool.h"
+
+uint64_t aging_us = 1000000;
+unsigned long bulk_cap = 64;
+
+void errorPrint(char *string);
+uint64_t monotonicMicros();
+
+/* Appends a job to a class FIFO,
+ * growing it or moving the live
+ * entries to the front when full.
+ *
+ * Input:
+ *     fifo: the FIFO
+ *     job:  the job to append
+ * Return:
+ *     0 on success
+ *    -1 if out of memory
+ */
+static int pushJob(struct jobfifo *fifo, struct jobentry *job){
+    if(fifo->tail == fifo->size){
+        if(fifo->head > fifo->size/2){
+            memmove(fifo->entries, fifo->entries+fifo->head,
+                    (fifo->tail-fifo->head)*sizeof(struct jobentry));
+            fifo->tail -= fifo->head;
+            fifo->head = 0;
+        }else{
+            long size = fifo->size == 0 ? 1024 : fifo->size*2;
+            struct jobentry *grown = realloc(fifo->entries, size*sizeof(struct jobentry));
+            if(grown == NULL){
+                return -1;
+            }
+            fifo->entries = grown;
+            fifo->size = size;
+        }
+    }
+    fifo->entries[fifo->tail++] = *job;
+    return 0;
+}
+
+/* Reads exactly len bytes at offset
+ * from the file.
+ *
+ * Return:
+ *     0 on success
+ *    -1 if the bytes aren't there (yet)
+ */
+static int readAt(int fd, void *buf, size_t len, long offset){
+    size_t done = 0;
+    while(done < len){
+        ssize_t got = pread(fd, (char*)buf+done, len-done, offset+done);
+        if(got <= 0){
+            return -1;
+        }
+        done += got;
+    }
+    return 0;
+}
+
+/* Finds the record at offset in the
+ * job file: where its type byte is,
+ * its type and priority class, and where
+ * the next record starts. A record with
+ * an invalid text length ends the file,
+ * and one with an invalid type is filed
+ * as 'O', both left for sendJob() to
+ * report.
+ *
+ * Return:
+ *     1 if a record was found
+ *     0 if it isn't complete yet
+ *    -1 if its priority is invalid
+ */
+static int findRecord(int fd, long size, long offset, struct jobentry *job, long *next){
+    unsigned char header[2];
+    unsigned int text_length;
+    job->offset = offset;
+    job->priority = PRIORITY_NORMAL;
+    job->prefix = 0;
+    job->frame = NULL;
+    if(readAt(fd, header, 2, job->offset) == -1){
+        return 0;
+    }
+    if(header[0] == 'P'){
+        if(header[1] >= PRIORITY_CLASSES){
+            errorPrint("Invalid priority class. Inspect job file.");
+            return -1;
+        }
+        job->priority = header[1];
+        job->prefix = 2;
+        job->offset += 2;
+        if(readAt(fd, header, 1, job->offset) == -1){
+            return 0;
+        }
+    }
+    job->type = header[0] == 'E';
+    if(readAt(fd, &text_length, sizeof(int), job->offset+1) == -1){
+        return 0;
+    }
+    if(text_length < 1 || text_length > 1000000){
+        *next = size;
+        return 1;
+    }
+    *next = job->offset + 1 + sizeof(int) + text_length;
+    return *next <= size;
+}
+
+/* Indexes the complete records written
+ * to the job file past the scan cursors
+ * of the given types, in one pass, until
+ * the window of each type is full. A
+ * record that is still being written is
+ * left for a later scan.
+ *
+ * Input:
+ *     sched: the queue's scheduler
+ *     fd:    the queue's job file
+ *     types: bit 1 << type set for
+ *            every job type to scan
+ * Return:
+ *     amount of jobs added
+ *    -1 on error
+ */
+int scanJobs(struct scheduler *sched, int fd, unsigned int types){
+    struct stat st;
+    if(fstat(fd, &st) == -1){
+        return -1;
+    }
+    if(st.st_size != sched->size){
+        sched->size = st.st_size;
+        sched->partial = 0;
+    }
+    unsigned int scanning = 0;
+    long offset = sched->size;
+    for(int t = 0; t < JOB_TYPES; t++){
+        if((types & (1 << t)) && sched->queued[t] < SCHED_WINDOW && sched->scanned[t] < sched->size){
+            scanning |= 1 << t;
+            if(sched->scanned[t] < offset){
+                offset = sched->scanned[t];
+            }
+        }
+    }
+    uint64_t now = monotonicMicros();
+    int added = 0;
+    while(scanning != 0 && offset < sched->size){
+        struct jobentry job;
+        long next;
+        int found = findRecord(fd, sched->size, offset, &job, &next);
+        if(found == -1){
+            return -1;
+        }
+        if(found == 0){
+            sched->partial |= scanning;
+            break;
+        }
+        for(int t = 0; t < JOB_TYPES; t++){
+            if(!(scanning & (1 << t)) || sched->scanned[t] > offset){
+                continue;
+            }
+            if(job.type == t){
+                job.seq = sched->next_seq++;
+                job.enqueued_us = now;
+                if(pushJob(&sched->classes[job.priority][job.type], &job) == -1){
+                    errorPrint("Out of memory while indexing jobs.");
+                    return -1;
+                }
+                sched->queued[t]++;
+                added++;
+            }
+            sched->scanned[t] = next;
+            if(sched->queued[t] >= SCHED_WINDOW){
+                scanning &= ~(1 << t);
+            }
+        }
+        offset = next;
+    }
+    return added;
+}
+
+/* Checks without touching the job file
+ * if any of the given types should be
+ * scanned further: its window has
+ * drained to half, and the file held
+ * more of it at the last scan.
+ *
+ * Input:
+ *     sched: the queue's scheduler
+ *     types: bit 1 << type set for
+ *            every job type wanted
+ * Return:
+ *     1 if scanJobs() should be called
+ *     0 if not
+ */
+int scanDue(struct scheduler *sched, unsigned int types){
+    for(int t = 0; t < JOB_TYPES; t++){
+        if((types & (1 << t)) && !(sched->partial & (1 << t)) &&
+           sched->queued[t] < SCHED_WINDOW/2 && sched->scanned[t] < sched->size){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Adds the offset of every complete
+ * record written to the job file since
+ * the last call to an index of the
+ * file, in file order, so job n of
+ * the file can be read directly. The
+ * index is kept apart from the
+ * scheduler, as jobs read by their
+ * number aren't taken from the queue.
+ *
+ * Input:
+ *     index: the index
+ *     fd:    the job file
+ * Return:
+ *     amount of jobs added
+ *    -1 on error
+ */
+int indexJobs(struct jobindex *index, int fd){
+    struct stat st;
+    if(fstat(fd, &st) == -1){
+        return -1;
+    }
+    int added = 0;
+    while(index->scanned < st.st_size){
+        struct jobentry job;
+        long next;
+        int found = findRecord(fd, st.st_size, index->scanned, &job, &next);
+        if(found == -1){
+            return -1;
+        }
+        if(found == 0){
+            break;
+        }
+        if(index->count == index->size){
+            uint64_t size = index->size == 0 ? 1024 : index->size*2;
+            long *grown = realloc(index->offsets, size*sizeof(long));
+            if(grown == NULL){
+                errorPrint("Out of memory while indexing jobs.");
+                return -1;
+            }
+            index->offsets = grown;
+            index->size = size;
+        }
+        index->offsets[index->count++] = job.offset;
+        added++;
+        index->scanned = next;
+    }
+    return added;
+}
+
+/* Frees the index of a job file.
+ *
+ * Input:
+ *     index: the index
+ * Return:
+ *     void
+ */
+void freeIndex(struct jobindex *index){
+    free(index->offsets);
+    memset(index, 0, sizeof(struct jobindex));
+}
+
+/* Adds a job that was read ahead,
+ * see readahead.c, to the FIFO of
+ * its class, unless its type has been
+ * spilled, see spillJobs().
+ *
+ * Input:
+ *     sched: the queue's scheduler
+ *     job:   the job, with its offset,
+ *            prefix, priority and
+ *            frame set
+ *     end:   where its record ends
+ * Return:
+ *     0 on success
+ *     1 if jobs of its type are found
+ *       by scanJobs(), and it wasn't
+ *       queued
+ *    -1 if out of memory
+ */
+int addJob(struct scheduler *sched, struct jobentry *job, long end){
+    sched->ahead = end;
+    if(sched->spilled & (1 << job->type)){
+        return 1;
+    }
+    job->seq = sched->next_seq++;
+    job->enqueued_us = monotonicMicros();
+    if(pushJob(&sched->classes[job->priority][job->type], job) == -1){
+        return -1;
+    }
+    sched->queued[job->type]++;
+    return 0;
+}
+
+/* Drops the queued jobs of a type that
+ * come after the last one of it that was
+ * sent, and leaves them to scanJobs(),
+ * which picks the type up where the
+ * first of them starts. Jobs of the type
+ * read ahead from then on aren't queued.
+ * The frames of the jobs have to be let
+ * go of first.
+ * Jobs of a type come in file order, so
+ * the ones dropped end every FIFO.
+ *
+ * Input:
+ *     sched: the queue's scheduler
+ *     type:  the job type
+ * Return:
+ *     void
+ */
+void spillJobs(struct scheduler *sched, int type){
+    long resume = sched->spilled & (1 << type) ? sched->scanned[type] : sched->ahead;
+    for(int c = 0; c < PRIORITY_CLASSES; c++){
+        struct jobfifo *fifo = &sched->classes[c][type];
+        while(fifo->tail > fifo->head && fifo->entries[fifo->tail-1].offset >= sched->taken_past[type]){
+            struct jobentry *job = &fifo->entries[--fifo->tail];
+            if(job->offset - job->prefix < resume){
+                resume = job->offset - job->prefix;
+            }
+            sched->queued[type]--;
+        }
+        if(fifo->head == fifo->tail){
+            fifo->head = 0;
+            fifo->tail = 0;
+        }
+    }
+    sched->spilled |= 1 << type;
+    sched->partial &= ~(1 << type);
+    sched->scanned[type] = resume;
+}
+
+/* Picks the next job of the given
+ * types to send and removes it from
+ * its FIFO. Jobs of other types are
+ * left queued, without being looked at.
+ *
+ * Input:
+ *     sched: the queue's scheduler
+ *     job:   where to store the job
+ *     types: bit 1 << type set for
+ *            every job type wanted
+ * Return:
+ *     0 on success
+ *    -1 if no jobs of the types
+ *       are queued
+ */
+int nextJob(struct scheduler *sched, struct jobentry *job, unsigned int types){
+    struct jobfifo *best = NULL;
+    int best_class = 0;
+    uint64_t best_deadline = 0;
+    int others_waiting = 0;
+    for(int c = 0; c < PRIORITY_CLASSES; c++){
+        for(int t = 0; t < JOB_TYPES; t++){
+            struct jobfifo *fifo = &sched->classes[c][t];
+            if(!(types & (1 << t)) || fifo->head == fifo->tail){
+                continue;
+            }
+            if(c != PRIORITY_BULK){
+                others_waiting = 1;
+            }
+            struct jobentry *head = &fifo->entries[fifo->head];
+            uint64_t deadline = head->enqueued_us + c*aging_us;
+            if(c == PRIORITY_BULK && others_waiting && sched->bulk_streak >= bulk_cap){
+                continue;
+            }
+            if(best == NULL || deadline < best_deadline ||
+               (deadline == best_deadline && head->seq < best->entries[best->head].seq)){
+                best = fifo;
+                best_class = c;
+                best_deadline = deadline;
+            }
+        }
+    }
+    if(best == NULL){
+        return -1;
+    }
+    *job = best->entries[best->head++];
+    if(best->head == best->tail){
+        best->head = 0;
+        best->tail = 0;
+    }
+    if(best_class == PRIORITY_BULK){
+        sched->bulk_streak++;
+    }else{
+        sched->bulk_streak = 0;
+    }
+    sched->type_sent[job->type]++;
+    sched->queued[job->type]--;
+    if(job->offset+1 > sched->taken_past[job->type]){
+        sched->taken_past[job->type] = job->offset+1;
+    }
+
+    uint64_t waited = monotonicMicros() - job->enqueued_us;
+    struct classstats *stats = &sched->stats[best_class];
+    stats->dispatched++;
+    stats->total_wait_us += waited;
+    if(waited > stats->max_wait_us){
+        stats->max_wait_us = waited;
+    }
+    return 0;
+}
+
+/* Frees the index of a scheduler,
+ * and the frames of jobs that were
+ * read ahead but not sent.
+ *
+ * Input:
+ *     sched: the scheduler
+ * Return:
+ *     void
+ */
+void freeScheduler(struct scheduler *sched){
+    for(int c = 0; c < PRIORITY_CLASSES; c++){
+        for(int t = 0; t < JOB_TYPES; t++){
+            struct jobfifo *fifo = &sched->classes[c][t];
+            for(long i = fifo->head; i < fifo->tail; i++){
+                poolFree(fifo->entries[i].frame);
+            }
+            free(fifo->entries);
+        }
+    }
+    memset(sched, 0, sizeof(struct scheduler));
+}
+
+/* Prints how many jobs of each class
+ * are queued and have been sent, and
+ * how long they waited in the queue,
+ * then the same counts by job type.
+ *
+ * Input:
+ *     sched: the scheduler
+ * Return:
+ *     void
+ */
+void printSchedulerStats(struct scheduler *sched){
+    static char *names[PRIORITY_CLASSES] = {"urgent", "normal", "bulk"};
+    long type_queued[JOB_TYPES] = {0};
+    for(int c = 0; c < PRIORITY_CLASSES; c++){
+        struct classstats *stats = &sched->stats[c];
+        long queued = 0;
+        for(int t = 0; t < JOB_TYPES; t++){
+            struct jobfifo *fifo = &sched->classes[c][t];
+            queued += fifo->tail-fifo->head;
+            type_queued[t] += fifo->tail-fifo->head;
+        }
+        double avg_ms = 0;
+        if(stats->dispatched > 0){
+            avg_ms = stats->total_wait_us / 1000.0 / stats->dispatched;
+        }
+        printf(COLOR_CYAN ">>%d<<     %-6s: %ld queued, %lu sent, "
+               "time in queue avg %.3f ms, max %.3f ms.", getpid(), names[c],
+               queued, stats->dispatched, avg_ms,
+               stats->max_wait_us / 1000.0);
+        printf(COLOR_RESET "\n");
+    }
+    printf(COLOR_CYAN ">>%d<<     types : 'O' %ld queued, %lu sent, 'E' %ld queued, %lu sent.",
+           getpid(), type_queued[0], sched->type_sent[0], type_queued[1], sched->type_sent[1]);
+    printf(COLOR_RESET "\n");
+}
@@ -0,0 +1,82 @@
+/* SCHEDULER.H
+ *
+ *****************************************
+ * Header file for the priority scheduler
+ * that sits between a job queue's file
+ * and the sending path.
+ *
+ */
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#define PRIORITY_URGENT     0
+#define PRIORITY_NORMAL     1
+#define PRIORITY_BULK       2
+#define PRIORITY_CLASSES    3
+
+#define JOB_TYPES           2
+#define TYPES_ALL           ((1 << JOB_TYPES)-1)
+
+#define SCHED_WINDOW        4096
+
+struct jobentry {
+    long offset;
+    uint64_t seq;
+    uint64_t enqueued_us;
+    unsigned char priority;
+    unsigned char prefix;
+    unsigned char type;
+    void *frame;
+};
+
+struct jobfifo {
+    struct jobentry *entries;
+    long head;
+    long tail;
+    long size;
+};
+
+struct classstats {
+    unsigned long dispatched;
+    uint64_t total_wait_us;
+    uint64_t max_wait_us;
+};
+
+struct scheduler {
+    struct jobfifo classes[PRIORITY_CLASSES][JOB_TYPES];
+    struct classstats stats[PRIORITY_CLASSES];
+    long scanned[JOB_TYPES];
+    long queued[JOB_TYPES];
+    long taken_past[JOB_TYPES];
+    long size;
+    long ahead;
+    unsigned int partial;
+    unsigned int spilled;
+    uint64_t next_seq;
+    unsigned long bulk_streak;
+    unsigned long type_sent[JOB_TYPES];
+};
+
+struct jobindex {
+    long *offsets;
+    uint64_t count;
+    uint64_t size;
+    long scanned;
+};
+
+extern uint64_t aging_us;
+extern unsigned long bulk_cap;
+
+int scanJobs(struct scheduler *sched, int fd, unsigned int types);
+int scanDue(struct scheduler *sched, unsigned int types);
+int indexJobs(struct jobindex *index, int fd);
+void freeIndex(struct jobindex *index);
+int addJob(struct scheduler *sched, struct jobentry *job, long end);
+void spillJobs(struct scheduler *sched, int type);
+int nextJob(struct scheduler *sched, struct jobentry *job, unsigned int types);
+void freeScheduler(struct scheduler *sched);
+void printSchedulerStats(struct scheduler *sched);
+
+#endif
@@ -0,0 +1,49 @@
+#!/bin/sh
+# tunebench.sh
+#############################################
+# Serves every job in a job file once per
+# combination of socket options, and reports
+# the throughput of each and which won.
+#
+# USAGE:
+#     scripts/tunebench.sh <jobfile> [port]
+#
+# Run from the directory with the server and
+# client binaries. Client output is discarded,
+# so the children's printing still counts.
+#
+
+JOBS=$1
+PORT=${2:-5700}
+if [ -z "$JOBS" ] || [ ! -f "$JOBS" ]; then
+    echo "./scripts/tunebench.sh <jobfile> [port]"
+    exit 1
+fi
+
+SIZE=$(wc -c < "$JOBS")
+BEST=""
+BEST_RATE=0
+
+for SETTINGS in "" "-NODELAY" "-CORK" "-CORK -SNDBUF=auto" \
+                "-SNDBUF=auto -RCVBUF=auto" "-NODELAY -LOWAT=16384" \
+                "-CORK -SNDBUF=4194304 -RCVBUF=4194304"; do
+    ./server "$JOBS" "$PORT" $SETTINGS > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 0.3
+    CLIENT_SETTINGS=$(echo "$SETTINGS" | sed 's/-CORK//')
+    START=$(date +%s%N)
+    printf '3\n' | ./client 127.0.0.1 "$PORT" $CLIENT_SETTINGS > /dev/null 2>&1
+    END=$(date +%s%N)
+    kill -INT $SERVER 2> /dev/null
+    wait $SERVER 2> /dev/null
+
+    RATE=$(( SIZE * 1000 / ((END - START) / 1000 + 1) ))
+    printf "%-40s %8d KB/s\n" "${SETTINGS:-(defaults)}" "$RATE"
+    if [ "$RATE" -gt "$BEST_RATE" ]; then
+        BEST_RATE=$RATE
+        BEST=${SETTINGS:-(defaults)}
+    fi
+    PORT=$((PORT + 1))
+done
+
+echo "Best: $BEST ($BEST_RATE KB/s)"
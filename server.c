@@ -1,49 +1,309 @@
 /* server.c
  *******************************************
  * USAGE:
- * Arguments: <filepath>  <port> -DEBUG
+ * Arguments: <filepath>  <port> -DEBUG -FOLLOW
+ *            -AGING=<ms> -BULKCAP=<jobs>
+ *            -MAXCONN=<clients> -OVERLOAD=<refuse|defer>
+ *            -QUANTUM=<bytes> -NODELAY -CORK
+ *            -SNDBUF=<n|auto> -RCVBUF=<n|auto> -LOWAT=<n>
+ *            -READAHEAD[=<KB>] -DIRECT -RECORD=<path>
+ *            -RESULTS=<path> -DEDUP[=<entries>]
+ *            -BROADCAST[=<block|drop|disconnect>] -LAG=<KB>
+ *            -COALESCE[=<us>] -HEARTBEAT=<ms> -IDLE=<ms>
+ *            -MEMORY=<KB> -CONNMEMORY=<KB>
  *
+ * <filepath> can be a single job file,
+ * a directory of job files or '@' followed
+ * by a manifest, see jobqueue.c. Every
+ * job file is served as its own queue.
+ *
+ * -FOLLOW keeps serving jobs that are
+ * appended to the job files instead of
+ * ending the session at end of file.
+ *
+ * Jobs are sent by priority, see
+ * scheduler.c. -AGING sets how long a
+ * job of one class waits before it
+ * overtakes newer jobs of the next class
+ * up, and -BULKCAP how many bulk jobs
+ * are sent in a row while other jobs
+ * wait. Jobs are queued a window at a
+ * time, and the jobs of one window are
+ * sent in class order; aging applies to
+ * the jobs queued later, like those
+ * appended in follow mode.
+ * Clients that subscribed to some job
+ * types only are sent the next job of
+ * those, see protocol.h, and the rest
+ * is left for other clients. Clients
+ * can also have the jobs they take
+ * filtered by their text, see match.c;
+ * the jobs that don't pass are taken
+ * but never sent.
+ *
+ * Any number of clients can be connected
+ * at once, up to -MAXCONN. Clients that
+ * connect beyond that are either refused
+ * with termination signal 5, or left in
+ * the listen backlog until a client leaves.
+ * Every client has its own send queue,
+ * and the queues take turns sending by
+ * deficit round-robin, each getting
+ * -QUANTUM bytes per round.
+ *
+ * <port> can also be unix:<path> to listen
+ * on an AF_UNIX socket, or shm:<name> to
+ * send frames through shared memory to
+ * clients on the same host, see transport.c.
+ *
+ * The socket options are described in
+ * sockopts.c. With -CORK every client's
+ * round-robin turn is written as one
+ * corked batch.
+ *
+ * -READAHEAD reads every job file in a
+ * thread of its own, keeping at most
+ * <KB> of frames ready to send, see
+ * readahead.c. -DIRECT reads them
+ * with O_DIRECT.
+ *
+ * -RECORD writes every request and frame
+ * of every session to a trace, see
+ * trace.c, that ./replay can play back.
+ *
+ * -RESULTS appends the results clients
+ * send back for their jobs to <path>,
+ * see results.c.
+ *
+ * -DEDUP has every client cache the
+ * texts of the last <entries> jobs it
+ * was sent, and sends a job whose text
+ * the client has as a reference to it,
+ * see dedup.c.
+ *
+ * -BROADCAST sends every job to every
+ * client served from its queue instead
+ * of to one of them. Each job is read
+ * once and its frame shared by all of
+ * their send queues. A client with more
+ * than -LAG queued holds the broadcast
+ * back (block, the default), misses jobs
+ * until it catches up (drop), or is
+ * disconnected (disconnect).
+ *
+ * -COALESCE queues up to a byte budget
+ * of frames per client and sends them
+ * with one sendmsg(), holding frames
+ * back for at most <us> (1000) while
+ * jobs trickle in. Budget and deadline
+ * are tuned per client as it is served,
+ * see tuneBatch() in connection.c.
+ *
+ * -HEARTBEAT sends a heartbeat to every
+ * client that has been silent for <ms>,
+ * and disconnects clients that stay
+ * silent for HEARTBEAT_MISSES of them,
+ * see checkConnection(). It also turns
+ * on TCP keepalive and TCP_USER_TIMEOUT
+ * to match, unless they are set with
+ * -KEEPALIVE and -USERTIMEOUT.
+ * -IDLE disconnects clients that have
+ * asked for nothing for <ms>.
+ * Clients on shm: share the host, and
+ * their socket closes with them, so
+ * they aren't checked.
+ *
+ * What is buffered for a client, its
+ * request buffer and queued frames, is
+ * charged to a budget of -CONNMEMORY,
+ * and every client's to one of -MEMORY
+ * for all of them, see budget.c. While
+ * either is exhausted the client's
+ * requests aren't read and no jobs are
+ * read for it, so it is held back by
+ * TCP, and while -MEMORY is new clients
+ * are left in the listen backlog, see
+ * throttleConnection(). Frames read
+ * ahead are held to -READAHEAD instead.
+ *
+ * Send SIGUSR1 to print the stats of
+ * every queue and client. Requests, job
+ * reads and sent frames can also be
+ * traced while running, see probes.h.
+ *
+ * Send SIGHUP, or have a client send 'R',
+ * to load <filepath> again without
+ * stopping, see reload.c. Clients that
+ * are connected keep the jobs they were
+ * being served, new clients get the
+ * reloaded ones.
  *
  */
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 
 #include "colors.h"
+#include "jobqueue.h"
+#include "scheduler.h"
+#include "readahead.h"
+#include "reload.h"
+#include "connection.h"
+#include "transport.h"
+#include "sockopts.h"
+#include "protocol.h"
+#include "pool.h"
+#include "trace.h"
+#include "results.h"
+#include "dedup.h"
+#include "timerwheel.h"
+#include "budget.h"
+#include "match.h"
+#include "probes.h"
+
+#define RESULT_LINE_MAX     (QUEUE_NAME_LEN + RESULT_TEXT_MAX + 64)
+
+#define LAG_BLOCK           0
+#define LAG_DROP            1
+#define LAG_DISCONNECT      2
+
+#define COALESCE_DEFAULT    1000
+
+#define HEARTBEAT_MISSES    3
+#define HEARTBEAT_TICKS     8
+
+#define MEMORY_DEFAULT      (256*1024*1024)
+#define CONN_MEMORY_DEFAULT (4*1024*1024)
 
 /* Fields 		*/
-FILE *f;
-int client_socket;
+struct jobset *jobs;
+char *job_source;
+char *record_path;
+char *results_path;
+int dedup_entries;
+int broadcast;
+int lag_policy;
+size_t lag_bytes;
+uint64_t coalesce_us;
+int batch_timer_fd;
+uint64_t batch_timer_us;
+uint64_t heartbeat_us;
+uint64_t idle_us;
+int heartbeat_timer_fd;
+struct timerwheel wheel;
+unsigned long dead_closed;
+unsigned long idle_closed;
+struct budget memory;
+size_t memory_limit;
+size_t conn_memory_limit;
+int throttled_count;
+int memory_pressure;
+int reload_fd;
+int reload_again;
+struct connection *connections;
+struct connection **connections_by_fd;
+int connections_size;
+int connection_count;
+unsigned long next_connection_id;
+struct connection *active_head;
+struct connection *active_tail;
 int server_socket;
+int transport;
+char *server_address;
+int epoll_fd;
+int listening;
 pid_t serverid;
 int debug;
+int follow;
+int inotify_fd;
+int readahead_fd;
+int max_connections;
+int refuse_overload;
+size_t quantum;
+volatile sig_atomic_t stop_requested;
+volatile sig_atomic_t stats_requested;
+volatile sig_atomic_t reload_requested;
 /* Functions 	*/
 void usage(int argc, char* argv[]);
 void createSocket(char* port);
-void takeRequests();
-int sendJob();
+void eventLoop();
+void acceptClients();
+void closeConnection(struct connection *conn);
+void reapConnections();
+void takeRequests(struct connection *conn);
+size_t handleRequest(struct connection *conn, char *data, size_t len);
+size_t takeResults(struct connection *conn, char *data, size_t len);
+void takeRange(struct connection *conn, char *data);
+void takeMatch(struct connection *conn, char *data, size_t len);
+int passesMatch(struct connection *conn, struct frame *frame);
+void sendCount(struct connection *conn);
+void sendStats(struct connection *conn);
+void sendControl(struct connection *conn, int kind, char *text, int len);
+struct frame *controlFrame(int kind, char *text, int len);
+struct frame *dedupFrame(struct connection *conn, struct frame *frame);
+void activate(struct connection *conn);
+void serveClients();
+void serveConnection(struct connection *conn);
+int sendJob(struct connection *conn);
+int readJob(struct connection *conn, struct frame **frame, struct jobentry *job);
+int readRangeJob(struct connection *conn, struct frame **frame, struct jobentry *job);
+int frameJob(struct connection *conn, struct jobentry *job, struct frame **frame);
+int takeReadaheadJob(struct connection *conn, struct frame **frame, struct jobentry *job);
+void shedReadahead(struct jobqueue *queue, unsigned int types);
+void deliverJob(struct connection *conn, struct frame *frame, struct jobentry *job);
+void broadcastJob(struct connection *origin, struct frame *frame, struct jobentry *job);
+int broadcastBlocked(struct connection *origin);
+int holdBatch(struct connection *conn);
+void armBatchTimer(uint64_t due);
+void releaseBatches();
+void throttleConnection(struct connection *conn);
+void watchConnection(struct connection *conn);
+void relieveMemory();
+void listenAgain();
+void checkConnection(struct connection *conn, uint64_t now);
+void expireConnections();
 void errorCode(int type);
-void sendTermSignal(int sig);
-void outOfJobs();
+void sendTermSignal(struct connection *conn, int sig);
+void outOfJobs(struct connection *conn);
+int waitForJobs(struct connection *conn);
+void wakeFollowers();
+void wakeWaiting();
+void requestReload();
+void publishReload();
+void printQueues();
+int closingMessage(int client_message);
+void printStats();
 void signalHandler(int sig);
+void shutdownServer();
+void statsSignalHandler(int sig);
+void reloadSignalHandler(int sig);
 
 void errorPrint(char* string);
 void debugPrint(char* string, int debug);
 int getChecksum(char* string, int length);
 int portCheck(char* port);
+uint64_t monotonicMicros();
 
 /* Main-function
  * That sets up the jobfile, a networking socket
- * accepts a connection from one client and
- * communicates with client until either
- * terminates or experiences an error.
+ * and serves every client that connects
+ * until the server is interrupted.
  *
  * Input:
  *     argc: amount of user arguments
@@ -56,47 +316,139 @@ int portCheck(char* port);
 int main(int argc, char *argv[]) {
 	serverid = getpid();
 	debug = 0;
+	follow = 0;
+	inotify_fd = -1;
+	readahead_fd = -1;
+	reload_fd = -1;
+	batch_timer_fd = -1;
+	heartbeat_timer_fd = -1;
+	max_connections = 64;
+	refuse_overload = 0;
+	quantum = 65536;
+	lag_bytes = 1024*1024;
+	memory_limit = MEMORY_DEFAULT;
+	conn_memory_limit = CONN_MEMORY_DEFAULT;
+	transport = TRANSPORT_TCP;
 
     struct sigaction sigint;
     memset(&sigint, 0, sizeof(sigint));
     sigint.sa_handler = signalHandler;
     sigaction(SIGINT, &sigint, NULL);
 
+    struct sigaction sigusr1;
+    memset(&sigusr1, 0, sizeof(sigusr1));
+    sigusr1.sa_handler = statsSignalHandler;
+    sigaction(SIGUSR1, &sigusr1, NULL);
+
+    struct sigaction sighup;
+    memset(&sighup, 0, sizeof(sighup));
+    sighup.sa_handler = reloadSignalHandler;
+    sigaction(SIGHUP, &sighup, NULL);
+
     usage(argc, argv);
+    initBudget(&memory, NULL, memory_limit);
 
-    debugPrint("Opening job-file.", debug);
-	f = fopen(argv[1], "r");
-	if(f == NULL){
-		errorPrint("Couldn't find the file. Shutting down server!");
+    debugPrint("Opening job-file(s).", debug);
+    job_source = argv[1];
+    jobs = calloc(1, sizeof(struct jobset));
+	if(jobs == NULL || loadJobset(jobs, job_source) == -1){
+		errorPrint("Couldn't load the job queues. Shutting down server!");
 		return 0;
 	}
+	holdJobset(jobs);
+	if(record_path != NULL && openTrace(record_path, TRACE_SERVER) == -1){
+	    releaseJobset(jobs);
+	    return 0;
+	}
+	if(results_path != NULL && openResults(results_path) == -1){
+	    releaseJobset(jobs);
+	    return 0;
+	}
+	reload_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(reload_fd == -1){
+	    errorPrint("Couldn't set up reloading.");
+	    releaseJobset(jobs);
+	    return 0;
+	}
+	if(follow){
+	    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	    if(inotify_fd == -1){
+	        errorPrint("Couldn't set up inotify for follow mode.");
+	        releaseJobset(jobs);
+	        return 0;
+	    }
+	}
+	if(coalesce_us > 0){
+	    batch_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	    if(batch_timer_fd == -1){
+	        errorPrint("Couldn't set up the coalescing timer.");
+	        releaseJobset(jobs);
+	        return 0;
+	    }
+	}
+	if(heartbeat_us > 0 || idle_us > 0){
+	    uint64_t tick_us = heartbeat_us > 0 ? heartbeat_us : idle_us;
+	    if(idle_us > 0 && idle_us < tick_us){
+	        tick_us = idle_us;
+	    }
+	    tick_us /= HEARTBEAT_TICKS;
+	    initWheel(&wheel, tick_us, monotonicMicros());
+	    heartbeat_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	    struct itimerspec spec;
+	    memset(&spec, 0, sizeof(spec));
+	    spec.it_interval.tv_sec = wheel.tick_us / 1000000;
+	    spec.it_interval.tv_nsec = (wheel.tick_us % 1000000) * 1000;
+	    spec.it_value = spec.it_interval;
+	    if(heartbeat_timer_fd == -1 || timerfd_settime(heartbeat_timer_fd, 0, &spec, NULL) == -1){
+	        errorPrint("Couldn't set up the heartbeat timer.");
+	        releaseJobset(jobs);
+	        return 0;
+	    }
+	}
+	if(readahead_budget > 0){
+	    readahead_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	    if(readahead_fd == -1){
+	        errorPrint("Couldn't set up read-ahead.");
+	        releaseJobset(jobs);
+	        return 0;
+	    }
+	}
+	printQueues();
 
     debugPrint("Creating server-socket.", debug);
     createSocket(argv[2]);
     if(server_socket == -1){
         errorPrint("Error in setting up server socket!");
         debugPrint("Shutting down server...", debug);
-        fclose(f);
+        releaseJobset(jobs);
         exit(EXIT_FAILURE);
     }
 
-    struct sockaddr_in client_addr;
-    memset(&client_addr, 0, sizeof(client_addr));
-    socklen_t addr_len = sizeof(client_addr);
-    client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_len);
-
-    char ipstring[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client_addr.sin_addr, ipstring, sizeof ipstring);
-    printf(COLOR_CYAN">>%d<< Client (%s) - Connected to server.", serverid, ipstring);
-    printf(COLOR_RESET "\n");
-    close(server_socket);
-
-	takeRequests();
+	eventLoop();
 
 	debugPrint("Shutting down server...", debug);
-	fclose(f);
-    close(client_socket);
-    return 0;
+	printStats();
+	closeTrace();
+	closeResults();
+	releaseJobset(jobs);
+	if(inotify_fd != -1){
+	    close(inotify_fd);
+	}
+	if(readahead_fd != -1){
+	    close(readahead_fd);
+	}
+	if(batch_timer_fd != -1){
+	    close(batch_timer_fd);
+	}
+	if(heartbeat_timer_fd != -1){
+	    close(heartbeat_timer_fd);
+	}
+	close(reload_fd);
+    close(server_socket);
+    if(transport == TRANSPORT_UNIX){
+        unlink(transportPath(server_address));
+    }
+    return stop_requested ? EXIT_FAILURE : 0;
 }
 /* How the program treats
  * arguments from user.
@@ -112,35 +464,112 @@ void usage(int argc, char* argv[]){
     if(argc < 3){
         errorPrint("Not enough program arguments supplied.\n");
         errorPrint("./server <joblist> <Port>.\n");
+        errorPrint("<joblist> can be a job file, a directory or @<manifest>.\n");
         errorPrint("To run client in debug mode add last argument '-DEBUG'\n");
         exit(EXIT_FAILURE);
     }
-    if(portCheck(argv[2]) == -1){
+    server_address = argv[2];
+    transport = transportType(argv[2]);
+    if(transport == TRANSPORT_TCP && portCheck(argv[2]) == -1){
         errorPrint("Please choose a port from 1 to 6535.");
+        errorPrint("Or unix:<path> or shm:<name> for a local transport.");
         errorPrint("./server <joblist> <Port>.\n");
         errorPrint("To run client in debug mode add last argument '-DEBUG'\n");
         exit(EXIT_FAILURE);
     }
-    if(argc == 4){
-        char comp[7]= "-DEBUG";
-        if(strcmp(comp, argv[3]) == 0){
+    for(int i = 3; i < argc; i++){
+        if(strcmp("-DEBUG", argv[i]) == 0){
             debug = 1;
             debugPrint("Running client in debug mode.", debug);
+        }else if(strcmp("-FOLLOW", argv[i]) == 0){
+            follow = 1;
+        }else if(strncmp("-AGING=", argv[i], 7) == 0 && atoi(argv[i]+7) > 0){
+            aging_us = (uint64_t)atoi(argv[i]+7) * 1000;
+        }else if(strncmp("-BULKCAP=", argv[i], 9) == 0 && atoi(argv[i]+9) > 0){
+            bulk_cap = atoi(argv[i]+9);
+        }else if(strncmp("-MAXCONN=", argv[i], 9) == 0 && atoi(argv[i]+9) > 0){
+            max_connections = atoi(argv[i]+9);
+        }else if(strcmp("-OVERLOAD=refuse", argv[i]) == 0){
+            refuse_overload = 1;
+        }else if(strcmp("-OVERLOAD=defer", argv[i]) == 0){
+            refuse_overload = 0;
+        }else if(strncmp("-QUANTUM=", argv[i], 9) == 0 && atoi(argv[i]+9) > 0){
+            quantum = atoi(argv[i]+9);
+        }else if(strcmp("-READAHEAD", argv[i]) == 0){
+            readahead_budget = READAHEAD_DEFAULT;
+        }else if(strncmp("-READAHEAD=", argv[i], 11) == 0 && atoi(argv[i]+11) > 0){
+            readahead_budget = (size_t)atoi(argv[i]+11) * 1024;
+        }else if(strcmp("-DIRECT", argv[i]) == 0){
+            readahead_direct = 1;
+        }else if(strncmp("-RECORD=", argv[i], 8) == 0 && argv[i][8] != '\0'){
+            record_path = argv[i]+8;
+        }else if(strncmp("-RESULTS=", argv[i], 9) == 0 && argv[i][9] != '\0'){
+            results_path = argv[i]+9;
+        }else if(strcmp("-DEDUP", argv[i]) == 0){
+            dedup_entries = DEDUP_DEFAULT;
+        }else if(strncmp("-DEDUP=", argv[i], 7) == 0 && atoi(argv[i]+7) > 0 &&
+                 atoi(argv[i]+7) <= DEDUP_MAX){
+            dedup_entries = atoi(argv[i]+7);
+        }else if(strcmp("-BROADCAST", argv[i]) == 0 || strcmp("-BROADCAST=block", argv[i]) == 0){
+            broadcast = 1;
+            lag_policy = LAG_BLOCK;
+        }else if(strcmp("-BROADCAST=drop", argv[i]) == 0){
+            broadcast = 1;
+            lag_policy = LAG_DROP;
+        }else if(strcmp("-BROADCAST=disconnect", argv[i]) == 0){
+            broadcast = 1;
+            lag_policy = LAG_DISCONNECT;
+        }else if(strncmp("-LAG=", argv[i], 5) == 0 && atoi(argv[i]+5) > 0){
+            lag_bytes = (size_t)atoi(argv[i]+5) * 1024;
+        }else if(strcmp("-COALESCE", argv[i]) == 0){
+            coalesce_us = COALESCE_DEFAULT;
+        }else if(strncmp("-COALESCE=", argv[i], 10) == 0 && atoi(argv[i]+10) > 0){
+            coalesce_us = atoi(argv[i]+10);
+        }else if(strncmp("-HEARTBEAT=", argv[i], 11) == 0 && atoi(argv[i]+11) > 0){
+            heartbeat_us = (uint64_t)atoi(argv[i]+11) * 1000;
+        }else if(strncmp("-IDLE=", argv[i], 6) == 0 && atoi(argv[i]+6) > 0){
+            idle_us = (uint64_t)atoi(argv[i]+6) * 1000;
+        }else if(strncmp("-MEMORY=", argv[i], 8) == 0 && atoi(argv[i]+8) >= BUDGET_MIN/1024){
+            memory_limit = (size_t)atoi(argv[i]+8) * 1024;
+        }else if(strncmp("-CONNMEMORY=", argv[i], 12) == 0 && atoi(argv[i]+12) >= BUDGET_MIN/1024){
+            conn_memory_limit = (size_t)atoi(argv[i]+12) * 1024;
+        }else if(parseSockopt(argv[i]) == 0){
         }else{
             errorPrint("./server <joblist> <Port>.\n");
-            errorPrint("To run client in debug mode add last argument '-DEBUG'\n");
+            errorPrint("To run client in debug mode add argument '-DEBUG'\n");
+            errorPrint("To keep serving appended jobs add argument '-FOLLOW'\n");
+            errorPrint("To tune priorities add '-AGING=<ms>' or '-BULKCAP=<jobs>'\n");
+            errorPrint("To limit clients add '-MAXCONN=<n>' and '-OVERLOAD=<refuse|defer>'\n");
+            errorPrint("To set the bytes each client may send per round add '-QUANTUM=<bytes>'\n");
+            errorPrint("To tune sockets add '-NODELAY', '-CORK', '-SNDBUF=<n|auto>', '-RCVBUF=<n|auto>' or '-LOWAT=<n>'\n");
+            errorPrint("To drop dead peers in the kernel add '-KEEPALIVE=<s>' or '-USERTIMEOUT=<ms>'\n");
+            errorPrint("To read job files ahead in a thread add '-READAHEAD[=<KB>]', and '-DIRECT' for O_DIRECT\n");
+            errorPrint("To record every session for ./replay add '-RECORD=<path>'\n");
+            errorPrint("To write the results clients send back add '-RESULTS=<path>'\n");
+            errorPrint("To send repeated job texts as references add '-DEDUP[=<entries>]'\n");
+            errorPrint("To send every job to every client add '-BROADCAST[=<block|drop|disconnect>]' and '-LAG=<KB>'\n");
+            errorPrint("To send frames in batches held back at most <us> add '-COALESCE[=<us>]'\n");
+            errorPrint("To disconnect silent clients add '-HEARTBEAT=<ms>', and idle ones '-IDLE=<ms>'\n");
+            errorPrint("To bound what is buffered add '-MEMORY=<KB>' for all clients and '-CONNMEMORY=<KB>' for each, at least 64\n");
             exit(EXIT_FAILURE);
         }
     }
+    if(heartbeat_us > 0 && socket_options.keepalive == 0){
+        socket_options.keepalive = heartbeat_us >= 1000000 ? heartbeat_us / 1000000 : 1;
+    }
+    if(heartbeat_us > 0 && socket_options.user_timeout == 0){
+        socket_options.user_timeout = HEARTBEAT_MISSES * heartbeat_us / 1000;
+    }
+    if(readahead_direct && readahead_budget == 0){
+        readahead_budget = READAHEAD_DEFAULT;
+    }
 }
 
 /* Creates a networking socket with
  * the port given by the user. Binds the
- * socket and listens for client to connect.
- * After client connects we close
- * the server_socket as to not
- * accept further connections from
- * other clients.
+ * socket and listens for clients to connect.
+ * Local transports listen on an AF_UNIX
+ * socket instead.
  * Uses sockopt to make the address
  * Reusable after shutdown.
  *
@@ -152,6 +581,15 @@ void usage(int argc, char* argv[]){
  *     -1 on any error
  */
 void createSocket(char* port){
+    if(transport != TRANSPORT_TCP){
+        server_socket = listenLocal(transport, transportPath(port));
+        if(server_socket == -1){
+            errorPrint("Error when binding local socket.");
+            return;
+        }
+        debugPrint("Waiting for clients to connect...", debug);
+        return;
+    }
     int port_num = atoi(port);
 
     if(debug){
@@ -159,7 +597,7 @@ void createSocket(char* port){
         printf(COLOR_RESET"\n");
     }
 
-    server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
 
     struct sockaddr_in server_address;
     server_address.sin_family = AF_INET;
@@ -181,250 +619,2215 @@ void createSocket(char* port){
         server_socket = -1;
         return;
     }
-    listen(server_socket, 1);
-    debugPrint("Waiting for client to connect...", debug);
+    listen(server_socket, SOMAXCONN);
+    debugPrint("Waiting for clients to connect...", debug);
 
 }
 
-/* Loop that receives request from the
- * connected client, and sends a job
- * or multiple jobs in response.
- * Or terminates the server if the
- * client requests termination.
- * Message protocol described in
- * protokoll.txt.
+/* Waits for events on the listening
+ * socket, the client sockets and the
+ * job files, and handles them. Between
+ * waits every client with work gets
+ * one round of sending.
+ * Only returns if epoll can't be used.
  *
  * Input:
  *     none
  * Return:
  *     void
  */
-void takeRequests(){
-	int client_message;
-	int numberOfJobs;
+void eventLoop(){
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1){
+        errorPrint("Couldn't create epoll instance.");
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event);
+    listening = 1;
+    if(inotify_fd != -1){
+        event.data.fd = inotify_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event);
+    }
+    if(readahead_fd != -1){
+        event.data.fd = readahead_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, readahead_fd, &event);
+    }
+    event.data.fd = reload_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reload_fd, &event);
+    if(batch_timer_fd != -1){
+        event.data.fd = batch_timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, batch_timer_fd, &event);
+    }
+    if(heartbeat_timer_fd != -1){
+        event.data.fd = heartbeat_timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, heartbeat_timer_fd, &event);
+    }
 
-	while(1){
-    	recv(client_socket, &client_message, sizeof(client_message), 0);
-    	char request = client_message & 255;
-    	switch(request){
-    		case 'J':
-    			numberOfJobs = (int)(client_message >> 8);
-                if(debug == 1){
-    			    printf(COLOR_CYAN "Client requested %d job(s).", numberOfJobs);
-    			    printf(COLOR_RESET "\n");
-                }
-    			for(int i = 0; i < numberOfJobs; i++){
-    				usleep(5000);
-    				if(sendJob() == -1){
-                        return;
-    				}
-    			}
-    			break;
-    		case 'U':
-    			debugPrint("Client requested all jobs.", debug);
-    			while(1){
-    				usleep(2500);
-    				if(sendJob() == -1){
-    					return;
-    				}
-    			}
-    			break;
-    		case 'T':
-    		    debugPrint("Client signaled termination.", debug);
-    			return;
-    		case 'E':
-    		    debugPrint("Client signaled termination from an error.", debug);
-                errorCode(((client_message>>8)&255));
-    			return;
-            case 'Q':
-                debugPrint("Client shutdown caused by CTRL+C. SIGINT", debug);
-                return;
-    		default:
-                printf("%d\n", client_message);
-    		    debugPrint("Unfamiliar command. Shutting down server.", debug);
-                sendTermSignal(3);
-    			return;
-    	}
-	}
+    struct epoll_event events[64];
+    while(1){
+        if(stop_requested){
+            shutdownServer();
+            break;
+        }
+        if(stats_requested){
+            stats_requested = 0;
+            printStats();
+        }
+        if(reload_requested){
+            reload_requested = 0;
+            requestReload();
+        }
+        int timeout = active_head != NULL ? 0 : -1;
+        int ready = epoll_wait(epoll_fd, events, 64, timeout);
+        if(ready == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            errorPrint("Error while waiting for events.");
+            break;
+        }
+        for(int i = 0; i < ready; i++){
+            int fd = events[i].data.fd;
+            if(fd == server_socket){
+                acceptClients();
+                continue;
+            }
+            if(fd == inotify_fd){
+                wakeFollowers();
+                continue;
+            }
+            if(fd == reload_fd){
+                publishReload();
+                continue;
+            }
+            if(fd == batch_timer_fd){
+                releaseBatches();
+                continue;
+            }
+            if(fd == heartbeat_timer_fd){
+                expireConnections();
+                continue;
+            }
+            if(fd == readahead_fd){
+                uint64_t count;
+                read(readahead_fd, &count, sizeof(count));
+                wakeWaiting();
+                continue;
+            }
+            struct connection *conn = connections_by_fd[fd];
+            if(conn == NULL || conn->state == CONN_CLOSED){
+                continue;
+            }
+            if(events[i].events & EPOLLOUT){
+                conn->blocked = 0;
+                watchConnection(conn);
+                activate(conn);
+            }
+            if(conn->throttled && conn->ring == NULL && (events[i].events & (EPOLLHUP | EPOLLERR))){
+                errorPrint("Lost connection to client.");
+                closeConnection(conn);
+                continue;
+            }
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+                takeRequests(conn);
+            }
+        }
+        serveClients();
+        relieveMemory();
+        reapConnections();
+    }
+    close(epoll_fd);
 }
 
-/* Reads a job from the jobfile
- * and puts together the information
- * so it sends it in the decided upon
- * format.
- *
- * 3 bit  - jobtype
- * 5 bit  - checksum
- * 4 char - a split integer
- *          containing text-length.
- * Rest   - the actual text
+/* Accepts every client waiting in the
+ * listen backlog, as long as there is
+ * room for them. When the server is full
+ * new clients are refused, or the
+ * listening socket is left alone until
+ * a client leaves.
  *
  * Input:
  *     none
  * Return:
- *     -1 on error
- *      0 on success
+ *     void
  */
-int sendJob(){
-    char job_type;
-    if(fread(&job_type, sizeof(char), 1, f) == 0){
-        debugPrint("Out of jobs. Alerting client.", debug);
-        outOfJobs();
-        return -1;
-    }
+void acceptClients(){
+    while(1){
+        if(connection_count >= max_connections && !refuse_overload){
+            debugPrint("Server full. Deferring new clients.", debug);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+            listening = 0;
+            return;
+        }
+        if(!budgetRoom(&memory, REQUEST_BUFFER)){
+            debugPrint("Out of memory budget. Deferring new clients.", debug);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server_socket, NULL);
+            listening = 0;
+            return;
+        }
+        struct sockaddr_storage client_addr;
+        memset(&client_addr, 0, sizeof(client_addr));
+        socklen_t addr_len = sizeof(client_addr);
+        int client_socket = accept4(server_socket, (struct sockaddr *)&client_addr,
+                                    &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client_socket == -1){
+            return;
+        }
+        char ipstring[INET_ADDRSTRLEN] = "local";
+        if(client_addr.ss_family == AF_INET){
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&client_addr)->sin_addr, ipstring, sizeof ipstring);
+        }
 
-    unsigned int text_length;
-    if(fread(&text_length, sizeof(int), 1, f) == 0){
-        errorPrint("Error with reading text-length. Inspect job file.");
-        sendTermSignal(2);
-        return -1;
-    }
-    if(text_length < 1 || text_length > 1000000){
-        errorPrint("Text-length out of bounds. Inspect job file.");
-        return -1;
-    }
-    char job_text[text_length+1];
-    memset(job_text,0, sizeof(job_text));
-    job_text[text_length] = '\0';
-    if(fread(&job_text, sizeof(char), text_length, f) == 0){
-        errorPrint("Error with reading job-text. Inspect job file.");
-        sendTermSignal(2);
-        return -1;
-    }
+        if(connection_count >= max_connections){
+            printf(COLOR_CYAN">>%d<< Client (%s) - Refused, server is full.", serverid, ipstring);
+            printf(COLOR_RESET "\n");
+            unsigned char full[5] = {5 << 5};
+            send(client_socket, full, sizeof(full), MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(client_socket);
+            continue;
+        }
 
-    int checksum = getChecksum(job_text, text_length);
-    if(checksum < 0 || checksum > 32){
-        errorPrint("Checksum value out of bounds.");
-        sendTermSignal(2);
-        return -1;
-    }
-    unsigned char job_info = checksum;
+        if(client_socket >= connections_size){
+            int size = client_socket*2 + 16;
+            struct connection **grown = realloc(connections_by_fd, size*sizeof(struct connection*));
+            if(grown == NULL){
+                errorPrint("Out of memory while accepting client.");
+                close(client_socket);
+                return;
+            }
+            memset(grown+connections_size, 0, (size-connections_size)*sizeof(struct connection*));
+            connections_by_fd = grown;
+            connections_size = size;
+        }
+        struct connection *conn = calloc(1, sizeof(struct connection));
+        if(conn == NULL){
+            errorPrint("Out of memory while accepting client.");
+            close(client_socket);
+            return;
+        }
+        conn->socket = client_socket;
+        if(transport == TRANSPORT_SHM){
+            conn->ring = createRing(client_socket);
+            if(conn->ring == NULL){
+                errorPrint("Couldn't set up shared memory for client.");
+                free(conn);
+                close(client_socket);
+                continue;
+            }
+            conn->ring_size = RING_SIZE;
+        }
+        conn->tcp = transport == TRANSPORT_TCP;
+        applySockopts(client_socket, conn->tcp);
+        conn->id = ++next_connection_id;
+        conn->jobs = jobs;
+        holdJobset(jobs);
+        conn->queue = getQueue(conn->jobs, 0);
+        conn->types = TYPES_ALL;
+        initBudget(&conn->memory, &memory, conn_memory_limit);
+        chargeBudget(&conn->memory, sizeof(conn->in_buf));
+        conn->connected_us = monotonicMicros();
+        conn->rate_mark_us = conn->connected_us;
+        tuneBatch(conn, coalesce_us);
+        conn->heard_us = conn->connected_us;
+        conn->requested_us = conn->connected_us;
+        if(heartbeat_timer_fd != -1 && conn->ring == NULL){
+            checkConnection(conn, conn->connected_us);
+        }
+        memcpy(conn->ip, ipstring, sizeof(ipstring));
+        conn->next = connections;
+        connections = conn;
+        connections_by_fd[client_socket] = conn;
+        connection_count++;
 
-    switch (job_type){
-        case 'O':
-            break;
-        case 'E':
-            job_info = job_info + (1<<5);
-            break;
-        default:
-            errorPrint("Invalid job type.");
-            sendTermSignal(2);
-            return -1;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = client_socket;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event);
+
+        traceRecord(TRACE_CONNECT, conn->id, 0, 0);
+        printf(COLOR_CYAN">>%d<< Client %lu (%s) - Connected to server.", serverid, conn->id, ipstring);
+        printf(COLOR_RESET "\n");
+        if(dedup_entries > 0){
+            if(initDedup(&conn->dedup, dedup_entries, 0) == 0){
+                char text[16];
+                int len = snprintf(text, sizeof(text), "%d", dedup_entries);
+                sendControl(conn, CONTROL_DEDUP, text, len);
+            }else{
+                errorPrint("Out of memory for the client's dedup cache. Sending whole jobs.");
+            }
+        }
     }
+}
 
-    char outMessage[text_length+2+sizeof(int)];
-    memset(outMessage,0, sizeof(outMessage));
-    outMessage[0] = job_info;
-    for(int i = 0; i < (int)sizeof(int); i++){
-        int shuffle = 12 -(i*4);
-        outMessage[i+1] = (char)((text_length >> shuffle) & 15);
+/* Closes the socket of a connection
+ * and prints its stats. The connection
+ * itself is freed by reapConnections().
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void closeConnection(struct connection *conn){
+    if(conn->state == CONN_CLOSED){
+        return;
     }
-    if(debug){
-        printf(COLOR_CYAN">>%d<< Sending job of type %c\n", getpid(), job_type);
-        printf(">>%d<< text length is: %d\n",getpid(), text_length);
-        printf(">>%d<< checksum is:    %d\n",getpid(), checksum);
-        printf(COLOR_YELLOW "\n%s\n", job_text);
-        printf("\n"COLOR_RESET);
+    printConnectionStats(conn);
+    traceRecord(TRACE_CLOSE, conn->id, 0, 0);
+    conn->state = CONN_CLOSED;
+    cancelTimer(&wheel, &conn->timer);
+    connections_by_fd[conn->socket] = NULL;
+    close(conn->socket);
+    if(conn->ring != NULL){
+        unmapRing(conn->ring, conn->ring_size);
+        conn->ring = NULL;
     }
-    strcpy((outMessage+1+sizeof(int)), job_text);
-    send(client_socket, outMessage, sizeof(outMessage), 0);
-    return 0;
+    connection_count--;
+    if(conn->throttled){
+        conn->throttled = 0;
+        throttled_count--;
+    }
+    if(conn->lagging){
+        conn->lagging = 0;
+        wakeWaiting();
+    }
+    listenAgain();
 }
 
-/* Reads and prints the reason
- * the client had to quit due
- * to an error
- * Error code protocol described
- * in protokoll.txt.
+/* Listens for new clients again, if
+ * they were left in the listen backlog.
  *
  * Input:
- *     type: integer error code
- * Result:
+ *     none
+ * Return:
  *     void
  */
-void errorCode(int type){
-    switch(type){
-        case 'S':
-            debugPrint("Client shutdown caused by checksum-error.", debug);
-            break;
-        case 'C':
-            debugPrint("Client shutdown caused by error in a child process.", debug);
-            break;
-        default:
-            debugPrint("Client shutdown caused by unkown error.", debug);
-            break;
+void listenAgain(){
+    if(listening){
+        return;
     }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event);
+    listening = 1;
 }
-/* Sends an otherwise empty message
- * containing only the signal for
- * termination of the server, where the
- * job-type is usually stated. So the
- * client is informed of the server terminating
- * and why.
+
+/* Frees every closed connection that
+ * is no longer in the send rotation,
+ * and drops its hold on its job set.
  *
  * Input:
- *     sig: integer error code
+ *     none
  * Return:
  *     void
  */
-void sendTermSignal(int sig){
-    unsigned char jobempty[5] ={0};
-    unsigned char empty= sig << 5;
-    jobempty[0] = empty;
-    send(client_socket, jobempty, 5*sizeof(char), 0);
+void reapConnections(){
+    struct connection **link = &connections;
+    while(*link != NULL){
+        struct connection *conn = *link;
+        if(conn->state == CONN_CLOSED && !conn->active){
+            *link = conn->next;
+            freeFrames(conn);
+            refundBudget(&conn->memory, sizeof(conn->in_buf));
+            releaseJobset(conn->jobs);
+            free(conn->sent);
+            free(conn->match);
+            freeDedup(&conn->dedup);
+            free(conn);
+        }else{
+            link = &conn->next;
+        }
+    }
 }
-/* Sends an otherwise empty message
- * containing only the signal for
- * termination of the server. So the
- * client is informed that it shuts down.
- * Then the server waits for client to
- * message back that it will also terminate.
+
+/* Reads what the client has sent into
+ * the connection's request buffer, and
+ * handles every complete request in it.
+ * Clients may send any number of requests
+ * without waiting for replies; a request
+ * split across reads is kept until the
+ * rest arrives. Reading stops while the
+ * client is throttled, see
+ * throttleConnection().
  *
  * Input:
- *     none
+ *     conn: the client's connection
  * Return:
  *     void
  */
-void outOfJobs(){
-    sendTermSignal(7);
-    debugPrint("Awaiting termination confirmation from client...", debug);
+void takeRequests(struct connection *conn){
+    while(conn->state != CONN_CLOSED && !(conn->throttled && conn->ring == NULL)){
+        ssize_t got = recv(conn->socket, conn->in_buf+conn->in_len,
+                           sizeof(conn->in_buf)-conn->in_len, MSG_DONTWAIT);
+        if(got == 0){
+            debugPrint("Client closed the connection.", debug);
+            closeConnection(conn);
+            return;
+        }
+        if(got == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+                return;
+            }
+            errorPrint("Lost connection to client.");
+            closeConnection(conn);
+            return;
+        }
+        conn->recv_calls++;
+        conn->in_len += got;
+        conn->heard_us = monotonicMicros();
 
-    int client_message = 0;
-    recv(client_socket, &client_message,sizeof(client_message), 0);
-    int request = client_message&255;
-    switch(request){
+        size_t used = 0;
+        while(conn->state != CONN_CLOSED){
+            size_t consumed = handleRequest(conn, conn->in_buf+used, conn->in_len-used);
+            if(consumed == 0){
+                break;
+            }
+            used += consumed;
+        }
+        memmove(conn->in_buf, conn->in_buf+used, conn->in_len-used);
+        conn->in_len -= used;
+        throttleConnection(conn);
+    }
+}
+
+/* Handles one request from the start
+ * of the bytes received from a client,
+ * and queues a job or multiple jobs
+ * in response.
+ * Or closes the connection if the
+ * client requests termination.
+ * Message protocol described in
+ * protokoll.txt.
+ *
+ * 'S' selects the queue the following
+ * requests are served from, with the
+ * queue id in the upper 24 bits.
+ * Sessions start on queue 0.
+ * 'I' asks for a control frame with
+ * the stats of the client's session.
+ * 'R' reloads the job set, answered
+ * with a notice once it is started.
+ * 'W' is the doorbell of the shm
+ * transport, telling the server there
+ * is room in the ring again.
+ * 'D' carries a batch of results, see
+ * takeResults(), and is taken in any
+ * state of the session.
+ * 'G' asks for a range of jobs, see
+ * takeRange(), and 'N' for the amount
+ * of jobs in the queue, see sendCount().
+ * 'F' subscribes the client to the job
+ * types in the upper 24 bits, see
+ * protocol.h.
+ * 'M' sets the client's filter, see
+ * takeMatch().
+ * 'H' answers a heartbeat, see
+ * checkConnection().
+ *
+ * Input:
+ *     conn: the client's connection
+ *     data: received bytes
+ *     len:  amount of received bytes
+ * Return:
+ *     amount of bytes used, or 0 if
+ *     the request isn't complete yet
+ */
+size_t handleRequest(struct connection *conn, char *data, size_t len){
+	int client_message;
+	int numberOfJobs;
+
+	if(len < sizeof(client_message)){
+	    return 0;
+	}
+	memcpy(&client_message, data, sizeof(client_message));
+	if((client_message & 255) != REQUEST_HEARTBEAT){
+	    conn->requested_us = conn->heard_us;
+	}
+	if((client_message & 255) == REQUEST_RESULTS){
+	    return takeResults(conn, data, len);
+	}
+	size_t used = sizeof(client_message);
+	if((client_message & 255) == REQUEST_RANGE){
+	    used += sizeof(struct rangerequest);
+	    if(len < used){
+	        return 0;
+	    }
+	}
+	if((client_message & 255) == REQUEST_MATCH &&
+	   ((unsigned int)client_message >> 8) <= MATCH_REQUEST_MAX){
+	    used += (unsigned int)client_message >> 8;
+	    if(len < used){
+	        return 0;
+	    }
+	}
+	conn->requests++;
+	PROBE4(request, conn->requests, client_message & 255, used, conn->id);
+	if(client_message == RING_DOORBELL){
+	    conn->blocked = 0;
+	    activate(conn);
+	    return sizeof(client_message);
+	}
+	traceRecord(TRACE_REQUEST, conn->id, client_message, 0);
+	if(used > sizeof(client_message)){
+	    tracePayload(conn->id, data+sizeof(client_message), used-sizeof(client_message));
+	}
+	if(conn->state != CONN_OPEN){
+	    if(closingMessage(client_message) == 0){
+	        closeConnection(conn);
+	    }
+	    return used;
+	}
+	char request = client_message & 255;
+	switch(request){
+		case 'S':
+		    if(getQueue(conn->jobs, (client_message >> 8) & QUEUE_MAX_COUNT) == NULL){
+		        errorPrint("Client selected an unknown queue.");
+		        sendTermSignal(conn, 3);
+		        break;
+		    }
+		    conn->queue = getQueue(conn->jobs, (client_message >> 8) & QUEUE_MAX_COUNT);
+		    if(debug == 1){
+		        printf(COLOR_CYAN "Client selected queue %s.", conn->queue->name);
+		        printf(COLOR_RESET "\n");
+		    }
+		    break;
+		case 'J':
+			conn->queue->requests++;
+			numberOfJobs = (int)(client_message >> 8);
+            if(debug == 1){
+			    printf(COLOR_CYAN "Client requested %d job(s).", numberOfJobs);
+			    printf(COLOR_RESET "\n");
+            }
+            if(conn->pending != PENDING_ALL){
+                conn->pending += numberOfJobs;
+            }
+            activate(conn);
+			break;
+		case 'U':
+			debugPrint("Client requested all jobs.", debug);
+			conn->queue->requests++;
+			conn->pending = PENDING_ALL;
+			activate(conn);
+			break;
+		case REQUEST_RANGE:
+		    takeRange(conn, data+sizeof(client_message));
+		    break;
+		case REQUEST_FILTER:
+		    conn->types = (client_message >> 8) & TYPES_ALL;
+		    if(conn->types == 0){
+		        conn->types = TYPES_ALL;
+		    }
+		    if(debug == 1){
+		        printf(COLOR_CYAN "Client subscribed to%s%s jobs.",
+		               conn->types & FILTER_O ? " 'O'" : "", conn->types & FILTER_E ? " 'E'" : "");
+		        printf(COLOR_RESET "\n");
+		    }
+		    break;
+		case REQUEST_MATCH:
+		    if(((unsigned int)client_message >> 8) > MATCH_REQUEST_MAX){
+		        errorPrint("Client sent a filter that is too long.");
+		        sendTermSignal(conn, 3);
+		        break;
+		    }
+		    takeMatch(conn, data+sizeof(client_message), used-sizeof(client_message));
+		    break;
+		case REQUEST_HEARTBEAT:
+		    debugPrint("Client answered a heartbeat.", debug);
+		    break;
+		case REQUEST_COUNT:
+		    debugPrint("Client requested the amount of jobs.", debug);
+		    sendCount(conn);
+		    break;
+		case 'I':
+		    debugPrint("Client requested stats.", debug);
+		    sendStats(conn);
+		    break;
+		case 'R':
+		    debugPrint("Client requested a reload.", debug);
+		    requestReload();
+		    sendControl(conn, CONTROL_NOTICE, "Reloading job set.", 18);
+		    break;
+		case 'T':
+		    debugPrint("Client signaled termination.", debug);
+		    closeConnection(conn);
+			break;
+		case 'E':
+		    debugPrint("Client signaled termination from an error.", debug);
+            errorCode(((client_message>>8)&255));
+            closeConnection(conn);
+			break;
         case 'Q':
             debugPrint("Client shutdown caused by CTRL+C. SIGINT", debug);
-            return;
-        case 'T':
-            debugPrint("Client termination message received.", debug);
-            return;
-        case 'E':
-            debugPrint("Client termination was due to error.", debug);
-            errorCode((client_message>>8)&255);
-            return;
-        default:
+            closeConnection(conn);
+            break;
+		default:
+            printf("%d\n", client_message);
+		    debugPrint("Unfamiliar command. Closing connection.", debug);
+            sendTermSignal(conn, 3);
+			break;
+	}
+	return used;
+}
+
+/* Takes a batch of results from the
+ * start of the bytes received from a
+ * client, once all of it has arrived.
+ * Every result is matched to the job
+ * it is for, see rememberJob() in
+ * connection.c, and formatted as a line
+ * that results.c writes to the results
+ * file. Results for jobs that aren't
+ * known any more are written with
+ * queue and job '-'.
+ * Without -RESULTS they are only counted.
+ * The batch is traced like any other
+ * request.
+ *
+ * Input:
+ *     conn: the client's connection
+ *     data: received bytes
+ *     len:  amount of received bytes
+ * Return:
+ *     amount of bytes used, or 0 if
+ *     the batch isn't complete yet
+ */
+size_t takeResults(struct connection *conn, char *data, size_t len){
+    int client_message;
+    memcpy(&client_message, data, sizeof(client_message));
+    unsigned int count = (unsigned int)client_message >> 8;
+    if(count > RESULT_BATCH_JOBS){
+        errorPrint("Client sent too many results at once.");
+        sendTermSignal(conn, 3);
+        return len;
+    }
+    struct resultheader header;
+    size_t used = sizeof(client_message);
+    unsigned int complete = 0;
+    while(complete < count && used+sizeof(header) <= len){
+        memcpy(&header, data+used, sizeof(header));
+        if(used+sizeof(header)+header.len > len){
             break;
+        }
+        used += sizeof(header)+header.len;
+        complete++;
+    }
+    if(complete < count){
+        if(len >= sizeof(conn->in_buf)){
+            errorPrint("Client sent a batch of results larger than the request buffer.");
+            sendTermSignal(conn, 3);
+            return len;
+        }
+        return 0;
+    }
+    conn->requests++;
+    PROBE4(request, conn->requests, REQUEST_RESULTS, used, conn->id);
+    traceRecord(TRACE_REQUEST, conn->id, client_message, 0);
+    tracePayload(conn->id, data+sizeof(client_message), used-sizeof(client_message));
+    conn->results += count;
+    if(results_path == NULL || count == 0){
+        return used;
+    }
+
+    struct resultbatch *batch = newResultBatch(count*RESULT_LINE_MAX);
+    if(batch == NULL){
+        errorPrint("Out of memory while taking results.");
+        return used;
+    }
+    size_t offset = sizeof(client_message);
+    for(unsigned int i = 0; i < count; i++){
+        memcpy(&header, data+offset, sizeof(header));
+        char *text = data+offset+sizeof(header);
+        offset += sizeof(header)+header.len;
+
+        char *line = batch->data+batch->len;
+        struct sentjob *job = findJob(conn, header.job);
+        int n;
+        if(job != NULL){
+            n = sprintf(line, "%s\t%llu\t%lu\t%c\t", job->queue->name,
+                        (unsigned long long)job->seq, conn->id, header.status);
+        }else{
+            n = sprintf(line, "-\t-\t%lu\t%c\t", conn->id, header.status);
+        }
+        for(int c = 0; c < header.len; c++){
+            line[n++] = text[c] == '\n' || text[c] == '\t' ? ' ' : text[c];
+        }
+        line[n++] = '\n';
+        batch->len += n;
+        batch->count++;
     }
+    queueResults(batch);
+    return used;
 }
 
-/* Signal handler that makes sure
- * the server shuts down in a good
- * way when the user interrupts with
- * CTRL+C.
- * Tells client that this is the
- * reason server is shutting down.
+/* Has the jobs of a range request sent
+ * on the connection, see protocol.h.
+ * Jobs asked for before have to be sent
+ * first, so a client fetches one range
+ * at a time.
  *
  * Input:
- *     sig: integer signal
+ *     conn: the client's connection
+ *     data: the rangerequest
  * Return:
- *    void
+ *     void
  */
-void signalHandler(int sig){
-    assert(sig == SIGINT);
-    fclose(f);
-	sendTermSignal(6);
-    debugPrint("Shutting down server...", debug);
-    close(client_socket);
-    exit(EXIT_FAILURE);
+void takeRange(struct connection *conn, char *data){
+    struct rangerequest range;
+    memcpy(&range, data, sizeof(range));
+    if(conn->pending != 0){
+        errorPrint("Client requested a range while jobs are pending.");
+        sendTermSignal(conn, 3);
+        return;
+    }
+    if(debug == 1){
+        printf(COLOR_CYAN "Client requested jobs %u to %u.", range.start, range.end);
+        printf(COLOR_RESET "\n");
+    }
+    if(range.end <= range.start){
+        return;
+    }
+    conn->queue->requests++;
+    conn->range_next = range.start;
+    conn->range_end = range.end;
+    conn->pending = range.end - range.start;
+    activate(conn);
+}
+
+/* Sets the client's filter from the text
+ * of a REQUEST_MATCH, see match.c, or
+ * turns filtering off if it is empty.
+ * An invalid filter ends the session
+ * like an unfamiliar request does.
+ *
+ * Input:
+ *     conn: the client's connection
+ *     data: the text of the request
+ *     len:  length of the text
+ * Return:
+ *     void
+ */
+void takeMatch(struct connection *conn, char *data, size_t len){
+    free(conn->match);
+    conn->match = NULL;
+    if(len == 0){
+        debugPrint("Client turned its filter off.", debug);
+        return;
+    }
+    conn->match = malloc(sizeof(struct matcher));
+    if(conn->match == NULL){
+        errorPrint("Out of memory while setting filter.");
+        sendTermSignal(conn, 2);
+        return;
+    }
+    if(parseMatch(conn->match, data, len) == -1){
+        free(conn->match);
+        conn->match = NULL;
+        errorPrint("Client sent an invalid filter.");
+        sendTermSignal(conn, 3);
+        return;
+    }
+    if(debug == 1){
+        printf(COLOR_CYAN "Client filters on %d literal(s), lengths %u to %u, with %s.",
+               conn->match->count, conn->match->min_length, conn->match->max_length,
+               matchKernelName(conn->match->kernel));
+        printf(COLOR_RESET "\n");
+    }
+}
+
+/* Checks a job against the client's
+ * filter. A job that doesn't pass is
+ * counted, and its frame's length taken
+ * from the deficit like it was sent,
+ * so a long run of them is spread over
+ * the client's turns.
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     frame: the job's frame
+ * Return:
+ *     1 if it passes, or the client
+ *       has no filter
+ *     0 otherwise
+ */
+int passesMatch(struct connection *conn, struct frame *frame){
+    if(conn->match == NULL ||
+       matchText(conn->match, frameData(frame)+1+sizeof(int), frame->len-2-sizeof(int))){
+        return 1;
+    }
+    conn->jobs_filtered++;
+    conn->bytes_filtered += frame->len;
+    conn->deficit -= frame->len < conn->deficit ? frame->len : conn->deficit;
+    return 0;
+}
+
+/* Queues a control frame with the
+ * amount of jobs in the job file of
+ * the client's queue so far.
+ *
+ * Input:
+ *     conn: the client's connection
+ * Return:
+ *     void
+ */
+void sendCount(struct connection *conn){
+    struct jobqueue *queue = conn->queue;
+    if(indexJobs(&queue->index, fileno(queue->file)) == -1){
+        sendTermSignal(conn, 2);
+        return;
+    }
+    char text[24];
+    int len = snprintf(text, sizeof(text), "%llu", (unsigned long long)queue->index.count);
+    sendControl(conn, CONTROL_COUNT, text, len);
+}
+
+/* Queues a control frame with the
+ * stats of a client's session and of
+ * the queue it is served from.
+ *
+ * Input:
+ *     conn: the client's connection
+ * Return:
+ *     void
+ */
+void sendStats(struct connection *conn){
+    char text[512];
+    int len = snprintf(text, sizeof(text),
+        "Client %lu: %lu job(s), %llu byte(s) sent, %ld pending, "
+        "%lu request(s) in %lu read(s), %lu result(s), %zu byte(s) buffered. "
+        "Queue %s: %lu job(s) sent, %d client(s) connected, %zu byte(s) buffered for all.",
+        conn->id, conn->jobs_sent, conn->bytes_sent, conn->pending,
+        conn->requests, conn->recv_calls, conn->results, conn->memory.used,
+        conn->queue->name, conn->queue->jobs_sent, connection_count, memory.used);
+    sendControl(conn, CONTROL_STATS, text, len);
+}
+
+/* Queues a control frame, laid out
+ * like a job frame with the kind of
+ * control message where the checksum
+ * usually is. See protocol.h.
+ *
+ * Input:
+ *     conn: the client's connection
+ *     kind: kind of control message
+ *     text: the message
+ *     len:  length of the message
+ * Return:
+ *     void
+ */
+void sendControl(struct connection *conn, int kind, char *text, int len){
+    struct frame *control = controlFrame(kind, text, len);
+    if(control == NULL){
+        return;
+    }
+    queueFrame(conn, control);
+    activate(conn);
+}
+
+/* Builds a control frame.
+ *
+ * Input:
+ *     kind: kind of control message
+ *     text: the message
+ *     len:  length of the message
+ * Return:
+ *     the frame, or NULL if out
+ *     of memory
+ */
+struct frame *controlFrame(int kind, char *text, int len){
+    struct frame *control = newFrame(len+2+sizeof(int));
+    if(control == NULL){
+        return NULL;
+    }
+    memset(control->data, 0, control->len);
+    control->data[0] = (FRAME_CONTROL << 5) + kind;
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        control->data[i+1] = (char)((len >> shuffle) & 15);
+    }
+    memcpy(control->data+1+sizeof(int), text, len);
+    return control;
+}
+
+/* In dedup mode, swaps a job frame for
+ * a reference to its text if the client
+ * has the text cached, see dedup.c.
+ * Otherwise the text is noted as cached
+ * by the client once the frame is sent.
+ * Texts longer than DEDUP_TEXT_MAX are
+ * always sent whole.
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     frame: the job frame
+ * Return:
+ *     the frame to queue, which is
+ *     the job frame or its reference
+ */
+struct frame *dedupFrame(struct connection *conn, struct frame *frame){
+    int text_length = frame->len-2-sizeof(int);
+    if(conn->dedup.capacity == 0 || text_length > DEDUP_TEXT_MAX){
+        return frame;
+    }
+    char *data = frameData(frame);
+    char *text = data+1+sizeof(int);
+    uint64_t hash = hashText(text, text_length);
+    /* Built up front, so the cache is never
+     * touched for a reference that can't
+     * be sent. */
+    char ref[1+sizeof(struct dedupref)];
+    ref[0] = (unsigned char)data[0] >> 5;
+    memcpy(ref+1, &hash, sizeof(hash));
+    struct frame *reference = controlFrame(CONTROL_REFERENCE, ref, sizeof(ref));
+    if(reference == NULL){
+        return frame;
+    }
+    if(findDedup(&conn->dedup, hash) == NULL){
+        addDedup(&conn->dedup, hash, text, text_length);
+        freeFrame(reference);
+        return frame;
+    }
+    conn->refs_sent++;
+    conn->bytes_saved += frame->len - reference->len;
+    freeFrame(frame);
+    return reference;
+}
+
+/* Puts a connection in the send
+ * rotation, if it isn't already.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void activate(struct connection *conn){
+    if(conn->active || conn->state == CONN_CLOSED){
+        return;
+    }
+    conn->active = 1;
+    conn->active_next = NULL;
+    if(active_tail == NULL){
+        active_head = conn;
+    }else{
+        active_tail->active_next = conn;
+    }
+    active_tail = conn;
+}
+
+/* One round of deficit round-robin over
+ * every connection in the send rotation.
+ * Connections that still have work after
+ * their turn go to the back of the rotation,
+ * the rest leave it until they get a new
+ * request or their socket drains.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void serveClients(){
+    struct connection *round_end = active_tail;
+    while(active_head != NULL){
+        struct connection *conn = active_head;
+        active_head = conn->active_next;
+        if(active_head == NULL){
+            active_tail = NULL;
+        }
+        conn->active = 0;
+
+        if(conn->state != CONN_CLOSED){
+            serveConnection(conn);
+        }
+        int has_work = conn->send_head != NULL ||
+            (conn->state == CONN_OPEN && conn->pending != 0 && !conn->waiting && !conn->throttled);
+        if(conn->state != CONN_CLOSED && has_work && !conn->blocked && conn->held_until_us == 0){
+            activate(conn);
+        }else{
+            conn->deficit = 0;
+        }
+        if(conn == round_end){
+            break;
+        }
+    }
+}
+
+/* Gives a connection its quantum and
+ * sends from its queue as long as the
+ * frame at the head fits in the deficit.
+ * Jobs are read into the queue as it
+ * runs empty, or with -COALESCE until
+ * it holds the connection's batch
+ * budget, and the batch is sent in one
+ * write unless it is held back, see
+ * holdBatch(). No jobs are read while
+ * the memory budget is exhausted, or
+ * once jobs that didn't pass the
+ * client's filter used up the deficit.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void serveConnection(struct connection *conn){
+    conn->deficit += quantum;
+    conn->rounds++;
+    conn->held_until_us = 0;
+    int corked = 0;
+    int coalesce = coalesce_us > 0 && conn->ring == NULL;
+    while(1){
+        if(coalesce){
+            while(conn->queued_bytes < conn->batch_budget && conn->state == CONN_OPEN &&
+                  conn->pending != 0 && !conn->waiting && conn->deficit > 0 &&
+                  !budgetExhausted(&conn->memory)){
+                if(sendJob(conn) != 0){
+                    break;
+                }
+            }
+            if(conn->send_head == NULL || holdBatch(conn)){
+                break;
+            }
+        }else if(conn->send_head == NULL){
+            if(conn->state != CONN_OPEN || conn->pending == 0 || conn->waiting ||
+               conn->deficit == 0 || budgetExhausted(&conn->memory)){
+                break;
+            }
+            sendJob(conn);
+            continue;
+        }
+        struct frame *head = conn->send_head;
+        if(head->len - head->sent > conn->deficit){
+            break;
+        }
+        if(socket_options.cork && conn->tcp && !corked){
+            setCork(conn->socket, 1);
+            corked = 1;
+        }
+        long sent = coalesce ? flushBatch(conn, conn->deficit) : flushFrame(conn);
+        if(sent == -1){
+            errorPrint("Lost connection to client.");
+            closeConnection(conn);
+            return;
+        }
+        if(coalesce){
+            tuneBatch(conn, coalesce_us);
+        }
+        conn->deficit -= sent;
+        if(conn->blocked && conn->ring == NULL){
+            watchConnection(conn);
+        }
+        if(conn->blocked){
+            break;
+        }
+    }
+    if(corked){
+        setCork(conn->socket, 0);
+    }
+    if(conn->ring == NULL && conn->rounds % 64 == 0){
+        uint64_t now = monotonicMicros();
+        uint64_t rate = (conn->bytes_sent - conn->rate_mark_bytes) * 1000000 /
+                        (now - conn->rate_mark_us + 1);
+        conn->drain_rate = rate;
+        if(conn->tcp && autosizeBuffers(conn->socket, rate) > 0 && debug){
+            char settings[160];
+            describeSockopts(conn->socket, conn->tcp, settings, sizeof(settings));
+            printf(COLOR_CYAN ">>%d<< Client %lu resized: %s", serverid, conn->id, settings);
+            printf(COLOR_RESET "\n");
+        }
+        conn->rate_mark_us = now;
+        conn->rate_mark_bytes = conn->bytes_sent;
+    }
+    if(conn->lagging && conn->queued_bytes < lag_bytes/2){
+        conn->lagging = 0;
+        wakeWaiting();
+    }
+    if(conn->state == CONN_FLUSH_CLOSE && conn->send_head == NULL){
+        closeConnection(conn);
+        return;
+    }
+    throttleConnection(conn);
+}
+
+/* Takes the next job from the connection's
+ * queue and queues it, on the connection
+ * or in broadcast mode on every client
+ * served from the same queue, see
+ * broadcastJob(). Jobs of a range request
+ * are read by their number instead, and
+ * only sent to the client that asked.
+ * A job that doesn't pass the client's
+ * filter is dropped instead, see
+ * passesMatch().
+ *
+ * Input:
+ *     conn: the client's connection
+ * Return:
+ *     -1 on error, or if the queue
+ *        is out of jobs
+ *      0 on success
+ *      1 if waiting for jobs to be
+ *        appended to the job file, read
+ *        ahead, or for a client that
+ *        fell behind the broadcast
+ */
+int sendJob(struct connection *conn){
+    int ranged = conn->range_next < conn->range_end;
+    if(!ranged && broadcast && lag_policy == LAG_BLOCK && broadcastBlocked(conn)){
+        debugPrint("Waiting for a client to catch up with the broadcast...", debug);
+        conn->waiting = 1;
+        return 1;
+    }
+    struct frame *frame;
+    struct jobentry job;
+    int ret;
+    if(ranged){
+        ret = readRangeJob(conn, &frame, &job);
+    }else if(readahead_budget > 0){
+        ret = takeReadaheadJob(conn, &frame, &job);
+    }else{
+        ret = readJob(conn, &frame, &job);
+    }
+    if(ret != 0){
+        return ret;
+    }
+    PROBE4(job_read, job.seq, (unsigned char)frameData(frame)[0] >> 5, frame->len, conn->id);
+    if(broadcast && !ranged){
+        broadcastJob(conn, frame, &job);
+    }else if(!ranged && !passesMatch(conn, frame)){
+        freeFrame(frame);
+    }else{
+        deliverJob(conn, frame, &job);
+    }
+    return 0;
+}
+
+/* Takes the next job of the types the
+ * client subscribed to from the
+ * connection's queue and reads it from
+ * the job file, see frameJob(). The
+ * file is scanned further once the
+ * window of a type drains, see
+ * scheduler.c. In follow mode it is
+ * also scanned when it was written to,
+ * see wakeFollowers(), so appended
+ * records are queued as they come, and
+ * an urgent one doesn't wait for every
+ * job queued before it to be sent.
+ * Picking a queued job otherwise
+ * doesn't touch the file.
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     frame: set to the job's frame
+ *     job:   set to the job
+ * Return:
+ *     -1 on error, or if the queue
+ *        is out of jobs
+ *      0 on success
+ *      1 if waiting for jobs to be
+ *        appended to the job file
+ */
+int readJob(struct connection *conn, struct frame **frame, struct jobentry *job){
+    struct jobqueue *queue = conn->queue;
+    FILE *f = queue->file;
+    if(follow && queue->watch == 0){
+        /* Watches the file, which is
+         * then scanned once so no
+         * append is missed. */
+        int watched = waitForJobs(conn);
+        if(watched != 0){
+            return watched;
+        }
+        queue->grown = 1;
+    }
+    if(queue->grown || scanDue(&queue->sched, conn->types)){
+        queue->grown = 0;
+        if(scanJobs(&queue->sched, fileno(f), conn->types) == -1){
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+    }
+    while(nextJob(&queue->sched, job, conn->types) == -1){
+        int added = scanJobs(&queue->sched, fileno(f), conn->types);
+        if(added == -1){
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+        if(added > 0){
+            continue;
+        }
+        if(!follow){
+            debugPrint("Out of jobs. Alerting client.", debug);
+            outOfJobs(conn);
+            return -1;
+        }
+        int waited = waitForJobs(conn);
+        if(waited != 0){
+            return waited;
+        }
+    }
+    if(frameJob(conn, job, frame) == -1){
+        return -1;
+    }
+    queue->cursor = ftell(f);
+    queue->jobs_sent++;
+    return 0;
+}
+
+/* Takes the next job of the connection's
+ * range request, see takeRange(), and
+ * reads it from the job file by its
+ * number. A range past the end of the
+ * file ends the session like running
+ * out of jobs does, except in follow
+ * mode, where it waits for the jobs.
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     frame: set to the job's frame
+ *     job:   set to the job
+ * Return:
+ *     -1 on error, or if the file
+ *        is out of jobs
+ *      0 on success
+ *      1 if waiting for jobs to be
+ *        appended to the job file
+ */
+int readRangeJob(struct connection *conn, struct frame **frame, struct jobentry *job){
+    struct jobqueue *queue = conn->queue;
+    while(conn->range_next >= queue->index.count){
+        int added = indexJobs(&queue->index, fileno(queue->file));
+        if(added == -1){
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+        if(added > 0){
+            continue;
+        }
+        if(!follow){
+            debugPrint("Range past the end of the jobs. Alerting client.", debug);
+            outOfJobs(conn);
+            return -1;
+        }
+        int waited = waitForJobs(conn);
+        if(waited != 0){
+            return waited;
+        }
+    }
+    memset(job, 0, sizeof(*job));
+    job->seq = conn->range_next;
+    job->offset = queue->index.offsets[conn->range_next];
+    if(frameJob(conn, job, frame) == -1){
+        return -1;
+    }
+    conn->range_next++;
+    queue->jobs_sent++;
+    return 0;
+}
+
+/* Reads a job from the job file and
+ * puts together the information
+ * in the decided upon format. The text
+ * is read straight into the frame,
+ * behind the room left for the header.
+ *
+ * 3 bit  - jobtype
+ * 5 bit  - checksum
+ * 4 char - a split integer
+ *          containing text-length.
+ * Rest   - the actual text
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     job:   the job, with its offset
+ *     frame: set to the job's frame
+ * Return:
+ *     -1 on error
+ *      0 on success
+ */
+int frameJob(struct connection *conn, struct jobentry *job, struct frame **frame){
+    char job_type;
+    FILE *f = conn->queue->file;
+    if(ftell(f) != job->offset){
+        fseek(f, job->offset, SEEK_SET);
+    }
+    if(fread(&job_type, sizeof(char), 1, f) == 0){
+        errorPrint("Error with reading job-type. Inspect job file.");
+        sendTermSignal(conn, 2);
+        return -1;
+    }
+
+    unsigned int text_length;
+    if(fread(&text_length, sizeof(int), 1, f) == 0){
+        errorPrint("Error with reading text-length. Inspect job file.");
+        sendTermSignal(conn, 2);
+        return -1;
+    }
+    if(text_length < 1 || text_length > 1000000){
+        errorPrint("Text-length out of bounds. Inspect job file.");
+        sendTermSignal(conn, 2);
+        return -1;
+    }
+    struct frame *outMessage = newFrame(text_length+2+sizeof(int));
+    if(outMessage == NULL){
+        errorPrint("Out of memory while queueing job.");
+        sendTermSignal(conn, 2);
+        return -1;
+    }
+    char *job_text = outMessage->data+1+sizeof(int);
+    job_text[text_length] = '\0';
+    if(fread(job_text, sizeof(char), text_length, f) != text_length){
+        errorPrint("Error with reading job-text. Inspect job file.");
+        freeFrame(outMessage);
+        sendTermSignal(conn, 2);
+        return -1;
+    }
+
+    int checksum = getChecksum(job_text, text_length);
+    if(checksum < 0 || checksum > 32){
+        errorPrint("Checksum value out of bounds.");
+        freeFrame(outMessage);
+        sendTermSignal(conn, 2);
+        return -1;
+    }
+    unsigned char job_info = checksum;
+
+    switch (job_type){
+        case 'O':
+            break;
+        case 'E':
+            job_info = job_info + (1<<5);
+            break;
+        default:
+            errorPrint("Invalid job type.");
+            freeFrame(outMessage);
+            sendTermSignal(conn, 2);
+            return -1;
+    }
+    PROBE4(job_checksum, job->seq, job_type == 'E', text_length, conn->id);
+
+    outMessage->data[0] = job_info;
+    for(int i = 0; i < (int)sizeof(int); i++){
+        int shuffle = 12 -(i*4);
+        outMessage->data[i+1] = (char)((text_length >> shuffle) & 15);
+    }
+    if(debug){
+        printf(COLOR_CYAN">>%d<< Sending job of type %c to client %lu\n", getpid(), job_type, conn->id);
+        printf(">>%d<< text length is: %d\n",getpid(), text_length);
+        printf(">>%d<< checksum is:    %d\n",getpid(), checksum);
+        printf(COLOR_YELLOW "\n%s\n", job_text);
+        printf("\n"COLOR_RESET);
+    }
+    *frame = outMessage;
+    return 0;
+}
+
+/* Takes the next job of the connection's
+ * queue from the frames read ahead, see
+ * readahead.c. The reader
+ * thread of the queue is started the
+ * first time it is needed.
+ * Frames are moved from the reader's
+ * ring to the queue's scheduler, so
+ * jobs read ahead are still sent by
+ * priority. A job whose frame was
+ * dropped by shedReadahead() is read
+ * from the job file instead, and so
+ * are the jobs of the types it left to
+ * be scanned.
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     frame: set to the job's frame
+ *     job:   set to the job
+ * Return:
+ *     -1 on error, or if the queue
+ *        is out of jobs
+ *      0 on success
+ *      1 if waiting for the reader
+ */
+int takeReadaheadJob(struct connection *conn, struct frame **frame, struct jobentry *job){
+    struct jobqueue *queue = conn->queue;
+    if(queue->ra == NULL){
+        queue->ra = startReadahead(queue->path, follow, readahead_fd);
+        if(queue->ra == NULL){
+            errorPrint("Couldn't start reading the job file ahead.");
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+    }
+    struct readslot slot;
+    int taken;
+    while((taken = takeReadahead(queue->ra, &slot)) == READAHEAD_TAKEN){
+        /* The frame is the record
+         * without its priority prefix,
+         * and one byte longer. */
+        job->offset = slot.end - (slot.frame->len - 1);
+        job->prefix = slot.prefix;
+        job->priority = slot.priority;
+        job->type = ((unsigned char)slot.frame->data[0] >> 5) == 1;
+        job->frame = slot.frame;
+        int added = addJob(&queue->sched, job, slot.end);
+        if(added != 0){
+            releaseReadahead(queue->ra, slot.frame->len);
+            freeFrame(slot.frame);
+        }
+        if(added == -1){
+            errorPrint("Out of memory while queueing job.");
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+    }
+    unsigned int spilled = conn->types & queue->sched.spilled;
+    if(spilled != 0 && (queue->grown || scanDue(&queue->sched, spilled))){
+        queue->grown = 0;
+        if(scanJobs(&queue->sched, fileno(queue->file), spilled) == -1){
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+    }
+    while(nextJob(&queue->sched, job, conn->types) == -1){
+        int added = 0;
+        if(spilled != 0){
+            added = scanJobs(&queue->sched, fileno(queue->file), spilled);
+        }
+        if(added == -1){
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+        if(added > 0){
+            continue;
+        }
+        if(taken == READAHEAD_ERROR){
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+        if(taken == READAHEAD_EOF){
+            debugPrint("Out of jobs. Alerting client.", debug);
+            outOfJobs(conn);
+            return -1;
+        }
+        if(follow && queue->watch == 0){
+            int waited = waitForJobs(conn);
+            if(waited == -1){
+                return -1;
+            }
+            if(waited == 0){
+                pokeReadahead(queue->ra);
+            }
+        }
+        if(conn->types != TYPES_ALL && readaheadFull(queue->ra)){
+            shedReadahead(queue, conn->types);
+        }
+        debugPrint("Waiting for jobs to be read ahead...", debug);
+        conn->waiting = 1;
+        return 1;
+    }
+
+    if(job->frame == NULL){
+        if(frameJob(conn, job, frame) == -1){
+            return -1;
+        }
+        queue->jobs_sent++;
+        return 0;
+    }
+    *frame = job->frame;
+    releaseReadahead(queue->ra, (*frame)->len);
+    if(debug){
+        printf(COLOR_CYAN">>%d<< Sending read-ahead job to client %lu, %zu byte(s)", getpid(),
+               conn->id, (*frame)->len);
+        printf(COLOR_RESET "\n");
+    }
+    queue->cursor = job->offset + (*frame)->len - 1;
+    queue->jobs_sent++;
+    return 0;
+}
+
+/* Drops the frames of the jobs read
+ * ahead that are queued in a queue's
+ * scheduler but of none of the given
+ * types, giving their budget back to
+ * the reader. It is called when the
+ * reader waits for budget that only
+ * jobs the client doesn't take hold, so
+ * the client gets to the jobs it takes.
+ * Those jobs are then left to be
+ * scanned from the job file, see
+ * spillJobs(), so they aren't queued
+ * for as long as nobody takes them.
+ *
+ * Input:
+ *     queue: the queue
+ *     types: the types whose frames
+ *            are kept
+ * Return:
+ *     void
+ */
+void shedReadahead(struct jobqueue *queue, unsigned int types){
+    for(int t = 0; t < JOB_TYPES; t++){
+        if(types & (1 << t)){
+            continue;
+        }
+        for(int c = 0; c < PRIORITY_CLASSES; c++){
+            struct jobfifo *fifo = &queue->sched.classes[c][t];
+            for(long i = fifo->head; i < fifo->tail; i++){
+                struct jobentry *job = &fifo->entries[i];
+                struct frame *frame = job->frame;
+                if(frame == NULL){
+                    continue;
+                }
+                job->frame = NULL;
+                releaseReadahead(queue->ra, frame->len);
+                freeFrame(frame);
+            }
+        }
+        spillJobs(&queue->sched, t);
+    }
+}
+
+/* Queues a job on a connection, as a
+ * reference to its text if the client
+ * has it cached, and counts it.
+ *
+ * Input:
+ *     conn:  the client's connection
+ *     frame: the job's frame
+ *     job:   the job
+ * Return:
+ *     void
+ */
+void deliverJob(struct connection *conn, struct frame *frame, struct jobentry *job){
+    frame = dedupFrame(conn, frame);
+    queueFrame(conn, frame);
+    if(conn->pending > 0){
+        conn->pending--;
+    }
+    conn->jobs_sent++;
+    if(results_path != NULL && rememberJob(conn, conn->queue, job->seq) == -1){
+        errorPrint("Out of memory while remembering job.");
+    }
+    conn->queue->bytes_sent += frame->len;
+}
+
+/* Queues a job on every client that is
+ * served from the same queue, takes its
+ * type, passes its filter and still
+ * wants jobs. The job is read and its
+ * frame built once; every client's send
+ * queue gets a frame sharing it, see
+ * shareFrame() in connection.c.
+ * A client with more than -LAG queued
+ * is skipped with the drop policy, or
+ * disconnected with the disconnect one.
+ * With the block policy the job isn't
+ * read until it has caught up, see
+ * broadcastBlocked().
+ *
+ * Input:
+ *     origin: the connection the job
+ *             was read for
+ *     frame:  the job's frame
+ *     job:    the job
+ * Return:
+ *     void
+ */
+void broadcastJob(struct connection *origin, struct frame *frame, struct jobentry *job){
+    struct jobqueue *queue = origin->queue;
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn->state != CONN_OPEN || conn->queue != queue || conn->pending == 0 ||
+           !(conn->types & (1 << job->type)) || !passesMatch(conn, frame)){
+            continue;
+        }
+        if(conn != origin && conn->queued_bytes >= lag_bytes){
+            if(lag_policy == LAG_DISCONNECT){
+                printf(COLOR_CYAN ">>%d<< Client %lu fell behind the broadcast. Disconnecting.",
+                       serverid, conn->id);
+                printf(COLOR_RESET "\n");
+                closeConnection(conn);
+                continue;
+            }
+            if(lag_policy == LAG_DROP){
+                conn->jobs_dropped++;
+                continue;
+            }
+        }
+        struct frame *share = shareFrame(frame);
+        if(share == NULL){
+            errorPrint("Out of memory while broadcasting job.");
+            conn->jobs_dropped++;
+            continue;
+        }
+        deliverJob(conn, share, job);
+        if(conn != origin){
+            activate(conn);
+        }
+    }
+    freeFrame(frame);
+}
+
+/* Checks, with the block policy, if a
+ * client served from the same queue has
+ * fallen more than -LAG behind. The
+ * clients waiting for it are woken once
+ * it is down to half of that, see
+ * serveConnection().
+ *
+ * Input:
+ *     origin: the connection a job is
+ *             about to be read for
+ * Return:
+ *     1 if the broadcast has to wait
+ *     0 otherwise
+ */
+int broadcastBlocked(struct connection *origin){
+    int blocked = 0;
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn != origin && conn->state == CONN_OPEN && conn->queue == origin->queue &&
+           conn->pending != 0 && conn->queued_bytes >= lag_bytes){
+            conn->lagging = 1;
+            blocked = 1;
+        }
+    }
+    return blocked;
+}
+
+
+/* Decides whether a batch smaller than
+ * the connection's budget is held back
+ * for more jobs. It is while the client
+ * wants more jobs than there are right
+ * now, and until the oldest frame in it
+ * has waited the connection's deadline.
+ * The batch timer then puts the
+ * connection back in the send rotation,
+ * see releaseBatches().
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     1 if the batch is held back
+ *     0 if it is to be sent
+ */
+int holdBatch(struct connection *conn){
+    if(conn->queued_bytes >= conn->batch_budget || conn->state != CONN_OPEN ||
+       conn->pending == 0 || !conn->waiting){
+        return 0;
+    }
+    uint64_t due = conn->send_head->queued_us + conn->batch_deadline_us;
+    if(due <= monotonicMicros()){
+        if(conn->batch_deadline_us > 0){
+            conn->deadline_flushes++;
+        }
+        return 0;
+    }
+    conn->held_until_us = due;
+    armBatchTimer(due);
+    return 1;
+}
+
+/* Arms the batch timer to go off at
+ * due, unless it already goes off
+ * before that.
+ *
+ * Input:
+ *     due: monotonic time in us
+ * Return:
+ *     void
+ */
+void armBatchTimer(uint64_t due){
+    if(batch_timer_us != 0 && batch_timer_us <= due){
+        return;
+    }
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = due / 1000000;
+    spec.it_value.tv_nsec = (due % 1000000) * 1000;
+    if(timerfd_settime(batch_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1){
+        errorPrint("Couldn't arm the coalescing timer.");
+        return;
+    }
+    batch_timer_us = due;
+}
+
+/* Throttles a connection while its
+ * memory budget, or the server's, is
+ * exhausted, and lets it go once it
+ * isn't any more. A throttled client's
+ * requests aren't read, see
+ * takeRequests(), and no jobs are read
+ * for it, while what is queued is still
+ * sent. Requests on shm: are read all
+ * the same, as they carry the doorbell
+ * that lets the queue drain.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void throttleConnection(struct connection *conn){
+    int exhausted = budgetExhausted(&conn->memory);
+    if(exhausted && memory.exhausted){
+        memory_pressure = 1;
+    }
+    if(exhausted == conn->throttled || conn->state == CONN_CLOSED){
+        return;
+    }
+    conn->throttled = exhausted;
+    if(exhausted){
+        conn->throttles++;
+        throttled_count++;
+        if(debug){
+            printf(COLOR_CYAN ">>%d<< Client %lu throttled, %zu byte(s) buffered for it, %zu for all.",
+                   serverid, conn->id, conn->memory.used, memory.used);
+            printf(COLOR_RESET "\n");
+        }
+    }else{
+        throttled_count--;
+        debugPrint("Client no longer throttled.", debug);
+        activate(conn);
+    }
+    if(conn->ring == NULL){
+        watchConnection(conn);
+    }
+}
+
+/* Sets what epoll waits for on a
+ * connection's socket: requests unless
+ * it is throttled, and room to send
+ * while it is blocked.
+ *
+ * Input:
+ *     conn: the connection
+ * Return:
+ *     void
+ */
+void watchConnection(struct connection *conn){
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (conn->throttled && conn->ring == NULL ? 0 : EPOLLIN) |
+                   (conn->blocked ? EPOLLOUT : 0);
+    event.data.fd = conn->socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->socket, &event);
+}
+
+/* Lets go of the connections that were
+ * throttled by the server's budget once
+ * it isn't exhausted any more, and
+ * listens for new clients again if
+ * they were left waiting for memory.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void relieveMemory(){
+    if(memory.exhausted){
+        return;
+    }
+    if(memory_pressure){
+        memory_pressure = 0;
+        for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+            if(conn->throttled){
+                throttleConnection(conn);
+            }
+        }
+    }
+    if(!listening && connection_count < max_connections &&
+       budgetRoom(&memory, REQUEST_BUFFER)){
+        listenAgain();
+    }
+}
+
+/* Checks a connection when its timer
+ * goes off, and sets the timer for the
+ * next check. A client counts as heard
+ * from when it sent anything, or took
+ * frames off its send queue, since
+ * the last check, or when it was
+ * throttled with nothing queued.
+ *
+ * A client silent for a heartbeat
+ * interval with nothing queued is sent
+ * a heartbeat, once an interval, and a
+ * client silent for HEARTBEAT_MISSES
+ * intervals is disconnected right away,
+ * giving back what it held. With -IDLE
+ * a client that has asked for nothing
+ * for that long, with nothing pending
+ * or queued, is told and disconnected.
+ *
+ * Input:
+ *     conn: the connection
+ *     now:  the current time
+ * Return:
+ *     void
+ */
+void checkConnection(struct connection *conn, uint64_t now){
+    if(conn->throttled && conn->send_head == NULL){
+        /* Held back by the other clients,
+         * and not read from meanwhile. */
+        conn->heard_us = now;
+    }
+    if(conn->frames_sent != conn->heard_frames){
+        conn->heard_frames = conn->frames_sent;
+        conn->heard_us = now;
+    }
+    uint64_t due = UINT64_MAX;
+    if(heartbeat_us > 0){
+        uint64_t silent = now - conn->heard_us;
+        if(silent >= HEARTBEAT_MISSES*heartbeat_us){
+            printf(COLOR_CYAN ">>%d<< Client %lu stopped answering heartbeats. Disconnecting.",
+                   serverid, conn->id);
+            printf(COLOR_RESET "\n");
+            dead_closed++;
+            closeConnection(conn);
+            return;
+        }
+        if(silent >= heartbeat_us && conn->send_head == NULL &&
+           now - conn->pinged_us >= heartbeat_us){
+            sendControl(conn, CONTROL_HEARTBEAT, "", 0);
+            /* Sending the heartbeat itself
+             * isn't hearing from the client. */
+            conn->heard_frames = conn->frames_sent + 1;
+            conn->pinged_us = now;
+            conn->pings++;
+        }
+        due = silent >= heartbeat_us ? now + heartbeat_us : conn->heard_us + heartbeat_us;
+    }
+    if(idle_us > 0 && conn->state == CONN_OPEN){
+        if(conn->pending == 0 && conn->send_head == NULL && now - conn->requested_us >= idle_us){
+            printf(COLOR_CYAN ">>%d<< Client %lu has been idle for %.0f ms. Disconnecting.",
+                   serverid, conn->id, (now - conn->requested_us) / 1000.0);
+            printf(COLOR_RESET "\n");
+            idle_closed++;
+            sendControl(conn, CONTROL_NOTICE, "Closing idle connection.", 24);
+            conn->state = CONN_FLUSH_CLOSE;
+        }else if(conn->requested_us + idle_us > now && conn->requested_us + idle_us < due){
+            due = conn->requested_us + idle_us;
+        }else if(now + idle_us < due){
+            due = now + idle_us;
+        }
+    }
+    if(due != UINT64_MAX){
+        scheduleTimer(&wheel, &conn->timer, due);
+    }
+}
+
+/* Turns the timer wheel when the
+ * heartbeat timer ticks, and checks
+ * every connection whose timer is due.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void expireConnections(){
+    uint64_t ticks;
+    read(heartbeat_timer_fd, &ticks, sizeof(ticks));
+    uint64_t now = monotonicMicros();
+    struct wheeltimer *timer = expireTimers(&wheel, now);
+    while(timer != NULL){
+        struct wheeltimer *next = timer->next;
+        timer->next = NULL;
+        struct connection *conn = (struct connection *)((char *)timer - offsetof(struct connection, timer));
+        if(conn->state != CONN_CLOSED){
+            checkConnection(conn, now);
+        }
+        timer = next;
+    }
+}
+
+/* Puts every connection whose batch has
+ * been held back until its deadline back
+ * in the send rotation, and arms the
+ * batch timer for the next one.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void releaseBatches(){
+    uint64_t count;
+    read(batch_timer_fd, &count, sizeof(count));
+    batch_timer_us = 0;
+    uint64_t now = monotonicMicros();
+    uint64_t next = 0;
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn->held_until_us == 0 || conn->state == CONN_CLOSED){
+            continue;
+        }
+        if(conn->held_until_us <= now){
+            conn->held_until_us = 0;
+            activate(conn);
+        }else if(next == 0 || conn->held_until_us < next){
+            next = conn->held_until_us;
+        }
+    }
+    if(next != 0){
+        armBatchTimer(next);
+    }
+}
+
+/* Reads and prints the reason
+ * the client had to quit due
+ * to an error
+ * Error code protocol described
+ * in protokoll.txt.
+ *
+ * Input:
+ *     type: integer error code
+ * Result:
+ *     void
+ */
+void errorCode(int type){
+    switch(type){
+        case 'S':
+            debugPrint("Client shutdown caused by checksum-error.", debug);
+            break;
+        case 'C':
+            debugPrint("Client shutdown caused by error in a child process.", debug);
+            break;
+        default:
+            debugPrint("Client shutdown caused by unkown error.", debug);
+            break;
+    }
+}
+/* Queues an otherwise empty message
+ * containing only the signal for
+ * termination of the server, where the
+ * job-type is usually stated. So the
+ * client is informed of the server ending
+ * the session and why. The connection
+ * is closed once the message is sent.
+ *
+ * Input:
+ *     conn: the client's connection
+ *     sig:  integer error code
+ * Return:
+ *     void
+ */
+void sendTermSignal(struct connection *conn, int sig){
+    struct frame *jobempty = newFrame(5*sizeof(char));
+    if(jobempty == NULL){
+        closeConnection(conn);
+        return;
+    }
+    memset(jobempty->data, 0, jobempty->len);
+    jobempty->data[0] = sig << 5;
+    queueFrame(conn, jobempty);
+    conn->pending = 0;
+    conn->state = CONN_FLUSH_CLOSE;
+    activate(conn);
+}
+/* Queues an otherwise empty message
+ * containing only the signal for
+ * termination of the server. So the
+ * client is informed that the session
+ * ends. The connection is kept until
+ * the client messages back that it
+ * will also terminate.
+ *
+ * Input:
+ *     conn: the client's connection
+ * Return:
+ *     void
+ */
+void outOfJobs(struct connection *conn){
+    sendTermSignal(conn, 7);
+    conn->state = CONN_ENDING;
+    debugPrint("Awaiting termination confirmation from client...", debug);
+}
+
+/* Prints why the client is ending
+ * the session, if the message is
+ * one of the closing requests.
+ *
+ * Input:
+ *     client_message: 4-byte request
+ * Return:
+ *     0 if the message closes the session
+ *    -1 otherwise
+ */
+int closingMessage(int client_message){
+    int request = client_message&255;
+    switch(request){
+        case 'Q':
+            debugPrint("Client shutdown caused by CTRL+C. SIGINT", debug);
+            return 0;
+        case 'T':
+            debugPrint("Client termination message received.", debug);
+            return 0;
+        case 'E':
+            debugPrint("Client termination was due to error.", debug);
+            errorCode((client_message>>8)&255);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* Parks a connection whose queue ran
+ * dry in follow mode until its job file
+ * is written to. The file is watched
+ * with inotify; the watch is added the
+ * first time the queue runs dry, after
+ * which the caller checks the file
+ * again so no append is missed. If the
+ * file can't be watched nothing would
+ * wake the connection, so the session
+ * ends with termination signal 2, and
+ * the next connection tries again.
+ *
+ * Input:
+ *     conn: the client's connection
+ * Return:
+ *     0 if the file should be checked again
+ *     1 if the connection is waiting
+ *    -1 if the file can't be watched
+ */
+int waitForJobs(struct connection *conn){
+    struct jobqueue *queue = conn->queue;
+    if(queue->watch == 0){
+        queue->watch = inotify_add_watch(inotify_fd, queue->path, IN_MODIFY);
+        if(queue->watch == -1){
+            errorPrint("Couldn't watch the job file.");
+            queue->watch = 0;
+            sendTermSignal(conn, 2);
+            return -1;
+        }
+        return 0;
+    }
+    debugPrint("Waiting for jobs to be appended...", debug);
+    conn->waiting = 1;
+    return 1;
+}
+
+/* Called when a watched job file is
+ * written to. Tells the reader threads,
+ * marks the queues to be scanned again,
+ * and puts every connection waiting
+ * for jobs back in the send rotation
+ * so it checks its queue again.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void wakeFollowers(){
+    char events[4096];
+    while(read(inotify_fd, events, sizeof(events)) > 0){
+    }
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn->state == CONN_CLOSED){
+            continue;
+        }
+        conn->queue->grown = 1;
+        if(conn->queue->ra != NULL){
+            pokeReadahead(conn->queue->ra);
+        }
+    }
+    wakeWaiting();
+}
+
+/* Puts every connection waiting for
+ * jobs back in the send rotation.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void wakeWaiting(){
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn->waiting){
+            conn->waiting = 0;
+            activate(conn);
+        }
+    }
+}
+
+/* Starts loading the job set again in
+ * the background. A reload asked for
+ * while one is running starts when it
+ * is done, so the last change to the
+ * job files is always picked up.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void requestReload(){
+    int ret = startReload(job_source, readahead_budget == 0, reload_fd);
+    if(ret == RELOAD_BUSY){
+        reload_again = 1;
+    }else if(ret == RELOAD_STARTED){
+        debugPrint("Reloading job set in the background.", debug);
+    }
+}
+
+/* Called when the reload thread is done.
+ * Makes the new job set the one new
+ * clients are served from. The old set
+ * is freed once the clients still
+ * served from it are gone.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void publishReload(){
+    uint64_t count;
+    read(reload_fd, &count, sizeof(count));
+    struct jobset *fresh = finishReload();
+    if(fresh == NULL){
+        errorPrint("Couldn't reload the job set. Keeping the current one.");
+    }else{
+        fresh->generation = jobs->generation+1;
+        holdJobset(fresh);
+        releaseJobset(jobs);
+        jobs = fresh;
+        printf(COLOR_CYAN ">>%d<< Reloaded job set, generation %lu.", serverid, jobs->generation);
+        printf(COLOR_RESET "\n");
+        printQueues();
+    }
+    if(reload_again){
+        reload_again = 0;
+        requestReload();
+    }
+}
+
+/* Prints the id and name of every
+ * queue in the current job set.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printQueues(){
+	for(int i = 0; i < jobs->count; i++){
+	    printf(COLOR_CYAN ">>%d<< Queue %d: %s", serverid, i, jobs->queues[i].name);
+	    printf(COLOR_RESET "\n");
+	}
+}
+
+/* Prints the stats of every queue
+ * and every connected client, and how
+ * evenly the clients have been served.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void printStats(){
+    printf(COLOR_CYAN ">>%d<< Job set generation %lu.", serverid, jobs->generation);
+    printf(COLOR_RESET "\n");
+    printQueueStats(jobs);
+    printPoolStats();
+    if(results_path != NULL){
+        printResultStats();
+    }
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn->state != CONN_CLOSED){
+            printConnectionStats(conn);
+        }
+    }
+    printf(COLOR_CYAN ">>%d<< %d client(s) connected, fairness index %.3f.",
+           serverid, connection_count, fairnessIndex(connections));
+    printf(COLOR_RESET "\n");
+    char budget[128];
+    describeBudget(&memory, budget, sizeof(budget));
+    printf(COLOR_CYAN ">>%d<< Memory: %s, %d client(s) throttled.",
+           serverid, budget, throttled_count);
+    printf(COLOR_RESET "\n");
+    if(heartbeat_timer_fd != -1){
+        printf(COLOR_CYAN ">>%d<< %lu client(s) disconnected for missing heartbeats, %lu for idling.",
+               serverid, dead_closed, idle_closed);
+        printf(COLOR_RESET "\n");
+        printWheelStats(&wheel);
+    }
+    fflush(stdout);
+}
+
+/* Signal handler for SIGINT that asks
+ * the event loop to shut the server
+ * down, see shutdownServer().
+ *
+ * Input:
+ *     sig: integer signal
+ * Return:
+ *    void
+ */
+void signalHandler(int sig){
+    assert(sig == SIGINT);
+    stop_requested = 1;
+}
+
+/* Makes sure the server shuts down in
+ * a good way when the user interrupts
+ * with CTRL+C. Tells every client that
+ * this is the reason server is shutting
+ * down, and frees every connection, so
+ * their holds on the job sets are let
+ * go of before main() releases them.
+ *
+ * Input:
+ *     none
+ * Return:
+ *    void
+ */
+void shutdownServer(){
+    unsigned char jobempty[5] = {6 << 5};
+    for(struct connection *conn = connections; conn != NULL; conn = conn->next){
+        if(conn->state != CONN_CLOSED){
+            send(conn->socket, jobempty, sizeof(jobempty), MSG_DONTWAIT | MSG_NOSIGNAL);
+            closeConnection(conn);
+        }
+        conn->active = 0;
+    }
+    active_head = NULL;
+    active_tail = NULL;
+    reapConnections();
+}
+
+/* Signal handler for SIGUSR1 that asks
+ * the event loop to print the stats.
+ *
+ * Input:
+ *     sig: integer signal
+ * Return:
+ *    void
+ */
+void statsSignalHandler(int sig){
+    assert(sig == SIGUSR1);
+    stats_requested = 1;
+}
+
+/* Signal handler for SIGHUP that asks
+ * the event loop to reload the job set.
+ *
+ * Input:
+ *     sig: integer signal
+ * Return:
+ *    void
+ */
+void reloadSignalHandler(int sig){
+    assert(sig == SIGHUP);
+    reload_requested = 1;
 }
@@ -0,0 +1,238 @@
+/* sockopts.c
+ *******************************************
+ * Socket tuning used by both server.c
+ * and client.c. Options are given as
+ * program arguments:
+ *
+ *     -NODELAY          disable Nagle, for
+ *                       interactive use.
+ *     -CORK             cork the socket while
+ *                       a batch of frames is
+ *                       written (server only).
+ *     -SNDBUF=<n|auto>  send buffer size.
+ *     -RCVBUF=<n|auto>  receive buffer size.
+ *     -LOWAT=<n>        TCP_NOTSENT_LOWAT, the
+ *                       most unsent bytes kept
+ *                       in the socket.
+ *     -KEEPALIVE=<s>    probe a connection idle
+ *                       for <s> seconds every
+ *                       <s> seconds, and drop it
+ *                       after KEEPALIVE_PROBES
+ *                       unanswered probes.
+ *     -USERTIMEOUT=<ms> TCP_USER_TIMEOUT, drop
+ *                       the connection once sent
+ *                       data goes unacknowledged
+ *                       for <ms>.
+ *
+ * With auto the buffer is sized to twice the
+ * bandwidth-delay product, from the RTT the
+ * kernel measured and the rate the caller
+ * measured, and resized as they change.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "sockopts.h"
+
+#define AUTO_MIN_BUFFER     (64*1024)
+#define AUTO_MAX_BUFFER     (16*1024*1024)
+
+struct sockopts socket_options;
+
+/* Parses a buffer size argument.
+ *
+ * Return:
+ *     the size, BUFFER_AUTO, or
+ *     -2 if not a valid size
+ */
+static int parseBufferSize(char *value){
+    if(strcmp(value, "auto") == 0){
+        return BUFFER_AUTO;
+    }
+    int size = atoi(value);
+    return size > 0 ? size : -2;
+}
+
+/* Checks if an argument is one of the
+ * socket options, and stores it.
+ *
+ * Input:
+ *     arg: program argument
+ * Return:
+ *     0 if it was a socket option
+ *    -1 if not
+ */
+int parseSockopt(char *arg){
+    if(strcmp(arg, "-NODELAY") == 0){
+        socket_options.nodelay = 1;
+    }else if(strcmp(arg, "-CORK") == 0){
+        socket_options.cork = 1;
+    }else if(strncmp(arg, "-SNDBUF=", 8) == 0 && parseBufferSize(arg+8) != -2){
+        socket_options.sndbuf = parseBufferSize(arg+8);
+    }else if(strncmp(arg, "-RCVBUF=", 8) == 0 && parseBufferSize(arg+8) != -2){
+        socket_options.rcvbuf = parseBufferSize(arg+8);
+    }else if(strncmp(arg, "-LOWAT=", 7) == 0 && atoi(arg+7) > 0){
+        socket_options.notsent_lowat = atoi(arg+7);
+    }else if(strncmp(arg, "-KEEPALIVE=", 11) == 0 && atoi(arg+11) > 0){
+        socket_options.keepalive = atoi(arg+11);
+    }else if(strncmp(arg, "-USERTIMEOUT=", 13) == 0 && atoi(arg+13) > 0){
+        socket_options.user_timeout = atoi(arg+13);
+    }else{
+        return -1;
+    }
+    return 0;
+}
+
+/* Applies the options to a socket.
+ * TCP-level options are skipped for
+ * local transports. Buffers set to
+ * auto start at the kernel default
+ * until autosizeBuffers() has a rate.
+ *
+ * Input:
+ *     socket: the socket
+ *     tcp:    1 if it is a TCP socket
+ * Return:
+ *     void
+ */
+void applySockopts(int socket, int tcp){
+    if(socket_options.sndbuf > 0){
+        setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &socket_options.sndbuf, sizeof(int));
+    }
+    if(socket_options.rcvbuf > 0){
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &socket_options.rcvbuf, sizeof(int));
+    }
+    if(!tcp){
+        return;
+    }
+    if(socket_options.nodelay){
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+    }
+    if(socket_options.notsent_lowat > 0){
+        setsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                   &socket_options.notsent_lowat, sizeof(int));
+    }
+    if(socket_options.keepalive > 0){
+        int on = 1;
+        int probes = KEEPALIVE_PROBES;
+        setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(int));
+        setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &socket_options.keepalive, sizeof(int));
+        setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &socket_options.keepalive, sizeof(int));
+        setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(int));
+    }
+    if(socket_options.user_timeout > 0){
+        setsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                   &socket_options.user_timeout, sizeof(int));
+    }
+}
+
+/* Corks or uncorks a TCP socket.
+ * Uncorking sends what was held back.
+ *
+ * Input:
+ *     socket: the socket
+ *     on:     1 to cork, 0 to uncork
+ * Return:
+ *     void
+ */
+void setCork(int socket, int on){
+    setsockopt(socket, IPPROTO_TCP, TCP_CORK, &on, sizeof(int));
+}
+
+/* Sizes the buffers set to auto to twice
+ * the bandwidth-delay product, using the
+ * kernel's smoothed RTT of the socket.
+ * Sizes within 25% of the current one
+ * are left alone.
+ *
+ * Input:
+ *     socket:        a TCP socket
+ *     bytes_per_sec: measured rate
+ * Return:
+ *     the new size, or 0 if unchanged
+ */
+int autosizeBuffers(int socket, uint64_t bytes_per_sec){
+    if(socket_options.sndbuf != BUFFER_AUTO && socket_options.rcvbuf != BUFFER_AUTO){
+        return 0;
+    }
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if(getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &len) == -1 || info.tcpi_rtt == 0){
+        return 0;
+    }
+    uint64_t size = 2 * bytes_per_sec * info.tcpi_rtt / 1000000;
+    if(size < AUTO_MIN_BUFFER){
+        size = AUTO_MIN_BUFFER;
+    }
+    if(size > AUTO_MAX_BUFFER){
+        size = AUTO_MAX_BUFFER;
+    }
+    int changed = 0;
+    int option[2] = {SO_SNDBUF, SO_RCVBUF};
+    int setting[2] = {socket_options.sndbuf, socket_options.rcvbuf};
+    for(int i = 0; i < 2; i++){
+        int current;
+        len = sizeof(int);
+        if(setting[i] != BUFFER_AUTO ||
+           getsockopt(socket, SOL_SOCKET, option[i], &current, &len) == -1){
+            continue;
+        }
+        /* The kernel reports twice the size that was set. */
+        current /= 2;
+        if(size*4 < (uint64_t)current*3 || size*4 > (uint64_t)current*5){
+            int value = size;
+            setsockopt(socket, SOL_SOCKET, option[i], &value, sizeof(int));
+            changed = value;
+        }
+    }
+    return changed;
+}
+
+/* Writes the settings in effect on a
+ * socket, as reported by the kernel,
+ * into buf.
+ *
+ * Input:
+ *     socket: the socket
+ *     tcp:    1 if it is a TCP socket
+ *     buf:    where to write
+ *     len:    size of buf
+ * Return:
+ *     void
+ */
+void describeSockopts(int socket, int tcp, char *buf, size_t len){
+    int sndbuf = 0;
+    int rcvbuf = 0;
+    int nodelay = 0;
+    int lowat = 0;
+    int keepalive = 0;
+    unsigned int user_timeout = 0;
+    socklen_t size = sizeof(int);
+    getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &sndbuf, &size);
+    size = sizeof(int);
+    getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &size);
+    if(tcp){
+        size = sizeof(int);
+        getsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, &size);
+        size = sizeof(int);
+        getsockopt(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, &size);
+        size = sizeof(int);
+        if(getsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &keepalive, &size) == 0 && keepalive){
+            size = sizeof(int);
+            getsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive, &size);
+        }
+        size = sizeof(user_timeout);
+        getsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, &size);
+    }
+    snprintf(buf, len, "nodelay=%d cork=%d sndbuf=%d%s rcvbuf=%d%s lowat=%d keepalive=%d "
+             "usertimeout=%u", nodelay, tcp && socket_options.cork, sndbuf,
+             socket_options.sndbuf == BUFFER_AUTO ? "(auto)" : "",
+             rcvbuf, socket_options.rcvbuf == BUFFER_AUTO ? "(auto)" : "", lowat,
+             keepalive, user_timeout);
+}
@@ -0,0 +1,37 @@
+/* SOCKOPTS.H
+ *
+ *****************************************
+ * Header file for the socket tuning
+ * options shared by server and client.
+ *
+ */
+#ifndef SOCKOPTS_H
+#define SOCKOPTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_DEFAULT      0
+#define BUFFER_AUTO         -1
+
+#define KEEPALIVE_PROBES    3
+
+struct sockopts {
+    int nodelay;
+    int cork;
+    int sndbuf;
+    int rcvbuf;
+    int notsent_lowat;
+    int keepalive;
+    int user_timeout;
+};
+
+extern struct sockopts socket_options;
+
+int parseSockopt(char *arg);
+void applySockopts(int socket, int tcp);
+void setCork(int socket, int on);
+int autosizeBuffers(int socket, uint64_t bytes_per_sec);
+void describeSockopts(int socket, int tcp, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,151 @@
+/* timerwheel.c
+ *******************************************
+ * Hashed timer wheel of WHEEL_SLOTS
+ * slots, each holding the timers due in
+ * one tick of tick_us, modulo the size
+ * of the wheel. The caller turns it once
+ * a tick, from a timerfd, and gets the
+ * timers that are due.
+ *
+ * Scheduling and cancelling a timer is
+ * O(1), and a tick only looks at the
+ * timers of its slot. Timers due more
+ * than one turn ahead are passed over
+ * until their turn comes, so no timer
+ * needs to be moved as time goes on.
+ *
+ * Timers are embedded in what they time,
+ * and linked into their slot through
+ * pprev, so they are unlinked without
+ * knowing their slot.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "colors.h"
+#include "timerwheel.h"
+
+/* Sets up an empty wheel.
+ *
+ * Input:
+ *     wheel:   the wheel
+ *     tick_us: length of a tick
+ *     now_us:  the current time
+ * Return:
+ *     void
+ */
+void initWheel(struct timerwheel *wheel, uint64_t tick_us, uint64_t now_us){
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick_us = tick_us > 0 ? tick_us : 1;
+    wheel->next_tick = now_us / wheel->tick_us;
+}
+
+/* Schedules a timer, moving it if it
+ * was scheduled before. It goes off on
+ * the first tick at or after due_us, or
+ * on the next tick if that has passed.
+ *
+ * Input:
+ *     wheel:  the wheel
+ *     timer:  the timer
+ *     due_us: when it is due
+ * Return:
+ *     void
+ */
+void scheduleTimer(struct timerwheel *wheel, struct wheeltimer *timer, uint64_t due_us){
+    cancelTimer(wheel, timer);
+    uint64_t tick = (due_us + wheel->tick_us - 1) / wheel->tick_us;
+    if(tick < wheel->next_tick){
+        tick = wheel->next_tick;
+    }
+    struct wheeltimer **slot = &wheel->slots[tick % WHEEL_SLOTS];
+    timer->due_us = due_us;
+    timer->next = *slot;
+    timer->pprev = slot;
+    if(*slot != NULL){
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    wheel->timers++;
+}
+
+/* Takes a timer off the wheel, if it
+ * is on it.
+ *
+ * Input:
+ *     wheel: the wheel
+ *     timer: the timer
+ * Return:
+ *     void
+ */
+void cancelTimer(struct timerwheel *wheel, struct wheeltimer *timer){
+    if(timer->pprev == NULL){
+        return;
+    }
+    *timer->pprev = timer->next;
+    if(timer->next != NULL){
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    wheel->timers--;
+}
+
+/* Turns the wheel up to the current
+ * time, taking every timer that is due
+ * off it. A wheel that fell a whole
+ * turn or more behind looks at every
+ * slot once.
+ *
+ * Input:
+ *     wheel:  the wheel
+ *     now_us: the current time
+ * Return:
+ *     the due timers, linked through
+ *     next, or NULL if none are due
+ */
+struct wheeltimer *expireTimers(struct timerwheel *wheel, uint64_t now_us){
+    struct wheeltimer *due = NULL;
+    uint64_t last = now_us / wheel->tick_us;
+    uint64_t tick = wheel->next_tick;
+    if(last >= tick + WHEEL_SLOTS){
+        tick = last - WHEEL_SLOTS + 1;
+    }
+    for(; tick <= last; tick++){
+        struct wheeltimer *timer = wheel->slots[tick % WHEEL_SLOTS];
+        while(timer != NULL){
+            struct wheeltimer *next = timer->next;
+            if(timer->due_us <= now_us){
+                cancelTimer(wheel, timer);
+                timer->next = due;
+                due = timer;
+                wheel->expired++;
+            }else{
+                wheel->passed++;
+            }
+            timer = next;
+        }
+        wheel->ticks++;
+    }
+    if(last+1 > wheel->next_tick){
+        wheel->next_tick = last+1;
+    }
+    return due;
+}
+
+/* Prints how many timers are on the
+ * wheel and how many went off.
+ *
+ * Input:
+ *     wheel: the wheel
+ * Return:
+ *     void
+ */
+void printWheelStats(struct timerwheel *wheel){
+    printf(COLOR_CYAN ">>%d<< Timer wheel: %lu timer(s), tick %.1f ms, %lu tick(s), "
+           "%lu expired, %lu passed over.", getpid(), wheel->timers,
+           wheel->tick_us / 1000.0, wheel->ticks, wheel->expired, wheel->passed);
+    printf(COLOR_RESET "\n");
+}
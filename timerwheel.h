@@ -0,0 +1,38 @@
+/* TIMERWHEEL.H
+ *
+ *****************************************
+ * Header file for the timer wheel the
+ * server checks its connections'
+ * heartbeats and idle times with.
+ *
+ */
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+#define WHEEL_SLOTS         512
+
+struct wheeltimer {
+    struct wheeltimer *next;
+    struct wheeltimer **pprev;
+    uint64_t due_us;
+};
+
+struct timerwheel {
+    struct wheeltimer *slots[WHEEL_SLOTS];
+    uint64_t tick_us;
+    uint64_t next_tick;
+    unsigned long timers;
+    unsigned long ticks;
+    unsigned long expired;
+    unsigned long passed;
+};
+
+void initWheel(struct timerwheel *wheel, uint64_t tick_us, uint64_t now_us);
+void scheduleTimer(struct timerwheel *wheel, struct wheeltimer *timer, uint64_t due_us);
+void cancelTimer(struct timerwheel *wheel, struct wheeltimer *timer);
+struct wheeltimer *expireTimers(struct timerwheel *wheel, uint64_t now_us);
+void printWheelStats(struct timerwheel *wheel);
+
+#endif
@@ -0,0 +1,211 @@
+/* trace.c
+ *******************************************
+ * Compact binary traces of the requests
+ * and frames of a session, written by
+ * server and client with -RECORD=<path>.
+ *
+ * A trace is a traceheader followed by
+ * one 24-byte tracerecord per event, in
+ * the order they happened:
+ *
+ *     TRACE_CONNECT  a session started
+ *     TRACE_REQUEST  value is the request
+ *     TRACE_PAYLOAD  value is the length of
+ *                    the bytes that follow
+ *                    the record, sent after
+ *                    the request before it
+ *     TRACE_FRAME    value is the length of
+ *                    the frame and info its
+ *                    first byte
+ *     TRACE_CLOSE    a session ended
+ *
+ * Times are microseconds since the trace
+ * was opened. The server writes when a
+ * request is read and a frame is fully
+ * sent, the client when a request is sent
+ * and a frame is fully received. Sessions
+ * are told apart by conn, the server's
+ * client id; the client always uses 1.
+ * Records are in host byte order.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static FILE *trace_file;
+static uint64_t trace_start_us;
+
+void errorPrint(char *string);
+uint64_t monotonicMicros();
+
+/* Creates a trace file and writes
+ * its header.
+ *
+ * Input:
+ *     path:   where to write the trace
+ *     source: TRACE_SERVER or TRACE_CLIENT
+ * Return:
+ *     0 on success
+ *    -1 on error
+ */
+int openTrace(char *path, int source){
+    trace_file = fopen(path, "wb");
+    if(trace_file == NULL){
+        errorPrint("Couldn't create the trace file.");
+        return -1;
+    }
+    trace_start_us = monotonicMicros();
+    struct traceheader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.source = source;
+    header.started_us = trace_start_us;
+    fwrite(&header, sizeof(header), 1, trace_file);
+    return 0;
+}
+
+/* Appends an event to the trace, if
+ * one is being recorded.
+ *
+ * Input:
+ *     kind:  TRACE_CONNECT, TRACE_REQUEST,
+ *            TRACE_FRAME or TRACE_CLOSE
+ *     conn:  the session
+ *     value: request or frame length
+ *     info:  first byte of a frame
+ * Return:
+ *     void
+ */
+void traceRecord(int kind, unsigned long conn, uint32_t value, uint8_t info){
+    if(trace_file == NULL){
+        return;
+    }
+    struct tracerecord record;
+    record.time_us = monotonicMicros() - trace_start_us;
+    record.value = value;
+    record.conn = conn;
+    record.kind = kind;
+    record.info = info;
+    record.spare = 0;
+    fwrite(&record, sizeof(record), 1, trace_file);
+}
+
+/* Appends the bytes a request carries
+ * after its 4-byte word, like the
+ * rangerequest of REQUEST_RANGE or the
+ * filter of REQUEST_MATCH, to the trace,
+ * if one is being recorded.
+ *
+ * Input:
+ *     conn: the session
+ *     data: the bytes
+ *     len:  amount of bytes
+ * Return:
+ *     void
+ */
+void tracePayload(unsigned long conn, const void *data, uint32_t len){
+    if(trace_file == NULL || len == 0){
+        return;
+    }
+    struct tracerecord record;
+    record.time_us = monotonicMicros() - trace_start_us;
+    record.value = len;
+    record.conn = conn;
+    record.kind = TRACE_PAYLOAD;
+    record.info = 0;
+    record.spare = 0;
+    fwrite(&record, sizeof(record), 1, trace_file);
+    fwrite(data, 1, len, trace_file);
+}
+
+/* Writes out and closes the trace.
+ *
+ * Input:
+ *     none
+ * Return:
+ *     void
+ */
+void closeTrace(){
+    if(trace_file != NULL){
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+/* Reads a whole trace into memory. The
+ * bytes of every TRACE_PAYLOAD record
+ * are put one after the other in
+ * payloads, and the record's time_us
+ * is set to where its bytes start.
+ *
+ * Input:
+ *     path:     the trace file
+ *     header:   where to store its header
+ *     records:  set to the records, to be
+ *               freed by the caller
+ *     count:    set to the amount of records
+ *     payloads: set to the payload bytes,
+ *               to be freed by the caller
+ * Return:
+ *     0 on success
+ *    -1 if it can't be read or isn't
+ *       a trace
+ */
+int readTrace(char *path, struct traceheader *header,
+              struct tracerecord **records, size_t *count, char **payloads){
+    FILE *in = fopen(path, "rb");
+    if(in == NULL){
+        errorPrint("Couldn't open the trace file.");
+        return -1;
+    }
+    if(fread(header, sizeof(*header), 1, in) != 1 ||
+       header->magic != TRACE_MAGIC || header->version != TRACE_VERSION){
+        errorPrint("Not a trace file, or of another version.");
+        fclose(in);
+        return -1;
+    }
+    size_t size = 0;
+    size_t payload_size = 0;
+    *records = NULL;
+    *count = 0;
+    *payloads = NULL;
+    while(1){
+        if(*count == size){
+            size = size == 0 ? 4096 : size*2;
+            struct tracerecord *grown = realloc(*records, size*sizeof(struct tracerecord));
+            if(grown == NULL){
+                errorPrint("Out of memory while reading the trace.");
+                free(*records);
+                free(*payloads);
+                fclose(in);
+                return -1;
+            }
+            *records = grown;
+        }
+        struct tracerecord *record = *records + *count;
+        if(fread(record, sizeof(struct tracerecord), 1, in) != 1){
+            break;
+        }
+        if(record->kind == TRACE_PAYLOAD){
+            char *grown = realloc(*payloads, payload_size + record->value);
+            if(grown == NULL || fread(grown + payload_size, 1, record->value, in) != record->value){
+                errorPrint(grown == NULL ? "Out of memory while reading the trace."
+                                         : "The trace ends in the middle of a payload.");
+                free(grown != NULL ? grown : *payloads);
+                free(*records);
+                fclose(in);
+                return -1;
+            }
+            *payloads = grown;
+            record->time_us = payload_size;
+            payload_size += record->value;
+        }
+        (*count)++;
+    }
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,50 @@
+/* TRACE.H
+ *
+ *****************************************
+ * Header file for the session traces
+ * recorded by server and client, and
+ * replayed by replay.c.
+ *
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC         0x4352544a
+#define TRACE_VERSION       3
+
+#define TRACE_SERVER        0
+#define TRACE_CLIENT        1
+
+#define TRACE_CONNECT       1
+#define TRACE_REQUEST       2
+#define TRACE_FRAME         3
+#define TRACE_CLOSE         4
+#define TRACE_PAYLOAD       5
+
+struct traceheader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t source;
+    uint64_t started_us;
+};
+
+struct tracerecord {
+    uint64_t time_us;
+    uint64_t conn;
+    uint32_t value;
+    uint8_t kind;
+    uint8_t info;
+    uint16_t spare;
+};
+
+int openTrace(char *path, int source);
+void traceRecord(int kind, unsigned long conn, uint32_t value, uint8_t info);
+void tracePayload(unsigned long conn, const void *data, uint32_t len);
+void closeTrace();
+int readTrace(char *path, struct traceheader *header,
+              struct tracerecord **records, size_t *count, char **payloads);
+
+#endif
@@ -0,0 +1,428 @@
+/* transport.c
+ *******************************************
+ * Transports used by both server.c and
+ * client.c. The address given where the
+ * port or hostname usually goes selects
+ * the transport:
+ *
+ *     <port>/<hostname> TCP, as before.
+ *     unix:<path>       AF_UNIX stream socket
+ *                       bound to path.
+ *     shm:<name>        shared-memory ring.
+ *
+ * The shm transport still connects over
+ * an AF_UNIX socket, in the abstract
+ * namespace under name. Requests are sent
+ * over that socket as usual, but the
+ * server writes its frames into a ring
+ * buffer in a memfd it passes to the
+ * client when it connects. The ring is
+ * a plain byte stream, so the framing is
+ * the same as over a socket.
+ *
+ * Either side that finds the ring empty
+ * (reader) or full (writer) raises its
+ * waiting flag, checks the ring again, and
+ * sleeps on the socket. The other side
+ * clears the flag after moving the ring
+ * and sends one doorbell: a byte from
+ * the server, the request 'W' from the
+ * client. Doorbells are only sent when
+ * someone sleeps, so a busy ring costs
+ * no system calls.
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "transport.h"
+
+void errorPrint(char *string);
+
+/* Finds the transport an address
+ * given by the user selects.
+ *
+ * Input:
+ *     address: port, hostname or
+ *              prefixed path
+ * Return:
+ *     TRANSPORT_TCP, TRANSPORT_UNIX
+ *     or TRANSPORT_SHM
+ */
+int transportType(char *address){
+    if(strncmp(address, "unix:", 5) == 0){
+        return TRANSPORT_UNIX;
+    }
+    if(strncmp(address, "shm:", 4) == 0){
+        return TRANSPORT_SHM;
+    }
+    return TRANSPORT_TCP;
+}
+
+/* Returns the path or name part
+ * of a prefixed address.
+ *
+ * Input:
+ *     address: prefixed address
+ * Return:
+ *     pointer into address
+ */
+char *transportPath(char *address){
+    return strchr(address, ':')+1;
+}
+
+/* Fills in the AF_UNIX address for a
+ * unix path, or the abstract address
+ * for a shm name.
+ *
+ * Return:
+ *     length of the address
+ *    -1 if the path is too long
+ */
+static int localAddress(int type, char *path, struct sockaddr_un *addr){
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    int len;
+    if(type == TRANSPORT_SHM){
+        len = snprintf(addr->sun_path+1, sizeof(addr->sun_path)-1, "jobserver:%s", path)+1;
+    }else{
+        len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    }
+    if(len >= (int)sizeof(addr->sun_path)){
+        errorPrint("Socket path too long.");
+        return -1;
+    }
+    return offsetof(struct sockaddr_un, sun_path) + len;
+}
+
+/* Creates a non-blocking AF_UNIX socket
+ * listening on a unix path or shm name.
+ * A stale socket file left at the
+ * path is removed first.
+ *
+ * Input:
+ *     type: TRANSPORT_UNIX or TRANSPORT_SHM
+ *     path: path or name
+ * Return:
+ *     the listening socket
+ *    -1 on error
+ */
+int listenLocal(int type, char *path){
+    struct sockaddr_un addr;
+    int len = localAddress(type, path, &addr);
+    if(len == -1){
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(sock == -1){
+        return -1;
+    }
+    if(type == TRANSPORT_UNIX){
+        unlink(path);
+    }
+    if(bind(sock, (struct sockaddr*)&addr, len) == -1 || listen(sock, SOMAXCONN) == -1){
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Connects to a server listening on
+ * a unix path or shm name.
+ *
+ * Input:
+ *     type: TRANSPORT_UNIX or TRANSPORT_SHM
+ *     path: path or name
+ * Return:
+ *     the connected socket
+ *    -1 on error
+ */
+int connectLocal(int type, char *path){
+    struct sockaddr_un addr;
+    int len = localAddress(type, path, &addr);
+    if(len == -1){
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(sock == -1){
+        return -1;
+    }
+    if(connect(sock, (struct sockaddr*)&addr, len) == -1){
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Creates a ring in a memfd, maps it
+ * and passes the memfd to the client
+ * on the other end of the socket.
+ *
+ * Input:
+ *     socket: a connected client socket
+ * Return:
+ *     the mapped ring
+ *     NULL on error
+ */
+struct shmring *createRing(int socket){
+    size_t map_size = sizeof(struct shmring) + RING_SIZE;
+    int fd = memfd_create("jobring", MFD_CLOEXEC);
+    if(fd == -1){
+        return NULL;
+    }
+    if(ftruncate(fd, map_size) == -1){
+        close(fd);
+        return NULL;
+    }
+    struct shmring *ring = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ring == MAP_FAILED){
+        close(fd);
+        return NULL;
+    }
+    ring->size = RING_SIZE;
+
+    char hello = 'M';
+    struct iovec iov = {&hello, 1};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    int sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    close(fd);
+    if(sent != 1){
+        munmap(ring, map_size);
+        return NULL;
+    }
+    return ring;
+}
+
+/* Receives the memfd of a ring from
+ * the server and maps it.
+ *
+ * Input:
+ *     socket: socket connected to the server
+ * Return:
+ *     the mapped ring
+ *     NULL on error
+ */
+struct shmring *attachRing(int socket){
+    char hello;
+    struct iovec iov = {&hello, 1};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if(recvmsg(socket, &msg, MSG_CMSG_CLOEXEC) != 1){
+        return NULL;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS){
+        return NULL;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    struct shmring *ring = mmap(NULL, sizeof(struct shmring) + RING_SIZE,
+                                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED){
+        return NULL;
+    }
+    return ring;
+}
+
+/* Unmaps a ring.
+ *
+ * Input:
+ *     ring: the ring
+ *     size: size of its data, as it was
+ *           created, not as the ring
+ *           says, see ringWrite()
+ * Return:
+ *     void
+ */
+void unmapRing(struct shmring *ring, size_t size){
+    munmap(ring, sizeof(struct shmring) + size);
+}
+
+/* Copies as much of buf into the
+ * ring as there is room for.
+ * Only the server writes to a ring.
+ * The client can write to all of the
+ * ring, so its size is the server's
+ * own, and a tail the client couldn't
+ * have reached is an error.
+ *
+ * Input:
+ *     ring: the ring
+ *     size: size of its data
+ *     buf:  bytes to write
+ *     len:  amount of bytes
+ * Return:
+ *     amount of bytes written
+ *    -1 if the tail is out of bounds
+ */
+long ringWrite(struct shmring *ring, size_t size, const char *buf, size_t len){
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(tail > head || head - tail > size){
+        return -1;
+    }
+    size_t space = size - (head - tail);
+    if(len > space){
+        len = space;
+    }
+    size_t offset = head % size;
+    size_t first = size - offset;
+    if(first > len){
+        first = len;
+    }
+    memcpy(ring->data+offset, buf, first);
+    memcpy(ring->data, buf+first, len-first);
+    __atomic_store_n(&ring->head, head+len, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Copies up to len bytes out of
+ * the ring. Only the client reads
+ * from a ring.
+ *
+ * Input:
+ *     ring: the ring
+ *     buf:  where to put the bytes
+ *     len:  most bytes to read
+ * Return:
+ *     amount of bytes read
+ */
+size_t ringRead(struct shmring *ring, char *buf, size_t len){
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(len > head - tail){
+        len = head - tail;
+    }
+    size_t offset = tail % ring->size;
+    size_t first = ring->size - offset;
+    if(first > len){
+        first = len;
+    }
+    memcpy(buf, ring->data+offset, first);
+    memcpy(buf+first, ring->data, len-first);
+    __atomic_store_n(&ring->tail, tail+len, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Called by the server when the ring
+ * is full. Raises the writer's waiting
+ * flag, so the client sends a doorbell
+ * once it has read from the ring.
+ *
+ * Input:
+ *     ring: the ring
+ *     size: size of its data
+ * Return:
+ *     1 if the server should wait
+ *       for the doorbell
+ *     0 if the client made room in
+ *       the meantime
+ */
+int ringParkWriter(struct shmring *ring, size_t size){
+    __atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    if(ring->head - tail < size){
+        __atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+/* Called by the server after writing.
+ * Rings the client's doorbell if it
+ * is sleeping on an empty ring.
+ *
+ * Input:
+ *     ring:   the ring
+ *     socket: socket to the client
+ * Return:
+ *     void
+ */
+void ringNotifyReader(struct shmring *ring, int socket){
+    if(__atomic_exchange_n(&ring->reader_waiting, 0, __ATOMIC_SEQ_CST) == 1){
+        char doorbell = 1;
+        send(socket, &doorbell, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+/* Called by the client when the ring
+ * is empty. Raises the reader's waiting
+ * flag and sleeps until the server
+ * rings the doorbell, unless the ring
+ * was written to in the meantime. A
+ * signal wakes it up as well.
+ *
+ * Input:
+ *     ring:   the ring
+ *     socket: socket to the server
+ * Return:
+ *     0 when the ring may have data
+ *    -1 if the server closed the socket
+ */
+int ringWaitReader(struct shmring *ring, int socket){
+    char doorbell;
+    __atomic_store_n(&ring->reader_waiting, 1, __ATOMIC_SEQ_CST);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    if(head != ring->tail){
+        if(__atomic_exchange_n(&ring->reader_waiting, 0, __ATOMIC_SEQ_CST) == 1){
+            return 0;
+        }
+        /* The server took the flag, so its doorbell is on the way. */
+    }
+    ssize_t got = recv(socket, &doorbell, 1, 0);
+    if(got == -1 && errno == EINTR){
+        return 0;
+    }
+    if(got <= 0){
+        return -1;
+    }
+    return 0;
+}
+
+/* Called by the client after reading.
+ * Sends the doorbell request if the
+ * server is waiting for room in the ring.
+ *
+ * Input:
+ *     ring:   the ring
+ *     socket: socket to the server
+ * Return:
+ *     void
+ */
+void ringNotifyWriter(struct shmring *ring, int socket){
+    if(__atomic_exchange_n(&ring->writer_waiting, 0, __ATOMIC_SEQ_CST) == 1){
+        int request = RING_DOORBELL;
+        send(socket, &request, sizeof(request), MSG_NOSIGNAL);
+    }
+}
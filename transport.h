@@ -0,0 +1,47 @@
+/* TRANSPORT.H
+ *
+ *****************************************
+ * Header file for the transports the
+ * server and client can talk over, and
+ * the shared-memory ring used by the
+ * shm transport.
+ *
+ */
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TRANSPORT_TCP       0
+#define TRANSPORT_UNIX      1
+#define TRANSPORT_SHM       2
+
+#define RING_SIZE           (4*1024*1024)
+#define RING_DOORBELL       'W'
+
+struct shmring {
+    uint64_t head __attribute__((aligned(64)));
+    int reader_waiting;
+    uint64_t tail __attribute__((aligned(64)));
+    int writer_waiting;
+    uint32_t size __attribute__((aligned(64)));
+    char data[] __attribute__((aligned(64)));
+};
+
+int transportType(char *address);
+char *transportPath(char *address);
+int listenLocal(int type, char *path);
+int connectLocal(int type, char *path);
+struct shmring *createRing(int socket);
+struct shmring *attachRing(int socket);
+void unmapRing(struct shmring *ring, size_t size);
+long ringWrite(struct shmring *ring, size_t size, const char *buf, size_t len);
+size_t ringRead(struct shmring *ring, char *buf, size_t len);
+int ringParkWriter(struct shmring *ring, size_t size);
+void ringNotifyReader(struct shmring *ring, int socket);
+int ringWaitReader(struct shmring *ring, int socket);
+void ringNotifyWriter(struct shmring *ring, int socket);
+
+#endif